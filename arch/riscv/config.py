@@ -46,11 +46,17 @@ class Ext(Enum):
     F = auto()
     D = auto()
     C = auto()
+    V = auto()
 
     # Standard machine-level
     Zicsr = auto()
     Zifencei = auto()
 
+    # Bit manipulation
+    Zba = auto()
+    Zbb = auto()
+    Zbs = auto()
+
 
 class Abi(Enum):
     # XLEN=32
@@ -125,16 +131,23 @@ STANDARD_UNPRIVILEGED_EXTS: list[Ext] = [
     Ext.F,
     Ext.D,
     Ext.C,
+    Ext.V,
 ]
 
+# Prefixed extensions in canonical order, which sorts them by the category
+# letter after the Z (I before B) and then alphabetically.
 STANDARD_MACHINE_EXTS: list[Ext] = [
     Ext.Zicsr,
     Ext.Zifencei,
+    Ext.Zba,
+    Ext.Zbb,
+    Ext.Zbs,
 ]
 
 IMPLIED_EXTS: dict[Ext, set[Ext]] = {
     Ext.F: {Ext.Zicsr},
     Ext.D: {Ext.F},
+    Ext.V: {Ext.D},
 }
 
 ABI_EXTS: dict[Abi, set[Ext]] = {
@@ -367,13 +380,22 @@ def do_kernel_config(config: Configuration, args) -> int:
     if config.mmu != Mmu.BARE:
         values.append("KERNEL_VM")
 
+    for ext in sorted(config.exts, key=lambda x: x.value):
+        values.append(f"RISCV_ISA_{format_ext(ext).upper()}")
+
     print(" ".join(values))
     return 0
 
 
 def do_cflags(config: Configuration, args) -> int:
+    # The kernel does not save vector state across traps or context switches,
+    # so compiled code must not use V.  The vector routines enable it in the
+    # assembler instead.
+    exts = config.exts.difference({Ext.V})
+    march = format_config(Configuration(config.xlen, exts, config.abi, config.mmu))
+
     flags = [
-        f"-march={format_config(config).lower()}",
+        f"-march={march.lower()}",
         f"-mabi={format_abi(config.abi)}",
     ]
 
@@ -21,10 +21,25 @@
 $(eval $(call generate-module,kernel))
 
 .PHONY: $(MODULE) clean-$(MODULE) distclean-$(MODULE)
-$(MODULE): $(kernel.OUT)
+$(MODULE): $(kernel.OUT) $(QEMU_DISK) $(QEMU_INITRD)
 	$(call run-command,QEMU $(kernel.OUT), \
 	    $(QEMU) $(QEMUFLAGS) -kernel $(kernel.OUT))
 clean-$(MODULE):
 distclean-$(MODULE):
 
+# A sparse disk image, which is kept across runs
+ifneq ($(QEMU_DISK),)
+$(QEMU_DISK):
+	$(call run-command,DISK $@, \
+	    $(MKDIR) $(dir $@) && $(TRUNCATE) -s $(QEMU_DISK_SIZE) $@)
+endif
+
+# The initrd, repacked whenever anything under INITRAMFS_DIR changes
+ifneq ($(INITRAMFS_DIR),)
+$(QEMU_INITRD): $(shell $(FIND) $(INITRAMFS_DIR))
+	$(call run-command,CPIO $@, \
+	    $(MKDIR) $(dir $@) && cd $(INITRAMFS_DIR) \
+	    && $(FIND) . | $(CPIO) -o -H newc --quiet > $(abspath $@))
+endif
+
 clean:: clean-$(MODULE)
@@ -0,0 +1,377 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/arch/vm.h>
+
+#ifdef KERNEL_VM
+
+#include <kernel/arch/csr.h>
+#include <kernel/arch/interrupt.h>
+#include <kernel/arch/sbi.h>
+#include <kernel/bitops.h>
+#include <kernel/config.h>
+#include <kernel/hart.h>
+#include <kernel/percpu.h>
+#include <kernel/spinlock.h>
+
+#include <assert.h>
+#include <stdio.h>
+
+// Each address space runs under its own ASID so that switching between them
+// keeps the translations of the others in the TLB.  ASIDs are allocated in
+// generations.  The context of an address space holds the generation of its
+// ASID, so a context from an old generation is replaced when the space is
+// next switched to.  When the ASIDs run out, a new generation begins and
+// every hart flushes its TLB before its next switch.  The contexts running on
+// the harts at the rollover are reserved in the new generation so that those
+// harts need not stop.  ASID 0 belongs to the kernel, whose translations are
+// all global.
+//
+// Without enough ASIDs, every address space runs under ASID 0 and a switch
+// flushes the non-global translations instead.
+
+#define MAX_ASID_COUNT (CSR_SATP_ASID_MASK + 1)
+#define ASID_BITMAP_SIZE (MAX_ASID_COUNT / BITS_PER_LONG)
+
+// Flushes of more than this many pages flush the whole address space.
+#define TLB_FLUSH_PAGE_LIMIT 64
+
+_Static_assert(MAX_HARTS <= BITS_PER_LONG,
+    "AddressSpace.hart_mask must have a bit for each hart");
+
+static unsigned int _asid_bits = 0;
+static uint64_t _asid_count = 1;
+
+static Spinlock _asid_lock = SPINLOCK_INITIALIZER;  // Guards the state below
+static uint64_t _asid_generation = 0;  // A multiple of _asid_count
+static unsigned long _asid_bitmap[ASID_BITMAP_SIZE];
+static uint64_t _next_asid = 1;
+
+// Context running on the hart, or 0 if a rollover has happened since
+static DEFINE_PER_HART(uint64_t, _active_context);
+// Context that the hart was running at the last rollover
+static DEFINE_PER_HART(uint64_t, _reserved_context);
+static DEFINE_PER_HART(bool, _is_flush_pending);
+static DEFINE_PER_HART(AddressSpace*, _current_address_space);
+
+static uint64_t _get_asid(uint64_t context)
+{
+    return context & (_asid_count - 1);
+}
+
+static bool _is_current_generation(uint64_t context)
+{
+    return (context & ~(_asid_count - 1))
+        == __atomic_load_n(&_asid_generation, __ATOMIC_RELAXED);
+}
+
+static void _write_satp(const AddressSpace* space, uint64_t asid)
+{
+    WRITE_CSR(satp, (CSR_SATP_MODE << CSR_SATP_MODE_SHIFT)
+        | (asid << CSR_SATP_ASID_SHIFT)
+        | (virtual_to_physical(space->root) >> PAGE_BITS));
+}
+
+static void _flush_local_tlb(void)
+{
+    __asm__ volatile("sfence.vma" : : : "memory");
+}
+
+// Flush the translations of [start, start + size), or of every address if
+// size is SBI_FLUSH_ALL, on this hart.  Global translations are flushed when
+// is_global is set and are otherwise left alone.
+static void _flush_local_tlb_range(bool is_global, unsigned long asid,
+    uintptr_t start, size_t size)
+{
+    if (size == SBI_FLUSH_ALL) {
+        if (is_global) {
+            _flush_local_tlb();
+        }
+        else {
+            __asm__ volatile("sfence.vma zero, %0" : : "r"(asid) : "memory");
+        }
+        return;
+    }
+
+    for (uintptr_t addr = start & PAGE_MASK; addr < start + size;
+            addr += PAGE_SIZE) {
+        if (is_global) {
+            __asm__ volatile("sfence.vma %0, zero" : : "r"(addr) : "memory");
+        }
+        else {
+            __asm__ volatile("sfence.vma %0, %1"
+                : : "r"(addr), "r"(asid) : "memory");
+        }
+    }
+}
+
+// Flush the harts in hart_mask through the SBI, which addresses harts by ID
+// in windows of BITS_PER_LONG.
+static void _flush_remote_tlb_range(unsigned long hart_mask, bool is_global,
+    unsigned long asid, uintptr_t start, size_t size)
+{
+    while (hart_mask != 0) {
+        const size_t base = get_hart(find_first_set_bit(hart_mask))->id;
+        unsigned long id_mask = 0;
+        for (size_t i = 0; i < get_hart_count(); ++i) {
+            const size_t id = get_hart(i)->id;
+            if ((hart_mask & (1ul << i)) != 0 && id >= base
+                && id - base < BITS_PER_LONG) {
+                id_mask |= 1ul << (id - base);
+                hart_mask &= ~(1ul << i);
+            }
+        }
+
+        const long error = is_global
+            ? sbi_remote_sfence_vma(id_mask, base, start, size)
+            : sbi_remote_sfence_vma_asid(id_mask, base, start, size, asid);
+        if (error != SBI_SUCCESS) {
+            dprintf("SBI remote sfence.vma failed with %d\n", (int)error);
+        }
+    }
+}
+
+static bool _test_and_set_asid(uint64_t asid)
+{
+    unsigned long* word = &_asid_bitmap[asid / BITS_PER_LONG];
+    const unsigned long bit = 1ul << (asid % BITS_PER_LONG);
+    const bool was_set = (*word & bit) != 0;
+    *word |= bit;
+    return was_set;
+}
+
+// Find the first free ASID at or after _next_asid, or 0 if there is none.
+static uint64_t _find_free_asid(void)
+{
+    uint64_t asid = _next_asid;
+    while (asid < _asid_count) {
+        const size_t offset = asid % BITS_PER_LONG;
+        const unsigned long word = _asid_bitmap[asid / BITS_PER_LONG]
+            | ((1ul << offset) - 1);
+        if (word != ~0ul) {
+            asid += find_first_set_bit(~word) - offset;
+            return asid < _asid_count ? asid : 0;
+        }
+        asid += BITS_PER_LONG - offset;
+    }
+    return 0;
+}
+
+static void _roll_over(void)
+{
+    __atomic_store_n(&_asid_generation, _asid_generation + _asid_count,
+        __ATOMIC_RELAXED);
+    for (size_t i = 0; i < ASID_BITMAP_SIZE; ++i) {
+        _asid_bitmap[i] = 0;
+    }
+    _test_and_set_asid(0);
+    _next_asid = 1;
+
+    for (size_t i = 0; i < get_hart_count(); ++i) {
+        uint64_t context = __atomic_exchange_n(HART_PTR(_active_context, i), 0,
+            __ATOMIC_RELAXED);
+        // A hart that has not switched since the previous rollover is still
+        // running its reserved context.
+        if (context == 0) {
+            context = *HART_PTR(_reserved_context, i);
+        }
+        _test_and_set_asid(_get_asid(context));
+        *HART_PTR(_reserved_context, i) = context;
+        *HART_PTR(_is_flush_pending, i) = true;
+    }
+}
+
+// Carry context into the current generation if a hart was running it at the
+// last rollover.
+static bool _update_reserved_context(uint64_t context, uint64_t new_context)
+{
+    bool is_reserved = false;
+    for (size_t i = 0; i < get_hart_count(); ++i) {
+        uint64_t* reserved_context = HART_PTR(_reserved_context, i);
+        if (*reserved_context == context) {
+            *reserved_context = new_context;
+            is_reserved = true;
+        }
+    }
+    return is_reserved;
+}
+
+// Get a context in the current generation for a space that last ran under
+// context.  The ASID lock must be held.
+static uint64_t _allocate_context(uint64_t context)
+{
+    if (context != 0) {
+        // Keep the previous ASID if it is still free.
+        const uint64_t asid = _get_asid(context);
+        const uint64_t new_context = _asid_generation | asid;
+        if (_update_reserved_context(context, new_context)
+            || !_test_and_set_asid(asid)) {
+            return new_context;
+        }
+    }
+
+    uint64_t asid = _find_free_asid();
+    if (asid == 0) {
+        _roll_over();
+        asid = _find_free_asid();
+        assert(asid != 0);
+    }
+    _test_and_set_asid(asid);
+    _next_asid = asid + 1;
+    return _asid_generation | asid;
+}
+
+// Get the ASID for space on this hart and whether the TLB must be flushed
+// after switching to it.  Interrupts must be disabled.
+static uint64_t _activate_address_space(AddressSpace* space, bool* needs_flush)
+{
+    uint64_t* active_context = THIS_HART_PTR(_active_context);
+    uint64_t context = __atomic_load_n(&space->context, __ATOMIC_RELAXED);
+    uint64_t old_active_context =
+        __atomic_load_n(active_context, __ATOMIC_RELAXED);
+
+    // The fast path takes no lock.  A rollover clears the active context of
+    // every hart, which makes the exchange fail.
+    *needs_flush = false;
+    if (old_active_context != 0 && _is_current_generation(context)
+        && __atomic_compare_exchange_n(active_context, &old_active_context,
+            context, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return _get_asid(context);
+    }
+
+    acquire_spinlock(&_asid_lock);
+    context = space->context;
+    if (!_is_current_generation(context)) {
+        context = _allocate_context(context);
+        __atomic_store_n(&space->context, context, __ATOMIC_RELAXED);
+    }
+    bool* is_flush_pending = THIS_HART_PTR(_is_flush_pending);
+    *needs_flush = *is_flush_pending;
+    *is_flush_pending = false;
+    __atomic_store_n(active_context, context, __ATOMIC_RELAXED);
+    release_spinlock(&_asid_lock);
+    return _get_asid(context);
+}
+
+void switch_address_space(AddressSpace* space)
+{
+    assert(space != NULL);
+
+    const InterruptState state = disable_interrupts();
+    AddressSpace** current = THIS_HART_PTR(_current_address_space);
+    if (*current == space) {
+        restore_interrupts(state);
+        return;
+    }
+
+    const unsigned long hart_bit = 1ul << get_hart_index();
+    const bool is_first_switch = *current == NULL;
+    if (_asid_bits == 0 && !is_first_switch) {
+        __atomic_fetch_and(&(*current)->hart_mask, ~hart_bit,
+            __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_or(&space->hart_mask, hart_bit, __ATOMIC_RELAXED);
+    *current = space;
+
+    if (space == get_kernel_address_space() || _asid_bits == 0) {
+        _write_satp(space, 0);
+        if (is_first_switch) {
+            // Drop the translations of the boot page table.
+            _flush_local_tlb();
+        }
+        else if (_asid_bits == 0) {
+            _flush_local_tlb_range(false, 0, 0, SBI_FLUSH_ALL);
+        }
+    }
+    else {
+        bool needs_flush;
+        _write_satp(space, _activate_address_space(space, &needs_flush));
+        if (needs_flush) {
+            _flush_local_tlb();
+        }
+    }
+    restore_interrupts(state);
+}
+
+void flush_tlb_range(AddressSpace* space, uintptr_t start, size_t size)
+{
+    assert(space != NULL);
+
+    const bool is_global = space == get_kernel_address_space();
+    const uint64_t context = __atomic_load_n(&space->context, __ATOMIC_RELAXED);
+    if (!is_global && context == 0 && _asid_bits != 0) {
+        return;  // Never run, so never cached
+    }
+    if (size > TLB_FLUSH_PAGE_LIMIT * PAGE_SIZE) {
+        start = 0;
+        size = SBI_FLUSH_ALL;
+    }
+
+    const InterruptState state = disable_interrupts();
+    unsigned long hart_mask = is_global
+        ? ~0ul >> (BITS_PER_LONG - get_hart_count())
+        : __atomic_load_n(&space->hart_mask, __ATOMIC_RELAXED);
+    const unsigned long hart_bit = 1ul << get_hart_index();
+    const unsigned long asid = _get_asid(context);
+    if ((hart_mask & hart_bit) != 0) {
+        _flush_local_tlb_range(is_global, asid, start, size);
+    }
+    hart_mask &= ~hart_bit;
+    if (hart_mask != 0) {
+        _flush_remote_tlb_range(hart_mask, is_global, asid, start, size);
+    }
+    restore_interrupts(state);
+}
+
+void flush_tlb(AddressSpace* space)
+{
+    flush_tlb_range(space, 0, SBI_FLUSH_ALL);
+}
+
+unsigned int get_asid_bits(void)
+{
+    return _asid_bits;
+}
+
+void initialize_asids(void)
+{
+    // Implemented ASID bits read back as ones.  The kernel page table maps
+    // only global pages, so it may run under any ASID, but translations
+    // cached under the probe ASID are flushed before it is handed out.
+    const uint_xlen_t satp = READ_CSR(satp);
+    WRITE_CSR(satp, satp | (CSR_SATP_ASID_MASK << CSR_SATP_ASID_SHIFT));
+    const uint_xlen_t asids =
+        (READ_CSR(satp) >> CSR_SATP_ASID_SHIFT) & CSR_SATP_ASID_MASK;
+    WRITE_CSR(satp, satp);
+    _flush_local_tlb();
+
+    // The kernel and each hart's reserved context must leave an ASID free
+    // after a rollover.
+    const unsigned int bits = count_set_bits(asids);
+    if ((1ul << bits) > MAX_HARTS + 1) {
+        _asid_bits = bits;
+        _asid_count = (uint64_t)1 << bits;
+    }
+    _asid_generation = _asid_count;
+    _test_and_set_asid(0);
+    dprintf("Using %u of %u ASID bits\n", _asid_bits, bits);
+}
+
+#endif  // KERNEL_VM
@@ -0,0 +1,58 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/arch/hart.h>
+
+#include <kernel/arch/memory.h>
+#include <kernel/arch/sbi.h>
+#include <kernel/hart.h>
+
+#include <stdio.h>
+
+extern const char _secondary_entry[];
+
+bool start_hart(Hart* hart)
+{
+    static int has_hsm = -1;
+    if (has_hsm < 0) {
+        has_hsm = sbi_probe_extension(SBI_EXT_HSM);
+    }
+    if (!has_hsm) {
+        dprintf("SBI does not implement HSM\n");
+        return false;
+    }
+
+    // The hart starts with translation off, so it is given physical
+    // addresses.  Its per-hart area arrives in a1.
+    const long error = sbi_hart_start(hart->id,
+        virtual_to_physical(_secondary_entry),
+        (unsigned long)hart);
+    if (error != SBI_SUCCESS) {
+        dprintf("SBI hart_start for hart %zu failed with %d\n", hart->id,
+            (int)error);
+        return false;
+    }
+    return true;
+}
+
+void send_ipi(const Hart* hart)
+{
+    sbi_send_ipi(1, hart->id);
+}
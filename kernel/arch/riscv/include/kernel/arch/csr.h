@@ -0,0 +1,99 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_ARCH_CSR_H
+#define KERNEL_ARCH_CSR_H
+
+#include <kernel/arch/types.h>
+
+// Supervisor status register
+#define CSR_SSTATUS_SIE  BIT_UX(1)  // Supervisor interrupt enable
+#define CSR_SSTATUS_SPIE BIT_UX(5)  // Previous supervisor interrupt enable
+#define CSR_SSTATUS_SPP  BIT_UX(8)  // Previous privilege mode
+
+// Vector state field of sstatus
+#define CSR_SSTATUS_VS_MASK    (BIT_UX(9) | BIT_UX(10))
+#define CSR_SSTATUS_VS_OFF     LITERAL_UX(0)
+#define CSR_SSTATUS_VS_INITIAL BIT_UX(9)
+
+// Supervisor interrupt enable and pending registers
+#define CSR_SIE_SSIE BIT_UX(1)  // Software interrupt
+#define CSR_SIE_STIE BIT_UX(5)  // Timer interrupt
+#define CSR_SIE_SEIE BIT_UX(9)  // External interrupt
+#define CSR_SIP_SSIP CSR_SIE_SSIE
+#define CSR_SIP_STIP CSR_SIE_STIE
+#define CSR_SIP_SEIP CSR_SIE_SEIE
+
+// Supervisor trap vector base address register
+#define CSR_STVEC_MODE_DIRECT   LITERAL_UX(0)
+#define CSR_STVEC_MODE_VECTORED LITERAL_UX(1)
+#define CSR_STVEC_MODE_MASK     LITERAL_UX(3)
+
+// Supervisor cause register
+#define CSR_SCAUSE_INTERRUPT BIT_UX(__riscv_xlen - 1)
+
+// Supervisor address translation and protection register
+#if __riscv_xlen == 64
+    #define CSR_SATP_MODE_SHIFT 60
+    #define CSR_SATP_ASID_SHIFT 44
+    #define CSR_SATP_ASID_MASK  LITERAL_UX(0xFFFF)
+#else
+    #define CSR_SATP_MODE_SHIFT 31
+    #define CSR_SATP_ASID_SHIFT 22
+    #define CSR_SATP_ASID_MASK  LITERAL_UX(0x1FF)
+#endif
+#define CSR_SATP_MODE_BARE LITERAL_UX(0)
+#define CSR_SATP_MODE_SV32 LITERAL_UX(1)
+#define CSR_SATP_MODE_SV39 LITERAL_UX(8)
+#define CSR_SATP_MODE_SV48 LITERAL_UX(9)
+
+#ifdef __C__
+    #define READ_CSR(csr) \
+        __extension__ ({ \
+            uint_xlen_t _value; \
+            __asm__ volatile("csrr %0, " #csr : "=r"(_value)); \
+            _value; \
+        })
+    #define WRITE_CSR(csr, value) \
+        __asm__ volatile("csrw " #csr ", %0" \
+            : : "rK"((uint_xlen_t)(value)) : "memory")
+    #define SET_CSR(csr, bits) \
+        __asm__ volatile("csrs " #csr ", %0" \
+            : : "rK"((uint_xlen_t)(bits)) : "memory")
+    #define CLEAR_CSR(csr, bits) \
+        __asm__ volatile("csrc " #csr ", %0" \
+            : : "rK"((uint_xlen_t)(bits)) : "memory")
+    #define READ_AND_SET_CSR(csr, bits) \
+        __extension__ ({ \
+            uint_xlen_t _value; \
+            __asm__ volatile("csrrs %0, " #csr ", %1" \
+                : "=r"(_value) : "rK"((uint_xlen_t)(bits)) : "memory"); \
+            _value; \
+        })
+    #define READ_AND_CLEAR_CSR(csr, bits) \
+        __extension__ ({ \
+            uint_xlen_t _value; \
+            __asm__ volatile("csrrc %0, " #csr ", %1" \
+                : "=r"(_value) : "rK"((uint_xlen_t)(bits)) : "memory"); \
+            _value; \
+        })
+#endif
+
+#endif  // KERNEL_ARCH_CSR_H
@@ -0,0 +1,45 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_ARCH_HART_H
+#define KERNEL_ARCH_HART_H
+
+#include <stdbool.h>
+
+struct Hart;
+
+// Get the per-hart area of the current hart.  The kernel reserves tp to hold
+// its address.  The read is volatile because a thread may migrate between
+// harts across any call.
+static inline void* get_per_hart_area(void)
+{
+    void* area;
+    __asm__ volatile("mv %0, tp" : "=r"(area));
+    return area;
+}
+
+// Start the hart described by hart, whose per-hart area is initialized, at
+// the secondary entry point.
+bool start_hart(struct Hart* hart);
+
+// Interrupt the hart, which calls handle_ipi.
+void send_ipi(const struct Hart* hart);
+
+#endif  // KERNEL_ARCH_HART_H
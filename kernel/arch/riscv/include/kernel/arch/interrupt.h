@@ -0,0 +1,55 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_ARCH_INTERRUPT_H
+#define KERNEL_ARCH_INTERRUPT_H
+
+#include <kernel/arch/csr.h>
+#include <kernel/arch/types.h>
+
+#include <stdbool.h>
+
+// The interrupt-enable state of the current hart as returned by
+// disable_interrupts and consumed by restore_interrupts.
+typedef uint_xlen_t InterruptState;
+
+static inline InterruptState disable_interrupts(void)
+{
+    return READ_AND_CLEAR_CSR(sstatus, CSR_SSTATUS_SIE) & CSR_SSTATUS_SIE;
+}
+
+static inline void restore_interrupts(InterruptState state)
+{
+    if (state != 0) {
+        SET_CSR(sstatus, CSR_SSTATUS_SIE);
+    }
+}
+
+static inline void enable_interrupts(void)
+{
+    SET_CSR(sstatus, CSR_SSTATUS_SIE);
+}
+
+static inline bool are_interrupts_enabled(void)
+{
+    return (READ_CSR(sstatus) & CSR_SSTATUS_SIE) != 0;
+}
+
+#endif  // KERNEL_ARCH_INTERRUPT_H
@@ -0,0 +1,37 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_ARCH_ISA_H
+#define KERNEL_ARCH_ISA_H
+
+#include <stdbool.h>
+
+// Whether a riscv,isa string such as "rv64imafdc_zicsr_sstc" names the
+// extension.  Single-letter extensions are looked up in the base part, where G
+// implies IMAFD and Zicsr and Zifencei; multi-letter extensions are looked up
+// among the underscore-separated names.  The comparison ignores case and
+// version numbers.
+bool has_isa_extension(const char* isa, const char* extension);
+
+// Whether every hart in the FDT implements the extension.  False if the FDT
+// lists no ISA strings.
+bool is_isa_extension_supported(const char* extension);
+
+#endif  // KERNEL_ARCH_ISA_H
@@ -25,7 +25,7 @@
 #include <kernel/config.h>
 
 #if RISCV_MMU_BARE
-    #define KERNEL_BASE LITERAL_UX(DRAM_BASE)
+    #define DIRECT_MAP_BASE LITERAL_UX(0)
 #else
     #if RISCV_MMU_SV32
         #error MMU Sv32 is not implemented
@@ -39,8 +39,13 @@
     #else
         #error Unknown MMU
     #endif
-    #define KERNEL_BASE LITERAL_UX(KERNEL_SPACE_BASE) + LITERAL_UX(DRAM_BASE)
+
+    // Physical memory is mapped at the start of kernel space, and the kernel
+    // is linked at its own address in this direct map.
+    #define DIRECT_MAP_BASE KERNEL_SPACE_BASE
+    #define DIRECT_MAP_SIZE KERNEL_SPACE_SIZE
 #endif
+#define KERNEL_BASE (DIRECT_MAP_BASE + LITERAL_UX(DRAM_BASE))
 
 #define PAGE_BITS LITERAL_UX(12)
 #define PAGE_SIZE BIT_UX(PAGE_BITS)
@@ -49,10 +54,26 @@
 #define ROUND_PAGE_DOWN(x) (((x) >> PAGE_BITS) << PAGE_BITS)
 #define ROUND_PAGE_UP(x) (ROUND_PAGE_DOWN((x) + (PAGE_SIZE - 1)))
 
-#define STACK_SIZE PAGE_SIZE
+#define STACK_BITS (PAGE_BITS + 2)
+#define STACK_SIZE BIT_UX(STACK_BITS)
+
+#define CACHE_LINE_SIZE 64
 
 #ifdef __C__
     typedef uint_xlen_t PhysicalAddress;
+
+    // Get the kernel-accessible address of physical memory.
+    static inline void* physical_to_virtual(PhysicalAddress addr)
+    {
+        return (void*)(addr + DIRECT_MAP_BASE);
+    }
+
+    // Get the physical address of kernel-accessible memory, which must be in
+    // the direct map.
+    static inline PhysicalAddress virtual_to_physical(const void* addr)
+    {
+        return (PhysicalAddress)addr - DIRECT_MAP_BASE;
+    }
 #endif
 
 #endif  // KERNEL_ARCH_MEMORY_H
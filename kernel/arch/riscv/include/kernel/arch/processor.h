@@ -0,0 +1,63 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_ARCH_PROCESSOR_H
+#define KERNEL_ARCH_PROCESSOR_H
+
+#include <kernel/arch/types.h>
+
+// Hint to the hart that it is in a spin-wait loop.  This is the Zihintpause
+// PAUSE encoding, which executes as a no-op on harts without the extension.
+static inline void cpu_relax(void)
+{
+    __asm__ volatile(".insn i 0x0F, 0, x0, x0, 0x010" : : : "memory");
+}
+
+// Read the cycle counter of the current hart.  Only differences between reads
+// on the same hart are meaningful.
+static inline uint_xlen_t get_cycle_count(void)
+{
+    uint_xlen_t cycles;
+    __asm__ volatile("rdcycle %0" : "=r"(cycles));
+    return cycles;
+}
+
+// Stall the hart until an interrupt is pending.  This returns even if
+// interrupts are disabled, without taking the interrupt.
+static inline void wait_for_interrupt(void)
+{
+    __asm__ volatile("wfi" : : : "memory");
+}
+
+// Order memory writes before a following device register write, such as a
+// doorbell that makes the device read the memory.
+static inline void device_write_barrier(void)
+{
+    __asm__ volatile("fence w, o" : : : "memory");
+}
+
+// Order a device register read before following memory reads, such as of
+// memory that the device wrote before it raised an interrupt.
+static inline void device_read_barrier(void)
+{
+    __asm__ volatile("fence i, r" : : : "memory");
+}
+
+#endif  // KERNEL_ARCH_PROCESSOR_H
@@ -0,0 +1,105 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_ARCH_SBI_H
+#define KERNEL_ARCH_SBI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Extension IDs
+#define SBI_EXT_BASE 0x10
+#define SBI_EXT_HSM  0x48534D
+#define SBI_EXT_RFENCE 0x52464E43
+#define SBI_EXT_TIME 0x54494D45
+#define SBI_EXT_IPI 0x735049
+#define SBI_EXT_LEGACY_SET_TIMER 0x00
+
+// Base extension functions
+#define SBI_BASE_GET_SPEC_VERSION 0
+#define SBI_BASE_PROBE_EXTENSION  3
+
+// Hart state management extension functions
+#define SBI_HSM_HART_START      0
+#define SBI_HSM_HART_STOP       1
+#define SBI_HSM_HART_GET_STATUS 2
+
+// Remote fence extension functions
+#define SBI_RFENCE_REMOTE_FENCE_I         0
+#define SBI_RFENCE_REMOTE_SFENCE_VMA      1
+#define SBI_RFENCE_REMOTE_SFENCE_VMA_ASID 2
+
+// Timer extension functions
+#define SBI_TIME_SET_TIMER 0
+
+// IPI extension functions
+#define SBI_IPI_SEND_IPI 0
+
+// Hart states
+#define SBI_HSM_STATE_STARTED       0
+#define SBI_HSM_STATE_STOPPED       1
+#define SBI_HSM_STATE_START_PENDING 2
+#define SBI_HSM_STATE_STOP_PENDING  3
+
+// Error codes
+#define SBI_SUCCESS               0
+#define SBI_ERR_FAILED            -1
+#define SBI_ERR_NOT_SUPPORTED     -2
+#define SBI_ERR_INVALID_PARAM     -3
+#define SBI_ERR_DENIED            -4
+#define SBI_ERR_INVALID_ADDRESS   -5
+#define SBI_ERR_ALREADY_AVAILABLE -6
+
+typedef struct SbiResult
+{
+    long error;
+    long value;
+} SbiResult;
+
+SbiResult sbi_call(long extension, long function, unsigned long arg0,
+    unsigned long arg1, unsigned long arg2, unsigned long arg3,
+    unsigned long arg4, unsigned long arg5);
+
+bool sbi_probe_extension(long extension);
+
+long sbi_hart_start(unsigned long hart_id, unsigned long start_address,
+    unsigned long opaque);
+long sbi_hart_get_status(unsigned long hart_id);
+
+// Raise a supervisor software interrupt on the harts in the mask.
+long sbi_send_ipi(unsigned long hart_mask, unsigned long hart_mask_base);
+
+// A hart mask selects the harts whose IDs are hart_mask_base plus the
+// positions of its set bits.  A size of SBI_FLUSH_ALL flushes every address.
+#define SBI_FLUSH_ALL ((unsigned long)-1)
+
+long sbi_remote_fence_i(unsigned long hart_mask, unsigned long hart_mask_base);
+long sbi_remote_sfence_vma(unsigned long hart_mask,
+    unsigned long hart_mask_base, unsigned long start, unsigned long size);
+long sbi_remote_sfence_vma_asid(unsigned long hart_mask,
+    unsigned long hart_mask_base, unsigned long start, unsigned long size,
+    unsigned long asid);
+
+// Program the next timer interrupt of the current hart for the given time.  A
+// time in the past fires immediately, and UINT64_MAX effectively disables it.
+long sbi_set_timer(uint64_t stime_value);
+
+#endif  // KERNEL_ARCH_SBI_H
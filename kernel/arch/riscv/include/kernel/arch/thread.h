@@ -0,0 +1,60 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_ARCH_THREAD_H
+#define KERNEL_ARCH_THREAD_H
+
+#include <kernel/arch/types.h>
+
+// Layout of ThreadContext for switch.S
+#define THREAD_CONTEXT_RA   (0 * __riscv_xlen_bytes)
+#define THREAD_CONTEXT_SP   (1 * __riscv_xlen_bytes)
+#define THREAD_CONTEXT_S(n) ((2 + (n)) * __riscv_xlen_bytes)
+
+#ifdef __C__
+    // The callee-saved registers of a switched-out thread.  Everything else
+    // is either saved by the compiler around the call to switch_context or
+    // belongs to the hart, as tp does.
+    typedef struct ThreadContext
+    {
+        uint_xlen_t ra;
+        uint_xlen_t sp;
+        uint_xlen_t s[12];
+    } ThreadContext;
+
+    // Save the current thread's context in from and resume to.  Returns when
+    // some hart switches back to from.
+    void switch_context(ThreadContext* from, const ThreadContext* to);
+
+    extern const char _thread_trampoline[];
+
+    // Prepare a context that calls enter_thread(entry, argument) on the
+    // stack ending at stack_top.
+    static inline void initialize_thread_context(ThreadContext* context,
+        void* stack_top, void (*entry)(void*), void* argument)
+    {
+        context->ra = (uint_xlen_t)(uintptr_t)_thread_trampoline;
+        context->sp = (uint_xlen_t)(uintptr_t)stack_top;
+        context->s[0] = (uint_xlen_t)(uintptr_t)entry;
+        context->s[1] = (uint_xlen_t)(uintptr_t)argument;
+    }
+#endif
+
+#endif  // KERNEL_ARCH_THREAD_H
@@ -0,0 +1,59 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_ARCH_TIMER_H
+#define KERNEL_ARCH_TIMER_H
+
+#include <stdint.h>
+
+// Sstc supervisor timer compare register, which the assembler may not know by
+// name
+#define CSR_STIMECMP  0x14D
+#define CSR_STIMECMPH 0x15D
+
+// Read the time CSR, which counts at the timebase frequency and is
+// synchronized across harts.
+static inline uint64_t get_time(void)
+{
+#if __riscv_xlen == 32
+    uint32_t high;
+    uint32_t low;
+    uint32_t check;
+    do {
+        __asm__ volatile("rdtimeh %0" : "=r"(high));
+        __asm__ volatile("rdtime %0" : "=r"(low));
+        __asm__ volatile("rdtimeh %0" : "=r"(check));
+    } while (high != check);
+    return ((uint64_t)high << 32) | low;
+#else
+    uint64_t time;
+    __asm__ volatile("rdtime %0" : "=r"(time));
+    return time;
+#endif
+}
+
+// Program the one-shot timer interrupt of the current hart.  UINT64_MAX
+// disarms it.
+void set_timer_deadline(uint64_t deadline);
+
+// Called on each hart.  Routes the timer interrupt to handle_timer_interrupt.
+void initialize_arch_timer(void);
+
+#endif  // KERNEL_ARCH_TIMER_H
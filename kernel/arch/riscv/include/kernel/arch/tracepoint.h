@@ -0,0 +1,71 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_ARCH_TRACEPOINT_H
+#define KERNEL_ARCH_TRACEPOINT_H
+
+#include <kernel/arch/types.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct Tracepoint;
+
+// Each tracepoint site records where its nop is, where to jump when the
+// tracepoint is enabled, and which tracepoint it belongs to.
+typedef struct TracepointSite
+{
+    uintptr_t site;
+    uintptr_t target;
+    struct Tracepoint* tracepoint;
+} TracepointSite;
+
+// A disabled site is a single nop on the fast path.  Enabling its tracepoint
+// patches the nop into a jump to the tracing code.  The nop is never
+// compressed or relaxed and is aligned to 4 bytes, so one store replaces it
+// and no hart can fetch half of each instruction.
+static inline __attribute__((always_inline)) bool is_tracepoint_site_enabled(
+    struct Tracepoint* tracepoint)
+{
+    __asm__ goto(
+        ".balign 4\n"
+        ".option push\n"
+        ".option norelax\n"
+        ".option norvc\n"
+        "1: nop\n"
+        ".option pop\n"
+        ".pushsection .tracepoint.site, \"a\"\n"
+        ".balign %1\n"
+        ASM_PTR " 1b, %l[enabled], %0\n"
+        ".popsection\n"
+        : : "i"(tracepoint), "i"(__alignof__(TracepointSite)) : : enabled);
+    return false;
+enabled:
+    return true;
+}
+
+// Patch a site into a jump to its target or back into a nop.  Other harts may
+// keep fetching the old instruction until synchronize_tracepoint_sites.
+void patch_tracepoint_site(const TracepointSite* site, bool is_enabled);
+
+// Make patched sites visible to the instruction fetch of every hart.
+void synchronize_tracepoint_sites(void);
+
+#endif  // KERNEL_ARCH_TRACEPOINT_H
@@ -0,0 +1,102 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_ARCH_TRAP_H
+#define KERNEL_ARCH_TRAP_H
+
+#include <kernel/arch/types.h>
+
+// Interrupt causes
+#define INTERRUPT_SUPERVISOR_SOFTWARE 1
+#define INTERRUPT_SUPERVISOR_TIMER    5
+#define INTERRUPT_SUPERVISOR_EXTERNAL 9
+#define INTERRUPT_CAUSE_COUNT 16
+
+// Exception causes
+#define EXCEPTION_INSTRUCTION_MISALIGNED    0
+#define EXCEPTION_INSTRUCTION_ACCESS_FAULT  1
+#define EXCEPTION_ILLEGAL_INSTRUCTION       2
+#define EXCEPTION_BREAKPOINT                3
+#define EXCEPTION_LOAD_MISALIGNED           4
+#define EXCEPTION_LOAD_ACCESS_FAULT         5
+#define EXCEPTION_STORE_MISALIGNED          6
+#define EXCEPTION_STORE_ACCESS_FAULT        7
+#define EXCEPTION_ENVIRONMENT_CALL_FROM_U   8
+#define EXCEPTION_ENVIRONMENT_CALL_FROM_S   9
+#define EXCEPTION_INSTRUCTION_PAGE_FAULT    12
+#define EXCEPTION_LOAD_PAGE_FAULT           13
+#define EXCEPTION_STORE_PAGE_FAULT          15
+#define EXCEPTION_CAUSE_COUNT 24
+
+// Layout of TrapFrame for the trap vector.  Registers are stored by number,
+// and the slot of x0 is unused.
+#define TRAP_FRAME_REGISTER(n) ((n) * __riscv_xlen_bytes)
+#define TRAP_FRAME_SEPC        TRAP_FRAME_REGISTER(32)
+#define TRAP_FRAME_SSTATUS     TRAP_FRAME_REGISTER(33)
+#define TRAP_FRAME_SCAUSE      TRAP_FRAME_REGISTER(34)
+#define TRAP_FRAME_STVAL       TRAP_FRAME_REGISTER(35)
+#define TRAP_FRAME_ENTRY_CYCLE TRAP_FRAME_REGISTER(36)
+#define TRAP_FRAME_SIZE ((TRAP_FRAME_REGISTER(37) + 15) & ~15)  // ABI aligned
+
+#ifdef __C__
+    #include <stdbool.h>
+    #include <stddef.h>
+    #include <stdint.h>
+
+    // Interrupts save only the registers that the handler may clobber: ra,
+    // t0-t6, a0-a7, sepc, and sstatus.  Exceptions save every register along
+    // with scause and stval, and any change that the handler makes to the
+    // frame takes effect on return.
+    typedef struct TrapFrame
+    {
+        uint_xlen_t registers[32];
+        uint_xlen_t sepc;
+        uint_xlen_t sstatus;
+        uint_xlen_t scause;
+        uint_xlen_t stval;
+        uint_xlen_t entry_cycle;  // Cycle count at trap entry
+    } TrapFrame;
+
+    typedef void (*InterruptHandler)(size_t cause, TrapFrame* frame);
+    // Return true if the exception was handled.
+    typedef bool (*ExceptionHandler)(size_t cause, TrapFrame* frame);
+
+    // Latency from trap entry to the call of the handler
+    typedef struct TrapStatistics
+    {
+        uint64_t count;
+        uint64_t min_cycles;
+        uint64_t max_cycles;
+        uint64_t total_cycles;
+    } TrapStatistics;
+
+    bool set_interrupt_handler(size_t cause, InterruptHandler handler);
+    bool set_exception_handler(size_t cause, ExceptionHandler handler);
+
+    void get_trap_statistics(size_t hart_index, bool is_interrupt,
+        size_t cause, TrapStatistics* statistics);
+    void print_trap_statistics(void);
+
+    bool is_trap_vector_vectored(void);
+
+    void initialize_traps(void);
+#endif
+
+#endif  // KERNEL_ARCH_TRAP_H
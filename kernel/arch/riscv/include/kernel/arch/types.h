@@ -37,11 +37,12 @@
 #define BIT_UX(x) BIT(x, ul)
 
 #if __riscv_xlen == 32
-    #define _riscv_xlen_bytes 4
+    #define __riscv_xlen_bytes 4
     #if defined(__C__)
         typedef uint32_t uint_xlen_t;
         #define ASM_LX "lw"
         #define ASM_SX "sw"
+        #define ASM_PTR ".word"
     #elif defined(__ASSEMBLER__)
         #define LX lw
         #define SX sw
@@ -52,6 +53,7 @@
         typedef uint64_t uint_xlen_t;
         #define ASM_LX "ld"
         #define ASM_SX "sd"
+        #define ASM_PTR ".dword"
     #elif defined(__ASSEMBLER__)
         #define LX ld
         #define SX sd
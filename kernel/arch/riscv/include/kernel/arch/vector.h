@@ -0,0 +1,51 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_ARCH_VECTOR_H
+#define KERNEL_ARCH_VECTOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Below this size the scalar routines finish before the vector unit pays off.
+#define VECTOR_MIN_SIZE 256
+
+// Vector registers are not saved across traps or context switches, so the
+// vector routines run with interrupts disabled.  They reenable interrupts
+// between chunks of this many bytes to bound the latency.
+#define VECTOR_CHUNK_SIZE 4096
+
+// Called on each hart, before the hart uses any string routine.  The boot hart
+// calls it after the FDT is parsed and decides for every hart whether to use
+// the vector routines.
+void initialize_vector(void);
+
+// Whether the vector routines may be used.
+bool is_vector_enabled(void);
+
+// Vector variants of memcpy, memset, memcmp, and strlen.  Only call these if
+// is_vector_enabled.  The copy runs forward, so it also serves memmove when s1
+// is below s2.
+void copy_memory_with_vector(void* s1, const void* s2, size_t n);
+void set_memory_with_vector(void* s, int c, size_t n);
+int compare_memory_with_vector(const void* s1, const void* s2, size_t n);
+size_t get_string_length_with_vector(const char* s);
+
+#endif  // KERNEL_ARCH_VECTOR_H
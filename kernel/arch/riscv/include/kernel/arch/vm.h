@@ -0,0 +1,119 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_ARCH_VM_H
+#define KERNEL_ARCH_VM_H
+
+#include <kernel/arch/csr.h>
+#include <kernel/arch/memory.h>
+#include <kernel/arch/types.h>
+#include <kernel/config.h>
+
+// Page table entry bits
+#define PTE_V BIT_UX(0)  // Valid
+#define PTE_R BIT_UX(1)  // Readable
+#define PTE_W BIT_UX(2)  // Writable
+#define PTE_X BIT_UX(3)  // Executable
+#define PTE_U BIT_UX(4)  // User accessible
+#define PTE_G BIT_UX(5)  // Global to all address spaces
+#define PTE_A BIT_UX(6)  // Accessed
+#define PTE_D BIT_UX(7)  // Dirty
+#define PTE_PPN_SHIFT 10
+
+#define PAGE_TABLE_INDEX_BITS 9
+#define PAGE_TABLE_ENTRIES BIT_UX(PAGE_TABLE_INDEX_BITS)
+
+#if RISCV_MMU_SV39
+    #define PAGE_TABLE_LEVELS 3
+    #define CSR_SATP_MODE CSR_SATP_MODE_SV39
+#endif
+
+// Size of a leaf page at the given level of the page table.  Level 0 maps
+// base pages, level 1 maps megapages, and level 2 maps gigapages.
+#define PAGE_LEVEL_BITS(level) (PAGE_BITS + (level) * PAGE_TABLE_INDEX_BITS)
+#define PAGE_LEVEL_SIZE(level) BIT_UX(PAGE_LEVEL_BITS(level))
+
+#ifdef __C__
+    #include <stdbool.h>
+    #include <stddef.h>
+    #include <stdint.h>
+
+    #ifdef KERNEL_VM
+        typedef uint_xlen_t PageTableEntry;
+
+        typedef struct PageTable
+        {
+            PageTableEntry entries[PAGE_TABLE_ENTRIES];
+        } PageTable;
+
+        // An address space is a root page table whose upper half is shared
+        // with the kernel page table.  Its context holds the ASID and the
+        // generation in which the ASID was allocated.
+        typedef struct AddressSpace
+        {
+            PageTable* root;
+            uint64_t context;  // 0 until first switched to
+            unsigned long hart_mask;  // Harts that may cache its translations
+        } AddressSpace;
+
+        PageTable* get_kernel_page_table(void);
+        bool map_pages(PageTable* root, uintptr_t virt, PhysicalAddress phys,
+            size_t size, PageTableEntry flags);
+
+        // Store one instruction into the kernel text, which is otherwise
+        // read-only.  The caller synchronizes the instruction fetch.
+        void patch_kernel_text(uint32_t* addr, uint32_t instruction);
+
+        AddressSpace* get_kernel_address_space(void);
+        AddressSpace* create_address_space(void);
+        void destroy_address_space(AddressSpace* space);
+        void switch_address_space(AddressSpace* space);
+
+        void flush_tlb_range(AddressSpace* space, uintptr_t start,
+            size_t size);
+        void flush_tlb(AddressSpace* space);
+
+        unsigned int get_asid_bits(void);
+
+        void initialize_asids(void);
+        void initialize_vm(void);
+
+        static inline void switch_to_kernel_page_table(void)
+        {
+            switch_address_space(get_kernel_address_space());
+        }
+    #else
+        static inline void patch_kernel_text(uint32_t* addr,
+            uint32_t instruction)
+        {
+            __atomic_store_n(addr, instruction, __ATOMIC_RELAXED);
+        }
+
+        static inline void initialize_vm(void)
+        {
+        }
+
+        static inline void switch_to_kernel_page_table(void)
+        {
+        }
+    #endif
+#endif
+
+#endif  // KERNEL_ARCH_VM_H
@@ -0,0 +1,127 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/arch/isa.h>
+
+#include <kernel/fdt.h>
+
+#include <stddef.h>
+#include <string.h>
+
+static char _to_lower(char chr)
+{
+    return chr >= 'A' && chr <= 'Z' ? (char)(chr - 'A' + 'a') : chr;
+}
+
+static bool _is_digit(char chr)
+{
+    return chr >= '0' && chr <= '9';
+}
+
+static bool _has_single_letter_extension(const char* base, size_t size,
+    char letter)
+{
+    for (size_t i = 0; i < size; ++i) {
+        const char chr = _to_lower(base[i]);
+        if (chr == letter) {
+            return true;
+        }
+        if (chr == 'g' && (letter == 'i' || letter == 'm' || letter == 'a' ||
+                letter == 'f' || letter == 'd')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether name matches extension, ignoring case and a trailing version such
+// as "2p0".
+static bool _is_extension_name(const char* name, size_t size,
+    const char* extension)
+{
+    size_t i = 0;
+    for (; extension[i] != '\0'; ++i) {
+        if (i >= size || _to_lower(name[i]) != _to_lower(extension[i])) {
+            return false;
+        }
+    }
+    for (; i < size; ++i) {
+        if (!_is_digit(name[i]) && _to_lower(name[i]) != 'p') {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool has_isa_extension(const char* isa, const char* extension)
+{
+    if (isa == NULL || extension == NULL || extension[0] == '\0') {
+        return false;
+    }
+    if (strlen(isa) < 4 || _to_lower(isa[0]) != 'r' ||
+            _to_lower(isa[1]) != 'v') {
+        return false;
+    }
+
+    // Skip "rvXX" to the single-letter extensions, which end at the first
+    // underscore.
+    const char* base = isa + 2;
+    while (_is_digit(*base)) {
+        ++base;
+    }
+    const char* end = strchr(base, '_');
+    const size_t base_size = end != NULL ? (size_t)(end - base) : strlen(base);
+
+    if (extension[1] == '\0') {
+        return _has_single_letter_extension(base, base_size,
+            _to_lower(extension[0]));
+    }
+    if (_has_single_letter_extension(base, base_size, 'g') &&
+            (_is_extension_name("zicsr", 5, extension) ||
+                _is_extension_name("zifencei", 8, extension))) {
+        return true;
+    }
+
+    while (end != NULL) {
+        const char* name = end + 1;
+        end = strchr(name, '_');
+        const size_t size = end != NULL ? (size_t)(end - name) : strlen(name);
+        if (_is_extension_name(name, size, extension)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_isa_extension_supported(const char* extension)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < get_fdt_cpu_count(); ++i) {
+        const FdtCpu* cpu = get_fdt_cpu(i);
+        if (cpu->isa == NULL) {
+            continue;
+        }
+        if (!has_isa_extension(cpu->isa, extension)) {
+            return false;
+        }
+        ++count;
+    }
+    return count != 0;
+}
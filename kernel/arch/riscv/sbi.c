@@ -0,0 +1,111 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/arch/sbi.h>
+
+SbiResult sbi_call(long extension, long function, unsigned long arg0,
+    unsigned long arg1, unsigned long arg2, unsigned long arg3,
+    unsigned long arg4, unsigned long arg5)
+{
+    register unsigned long a0 __asm__("a0") = arg0;
+    register unsigned long a1 __asm__("a1") = arg1;
+    register unsigned long a2 __asm__("a2") = arg2;
+    register unsigned long a3 __asm__("a3") = arg3;
+    register unsigned long a4 __asm__("a4") = arg4;
+    register unsigned long a5 __asm__("a5") = arg5;
+    register unsigned long a6 __asm__("a6") = function;
+    register unsigned long a7 __asm__("a7") = extension;
+    __asm__ volatile("ecall"
+        : "+r"(a0), "+r"(a1)
+        : "r"(a2), "r"(a3), "r"(a4), "r"(a5), "r"(a6), "r"(a7)
+        : "memory");
+
+    const SbiResult result = {
+        .error = (long)a0,
+        .value = (long)a1,
+    };
+    return result;
+}
+
+bool sbi_probe_extension(long extension)
+{
+    const SbiResult result = sbi_call(SBI_EXT_BASE, SBI_BASE_PROBE_EXTENSION,
+        extension, 0, 0, 0, 0, 0);
+    return result.error == SBI_SUCCESS && result.value != 0;
+}
+
+long sbi_hart_start(unsigned long hart_id, unsigned long start_address,
+    unsigned long opaque)
+{
+    return sbi_call(SBI_EXT_HSM, SBI_HSM_HART_START, hart_id, start_address,
+        opaque, 0, 0, 0).error;
+}
+
+long sbi_hart_get_status(unsigned long hart_id)
+{
+    const SbiResult result = sbi_call(SBI_EXT_HSM, SBI_HSM_HART_GET_STATUS,
+        hart_id, 0, 0, 0, 0, 0);
+    return result.error == SBI_SUCCESS ? result.value : result.error;
+}
+
+long sbi_send_ipi(unsigned long hart_mask, unsigned long hart_mask_base)
+{
+    return sbi_call(SBI_EXT_IPI, SBI_IPI_SEND_IPI, hart_mask, hart_mask_base,
+        0, 0, 0, 0).error;
+}
+
+long sbi_remote_fence_i(unsigned long hart_mask, unsigned long hart_mask_base)
+{
+    return sbi_call(SBI_EXT_RFENCE, SBI_RFENCE_REMOTE_FENCE_I, hart_mask,
+        hart_mask_base, 0, 0, 0, 0).error;
+}
+
+long sbi_remote_sfence_vma(unsigned long hart_mask,
+    unsigned long hart_mask_base, unsigned long start, unsigned long size)
+{
+    return sbi_call(SBI_EXT_RFENCE, SBI_RFENCE_REMOTE_SFENCE_VMA, hart_mask,
+        hart_mask_base, start, size, 0, 0).error;
+}
+
+long sbi_remote_sfence_vma_asid(unsigned long hart_mask,
+    unsigned long hart_mask_base, unsigned long start, unsigned long size,
+    unsigned long asid)
+{
+    return sbi_call(SBI_EXT_RFENCE, SBI_RFENCE_REMOTE_SFENCE_VMA_ASID,
+        hart_mask, hart_mask_base, start, size, asid, 0).error;
+}
+
+long sbi_set_timer(uint64_t stime_value)
+{
+    // Fall back to the legacy call on implementations predating TIME.
+    static int is_time_present = -1;
+    if (is_time_present < 0) {
+        is_time_present = sbi_probe_extension(SBI_EXT_TIME) ? 1 : 0;
+    }
+    const long extension =
+        is_time_present ? SBI_EXT_TIME : SBI_EXT_LEGACY_SET_TIMER;
+#if __riscv_xlen == 32
+    return sbi_call(extension, SBI_TIME_SET_TIMER, (unsigned long)stime_value,
+        (unsigned long)(stime_value >> 32), 0, 0, 0, 0).error;
+#else
+    return sbi_call(extension, SBI_TIME_SET_TIMER, stime_value, 0, 0, 0, 0,
+        0).error;
+#endif
+}
@@ -19,23 +19,74 @@
 // DEALINGS IN THE SOFTWARE.
 
 #include <kernel/arch/memory.h>
+#include <kernel/arch/trap.h>
+#include <kernel/arch/vector.h>
+#include <kernel/arch/vm.h>
+#include <kernel/block_cache.h>
 #include <kernel/debug.h>
+#include <kernel/fdt.h>
+#include <kernel/hart.h>
+#include <kernel/initramfs.h>
+#include <kernel/klog.h>
 #include <kernel/main.h>
 #include <kernel/panic.h>
 #include <kernel/pmm.h>
+#include <kernel/rcu.h>
+#include <kernel/slab.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <kernel/tracepoint.h>
 
 #include <stddef.h>
 #include <stdio.h>
 #include <stdnoreturn.h>
 
+static void _run_main(void* argument)
+{
+    (void)argument;
+    const int exit_code = main();
+    panic("main returned with exit code %d\n", exit_code);
+}
+
 noreturn void _start(size_t hart_id, void* device_tree)
 {
     initialize_debug();
-    dprintf("Starting hart %u with device tree pointer %p\n", hart_id,
+    dprintf("Starting hart %zu with device tree pointer %p\n", hart_id,
         device_tree);
+    initialize_boot_hart(hart_id);
+    initialize_traps();
 
+    if (!initialize_fdt(
+            physical_to_virtual((PhysicalAddress)device_tree))) {
+        dprintf("Continuing without a device tree\n");
+    }
+    initialize_vector();
     initialize_pmm();
+    initialize_vm();
+    initialize_tracepoints();
+    initialize_slab();
+    initialize_timers();
+    initialize_scheduler();
+    initialize_rcu();
+    initialize_klog();
+    initialize_block_cache();
+    initialize_initramfs();
+    start_secondary_harts();
 
-    const int exit_code = main();
-    panic("main returned with exit code %d\n", exit_code);
+    if (create_thread("main", _run_main, NULL) == NULL) {
+        panic("Unable to create the main thread\n");
+    }
+    run_idle_thread();
+}
+
+noreturn void _start_secondary(size_t hart_id)
+{
+    switch_to_kernel_page_table();
+    initialize_vector();
+    initialize_traps();
+    initialize_timers();
+    initialize_scheduler();
+    set_hart_online();
+    dprintf("Hart %zu online as index %zu\n", hart_id, get_hart_index());
+    run_idle_thread();
 }
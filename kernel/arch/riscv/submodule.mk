@@ -19,8 +19,20 @@
 # IN THE SOFTWARE.
 
 $(SUBMODULE).SRCS := \
+    asid.c \
     entry.S \
     halt.c \
-    start.c
+    hart.c \
+    isa.c \
+    sbi.c \
+    start.c \
+    switch.S \
+    timer.c \
+    tracepoint.c \
+    trap.S \
+    trap.c \
+    vector.S \
+    vector.c \
+    vm.c
 $(SUBMODULE).LDS := kernel.lds.S
 $(SUBMODULE).INC_DIRS := include
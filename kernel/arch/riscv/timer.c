@@ -0,0 +1,78 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/arch/timer.h>
+
+#include <kernel/arch/csr.h>
+#include <kernel/arch/isa.h>
+#include <kernel/arch/sbi.h>
+#include <kernel/arch/trap.h>
+#include <kernel/timer.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+
+static bool _has_sstc = false;
+static bool _is_detected = false;
+
+static void _handle_timer_interrupt(size_t cause, TrapFrame* frame)
+{
+    (void)cause;
+    (void)frame;
+    handle_timer_interrupt();
+}
+
+// Writing stimecmp directly avoids a round trip through M-mode for every
+// deadline, which SBI needs on harts without Sstc.
+void set_timer_deadline(uint64_t deadline)
+{
+    if (_has_sstc) {
+#if __riscv_xlen == 32
+        // Raise the high half first so that no intermediate value fires.
+        __asm__ volatile("csrw %0, %1"
+            : : "i"(CSR_STIMECMPH), "r"(UINT32_MAX));
+        __asm__ volatile("csrw %0, %1"
+            : : "i"(CSR_STIMECMP), "r"((uint32_t)deadline));
+        __asm__ volatile("csrw %0, %1"
+            : : "i"(CSR_STIMECMPH), "r"((uint32_t)(deadline >> 32)));
+#else
+        __asm__ volatile("csrw %0, %1" : : "i"(CSR_STIMECMP), "r"(deadline));
+#endif
+    }
+    else {
+        sbi_set_timer(deadline);
+    }
+}
+
+void initialize_arch_timer(void)
+{
+    // Every hart runs this after the FDT is parsed, and all harts must agree,
+    // so the boot hart decides for everyone.
+    if (!_is_detected) {
+        _has_sstc = is_isa_extension_supported("sstc");
+        _is_detected = true;
+        dprintf("Timer uses %s\n", _has_sstc ? "stimecmp" : "SBI");
+    }
+
+    set_timer_deadline(UINT64_MAX);
+    set_interrupt_handler(INTERRUPT_SUPERVISOR_TIMER,
+        _handle_timer_interrupt);
+    SET_CSR(sie, CSR_SIE_STIE);
+}
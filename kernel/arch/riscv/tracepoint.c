@@ -0,0 +1,68 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/arch/tracepoint.h>
+
+#include <kernel/arch/sbi.h>
+#include <kernel/arch/vm.h>
+
+#include <assert.h>
+#include <stdio.h>
+
+#define INSTRUCTION_NOP 0x00000013u  // addi zero, zero, 0
+#define INSTRUCTION_JAL 0x0000006Fu  // jal zero, 0
+
+// Reach of jal, which has a signed 21-bit offset in multiples of 2 bytes
+#define JAL_OFFSET_LIMIT (1l << 20)
+
+// Encode jal zero from site to target.  The offset bits are scattered over
+// the immediate field in J-type order.
+static uint32_t _encode_jump(uintptr_t site, uintptr_t target)
+{
+    const long offset = (long)(target - site);
+    assert(offset >= -JAL_OFFSET_LIMIT && offset < JAL_OFFSET_LIMIT);
+    assert((offset & 1) == 0);
+
+    const uint32_t imm = (uint32_t)offset;
+    return ((imm & 0x100000u) << 11)  // imm[20] at bit 31
+        | ((imm & 0x7FEu) << 20)      // imm[10:1] at bits 30:21
+        | ((imm & 0x800u) << 9)       // imm[11] at bit 20
+        | (imm & 0xFF000u)            // imm[19:12] at bits 19:12
+        | INSTRUCTION_JAL;
+}
+
+void patch_tracepoint_site(const TracepointSite* site, bool is_enabled)
+{
+    assert((site->site & 3) == 0);
+    patch_kernel_text((uint32_t*)site->site, is_enabled
+        ? _encode_jump(site->site, site->target)
+        : INSTRUCTION_NOP);
+}
+
+void synchronize_tracepoint_sites(void)
+{
+    __asm__ volatile("fence.i" : : : "memory");
+
+    // A hart mask base of -1 selects every hart.
+    const long error = sbi_remote_fence_i(0, (unsigned long)-1);
+    if (error != SBI_SUCCESS) {
+        dprintf("SBI remote fence.i failed with %d\n", (int)error);
+    }
+}
@@ -0,0 +1,230 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/arch/trap.h>
+
+#include <kernel/arch/csr.h>
+#include <kernel/arch/processor.h>
+#include <kernel/hart.h>
+#include <kernel/irq.h>
+#include <kernel/klog.h>
+#include <kernel/panic.h>
+#include <kernel/percpu.h>
+#include <kernel/thread.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct HartTrapStatistics
+{
+    TrapStatistics interrupts[INTERRUPT_CAUSE_COUNT];
+    TrapStatistics exceptions[EXCEPTION_CAUSE_COUNT];
+} HartTrapStatistics;
+
+_Static_assert(offsetof(TrapFrame, sepc) == TRAP_FRAME_SEPC,
+    "TrapFrame does not match TRAP_FRAME_SEPC");
+_Static_assert(offsetof(TrapFrame, sstatus) == TRAP_FRAME_SSTATUS,
+    "TrapFrame does not match TRAP_FRAME_SSTATUS");
+_Static_assert(offsetof(TrapFrame, scause) == TRAP_FRAME_SCAUSE,
+    "TrapFrame does not match TRAP_FRAME_SCAUSE");
+_Static_assert(offsetof(TrapFrame, stval) == TRAP_FRAME_STVAL,
+    "TrapFrame does not match TRAP_FRAME_STVAL");
+_Static_assert(offsetof(TrapFrame, entry_cycle) == TRAP_FRAME_ENTRY_CYCLE,
+    "TrapFrame does not match TRAP_FRAME_ENTRY_CYCLE");
+_Static_assert(sizeof(TrapFrame) <= TRAP_FRAME_SIZE,
+    "TrapFrame does not fit in TRAP_FRAME_SIZE");
+
+extern const char _trap_entry[];
+extern const char _trap_vector[];
+
+static InterruptHandler _interrupt_handlers[INTERRUPT_CAUSE_COUNT] = {NULL};
+static ExceptionHandler _exception_handlers[EXCEPTION_CAUSE_COUNT] = {NULL};
+static bool _is_vectored = false;
+
+static DEFINE_PER_HART(HartTrapStatistics, _statistics);
+
+static void _record_trap(TrapStatistics* statistics, uint_xlen_t entry_cycle)
+{
+    const uint64_t cycles = get_cycle_count() - entry_cycle;
+    if (statistics->count == 0 || cycles < statistics->min_cycles) {
+        statistics->min_cycles = cycles;
+    }
+    if (cycles > statistics->max_cycles) {
+        statistics->max_cycles = cycles;
+    }
+    statistics->total_cycles += cycles;
+    ++statistics->count;
+}
+
+// Called by the trap vector with interrupts disabled.
+void handle_interrupt(size_t cause, TrapFrame* frame)
+{
+    if (cause >= INTERRUPT_CAUSE_COUNT) {
+        klog("Ignoring interrupt with unknown cause %zu\n", cause);
+        return;
+    }
+
+    _record_trap(&THIS_HART_PTR(_statistics)->interrupts[cause],
+        frame->entry_cycle);
+    const InterruptHandler handler =
+        __atomic_load_n(&_interrupt_handlers[cause], __ATOMIC_ACQUIRE);
+    if (handler != NULL) {
+        handler(cause, frame);
+    }
+    else {
+        klog("Ignoring interrupt %zu without a handler\n", cause);
+    }
+    // Switching threads here leaves this frame on the old thread's stack
+    // until it is resumed, so any hart can finish returning from it.
+    preempt_if_needed();
+}
+
+// Called by the trap vector with interrupts disabled.
+void handle_exception(TrapFrame* frame)
+{
+    const size_t cause = frame->scause;
+    if (cause < EXCEPTION_CAUSE_COUNT) {
+        _record_trap(&THIS_HART_PTR(_statistics)->exceptions[cause],
+            frame->entry_cycle);
+        const ExceptionHandler handler =
+            __atomic_load_n(&_exception_handlers[cause], __ATOMIC_ACQUIRE);
+        if (handler != NULL && handler(cause, frame)) {
+            return;
+        }
+    }
+
+    panic("Unhandled exception %zu on hart %zu at %p with stval %p\n", cause,
+        get_hart_index(), (void*)frame->sepc, (void*)frame->stval);
+}
+
+bool set_interrupt_handler(size_t cause, InterruptHandler handler)
+{
+    if (cause >= INTERRUPT_CAUSE_COUNT) {
+        return false;
+    }
+    __atomic_store_n(&_interrupt_handlers[cause], handler, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool set_exception_handler(size_t cause, ExceptionHandler handler)
+{
+    if (cause >= EXCEPTION_CAUSE_COUNT) {
+        return false;
+    }
+    __atomic_store_n(&_exception_handlers[cause], handler, __ATOMIC_RELEASE);
+    return true;
+}
+
+void get_trap_statistics(size_t hart_index, bool is_interrupt, size_t cause,
+    TrapStatistics* statistics)
+{
+    assert(hart_index < get_hart_count());
+    assert(statistics != NULL);
+
+    const HartTrapStatistics* hart = HART_PTR(_statistics, hart_index);
+    if (is_interrupt) {
+        assert(cause < INTERRUPT_CAUSE_COUNT);
+        *statistics = hart->interrupts[cause];
+    }
+    else {
+        assert(cause < EXCEPTION_CAUSE_COUNT);
+        *statistics = hart->exceptions[cause];
+    }
+}
+
+static void _print_trap_statistics(bool is_interrupt, size_t cause)
+{
+    TrapStatistics total = {0};
+    for (size_t i = 0; i < get_hart_count(); ++i) {
+        TrapStatistics statistics;
+        get_trap_statistics(i, is_interrupt, cause, &statistics);
+        if (statistics.count == 0) {
+            continue;
+        }
+        if (total.count == 0 || statistics.min_cycles < total.min_cycles) {
+            total.min_cycles = statistics.min_cycles;
+        }
+        if (statistics.max_cycles > total.max_cycles) {
+            total.max_cycles = statistics.max_cycles;
+        }
+        total.total_cycles += statistics.total_cycles;
+        total.count += statistics.count;
+    }
+
+    if (total.count != 0) {
+        dprintf("%s %zu: %zu traps, %llu/%llu/%llu min/avg/max cycles\n",
+            is_interrupt ? "Interrupt" : "Exception", cause, total.count,
+            (unsigned long long)total.min_cycles,
+            (unsigned long long)(total.total_cycles / total.count),
+            (unsigned long long)total.max_cycles);
+    }
+}
+
+void print_trap_statistics(void)
+{
+    for (size_t cause = 0; cause < INTERRUPT_CAUSE_COUNT; ++cause) {
+        _print_trap_statistics(true, cause);
+    }
+    for (size_t cause = 0; cause < EXCEPTION_CAUSE_COUNT; ++cause) {
+        _print_trap_statistics(false, cause);
+    }
+}
+
+bool is_trap_vector_vectored(void)
+{
+    return _is_vectored;
+}
+
+static void _handle_software_interrupt(size_t cause, TrapFrame* frame)
+{
+    (void)cause;
+    (void)frame;
+    CLEAR_CSR(sip, CSR_SIP_SSIP);
+    handle_ipi();
+}
+
+static void _handle_external_interrupt(size_t cause, TrapFrame* frame)
+{
+    (void)cause;
+    (void)frame;
+    handle_external_interrupt();
+}
+
+void initialize_traps(void)
+{
+    // Vectored mode is optional.  The mode field is WARL, so it reads back
+    // as direct if vectored mode is not implemented.
+    WRITE_CSR(stvec, (uintptr_t)_trap_vector | CSR_STVEC_MODE_VECTORED);
+    if ((READ_CSR(stvec) & CSR_STVEC_MODE_MASK) == CSR_STVEC_MODE_VECTORED) {
+        _is_vectored = true;
+    }
+    else {
+        WRITE_CSR(stvec, (uintptr_t)_trap_entry | CSR_STVEC_MODE_DIRECT);
+    }
+
+    // External interrupts are routed by the interrupt controller, which masks
+    // them until a device registers a handler.
+    set_interrupt_handler(INTERRUPT_SUPERVISOR_EXTERNAL,
+        _handle_external_interrupt);
+    set_interrupt_handler(INTERRUPT_SUPERVISOR_SOFTWARE,
+        _handle_software_interrupt);
+    SET_CSR(sie, CSR_SIE_SEIE | CSR_SIE_SSIE);
+}
@@ -0,0 +1,130 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/arch/vector.h>
+
+#include <kernel/arch/csr.h>
+#include <kernel/arch/interrupt.h>
+#include <kernel/arch/isa.h>
+#include <kernel/config.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+// The chunk routines in vector.S, which expect interrupts to be disabled
+void _copy_vector_chunk(void* s1, const void* s2, size_t n);
+void _set_vector_chunk(void* s, int c, size_t n);
+int _compare_vector_chunk(const void* s1, const void* s2, size_t n);
+size_t _get_vector_string_length(const char* s, size_t n);
+
+static bool _is_enabled = false;
+static bool _is_detected = false;
+
+void initialize_vector(void)
+{
+    if (!_is_detected) {
+#ifdef RISCV_ISA_V
+        _is_enabled = true;
+#else
+        _is_enabled = is_isa_extension_supported("v");
+#endif
+        _is_detected = true;
+        dprintf("String routines use %s\n",
+            _is_enabled ? "the vector unit" : "scalar code");
+    }
+
+    // Vector instructions trap while the vector state is off.  Nothing saves
+    // or restores the state, so it never needs to leave the initial state.
+    if (_is_enabled) {
+        SET_CSR(sstatus, CSR_SSTATUS_VS_INITIAL);
+    }
+}
+
+bool is_vector_enabled(void)
+{
+    return _is_enabled;
+}
+
+static size_t _get_chunk_size(size_t n)
+{
+    return n < VECTOR_CHUNK_SIZE ? n : VECTOR_CHUNK_SIZE;
+}
+
+void copy_memory_with_vector(void* s1, const void* s2, size_t n)
+{
+    uint8_t* d = s1;
+    const uint8_t* s = s2;
+    while (n > 0) {
+        const size_t size = _get_chunk_size(n);
+        const InterruptState state = disable_interrupts();
+        _copy_vector_chunk(d, s, size);
+        restore_interrupts(state);
+        d += size;
+        s += size;
+        n -= size;
+    }
+}
+
+void set_memory_with_vector(void* s, int c, size_t n)
+{
+    uint8_t* p = s;
+    while (n > 0) {
+        const size_t size = _get_chunk_size(n);
+        const InterruptState state = disable_interrupts();
+        _set_vector_chunk(p, c, size);
+        restore_interrupts(state);
+        p += size;
+        n -= size;
+    }
+}
+
+int compare_memory_with_vector(const void* s1, const void* s2, size_t n)
+{
+    const uint8_t* p1 = s1;
+    const uint8_t* p2 = s2;
+    while (n > 0) {
+        const size_t size = _get_chunk_size(n);
+        const InterruptState state = disable_interrupts();
+        const int result = _compare_vector_chunk(p1, p2, size);
+        restore_interrupts(state);
+        if (result != 0) {
+            return result;
+        }
+        p1 += size;
+        p2 += size;
+        n -= size;
+    }
+    return 0;
+}
+
+size_t get_string_length_with_vector(const char* s)
+{
+    size_t length = 0;
+    for (;;) {
+        const InterruptState state = disable_interrupts();
+        const size_t size =
+            _get_vector_string_length(s + length, VECTOR_CHUNK_SIZE);
+        restore_interrupts(state);
+        length += size;
+        if (size != VECTOR_CHUNK_SIZE) {
+            return length;
+        }
+    }
+}
@@ -0,0 +1,351 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/arch/vm.h>
+
+#ifdef KERNEL_VM
+
+#include <kernel/arch/csr.h>
+#include <kernel/arch/interrupt.h>
+#include <kernel/arch/memory.h>
+#include <kernel/fdt.h>
+#include <kernel/hart.h>
+#include <kernel/panic.h>
+#include <kernel/pmm.h>
+#include <kernel/slab.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// The kernel page table maps the kernel image with base pages so that each
+// part gets its own permissions, and maps the rest of memory and the devices
+// with the largest pages that fit to keep TLB misses rare.  The entry code
+// runs on a boot page table of gigapages until the kernel page table exists.
+
+#define KERNEL_PTE_FLAGS (PTE_V | PTE_G | PTE_A | PTE_D)
+
+// Each hart has a page at the top of kernel space, above any memory or
+// device in the direct map, for short-lived mappings of its own.
+#define FIXMAP_BASE \
+    (KERNEL_SPACE_BASE + KERNEL_SPACE_SIZE - MAX_HARTS * PAGE_SIZE)
+
+extern char __text_start[];
+extern char __text_end[];
+extern char __rodata_start[];
+extern char __rodata_end[];
+extern char __data_start[];
+extern char __end[];
+
+static PageTable* _kernel_page_table = NULL;
+static PageTableEntry* _fixmap_entries[MAX_HARTS];  // Leaf of each slot
+static AddressSpace _kernel_address_space = {
+    .root = NULL,
+    .context = 0,
+    .hart_mask = 0,
+};
+
+static size_t _get_index(uintptr_t virt, unsigned int level)
+{
+    return (virt >> PAGE_LEVEL_BITS(level)) & (PAGE_TABLE_ENTRIES - 1);
+}
+
+static PageTableEntry _make_entry(PhysicalAddress addr, PageTableEntry flags)
+{
+    return ((addr >> PAGE_BITS) << PTE_PPN_SHIFT) | flags;
+}
+
+static PhysicalAddress _get_entry_address(PageTableEntry entry)
+{
+    return (entry >> PTE_PPN_SHIFT) << PAGE_BITS;
+}
+
+static bool _is_leaf(PageTableEntry entry)
+{
+    return (entry & (PTE_R | PTE_W | PTE_X)) != 0;
+}
+
+static PageTable* _allocate_page_table(void)
+{
+    const PhysicalAddress addr = allocate_physical_page();
+    if (addr == 0) {
+        return NULL;
+    }
+    PageTable* table = physical_to_virtual(addr);
+    memset(table, 0, sizeof(*table));
+    return table;
+}
+
+// Get the entry for virt at the given level, allocating the tables above it.
+// Return NULL if a larger leaf already covers virt.
+static PageTableEntry* _walk(PageTable* root, uintptr_t virt,
+    unsigned int level)
+{
+    PageTable* table = root;
+    for (unsigned int i = PAGE_TABLE_LEVELS - 1; i > level; --i) {
+        PageTableEntry* entry = &table->entries[_get_index(virt, i)];
+        if ((*entry & PTE_V) == 0) {
+            PageTable* next = _allocate_page_table();
+            if (next == NULL) {
+                return NULL;
+            }
+            *entry = _make_entry(virtual_to_physical(next), PTE_V);
+        }
+        else if (_is_leaf(*entry)) {
+            return NULL;
+        }
+        table = physical_to_virtual(_get_entry_address(*entry));
+    }
+    return &table->entries[_get_index(virt, level)];
+}
+
+// Get the largest page level for mapping from virt to phys with size bytes
+// remaining.
+static unsigned int _get_map_level(uintptr_t virt, PhysicalAddress phys,
+    size_t size)
+{
+    unsigned int level = PAGE_TABLE_LEVELS - 1;
+    while (level > 0
+        && (((virt | phys) & (PAGE_LEVEL_SIZE(level) - 1)) != 0
+            || size < PAGE_LEVEL_SIZE(level))) {
+        --level;
+    }
+    return level;
+}
+
+PageTable* get_kernel_page_table(void)
+{
+    return _kernel_page_table;
+}
+
+bool map_pages(PageTable* root, uintptr_t virt, PhysicalAddress phys,
+    size_t size, PageTableEntry flags)
+{
+    assert(root != NULL);
+    assert((virt & (PAGE_SIZE - 1)) == 0);
+    assert((phys & (PAGE_SIZE - 1)) == 0);
+    assert((size & (PAGE_SIZE - 1)) == 0);
+    assert((flags & (PTE_R | PTE_W | PTE_X)) != 0);
+
+    while (size != 0) {
+        const unsigned int level = _get_map_level(virt, phys, size);
+        PageTableEntry* entry = _walk(root, virt, level);
+        if (entry == NULL || (*entry & PTE_V) != 0) {
+            return false;
+        }
+        *entry = _make_entry(phys, flags | PTE_V | PTE_A | PTE_D);
+
+        virt += PAGE_LEVEL_SIZE(level);
+        phys += PAGE_LEVEL_SIZE(level);
+        size -= PAGE_LEVEL_SIZE(level);
+    }
+    return true;
+}
+
+static void _map_direct(PhysicalAddress start, PhysicalAddress end,
+    PageTableEntry flags)
+{
+    start = ROUND_PAGE_DOWN(start);
+    end = ROUND_PAGE_UP(end);
+    if (start >= end) {
+        return;
+    }
+    if (!map_pages(_kernel_page_table, (uintptr_t)physical_to_virtual(start),
+            start, end - start, KERNEL_PTE_FLAGS | flags)) {
+        panic("Unable to map [%p, %p) into the direct map\n",
+            (void*)start, (void*)end);
+    }
+}
+
+// Map the kernel image with the permissions of its segments and the rest of
+// the memory range [start, end) as data.
+static void _map_memory(PhysicalAddress start, PhysicalAddress end)
+{
+    const PhysicalAddress text_start = virtual_to_physical(__text_start);
+    const PhysicalAddress text_end = virtual_to_physical(__text_end);
+    const PhysicalAddress rodata_start = virtual_to_physical(__rodata_start);
+    const PhysicalAddress rodata_end = virtual_to_physical(__rodata_end);
+    const PhysicalAddress data_start = virtual_to_physical(__data_start);
+    const PhysicalAddress image_end = ROUND_PAGE_UP(virtual_to_physical(__end));
+
+    if (end <= text_start || start >= image_end) {
+        _map_direct(start, end, PTE_R | PTE_W);
+        return;
+    }
+    assert(start <= text_start && end >= image_end);
+    _map_direct(start, text_start, PTE_R | PTE_W);
+    _map_direct(text_start, text_end, PTE_R | PTE_X);
+    _map_direct(rodata_start, rodata_end, PTE_R);
+    _map_direct(data_start, image_end, PTE_R | PTE_W);
+    _map_direct(image_end, end, PTE_R | PTE_W);
+}
+
+// Map the registers of a device.  Devices get whole gigapages, which also
+// covers their neighbors, unless the gigapage is shared with memory.
+static void _map_device(PhysicalAddress base, size_t size)
+{
+    const size_t giga_size = PAGE_LEVEL_SIZE(PAGE_TABLE_LEVELS - 1);
+    const PhysicalAddress end = ROUND_PAGE_UP(base + size);
+    for (PhysicalAddress giga = base & ~(giga_size - 1); giga < end;
+            giga += giga_size) {
+        PageTableEntry* entry = &_kernel_page_table->entries[_get_index(
+            (uintptr_t)physical_to_virtual(giga), PAGE_TABLE_LEVELS - 1)];
+        if ((*entry & PTE_V) == 0) {
+            *entry = _make_entry(giga, KERNEL_PTE_FLAGS | PTE_R | PTE_W);
+            continue;
+        }
+        if (_is_leaf(*entry)) {
+            continue;
+        }
+
+        PhysicalAddress page = ROUND_PAGE_DOWN(base > giga ? base : giga);
+        const PhysicalAddress page_end =
+            end < giga + giga_size ? end : giga + giga_size;
+        for (; page < page_end; page += PAGE_SIZE) {
+            void* virt = physical_to_virtual(page);
+            PageTableEntry* leaf = _walk(_kernel_page_table, (uintptr_t)virt,
+                0);
+            if (leaf != NULL && (*leaf & PTE_V) == 0) {
+                *leaf = _make_entry(page, KERNEL_PTE_FLAGS | PTE_R | PTE_W);
+            }
+        }
+    }
+}
+
+void initialize_vm(void)
+{
+    _kernel_page_table = _allocate_page_table();
+    if (_kernel_page_table == NULL) {
+        panic("Unable to allocate the kernel page table\n");
+    }
+
+    const size_t memory_range_count = get_fdt_memory_range_count();
+    if (memory_range_count != 0) {
+        for (size_t i = 0; i < memory_range_count; ++i) {
+            const FdtRange* range = get_fdt_memory_range(i);
+            _map_memory(range->base, range->base + range->size);
+        }
+    }
+    else {
+        _map_memory(DRAM_BASE, DRAM_BASE + get_dram_size());
+    }
+
+    for (size_t i = 0; i < get_fdt_device_count(); ++i) {
+        const FdtDevice* device = get_fdt_device(i);
+        _map_device(device->base, device->size);
+    }
+    _map_device(UART0_BASE, UART0_SIZE);  // Debug output
+
+    // Build the tables down to the fixmap leaves now, so that using a slot
+    // only writes its leaf.
+    for (size_t i = 0; i < MAX_HARTS; ++i) {
+        _fixmap_entries[i] =
+            _walk(_kernel_page_table, FIXMAP_BASE + i * PAGE_SIZE, 0);
+        if (_fixmap_entries[i] == NULL || (*_fixmap_entries[i] & PTE_V) != 0) {
+            panic("Unable to reserve the fixmap\n");
+        }
+    }
+
+    _kernel_address_space.root = _kernel_page_table;
+    switch_to_kernel_page_table();
+    dprintf("Kernel page table at %p\n", (void*)_kernel_page_table);
+    initialize_asids();
+}
+
+void patch_kernel_text(uint32_t* addr, uint32_t instruction)
+{
+    assert((char*)addr >= __text_start && (char*)addr < __text_end);
+
+    // The text mapping stays read-only.  The store goes through a writable
+    // alias of the page in this hart's fixmap slot, which only this hart
+    // uses and which is unmapped again before interrupts are restored.
+    const InterruptState state = disable_interrupts();
+    const size_t index = get_hart_index();
+    const uintptr_t slot = FIXMAP_BASE + index * PAGE_SIZE;
+    const PhysicalAddress phys = virtual_to_physical(addr);
+    *_fixmap_entries[index] =
+        _make_entry(ROUND_PAGE_DOWN(phys), KERNEL_PTE_FLAGS | PTE_R | PTE_W);
+    __asm__ volatile("sfence.vma %0, zero" : : "r"(slot) : "memory");
+    __atomic_store_n((uint32_t*)(slot + (phys & ~PAGE_MASK)), instruction,
+        __ATOMIC_RELAXED);
+    *_fixmap_entries[index] = 0;
+    __asm__ volatile("sfence.vma %0, zero" : : "r"(slot) : "memory");
+    restore_interrupts(state);
+}
+
+AddressSpace* get_kernel_address_space(void)
+{
+    return &_kernel_address_space;
+}
+
+AddressSpace* create_address_space(void)
+{
+    AddressSpace* space = kmalloc(sizeof(*space));
+    if (space == NULL) {
+        return NULL;
+    }
+    space->root = _allocate_page_table();
+    if (space->root == NULL) {
+        kfree(space);
+        return NULL;
+    }
+    space->context = 0;
+    space->hart_mask = 0;
+
+    // Share the kernel half.  Its top-level entries do not change after
+    // initialize_vm, so they never need to be propagated.
+    for (size_t i = PAGE_TABLE_ENTRIES / 2; i < PAGE_TABLE_ENTRIES; ++i) {
+        space->root->entries[i] = _kernel_page_table->entries[i];
+    }
+    return space;
+}
+
+static void _free_page_table(PageTable* table, unsigned int level)
+{
+    for (size_t i = 0; level > 0 && i < PAGE_TABLE_ENTRIES; ++i) {
+        const PageTableEntry entry = table->entries[i];
+        if ((entry & PTE_V) != 0 && !_is_leaf(entry)) {
+            _free_page_table(physical_to_virtual(_get_entry_address(entry)),
+                level - 1);
+        }
+    }
+    free_physical_page(virtual_to_physical(table));
+}
+
+void destroy_address_space(AddressSpace* space)
+{
+    // The space must not be current on any hart.  Its ASID is not reused
+    // before the next rollover, which flushes every hart, so its translations
+    // need no flush here.
+    assert(space != NULL);
+    assert(space != &_kernel_address_space);
+
+    for (size_t i = 0; i < PAGE_TABLE_ENTRIES / 2; ++i) {
+        const PageTableEntry entry = space->root->entries[i];
+        if ((entry & PTE_V) != 0 && !_is_leaf(entry)) {
+            _free_page_table(physical_to_virtual(_get_entry_address(entry)),
+                PAGE_TABLE_LEVELS - 2);
+        }
+    }
+    free_physical_page(virtual_to_physical(space->root));
+    kfree(space);
+}
+
+#endif  // KERNEL_VM
@@ -0,0 +1,461 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/block.h>
+
+#include <kernel/arch/memory.h>
+#include <kernel/arch/timer.h>
+#include <kernel/block_cache.h>
+#include <kernel/hart.h>
+#include <kernel/pmm.h>
+#include <kernel/rwlock.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <kernel/tracepoint.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_BLOCK_DEVICES 8
+
+static const BlockDevice* _devices[MAX_BLOCK_DEVICES] = {NULL};
+static size_t _device_count = 0;
+// Guards registration.  Lookups only read, so they do not serialize.
+DEFINE_LOCK_CLASS(block_registry);
+static RwLock _lock = RWLOCK_CLASS_INITIALIZER(block_registry);
+
+DEFINE_TRACEPOINT(block_submit, "%s op %d sector %llu size %zu");
+DEFINE_TRACEPOINT(block_complete, "op %d sector %llu status %d");
+
+bool register_block_device(const BlockDevice* device)
+{
+    if (device == NULL) {
+        return false;
+    }
+
+    const InterruptState state = acquire_rwlock_write_irqsave(&_lock);
+    bool is_registered = _device_count < MAX_BLOCK_DEVICES;
+    for (size_t i = 0; i < _device_count; ++i) {
+        if (_devices[i] == device) {
+            is_registered = false;
+        }
+    }
+    if (is_registered) {
+        _devices[_device_count] = device;
+        ++_device_count;
+    }
+    release_rwlock_write_irqrestore(&_lock, state);
+    return is_registered;
+}
+
+bool deregister_block_device(const BlockDevice* device)
+{
+    if (device == NULL) {
+        return false;
+    }
+
+    // Nothing may stay cached for a device that goes away, and a device
+    // whose blocks are still in use cannot go away.
+    if (!invalidate_block_cache(device)) {
+        return false;
+    }
+    const InterruptState state = acquire_rwlock_write_irqsave(&_lock);
+    bool was_removed = false;
+    for (size_t i = 0; i < _device_count; ++i) {
+        if (_devices[i] == device) {
+            was_removed = true;
+        }
+        if (was_removed) {
+            _devices[i] = i + 1 < _device_count ? _devices[i + 1] : NULL;
+        }
+    }
+    if (was_removed) {
+        --_device_count;
+    }
+    release_rwlock_write_irqrestore(&_lock, state);
+    return was_removed;
+}
+
+size_t get_block_device_count(void)
+{
+    return _device_count;
+}
+
+const BlockDevice* get_block_device(size_t index)
+{
+    const InterruptState state = acquire_rwlock_read_irqsave(&_lock);
+    const BlockDevice* device = index < _device_count ? _devices[index]
+        : NULL;
+    release_rwlock_read_irqrestore(&_lock, state);
+    return device;
+}
+
+const BlockDevice* find_block_device(const char* name)
+{
+    const InterruptState state = acquire_rwlock_read_irqsave(&_lock);
+    const BlockDevice* device = NULL;
+    for (size_t i = 0; i < _device_count && device == NULL; ++i) {
+        if (strcmp(_devices[i]->name, name) == 0) {
+            device = _devices[i];
+        }
+    }
+    release_rwlock_read_irqrestore(&_lock, state);
+    return device;
+}
+
+static bool _is_request_valid(const BlockDevice* device,
+    const BlockRequest* request)
+{
+    if (request->operation == BLOCK_FLUSH) {
+        return true;
+    }
+    if (request->operation == BLOCK_WRITE && device->is_read_only) {
+        return false;
+    }
+    if (request->size == 0 || request->size % device->block_size != 0
+            || request->size > device->max_transfer_size
+            || request->sector * BLOCK_SECTOR_SIZE % device->block_size
+                != 0) {
+        return false;
+    }
+    const uint64_t sectors = request->size / BLOCK_SECTOR_SIZE;
+    return request->sector <= device->sector_count
+        && sectors <= device->sector_count - request->sector;
+}
+
+size_t submit_block_requests(const BlockDevice* device,
+    BlockRequest* const* requests, size_t count)
+{
+    size_t taken = 0;
+    while (taken < count) {
+        // Pass each run of valid requests to the driver as one batch.
+        size_t valid = 0;
+        while (taken + valid < count
+                && _is_request_valid(device, requests[taken + valid])) {
+            BlockRequest* request = requests[taken + valid];
+            trace(block_submit, device->name, (int)request->operation,
+                (unsigned long long)request->sector, request->size);
+            request->status = BLOCK_PENDING;
+            ++valid;
+        }
+        if (valid == 0) {
+            complete_block_request(requests[taken], BLOCK_INVALID);
+            ++taken;
+            continue;
+        }
+
+        const size_t submitted = device->submit(device, &requests[taken],
+            valid);
+        taken += submitted;
+        if (submitted < valid) {
+            break;
+        }
+    }
+    return taken;
+}
+
+void submit_all_block_requests(const BlockDevice* device,
+    BlockRequest* const* requests, size_t count)
+{
+    size_t taken = submit_block_requests(device, requests, count);
+    while (taken < count) {
+        // Drivers reap completed requests when they run out of room, so
+        // retrying makes progress even when completions are polled.
+        yield_thread();
+        taken += submit_block_requests(device, &requests[taken],
+            count - taken);
+    }
+}
+
+void complete_block_request(BlockRequest* request, BlockStatus status)
+{
+    trace(block_complete, (int)request->operation,
+        (unsigned long long)request->sector, (int)status);
+    // Without a callback, the submitter may reuse the request as soon as it
+    // sees the status, so the callback is read first.
+    const BlockCompletion complete = request->complete;
+    __atomic_store_n(&request->status, status, __ATOMIC_RELEASE);
+    if (complete != NULL) {
+        complete(request);
+    }
+}
+
+typedef struct BlockRequestBatch
+{
+    BlockRequest* const* requests;
+    size_t count;
+} BlockRequestBatch;
+
+static bool _is_batch_complete(void* data)
+{
+    const BlockRequestBatch* batch = data;
+    for (size_t i = 0; i < batch->count; ++i) {
+        if (__atomic_load_n(&batch->requests[i]->status, __ATOMIC_ACQUIRE)
+                == BLOCK_PENDING) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void wait_for_block_requests(const BlockDevice* device,
+    BlockRequest* const* requests, size_t count)
+{
+    BlockRequestBatch batch = {.requests = requests, .count = count};
+    device->wait(device, _is_batch_complete, &batch);
+}
+
+static BlockStatus _transfer(const BlockDevice* device,
+    BlockOperation operation, uint64_t sector, void* data, size_t size)
+{
+    BlockRequest request = {
+        .operation = operation,
+        .sector = sector,
+        .data = data,
+        .size = size,
+    };
+    BlockRequest* const requests[] = {&request};
+    submit_all_block_requests(device, requests, 1);
+    wait_for_block_requests(device, requests, 1);
+    return request.status;
+}
+
+BlockStatus read_block_device(const BlockDevice* device, uint64_t sector,
+    void* data, size_t size)
+{
+    return _transfer(device, BLOCK_READ, sector, data, size);
+}
+
+BlockStatus write_block_device(const BlockDevice* device, uint64_t sector,
+    const void* data, size_t size)
+{
+    return _transfer(device, BLOCK_WRITE, sector, (void*)data, size);
+}
+
+BlockStatus flush_block_device(const BlockDevice* device)
+{
+    return _transfer(device, BLOCK_FLUSH, 0, NULL, 0);
+}
+
+bool set_block_device_polling(const BlockDevice* device, bool is_polling)
+{
+    return device->set_polling != NULL
+        && device->set_polling(device, is_polling);
+}
+
+// Each benchmark thread keeps its requests in flight as one batch and waits
+// for the whole batch before submitting the next.  Workers are static so
+// that a completion may still be waking one after it finished waiting.
+typedef struct BlockBenchmarkWorker
+{
+    const BlockDevice* device;
+    uint64_t deadline;
+    uint64_t random;
+    size_t completed;  // In the current batch
+    size_t operations;
+    size_t errors;
+    PhysicalAddress buffers;
+    BlockRequest requests[BLOCK_BENCHMARK_QUEUE_DEPTH];
+    BlockRequest* batch[BLOCK_BENCHMARK_QUEUE_DEPTH];
+} BlockBenchmarkWorker;
+
+static BlockBenchmarkWorker _workers[MAX_HARTS];
+
+#define BLOCK_BENCHMARK_PAGES \
+    ((BLOCK_BENCHMARK_REQUEST_SIZE + PAGE_SIZE - 1) / PAGE_SIZE)
+
+// xorshift64
+static uint64_t _get_random(BlockBenchmarkWorker* worker)
+{
+    uint64_t x = worker->random;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    worker->random = x;
+    return x;
+}
+
+static void _count_benchmark_completion(BlockRequest* request)
+{
+    BlockBenchmarkWorker* worker = request->context;
+    __atomic_add_fetch(&worker->completed, 1, __ATOMIC_RELEASE);
+}
+
+static bool _is_benchmark_batch_complete(void* data)
+{
+    BlockBenchmarkWorker* worker = data;
+    return __atomic_load_n(&worker->completed, __ATOMIC_ACQUIRE)
+        == BLOCK_BENCHMARK_QUEUE_DEPTH;
+}
+
+static void _run_benchmark_worker(void* argument)
+{
+    BlockBenchmarkWorker* worker = argument;
+    const BlockDevice* device = worker->device;
+    const uint64_t sectors = BLOCK_BENCHMARK_REQUEST_SIZE / BLOCK_SECTOR_SIZE;
+    const uint64_t slots = device->sector_count / sectors;
+    uint8_t* buffers = physical_to_virtual(worker->buffers);
+
+    while (get_time() < worker->deadline) {
+        for (size_t i = 0; i < BLOCK_BENCHMARK_QUEUE_DEPTH; ++i) {
+            worker->requests[i] = (BlockRequest){
+                .operation = BLOCK_READ,
+                .sector = _get_random(worker) % slots * sectors,
+                .data = buffers + i * BLOCK_BENCHMARK_PAGES * PAGE_SIZE,
+                .size = BLOCK_BENCHMARK_REQUEST_SIZE,
+                .complete = _count_benchmark_completion,
+                .context = worker,
+            };
+            worker->batch[i] = &worker->requests[i];
+        }
+        worker->completed = 0;
+        submit_all_block_requests(device, worker->batch,
+            BLOCK_BENCHMARK_QUEUE_DEPTH);
+        device->wait(device, _is_benchmark_batch_complete, worker);
+
+        for (size_t i = 0; i < BLOCK_BENCHMARK_QUEUE_DEPTH; ++i) {
+            if (worker->requests[i].status != BLOCK_OK) {
+                ++worker->errors;
+            }
+        }
+        worker->operations += BLOCK_BENCHMARK_QUEUE_DEPTH;
+    }
+}
+
+// Cached reads are synchronous, so each thread has one in flight.
+static void _run_cached_benchmark_worker(void* argument)
+{
+    BlockBenchmarkWorker* worker = argument;
+    const BlockDevice* device = worker->device;
+    const uint64_t slots = device->sector_count * BLOCK_SECTOR_SIZE
+        / BLOCK_BENCHMARK_REQUEST_SIZE;
+    uint8_t* buffer = physical_to_virtual(worker->buffers);
+
+    while (get_time() < worker->deadline) {
+        const uint64_t offset =
+            _get_random(worker) % slots * BLOCK_BENCHMARK_REQUEST_SIZE;
+        if (!read_block_cache(device, offset, buffer,
+                BLOCK_BENCHMARK_REQUEST_SIZE)) {
+            ++worker->errors;
+        }
+        ++worker->operations;
+    }
+}
+
+static void _run_benchmark(const BlockDevice* device, size_t thread_count,
+    ThreadEntry entry, const char* mode)
+{
+    Thread* threads[MAX_HARTS];
+    size_t started = 0;
+    const uint64_t start_time = get_time();
+    const uint64_t deadline = start_time
+        + nanoseconds_to_ticks(BLOCK_BENCHMARK_DURATION_NS);
+    for (size_t i = 0; i < thread_count; ++i) {
+        BlockBenchmarkWorker* worker = &_workers[i];
+        const PhysicalAddress buffers = allocate_contiguous_physical_pages(
+            BLOCK_BENCHMARK_QUEUE_DEPTH * BLOCK_BENCHMARK_PAGES);
+        if (buffers == 0) {
+            break;
+        }
+        *worker = (BlockBenchmarkWorker){
+            .device = device,
+            .deadline = deadline,
+            .random = UINT64_C(0x9E3779B97F4A7C15) * (i + 1),
+            .buffers = buffers,
+        };
+        threads[i] = create_thread("block-benchmark", entry, worker);
+        if (threads[i] == NULL) {
+            free_contiguous_physical_pages(buffers,
+                BLOCK_BENCHMARK_QUEUE_DEPTH * BLOCK_BENCHMARK_PAGES);
+            break;
+        }
+        ++started;
+    }
+
+    size_t operations = 0;
+    size_t errors = 0;
+    for (size_t i = 0; i < started; ++i) {
+        join_thread(threads[i]);
+        operations += _workers[i].operations;
+        errors += _workers[i].errors;
+        free_contiguous_physical_pages(_workers[i].buffers,
+            BLOCK_BENCHMARK_QUEUE_DEPTH * BLOCK_BENCHMARK_PAGES);
+    }
+    const uint64_t nanoseconds = ticks_to_nanoseconds(get_time()
+        - start_time);
+    if (started != thread_count) {
+        dprintf("Block benchmark started %zu of %zu threads\n", started,
+            thread_count);
+    }
+    dprintf("%s: %zu threads, %s: %llu IOPS, %zu errors\n", device->name,
+        started, mode, nanoseconds != 0 ? (unsigned long long)operations
+            * NANOSECONDS_PER_SECOND / nanoseconds : 0ull, errors);
+}
+
+// Run the benchmark for 1, 2, 4, ... threads, up to one per hart.
+static void _run_benchmarks(const BlockDevice* device, ThreadEntry entry,
+    const char* mode)
+{
+    const size_t hart_count = get_hart_count();
+    for (size_t count = 1; ; count *= 2) {
+        if (count > hart_count) {
+            count = hart_count;
+        }
+        _run_benchmark(device, count, entry, mode);
+        if (count == hart_count) {
+            break;
+        }
+    }
+}
+
+void run_block_benchmark(const BlockDevice* device)
+{
+    if (device == NULL) {
+        dprintf("No block device to benchmark\n");
+        return;
+    }
+    const uint64_t sectors = BLOCK_BENCHMARK_REQUEST_SIZE / BLOCK_SECTOR_SIZE;
+    if (device->sector_count < sectors
+            || BLOCK_BENCHMARK_REQUEST_SIZE % device->block_size != 0
+            || BLOCK_BENCHMARK_REQUEST_SIZE > device->max_transfer_size) {
+        dprintf("%s cannot serve %u-byte benchmark requests\n", device->name,
+            BLOCK_BENCHMARK_REQUEST_SIZE);
+        return;
+    }
+
+    dprintf("Benchmarking %u-byte random reads from %s at queue depth %u "
+        "per thread\n", BLOCK_BENCHMARK_REQUEST_SIZE, device->name,
+        BLOCK_BENCHMARK_QUEUE_DEPTH);
+    for (int polling = 0; polling < 2; ++polling) {
+        if (polling && !set_block_device_polling(device, true)) {
+            break;
+        }
+        _run_benchmarks(device, _run_benchmark_worker,
+            polling ? "polled" : "interrupts");
+        if (polling) {
+            set_block_device_polling(device, false);
+        }
+    }
+
+    // Repeat the reads through the block cache, whose hit rate depends on
+    // how much of the device fits in it.
+    _run_benchmarks(device, _run_cached_benchmark_worker, "cached");
+    print_block_cache_statistics();
+}
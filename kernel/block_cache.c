@@ -0,0 +1,923 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/block_cache.h>
+
+#include <kernel/bitops.h>
+#include <kernel/mcs_lock.h>
+#include <kernel/pmm.h>
+#include <kernel/slab.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <kernel/tracepoint.h>
+#include <kernel/wait_queue.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_BLOCK_CACHE_STREAMS 8
+
+// Devices flushed together at the end of a write-back
+#define MAX_BLOCK_CACHE_FLUSHES 8
+
+// Detects sequential reads of one device
+typedef struct BlockCacheStream
+{
+    const BlockDevice* device;
+    uint64_t next_block;  // The block that would continue the sequence
+    uint64_t readahead_end;  // The first block not yet read ahead
+    size_t window;
+} BlockCacheStream;
+
+static BlockCacheEntry* _entries = NULL;
+static size_t _entry_count = 0;
+static BlockCacheEntry** _buckets = NULL;
+static unsigned int _bucket_bits = 0;
+static size_t _capacity = 0;
+static size_t _fifo_capacity = 0;
+static size_t _ghost_capacity = 0;
+static size_t _page_count = 0;  // Taken from the PMM
+static size_t _fifo_count = 0;
+static size_t _main_count = 0;
+static size_t _ghost_count = 0;
+static List _free;  // Entries with pages first
+static List _fifo;  // Oldest first
+static List _main;  // Starting at the CLOCK hand
+static List _ghosts;  // Oldest first
+static List _dirty;  // In the order the blocks were dirtied
+static BlockCacheStream _streams[MAX_BLOCK_CACHE_STREAMS];
+static size_t _next_stream = 0;
+static BlockCacheStatistics _statistics;
+
+// Guards everything above and the entries, except for their data.  Hits
+// only look up, pin, and set a flag, so the lock is held briefly, but every
+// hart takes it for every block, so it is queued to stay fair under load.
+DEFINE_LOCK_CLASS(block_cache);
+static McsLock _lock = MCS_LOCK_CLASS_INITIALIZER(block_cache);
+
+// Woken whenever an entry finishes I/O or write-back ends
+static WaitQueue _io_waiters = WAIT_QUEUE_INITIALIZER(_io_waiters);
+static bool _is_writing_back = false;
+
+DEFINE_TRACEPOINT(block_cache_miss, "%s block %llu");
+DEFINE_TRACEPOINT(block_cache_write_back, "%zu blocks");
+
+static unsigned int _get_flags(const BlockCacheEntry* entry)
+{
+    return __atomic_load_n(&entry->flags, __ATOMIC_ACQUIRE);
+}
+
+static void _set_flags(BlockCacheEntry* entry, unsigned int flags)
+{
+    __atomic_fetch_or(&entry->flags, flags, __ATOMIC_RELEASE);
+}
+
+static void _clear_flags(BlockCacheEntry* entry, unsigned int flags)
+{
+    __atomic_fetch_and(&entry->flags, ~flags, __ATOMIC_RELEASE);
+}
+
+static bool _is_cacheable(const BlockDevice* device)
+{
+    return _entries != NULL
+        && BLOCK_CACHE_BLOCK_SIZE % device->block_size == 0
+        && device->max_transfer_size >= BLOCK_CACHE_BLOCK_SIZE;
+}
+
+static uint64_t _get_block_count(const BlockDevice* device)
+{
+    return device->sector_count / BLOCK_CACHE_BLOCK_SECTORS;
+}
+
+// The helpers below expect the cache lock to be held.
+
+static size_t _hash(const BlockDevice* device, uint64_t block)
+{
+    const uint64_t key = ((uint64_t)(uintptr_t)device >> 4)
+        ^ (block * UINT64_C(0x9E3779B97F4A7C15));
+    return (size_t)((key * UINT64_C(0x9E3779B97F4A7C15))
+        >> (64 - _bucket_bits));
+}
+
+static BlockCacheEntry* _find_entry(const BlockDevice* device,
+    uint64_t block)
+{
+    BlockCacheEntry* entry = _buckets[_hash(device, block)];
+    while (entry != NULL
+            && (entry->device != device || entry->block != block)) {
+        entry = entry->next_in_bucket;
+    }
+    return entry;
+}
+
+static void _hash_entry(BlockCacheEntry* entry)
+{
+    BlockCacheEntry** bucket = &_buckets[_hash(entry->device, entry->block)];
+    entry->next_in_bucket = *bucket;
+    *bucket = entry;
+}
+
+static void _unhash_entry(BlockCacheEntry* entry)
+{
+    BlockCacheEntry** link = &_buckets[_hash(entry->device, entry->block)];
+    while (*link != entry) {
+        link = &(*link)->next_in_bucket;
+    }
+    *link = entry->next_in_bucket;
+    entry->next_in_bucket = NULL;
+}
+
+static void _unlink_entry(BlockCacheEntry* entry)
+{
+    remove_list_node(&entry->node);
+    switch (entry->queue) {
+        case BLOCK_CACHE_FIFO:
+            --_fifo_count;
+            break;
+        case BLOCK_CACHE_MAIN:
+            --_main_count;
+            break;
+        case BLOCK_CACHE_GHOST:
+            --_ghost_count;
+            break;
+        case BLOCK_CACHE_FREE:
+            break;
+    }
+}
+
+static void _free_entry(BlockCacheEntry* entry)
+{
+    entry->queue = BLOCK_CACHE_FREE;
+    entry->device = NULL;
+    entry->flags = 0;
+    if (entry->data != NULL) {
+        push_list_front(&_free, &entry->node);
+    }
+    else {
+        push_list_back(&_free, &entry->node);
+    }
+}
+
+// Forget a cached block or ghost that nobody uses, keeping its page.
+static void _discard_entry(BlockCacheEntry* entry)
+{
+    _unlink_entry(entry);
+    _unhash_entry(entry);
+    _free_entry(entry);
+}
+
+static void _push_ghost(BlockCacheEntry* entry)
+{
+    entry->queue = BLOCK_CACHE_GHOST;
+    entry->flags = 0;
+    push_list_back(&_ghosts, &entry->node);
+    ++_ghost_count;
+    if (_ghost_count > _ghost_capacity) {
+        _discard_entry(LIST_ENTRY(_ghosts.next, BlockCacheEntry, node));
+    }
+}
+
+static bool _is_evictable(const BlockCacheEntry* entry)
+{
+    return entry->pins == 0 && (entry->flags & (BLOCK_CACHE_DIRTY
+        | BLOCK_CACHE_LOADING | BLOCK_CACHE_WRITING)) == 0;
+}
+
+// Take the page of the oldest evictable block in the FIFO and remember the
+// block as a ghost.
+static uint8_t* _evict_from_fifo(void)
+{
+    LIST_FOR_EACH(node, &_fifo) {
+        BlockCacheEntry* entry = LIST_ENTRY(node, BlockCacheEntry, node);
+        if (_is_evictable(entry)) {
+            uint8_t* data = entry->data;
+            entry->data = NULL;
+            _unlink_entry(entry);
+            _push_ghost(entry);
+            ++_statistics.evictions;
+            return data;
+        }
+    }
+    return NULL;
+}
+
+// Sweep the CLOCK hand over the main queue, giving referenced blocks another
+// round, and take the page of the first unreferenced evictable block.
+static uint8_t* _evict_from_main(void)
+{
+    for (size_t i = 2 * _main_count; i != 0; --i) {
+        ListNode* node = _main.next;
+        BlockCacheEntry* entry = LIST_ENTRY(node, BlockCacheEntry, node);
+        if ((entry->flags & BLOCK_CACHE_REFERENCED) != 0
+                || !_is_evictable(entry)) {
+            _clear_flags(entry, BLOCK_CACHE_REFERENCED);
+            remove_list_node(node);
+            push_list_back(&_main, node);
+            continue;
+        }
+
+        uint8_t* data = entry->data;
+        entry->data = NULL;
+        _discard_entry(entry);
+        ++_statistics.evictions;
+        return data;
+    }
+    return NULL;
+}
+
+// 2Q evicts from the FIFO while it holds more than its share.
+static uint8_t* _reclaim_page(void)
+{
+    uint8_t* data;
+    if (_fifo_count > _fifo_capacity || _main_count == 0) {
+        data = _evict_from_fifo();
+        if (data == NULL) {
+            data = _evict_from_main();
+        }
+    }
+    else {
+        data = _evict_from_main();
+        if (data == NULL) {
+            data = _evict_from_fifo();
+        }
+    }
+    return data;
+}
+
+// Take a free entry with a page, growing the cache up to its capacity
+// before evicting.  Returns NULL if every block is busy or dirty.
+static BlockCacheEntry* _take_entry(void)
+{
+    ListNode* node = pop_list_front(&_free);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    BlockCacheEntry* entry = LIST_ENTRY(node, BlockCacheEntry, node);
+    if (entry->data == NULL && _page_count < _capacity) {
+        const PhysicalAddress page = allocate_physical_page();
+        if (page != 0) {
+            entry->data = physical_to_virtual(page);
+            ++_page_count;
+        }
+    }
+    if (entry->data == NULL) {
+        entry->data = _reclaim_page();
+    }
+    if (entry->data == NULL) {
+        push_list_back(&_free, node);
+        return NULL;
+    }
+    return entry;
+}
+
+// Cache a block that is about to be read, in the main queue if its ghost is
+// given and in the FIFO otherwise.
+static BlockCacheEntry* _add_block(const BlockDevice* device, uint64_t block,
+    BlockCacheEntry* ghost)
+{
+    BlockCacheEntry* entry;
+    if (ghost != NULL) {
+        // Unlinked first so that reclaiming cannot drop it.
+        _unlink_entry(ghost);
+        BlockCacheEntry* donor = _take_entry();
+        if (donor == NULL) {
+            _push_ghost(ghost);
+            return NULL;
+        }
+        ghost->data = donor->data;
+        donor->data = NULL;
+        _free_entry(donor);
+        entry = ghost;
+        entry->queue = BLOCK_CACHE_MAIN;
+        push_list_back(&_main, &entry->node);
+        ++_main_count;
+        ++_statistics.ghost_hits;
+    }
+    else {
+        entry = _take_entry();
+        if (entry == NULL) {
+            return NULL;
+        }
+        entry->device = device;
+        entry->block = block;
+        _hash_entry(entry);
+        entry->queue = BLOCK_CACHE_FIFO;
+        push_list_back(&_fifo, &entry->node);
+        ++_fifo_count;
+    }
+    entry->pins = 0;
+    entry->flags = BLOCK_CACHE_LOADING;
+    return entry;
+}
+
+static void _complete_read(BlockRequest* request)
+{
+    BlockCacheEntry* entry = request->context;
+    McsNode node;
+    const InterruptState state = acquire_mcs_lock_irqsave(&_lock, &node);
+    _set_flags(entry, request->status == BLOCK_OK ? BLOCK_CACHE_VALID
+        : BLOCK_CACHE_ERROR);
+    _clear_flags(entry, BLOCK_CACHE_LOADING);
+    // Nobody waits for a failed readahead.
+    if ((entry->flags & BLOCK_CACHE_ERROR) != 0 && entry->pins == 0) {
+        _discard_entry(entry);
+    }
+    release_mcs_lock_irqrestore(&_lock, &node, state);
+    wake_all(&_io_waiters);
+}
+
+static void _prepare_read(BlockCacheEntry* entry)
+{
+    entry->request = (BlockRequest){
+        .operation = BLOCK_READ,
+        .sector = entry->block * BLOCK_CACHE_BLOCK_SECTORS,
+        .data = entry->data,
+        .size = BLOCK_CACHE_BLOCK_SIZE,
+        .complete = _complete_read,
+        .context = entry,
+    };
+}
+
+static BlockCacheStream* _get_stream(const BlockDevice* device)
+{
+    for (size_t i = 0; i < MAX_BLOCK_CACHE_STREAMS; ++i) {
+        if (_streams[i].device == device) {
+            return &_streams[i];
+        }
+    }
+    BlockCacheStream* stream =
+        &_streams[_next_stream++ % MAX_BLOCK_CACHE_STREAMS];
+    *stream = (BlockCacheStream){
+        .device = device,
+        .next_block = UINT64_MAX,
+        .window = BLOCK_CACHE_READAHEAD_MIN,
+    };
+    return stream;
+}
+
+// Follow an access to the block and, if it continues a sequence that is
+// running out of blocks read ahead, cache the next blocks of the window.
+// Returns the number of read requests added.
+static size_t _read_ahead(const BlockDevice* device, uint64_t block,
+    BlockRequest** requests)
+{
+    BlockCacheStream* stream = _get_stream(device);
+    const bool is_sequential = block == stream->next_block;
+    stream->next_block = block + 1;
+    if (!is_sequential) {
+        stream->window = BLOCK_CACHE_READAHEAD_MIN;
+        stream->readahead_end = block + 1;
+        return 0;
+    }
+    if (stream->readahead_end < block + 1) {
+        stream->readahead_end = block + 1;
+    }
+    if (stream->readahead_end - (block + 1) >= stream->window / 2) {
+        return 0;
+    }
+
+    uint64_t end = block + 1 + stream->window;
+    if (end > _get_block_count(device)) {
+        end = _get_block_count(device);
+    }
+    uint64_t next = stream->readahead_end;
+    stream->readahead_end = end > next ? end : next;
+    stream->window *= 2;
+    if (stream->window > BLOCK_CACHE_READAHEAD_MAX) {
+        stream->window = BLOCK_CACHE_READAHEAD_MAX;
+    }
+
+    size_t count = 0;
+    for (; next < end; ++next) {
+        BlockCacheEntry* entry = _find_entry(device, next);
+        if (entry != NULL && entry->queue != BLOCK_CACHE_GHOST) {
+            continue;
+        }
+        entry = _add_block(device, next, entry);
+        if (entry == NULL) {
+            break;
+        }
+        _set_flags(entry, BLOCK_CACHE_READAHEAD);
+        _prepare_read(entry);
+        requests[count] = &entry->request;
+        ++count;
+    }
+    _statistics.readaheads += count;
+    return count;
+}
+
+// Report whether any cached block is unpinned, and so can become evictable
+// once its I/O finishes and it is written back.
+static bool _has_unpinned_block(void)
+{
+    for (size_t i = 0; i < _entry_count; ++i) {
+        const BlockCacheEntry* entry = &_entries[i];
+        if ((entry->queue == BLOCK_CACHE_FIFO
+                || entry->queue == BLOCK_CACHE_MAIN) && entry->pins == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool _is_entry_loaded(void* data)
+{
+    return (_get_flags(data) & BLOCK_CACHE_LOADING) == 0;
+}
+
+BlockCacheEntry* read_cached_block(const BlockDevice* device, uint64_t block)
+{
+    if (!_is_cacheable(device) || block >= _get_block_count(device)) {
+        return NULL;
+    }
+
+    BlockRequest* requests[1 + BLOCK_CACHE_READAHEAD_MAX];
+    size_t count = 0;
+    BlockCacheEntry* entry;
+    for (;;) {
+        McsNode node;
+        const InterruptState state = acquire_mcs_lock_irqsave(&_lock, &node);
+        entry = _find_entry(device, block);
+        if (entry != NULL && entry->queue != BLOCK_CACHE_GHOST) {
+            ++entry->pins;
+            ++_statistics.hits;
+            if ((entry->flags & BLOCK_CACHE_READAHEAD) != 0) {
+                _clear_flags(entry, BLOCK_CACHE_READAHEAD);
+                ++_statistics.readahead_hits;
+            }
+            _set_flags(entry, BLOCK_CACHE_REFERENCED);
+        }
+        else {
+            entry = _add_block(device, block, entry);
+            if (entry == NULL) {
+                // Every block is busy or dirty.  Write-back makes unpinned
+                // blocks clean, but cannot help if every block is pinned or
+                // the writes fail.
+                const bool has_unpinned = _has_unpinned_block();
+                release_mcs_lock_irqrestore(&_lock, &node, state);
+                if (has_unpinned && write_back_block_cache(NULL)) {
+                    yield_thread();
+                    continue;
+                }
+                const InterruptState count_state =
+                    acquire_mcs_lock_irqsave(&_lock, &node);
+                ++_statistics.exhausted;
+                release_mcs_lock_irqrestore(&_lock, &node, count_state);
+                return NULL;
+            }
+            trace(block_cache_miss, device->name, (unsigned long long)block);
+            entry->pins = 1;
+            ++_statistics.misses;
+            _prepare_read(entry);
+            requests[count] = &entry->request;
+            ++count;
+        }
+        count += _read_ahead(device, block, &requests[count]);
+        release_mcs_lock_irqrestore(&_lock, &node, state);
+        break;
+    }
+
+    // The block and its readahead go to the device in one batch.
+    if (count != 0) {
+        submit_all_block_requests(device, requests, count);
+    }
+    if ((_get_flags(entry) & BLOCK_CACHE_LOADING) != 0) {
+        wait_on_queue(&_io_waiters, _is_entry_loaded, entry);
+    }
+    if ((_get_flags(entry) & BLOCK_CACHE_ERROR) != 0) {
+        release_cached_block(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+void mark_cached_block_dirty(BlockCacheEntry* entry)
+{
+    McsNode node;
+    const InterruptState state = acquire_mcs_lock_irqsave(&_lock, &node);
+    if ((entry->flags & BLOCK_CACHE_DIRTY) == 0) {
+        _set_flags(entry, BLOCK_CACHE_DIRTY);
+        push_list_back(&_dirty, &entry->dirty_node);
+        ++_statistics.dirty;
+    }
+    release_mcs_lock_irqrestore(&_lock, &node, state);
+}
+
+void release_cached_block(BlockCacheEntry* entry)
+{
+    McsNode node;
+    const InterruptState state = acquire_mcs_lock_irqsave(&_lock, &node);
+    --entry->pins;
+    if (entry->pins == 0 && (entry->flags & BLOCK_CACHE_ERROR) != 0) {
+        _discard_entry(entry);
+    }
+    release_mcs_lock_irqrestore(&_lock, &node, state);
+}
+
+bool read_block_cache(const BlockDevice* device, uint64_t offset, void* data,
+    size_t size)
+{
+    uint8_t* bytes = data;
+    while (size != 0) {
+        const size_t within = offset % BLOCK_CACHE_BLOCK_SIZE;
+        size_t length = BLOCK_CACHE_BLOCK_SIZE - within;
+        if (length > size) {
+            length = size;
+        }
+        BlockCacheEntry* entry =
+            read_cached_block(device, offset / BLOCK_CACHE_BLOCK_SIZE);
+        if (entry == NULL) {
+            return false;
+        }
+        memcpy(bytes, entry->data + within, length);
+        release_cached_block(entry);
+        bytes += length;
+        offset += length;
+        size -= length;
+    }
+    return true;
+}
+
+bool write_block_cache(const BlockDevice* device, uint64_t offset,
+    const void* data, size_t size)
+{
+    if (device->is_read_only) {
+        return false;
+    }
+
+    const uint8_t* bytes = data;
+    while (size != 0) {
+        const size_t within = offset % BLOCK_CACHE_BLOCK_SIZE;
+        size_t length = BLOCK_CACHE_BLOCK_SIZE - within;
+        if (length > size) {
+            length = size;
+        }
+        BlockCacheEntry* entry =
+            read_cached_block(device, offset / BLOCK_CACHE_BLOCK_SIZE);
+        if (entry == NULL) {
+            return false;
+        }
+        memcpy(entry->data + within, bytes, length);
+        mark_cached_block_dirty(entry);
+        release_cached_block(entry);
+        bytes += length;
+        offset += length;
+        size -= length;
+    }
+    return true;
+}
+
+static void _complete_write(BlockRequest* request)
+{
+    BlockCacheEntry* entry = request->context;
+    McsNode node;
+    const InterruptState state = acquire_mcs_lock_irqsave(&_lock, &node);
+    ++_statistics.writebacks;
+    if (request->status != BLOCK_OK) {
+        // Keep the data until a later write-back succeeds.
+        ++_statistics.write_errors;
+        if ((entry->flags & BLOCK_CACHE_DIRTY) == 0) {
+            _set_flags(entry, BLOCK_CACHE_DIRTY);
+            push_list_back(&_dirty, &entry->dirty_node);
+            ++_statistics.dirty;
+        }
+    }
+    _clear_flags(entry, BLOCK_CACHE_WRITING);
+    release_mcs_lock_irqrestore(&_lock, &node, state);
+    wake_all(&_io_waiters);
+}
+
+typedef struct BlockCacheBatch
+{
+    BlockCacheEntry* entries[BLOCK_CACHE_WRITEBACK_BATCH];
+    BlockRequest* requests[BLOCK_CACHE_WRITEBACK_BATCH];
+    size_t count;
+} BlockCacheBatch;
+
+static bool _is_batch_written(void* data)
+{
+    const BlockCacheBatch* batch = data;
+    for (size_t i = 0; i < batch->count; ++i) {
+        if ((_get_flags(batch->entries[i]) & BLOCK_CACHE_WRITING) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool _is_before(const BlockCacheEntry* a, const BlockCacheEntry* b)
+{
+    if (a->device != b->device) {
+        return (uintptr_t)a->device < (uintptr_t)b->device;
+    }
+    return a->block < b->block;
+}
+
+// Start writing back up to a batch of the dirty blocks of the device, or of
+// any device, in order of device and block.  Expects the cache lock to be
+// held.
+static void _collect_batch(const BlockDevice* device, BlockCacheBatch* batch)
+{
+    batch->count = 0;
+    LIST_FOR_EACH_SAFE(node, &_dirty) {
+        if (batch->count == BLOCK_CACHE_WRITEBACK_BATCH) {
+            break;
+        }
+        BlockCacheEntry* entry =
+            LIST_ENTRY(node, BlockCacheEntry, dirty_node);
+        if (device != NULL && entry->device != device) {
+            continue;
+        }
+
+        remove_list_node(node);
+        --_statistics.dirty;
+        _clear_flags(entry, BLOCK_CACHE_DIRTY);
+        _set_flags(entry, BLOCK_CACHE_WRITING);
+        entry->request = (BlockRequest){
+            .operation = BLOCK_WRITE,
+            .sector = entry->block * BLOCK_CACHE_BLOCK_SECTORS,
+            .data = entry->data,
+            .size = BLOCK_CACHE_BLOCK_SIZE,
+            .complete = _complete_write,
+            .context = entry,
+        };
+        size_t i = batch->count;
+        while (i != 0 && _is_before(entry, batch->entries[i - 1])) {
+            batch->entries[i] = batch->entries[i - 1];
+            --i;
+        }
+        batch->entries[i] = entry;
+        ++batch->count;
+    }
+}
+
+static bool _claim_write_back(void* data)
+{
+    (void)data;
+    return !__atomic_exchange_n(&_is_writing_back, true, __ATOMIC_ACQUIRE);
+}
+
+static void _flush_devices(const BlockDevice** devices, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        flush_block_device(devices[i]);
+        McsNode node;
+        const InterruptState state = acquire_mcs_lock_irqsave(&_lock, &node);
+        ++_statistics.flushes;
+        release_mcs_lock_irqrestore(&_lock, &node, state);
+    }
+}
+
+bool write_back_block_cache(const BlockDevice* device)
+{
+    if (_entries == NULL) {
+        return true;
+    }
+
+    // One writer at a time, so that a block is never written twice at once
+    // and the flushes cover every write that came before them.
+    wait_on_queue(&_io_waiters, _claim_write_back, NULL);
+
+    // Only the writer uses the batch.
+    static BlockCacheBatch batch;
+    const BlockDevice* written[MAX_BLOCK_CACHE_FLUSHES];
+    size_t written_count = 0;
+    bool is_ok = true;
+    for (;;) {
+        McsNode node;
+        InterruptState state = acquire_mcs_lock_irqsave(&_lock, &node);
+        _collect_batch(device, &batch);
+        const size_t errors = _statistics.write_errors;
+        if (batch.count != 0) {
+            ++_statistics.write_batches;
+        }
+        release_mcs_lock_irqrestore(&_lock, &node, state);
+        if (batch.count == 0) {
+            break;
+        }
+        trace(block_cache_write_back, batch.count);
+
+        // Each device's run goes to it as one batch.
+        size_t start = 0;
+        for (size_t i = 0; i < batch.count; ++i) {
+            batch.requests[i] = &batch.entries[i]->request;
+            if (i + 1 < batch.count
+                    && batch.entries[i + 1]->device
+                        == batch.entries[start]->device) {
+                continue;
+            }
+
+            const BlockDevice* target = batch.entries[start]->device;
+            submit_all_block_requests(target, &batch.requests[start],
+                i + 1 - start);
+            size_t j = 0;
+            while (j < written_count && written[j] != target) {
+                ++j;
+            }
+            if (j == written_count) {
+                if (written_count == MAX_BLOCK_CACHE_FLUSHES) {
+                    _flush_devices(written, written_count);
+                    written_count = 0;
+                }
+                written[written_count] = target;
+                ++written_count;
+            }
+            start = i + 1;
+        }
+        wait_on_queue(&_io_waiters, _is_batch_written, &batch);
+
+        state = acquire_mcs_lock_irqsave(&_lock, &node);
+        if (_statistics.write_errors != errors) {
+            is_ok = false;
+        }
+        release_mcs_lock_irqrestore(&_lock, &node, state);
+        if (!is_ok) {
+            break;
+        }
+    }
+    _flush_devices(written, written_count);
+
+    __atomic_store_n(&_is_writing_back, false, __ATOMIC_RELEASE);
+    wake_all(&_io_waiters);
+    return is_ok;
+}
+
+static bool _is_device_idle(void* data)
+{
+    const BlockDevice* device = data;
+    for (size_t i = 0; i < _entry_count; ++i) {
+        if (_entries[i].device == device && (_get_flags(&_entries[i])
+                & (BLOCK_CACHE_LOADING | BLOCK_CACHE_WRITING)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool invalidate_block_cache(const BlockDevice* device)
+{
+    if (_entries == NULL) {
+        return true;
+    }
+
+    write_back_block_cache(device);
+    for (;;) {
+        // Requests in flight still point at the entries and the device.
+        wait_on_queue(&_io_waiters, _is_device_idle, (void*)device);
+
+        McsNode node;
+        const InterruptState state = acquire_mcs_lock_irqsave(&_lock, &node);
+        bool is_pinned = false;
+        bool is_busy = false;
+        for (size_t i = 0; i < _entry_count; ++i) {
+            const BlockCacheEntry* entry = &_entries[i];
+            if (entry->device != device
+                    || entry->queue == BLOCK_CACHE_FREE) {
+                continue;
+            }
+            if (entry->pins != 0) {
+                is_pinned = true;
+            }
+            else if ((entry->flags & (BLOCK_CACHE_LOADING
+                    | BLOCK_CACHE_WRITING)) != 0) {
+                is_busy = true;
+            }
+        }
+        if (is_pinned || is_busy) {
+            // Readahead or write-back may have started since the wait.
+            release_mcs_lock_irqrestore(&_lock, &node, state);
+            if (is_pinned) {
+                dprintf("Blocks of %s are still in use\n", device->name);
+                return false;
+            }
+            continue;
+        }
+
+        for (size_t i = 0; i < _entry_count; ++i) {
+            BlockCacheEntry* entry = &_entries[i];
+            if (entry->device != device
+                    || entry->queue == BLOCK_CACHE_FREE) {
+                continue;
+            }
+            if ((entry->flags & BLOCK_CACHE_DIRTY) != 0) {
+                remove_list_node(&entry->dirty_node);
+                --_statistics.dirty;
+            }
+            _discard_entry(entry);
+        }
+        for (size_t i = 0; i < MAX_BLOCK_CACHE_STREAMS; ++i) {
+            if (_streams[i].device == device) {
+                _streams[i].device = NULL;
+            }
+        }
+        release_mcs_lock_irqrestore(&_lock, &node, state);
+        return true;
+    }
+}
+
+void get_block_cache_statistics(BlockCacheStatistics* statistics)
+{
+    McsNode node;
+    const InterruptState state = acquire_mcs_lock_irqsave(&_lock, &node);
+    *statistics = _statistics;
+    statistics->capacity = _capacity;
+    statistics->cached = _fifo_count + _main_count;
+    release_mcs_lock_irqrestore(&_lock, &node, state);
+}
+
+void print_block_cache_statistics(void)
+{
+    BlockCacheStatistics statistics;
+    get_block_cache_statistics(&statistics);
+    dprintf("Block cache: %zu of %zu blocks cached, %zu dirty\n",
+        statistics.cached, statistics.capacity, statistics.dirty);
+    dprintf("  %zu hits, %zu misses, %zu ghost hits, %zu evictions\n",
+        statistics.hits, statistics.misses, statistics.ghost_hits,
+        statistics.evictions);
+    dprintf("  %zu blocks read ahead, %zu of them used\n",
+        statistics.readaheads, statistics.readahead_hits);
+    dprintf("  %zu reads refused with every block pinned or unwritable\n",
+        statistics.exhausted);
+    dprintf("  %zu blocks written back in %zu batches, %zu errors, "
+        "%zu flushes\n", statistics.writebacks, statistics.write_batches,
+        statistics.write_errors, statistics.flushes);
+}
+
+static void _run_write_back(void* argument)
+{
+    (void)argument;
+    for (;;) {
+        sleep_for(BLOCK_CACHE_WRITEBACK_INTERVAL_NS);
+        if (__atomic_load_n(&_statistics.dirty, __ATOMIC_RELAXED) != 0) {
+            write_back_block_cache(NULL);
+        }
+    }
+}
+
+void initialize_block_cache(void)
+{
+    size_t capacity =
+        (get_dram_size() >> BLOCK_CACHE_DRAM_SHIFT) / BLOCK_CACHE_BLOCK_SIZE;
+    if (capacity < BLOCK_CACHE_MIN_BLOCKS) {
+        capacity = BLOCK_CACHE_MIN_BLOCKS;
+    }
+    const size_t ghost_capacity = capacity * BLOCK_CACHE_GHOST_PERCENT / 100;
+    // Every cached block and ghost has an entry, and one more is always free
+    // to take a page.
+    const size_t entry_count = capacity + ghost_capacity + 1;
+    const unsigned int bucket_bits = log2_ceil(entry_count);
+
+    BlockCacheEntry* entries = kmalloc(sizeof(BlockCacheEntry) * entry_count);
+    BlockCacheEntry** buckets =
+        kmalloc(sizeof(BlockCacheEntry*) << bucket_bits);
+    if (entries == NULL || buckets == NULL) {
+        kfree(entries);
+        kfree(buckets);
+        dprintf("Unable to allocate the block cache\n");
+        return;
+    }
+    memset(entries, 0, sizeof(BlockCacheEntry) * entry_count);
+    memset(buckets, 0, sizeof(BlockCacheEntry*) << bucket_bits);
+
+    initialize_list(&_free);
+    initialize_list(&_fifo);
+    initialize_list(&_main);
+    initialize_list(&_ghosts);
+    initialize_list(&_dirty);
+    for (size_t i = 0; i < entry_count; ++i) {
+        initialize_list(&entries[i].dirty_node);
+        push_list_back(&_free, &entries[i].node);
+    }
+
+    _capacity = capacity;
+    _fifo_capacity = capacity * BLOCK_CACHE_FIFO_PERCENT / 100;
+    _ghost_capacity = ghost_capacity;
+    _entry_count = entry_count;
+    _bucket_bits = bucket_bits;
+    _buckets = buckets;
+    _entries = entries;
+
+    if (create_thread("block-write-back", _run_write_back, NULL) == NULL) {
+        dprintf("Unable to create the block cache write-back thread\n");
+    }
+    dprintf("Block cache of up to %zu %u-byte blocks\n", capacity,
+        (unsigned int)BLOCK_CACHE_BLOCK_SIZE);
+}
@@ -20,33 +20,98 @@
 
 #include <kernel/console.h>
 
+#include <kernel/rcu.h>
+#include <kernel/tracepoint.h>
+#include <kernel/wait_queue.h>
+
 #define MAX_CONSOLES 8
 
-static const Console* _consoles[MAX_CONSOLES] = {NULL};
-static size_t _console_count = 0;
+typedef struct ConsoleTable
+{
+    size_t count;
+    const Console* consoles[MAX_CONSOLES];
+} ConsoleTable;
+
+// The table and the active console are read under RCU, so the consoles can
+// be printed to from every hart at once.  An update copies the table into
+// the other one and publishes it, and the grace period at its end frees the
+// old one for the next update.
+static ConsoleTable _tables[2];
+static ConsoleTable* _table = &_tables[0];
 static const Console* _active_console = NULL;
 
-bool register_console(const Console* console)
+// Updaters, which device initializers running on different harts may be at
+// the same time, take turns.  They sleep through grace periods, so this is
+// a flag to wait on rather than a spinlock.
+static WaitQueue _updaters = WAIT_QUEUE_INITIALIZER(_updaters);
+static bool _is_updating = false;
+
+DEFINE_TRACEPOINT(console_read, "size %zu read %zu");
+DEFINE_TRACEPOINT(console_write, "size %zu written %zu");
+
+static bool _claim_update(void* data)
 {
-    if (console == NULL) {
-        return false;
+    (void)data;
+    return !__atomic_exchange_n(&_is_updating, true, __ATOMIC_ACQUIRE);
+}
+
+static ConsoleTable* _begin_update(void)
+{
+    wait_on_queue(&_updaters, _claim_update, NULL);
+    // Only updaters write _table, so no read-side critical section is needed.
+    ConsoleTable* table = _table == &_tables[0] ? &_tables[1] : &_tables[0];
+    *table = *_table;
+    return table;
+}
+
+// Publish the new table and active console, wait until no reader can still
+// see the old ones, and only then deactivate the old active console.
+static void _end_update(ConsoleTable* table, const Console* active)
+{
+    const Console* previous = _active_console;
+    if (active != previous && active != NULL) {
+        active->activate(active);
     }
-    if (_console_count >= MAX_CONSOLES) {
-        return false;
+    publish_rcu_pointer(&_table, table);
+    publish_rcu_pointer(&_active_console, active);
+    synchronize_rcu();
+    if (active != previous && previous != NULL) {
+        previous->deactivate(previous);
     }
 
-    for (size_t i = 0; i < _console_count; ++i) {
-        if (_consoles[i] == console) {
-            return false;
+    __atomic_store_n(&_is_updating, false, __ATOMIC_RELEASE);
+    wake_all(&_updaters);
+}
+
+static bool _is_in_table(const ConsoleTable* table, const Console* console)
+{
+    for (size_t i = 0; i < table->count; ++i) {
+        if (table->consoles[i] == console) {
+            return true;
         }
     }
+    return false;
+}
+
+bool register_console(const Console* console)
+{
+    if (console == NULL) {
+        return false;
+    }
 
-    _consoles[_console_count] = console;
-    ++_console_count;
-    if (_console_count == 1) {
-        activate_console(console);
+    ConsoleTable* table = _begin_update();
+    const Console* active = _active_console;
+    const bool is_registered = table->count < MAX_CONSOLES
+        && !_is_in_table(table, console);
+    if (is_registered) {
+        table->consoles[table->count] = console;
+        ++table->count;
+        if (active == NULL || console->priority > active->priority) {
+            active = console;
+        }
     }
-    return true;
+    _end_update(table, active);
+    return is_registered;
 }
 
 bool deregister_console(const Console* console)
@@ -55,32 +120,57 @@ bool deregister_console(const Console* console)
         return false;
     }
 
+    ConsoleTable* table = _begin_update();
+    const Console* active = _active_console;
     bool was_removed = false;
-    for (size_t i = 0; i < _console_count; ++i) {
-        if (_consoles[i] == console) {
-            deactivate_console();
+    for (size_t i = 0; i < table->count; ++i) {
+        if (table->consoles[i] == console) {
             was_removed = true;
         }
         if (was_removed) {
-            if (i + 1 < _console_count) {
-                _consoles[i] = _consoles[i + 1];
+            if (i + 1 < table->count) {
+                table->consoles[i] = table->consoles[i + 1];
             }
             else {
-                _consoles[i] = NULL;
+                table->consoles[i] = NULL;
+            }
+        }
+    }
+    if (was_removed) {
+        --table->count;
+    }
+
+    // Fall back to the remaining console with the highest priority.
+    if (was_removed && (active == console || active == NULL)) {
+        active = NULL;
+        for (size_t i = 0; i < table->count; ++i) {
+            if (active == NULL
+                    || table->consoles[i]->priority > active->priority) {
+                active = table->consoles[i];
             }
         }
     }
+    // Once this returns, nothing is using the console.
+    _end_update(table, active);
     return was_removed;
 }
 
 size_t get_console_count(void)
 {
-    return _console_count;
+    begin_rcu_read();
+    const size_t count = read_rcu_pointer(&_table)->count;
+    end_rcu_read();
+    return count;
 }
 
 const Console* get_console(size_t index)
 {
-    return index < _console_count ? _consoles[index] : NULL;
+    begin_rcu_read();
+    const ConsoleTable* table = read_rcu_pointer(&_table);
+    const Console* console = index < table->count ? table->consoles[index]
+        : NULL;
+    end_rcu_read();
+    return console;
 }
 
 bool is_console_registered(const Console *console)
@@ -89,67 +179,73 @@ bool is_console_registered(const Console *console)
         return false;
     }
 
-    for (size_t i = 0; i < _console_count; ++i) {
-        if (_consoles[i] == console) {
-            return true;
-        }
-    }
-    return false;
+    begin_rcu_read();
+    const bool is_registered =
+        _is_in_table(read_rcu_pointer(&_table), console);
+    end_rcu_read();
+    return is_registered;
 }
 
 bool activate_console(const Console* console)
 {
-    if (!is_console_registered(console)) {
+    if (console == NULL) {
         return false;
     }
 
-    if (_active_console != NULL) {
-        _active_console->deactivate(_active_console);
-    }
-    _active_console = console;
-    _active_console->activate(_active_console);
-    return true;
+    ConsoleTable* table = _begin_update();
+    const bool is_registered = _is_in_table(table, console);
+    _end_update(table, is_registered ? console : _active_console);
+    return is_registered;
 }
 
 bool deactivate_console(void)
 {
-    if (_active_console == NULL) {
-        return false;
-    }
-
-    _active_console->deactivate(_active_console);
-    _active_console = NULL;
-    return true;
+    ConsoleTable* table = _begin_update();
+    const bool was_active = _active_console != NULL;
+    _end_update(table, NULL);
+    return was_active;
 }
 
 const Console* get_active_console(void)
 {
-    return _active_console;
+    return read_rcu_pointer(&_active_console);
 }
 
 size_t read_from_console(char* data, size_t size)
 {
-    if (_active_console == NULL) {
+    begin_rcu_read();
+    const Console* console = read_rcu_pointer(&_active_console);
+    if (console == NULL) {
+        end_rcu_read();
         return 0;
     }
 
-    return _active_console->read(_active_console, data, size);
+    const size_t count = console->read(console, data, size);
+    end_rcu_read();
+    trace(console_read, size, count);
+    return count;
 }
 
-size_t write_to_console(const char* data)
+size_t write_to_console(const char* data, size_t size)
 {
-    if (_active_console == NULL) {
+    begin_rcu_read();
+    const Console* console = read_rcu_pointer(&_active_console);
+    if (console == NULL) {
+        end_rcu_read();
         return 0;
     }
 
-    return _active_console->write(_active_console, data);
+    const size_t count = console->write(console, data, size);
+    end_rcu_read();
+    trace(console_write, size, count);
+    return count;
 }
 
 bool put_to_console(char chr)
 {
-    if (_active_console == NULL) {
-        return 0;
-    }
-
-    return _active_console->put(_active_console, chr);
+    begin_rcu_read();
+    const Console* console = read_rcu_pointer(&_active_console);
+    const bool was_put = console != NULL && console->put(console, chr);
+    end_rcu_read();
+    return was_put;
 }
@@ -0,0 +1,259 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/device.h>
+
+#include <kernel/arch/timer.h>
+#include <kernel/hart.h>
+#include <kernel/panic.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <kernel/tracepoint.h>
+#include <kernel/wait_queue.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_DEVICE_INITIALIZERS 64
+
+typedef enum DeviceInitializerState
+{
+    DEVICE_INITIALIZER_PENDING,
+    DEVICE_INITIALIZER_RUNNING,
+    DEVICE_INITIALIZER_DONE,
+} DeviceInitializerState;
+
+typedef struct DeviceInitializerRun
+{
+    const DeviceInitializer* initializer;
+    DeviceInitializerState state;
+    size_t hart_index;  // Where the initializer started
+    uint64_t start_time;
+    uint64_t end_time;
+} DeviceInitializerRun;
+
+// Guards the run states and counts.  Workers that find nothing ready wait on
+// _queue until a running initializer finishes.
+static Spinlock _lock = SPINLOCK_INITIALIZER;
+static WaitQueue _queue = WAIT_QUEUE_INITIALIZER(_queue);
+static DeviceInitializerRun _runs[MAX_DEVICE_INITIALIZERS];
+static size_t _run_count = 0;
+static size_t _pending_count = 0;
+static size_t _running_count = 0;
+static size_t _worker_count = 0;
+static uint64_t _start_time = 0;
+static uint64_t _end_time = 0;
+
+DEFINE_TRACEPOINT(device_initialize_start, "%s");
+DEFINE_TRACEPOINT(device_initialize_end, "%s");
+DEFINE_TRACEPOINT(device_finalize_start, "%p");
+DEFINE_TRACEPOINT(device_finalize_end, "%p");
+
+static DeviceInitializerRun* _find_run(const char* tag)
+{
+    for (size_t i = 0; i < _run_count; ++i) {
+        if (strcmp(_runs[i].initializer->tag, tag) == 0) {
+            return &_runs[i];
+        }
+    }
+    return NULL;
+}
+
+// Unknown dependencies are reported once by initialize_devices and then
+// treated as met.
+static bool _is_ready(const DeviceInitializerRun* run)
+{
+    const char* const* dependencies = run->initializer->dependencies;
+    for (size_t i = 0; dependencies != NULL && dependencies[i] != NULL; ++i) {
+        const DeviceInitializerRun* dependency = _find_run(dependencies[i]);
+        if (dependency != NULL
+                && dependency->state != DEVICE_INITIALIZER_DONE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Claim the ready initializer with the highest priority for the calling
+// worker, or NULL once nothing is left to start.  Returns false to keep the
+// worker waiting while everything left depends on a running initializer.
+static bool _claim_initializer(void* data)
+{
+    DeviceInitializerRun** claimed = data;
+    *claimed = NULL;
+    acquire_spinlock(&_lock);
+    if (_pending_count == 0) {
+        release_spinlock(&_lock);
+        return true;
+    }
+
+    DeviceInitializerRun* best = NULL;
+    DeviceInitializerRun* fallback = NULL;
+    for (size_t i = 0; i < _run_count; ++i) {
+        DeviceInitializerRun* run = &_runs[i];
+        if (run->state != DEVICE_INITIALIZER_PENDING) {
+            continue;
+        }
+        const int priority = run->initializer->priority;
+        if (fallback == NULL || priority > fallback->initializer->priority) {
+            fallback = run;
+        }
+        if (_is_ready(run)
+                && (best == NULL || priority > best->initializer->priority)) {
+            best = run;
+        }
+    }
+
+    // Nothing running can satisfy the rest, so the dependencies form a
+    // cycle.  Break it rather than hang the boot.
+    if (best == NULL && _running_count == 0) {
+        dprintf("Device initializer %s is in a dependency cycle\n",
+            fallback->initializer->tag);
+        best = fallback;
+    }
+    if (best != NULL) {
+        best->state = DEVICE_INITIALIZER_RUNNING;
+        --_pending_count;
+        ++_running_count;
+        *claimed = best;
+    }
+    release_spinlock(&_lock);
+    return best != NULL;
+}
+
+static void _run_initializers(void* argument)
+{
+    (void)argument;
+    for (;;) {
+        DeviceInitializerRun* run;
+        wait_on_queue(&_queue, _claim_initializer, &run);
+        if (run == NULL) {
+            return;
+        }
+
+        run->hart_index = get_hart_index();
+        run->start_time = get_time();
+        trace(device_initialize_start, run->initializer->tag);
+        run->initializer->initialize();
+        trace(device_initialize_end, run->initializer->tag);
+        const uint64_t end_time = get_time();
+
+        const InterruptState state = acquire_spinlock_irqsave(&_lock);
+        run->end_time = end_time;
+        run->state = DEVICE_INITIALIZER_DONE;
+        --_running_count;
+        release_spinlock_irqrestore(&_lock, state);
+        wake_all(&_queue);
+    }
+}
+
+void initialize_devices(void)
+{
+    for (const DeviceInitializer* initializer = &__device_initializer_start;
+            initializer < &__device_initializer_end; ++initializer) {
+        if (_run_count == MAX_DEVICE_INITIALIZERS) {
+            panic("More than %d device initializers\n",
+                MAX_DEVICE_INITIALIZERS);
+        }
+        _runs[_run_count] = (DeviceInitializerRun){
+            .initializer = initializer,
+            .state = DEVICE_INITIALIZER_PENDING,
+        };
+        ++_run_count;
+    }
+    for (size_t i = 0; i < _run_count; ++i) {
+        const char* const* dependencies = _runs[i].initializer->dependencies;
+        for (size_t j = 0; dependencies != NULL && dependencies[j] != NULL;
+                ++j) {
+            if (_find_run(dependencies[j]) == NULL) {
+                dprintf("Device initializer %s depends on unknown %s\n",
+                    _runs[i].initializer->tag, dependencies[j]);
+            }
+        }
+    }
+    _pending_count = _run_count;
+
+    // The calling thread is one of the workers.  The rest are stolen by idle
+    // harts.
+    size_t worker_count = get_hart_count();
+    if (worker_count > _run_count) {
+        worker_count = _run_count;
+    }
+    Thread* workers[MAX_HARTS];
+    _worker_count = 1;
+    _start_time = get_time();
+    for (size_t i = 1; i < worker_count; ++i) {
+        workers[_worker_count - 1] =
+            create_thread("device-init", _run_initializers, NULL);
+        if (workers[_worker_count - 1] == NULL) {
+            dprintf("Unable to create a device initializer worker\n");
+            break;
+        }
+        ++_worker_count;
+    }
+    _run_initializers(NULL);
+    for (size_t i = 0; i + 1 < _worker_count; ++i) {
+        join_thread(workers[i]);
+    }
+    _end_time = get_time();
+}
+
+void finalize_devices(void)
+{
+    for (const DeviceFinalizer* func = &__device_finalizer_start;
+            func < &__device_finalizer_end; ++func) {
+        trace(device_finalize_start, *func);
+        (*func)();
+        trace(device_finalize_end, *func);
+    }
+}
+
+static unsigned long long _to_microseconds(uint64_t ticks)
+{
+    return (unsigned long long)(ticks_to_nanoseconds(ticks) / 1000);
+}
+
+void print_boot_timeline(void)
+{
+    // Order by start time.  There are few enough initializers for an
+    // insertion sort.
+    const DeviceInitializerRun* order[MAX_DEVICE_INITIALIZERS];
+    for (size_t i = 0; i < _run_count; ++i) {
+        size_t j = i;
+        for (; j > 0 && order[j - 1]->start_time > _runs[i].start_time; --j) {
+            order[j] = order[j - 1];
+        }
+        order[j] = &_runs[i];
+    }
+
+    dprintf("Boot timeline (us since reset):\n");
+    dprintf("%10s %10s %5s  %s\n", "start", "duration", "hart", "device");
+    for (size_t i = 0; i < _run_count; ++i) {
+        const DeviceInitializerRun* run = order[i];
+        dprintf("%10llu %10llu %5zu  %s\n", _to_microseconds(run->start_time),
+            _to_microseconds(run->end_time - run->start_time),
+            run->hart_index, run->initializer->tag);
+    }
+    dprintf("Devices initialized in %llu us on %zu workers, "
+        "%llu us after reset\n", _to_microseconds(_end_time - _start_time),
+        _worker_count, _to_microseconds(_end_time));
+}
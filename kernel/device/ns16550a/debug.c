@@ -21,18 +21,55 @@
 #include <kernel/debug.h>
 
 #include <kernel/device/ns16550a/ns16550a.h>
+#include <kernel/panic.h>
+#include <kernel/spinlock.h>
+
+#include <string.h>
+
+// Write a character straight to THR, bypassing the TX ring so that output
+// survives a broken kernel.  Writing THR directly avoids the read of RBR,
+// which shares its index, in NS16550A_WRITE_FIELD.
+static void _put_unlocked(char c)
+{
+    while (!NS16550A_READ_FIELD(&ns16550a_uart0, LSR, THR)) {
+    }
+    ns16550a_write_register(&ns16550a_uart0, NS16550A_THR_INDEX, (uint8_t)c);
+}
+
+// Once the driver is up it refills the FIFO under the lock, so the lock must
+// be held between the THR check and the write to avoid overrunning the FIFO.
+// Before then, and during a panic, nothing else can be relied on to release
+// it.
+static bool _should_lock(void)
+{
+    return __atomic_load_n(&ns16550a_uart0.is_initialized, __ATOMIC_ACQUIRE)
+        && !is_panicking();
+}
 
 void dputc(char c)
 {
-    // Write the character without waiting for THR.
-    NS16550A_WRITE_FIELD(&ns16550a_uart0, THR, CHR, c);
+    dwrite(&c, 1);
 }
 
 void dputs(const char* s)
 {
-    for (; *s != '\0'; ++s) {
-        dputc(*s);
+    dwrite(s, strlen(s));
+}
+
+void dwrite(const char* data, size_t size)
+{
+    if (!_should_lock()) {
+        for (size_t i = 0; i < size; ++i) {
+            _put_unlocked(data[i]);
+        }
+        return;
+    }
+
+    InterruptState state = acquire_spinlock_irqsave(&ns16550a_uart0.lock);
+    for (size_t i = 0; i < size; ++i) {
+        _put_unlocked(data[i]);
     }
+    release_spinlock_irqrestore(&ns16550a_uart0.lock, state);
 }
 
 void initialize_debug(void)
@@ -20,16 +20,32 @@
 
 #include <kernel/device/ns16550a/ns16550a.h>
 
+#include <kernel/arch/memory.h>
 #include <kernel/config.h>
 #include <kernel/console.h>
 #include <kernel/device.h>
+#include <kernel/fdt.h>
+#include <kernel/irq.h>
 
-#include <string.h>
+#include <stdio.h>
 
-const Ns16550aUart ns16550a_uart0 = {
-    .base = (uint8_t*)UART0_BASE,
+// Maximum number of interrupt causes serviced per call to the handler, which
+// bounds the time spent in it when the line is flooded
+#define MAX_INTERRUPT_ITERATIONS 64
+
+static uint8_t _uart0_tx_data[NS16550A_TX_BUFFER_SIZE];
+static uint8_t _uart0_rx_data[NS16550A_RX_BUFFER_SIZE];
+
+// The configured base is used for early debug output until the FDT is
+// available to locate the UART.
+Ns16550aUart ns16550a_uart0 = {
+    .base = (uint8_t*)(DIRECT_MAP_BASE + UART0_BASE),
     .size = (size_t)UART0_SIZE,
     .register_width = UART0_REGISTER_WIDTH,
+    .lock = SPINLOCK_INITIALIZER,
+    .tx = {.data = _uart0_tx_data, .size = NS16550A_TX_BUFFER_SIZE},
+    .rx = {.data = _uart0_rx_data, .size = NS16550A_RX_BUFFER_SIZE},
+    .rx_trigger_level = NS16550A_RX_TRIGGER_LEVEL,
 };
 
 static volatile uint8_t* _get_register_address(const Ns16550aUart* uart,
@@ -49,54 +65,246 @@ void ns16550a_write_register(const Ns16550aUart* uart, uint8_t index,
     *_get_register_address(uart, index) = value;
 }
 
-bool ns16550a_try_receive(const Ns16550aUart* uart, uint8_t* chr)
+// The helpers below expect the UART lock to be held.
+
+static void _set_interrupt_enable(Ns16550aUart* uart, uint8_t ier)
+{
+    if (uart->ier != ier) {
+        uart->ier = ier;
+        ns16550a_write_register(uart, NS16550A_IER_INDEX, ier);
+    }
+}
+
+static void _account_line_status(Ns16550aUart* uart, uint8_t lsr)
+{
+    if (lsr & (NS16550A_LSR_OER_MASK | NS16550A_LSR_PER_MASK |
+            NS16550A_LSR_FER_MASK | NS16550A_LSR_BKI_MASK)) {
+        ++uart->statistics.line_errors;
+    }
+}
+
+// FCR is write-only, and its index aliases ISR, so it is always written whole
+// rather than through NS16550A_WRITE_FIELD.
+static void _write_fifo_control(Ns16550aUart* uart, uint8_t reset)
+{
+    ns16550a_write_register(uart, NS16550A_FCR_INDEX, NS16550A_FCR_FEN_MASK |
+        reset | ((uart->rx_trigger_level << NS16550A_FCR_RTL_OFFSET) &
+            NS16550A_FCR_RTL_MASK));
+}
+
+// Move characters from the receive FIFO into the RX ring.  When the ring is
+// full, the receive interrupt is masked so that the remaining characters stay
+// in the FIFO instead of being dropped.
+static void _drain_rx_fifo(Ns16550aUart* uart)
+{
+    for (;;) {
+        uint8_t lsr = ns16550a_read_register(uart, NS16550A_LSR_INDEX);
+        _account_line_status(uart, lsr);
+        if (!(lsr & NS16550A_LSR_RBR_MASK)) {
+            break;
+        }
+        if (is_ring_buffer_full(&uart->rx)) {
+            if (uart->ier & NS16550A_IER_RBR_MASK) {
+                ++uart->statistics.rx_throttles;
+                _set_interrupt_enable(uart,
+                    uart->ier & ~NS16550A_IER_RBR_MASK);
+            }
+            break;
+        }
+        push_ring_buffer(&uart->rx,
+            ns16550a_read_register(uart, NS16550A_RBR_INDEX));
+        ++uart->statistics.received;
+    }
+}
+
+// Resume reception once a throttled RX ring has room for a full FIFO.
+static void _unthrottle_rx(Ns16550aUart* uart)
 {
-    if (NS16550A_READ_FIELD(uart, LSR, RBR)) {
-        *chr = NS16550A_READ_FIELD(uart, RBR, CHR);
-        return true;
+    if (uart->is_interrupt_driven && !(uart->ier & NS16550A_IER_RBR_MASK) &&
+            get_ring_buffer_space(&uart->rx) >= NS16550A_FIFO_SIZE) {
+        _set_interrupt_enable(uart, uart->ier | NS16550A_IER_RBR_MASK);
     }
-    return false;
 }
 
-size_t ns16550a_receive_buffer(const Ns16550aUart* uart, uint8_t* data,
+// Refill the transmit FIFO from the TX ring if the FIFO is empty.  THR empty
+// means the whole FIFO is free, so it takes up to a FIFO's worth at once.
+static void _fill_tx_fifo(Ns16550aUart* uart)
+{
+    if (!NS16550A_READ_FIELD(uart, LSR, THR)) {
+        return;
+    }
+
+    uint8_t chr;
+    for (size_t i = 0; i < NS16550A_FIFO_SIZE &&
+            pop_ring_buffer(&uart->tx, &chr); ++i) {
+        ns16550a_write_register(uart, NS16550A_THR_INDEX, chr);
+        ++uart->statistics.transmitted;
+    }
+}
+
+// Request the THR empty interrupt only while there is data to send.
+static void _update_tx_interrupt(Ns16550aUart* uart)
+{
+    if (!uart->is_interrupt_driven) {
+        return;
+    }
+    if (is_ring_buffer_empty(&uart->tx)) {
+        _set_interrupt_enable(uart, uart->ier & ~NS16550A_IER_THR_MASK);
+    }
+    else {
+        _set_interrupt_enable(uart, uart->ier | NS16550A_IER_THR_MASK);
+    }
+}
+
+// Busy-wait until the TX ring is empty.
+static void _drain_tx_ring(Ns16550aUart* uart)
+{
+    while (!is_ring_buffer_empty(&uart->tx)) {
+        _fill_tx_fifo(uart);
+    }
+}
+
+bool ns16550a_try_receive(Ns16550aUart* uart, uint8_t* chr)
+{
+    return ns16550a_receive_buffer(uart, chr, 1) == 1;
+}
+
+size_t ns16550a_receive_buffer(Ns16550aUart* uart, uint8_t* data,
     size_t size)
 {
     if (uart == NULL || data == NULL) {
         return 0;
     }
 
-    uint8_t chr;
-    size_t i = 0;
-    while (i < size && ns16550a_try_receive(uart, &chr)) {
-        data[i] = chr;
-        ++i;
+    InterruptState state = acquire_spinlock_irqsave(&uart->lock);
+    if (!uart->is_interrupt_driven) {
+        _drain_rx_fifo(uart);
     }
-    return i;
+    size_t count = read_ring_buffer(&uart->rx, data, size);
+    _unthrottle_rx(uart);
+    release_spinlock_irqrestore(&uart->lock, state);
+    return count;
 }
 
-bool ns16550a_transmit(const Ns16550aUart* uart, uint8_t chr)
+bool ns16550a_transmit(Ns16550aUart* uart, uint8_t chr)
 {
-    if (NS16550A_READ_FIELD(uart, LSR, THR)) {
-        NS16550A_WRITE_FIELD(uart, THR, CHR, chr);
-        return true;
-    }
-    return false;
+    return ns16550a_transmit_buffer(uart, &chr, 1) == 1;
 }
 
-size_t ns16550a_transmit_buffer(const Ns16550aUart* uart, const uint8_t* data,
+// Queue the data on the TX ring.  Rather than dropping data when the ring is
+// full, the writer feeds the FIFO itself until everything fits.  When the UART
+// is polled, the ring is drained before returning.
+size_t ns16550a_transmit_buffer(Ns16550aUart* uart, const uint8_t* data,
     size_t size)
 {
     if (uart == NULL || data == NULL) {
         return 0;
     }
 
-    size_t i = 0;
-    for (; i < size; ++i) {
-        if (!ns16550a_transmit(uart, data[i])) {
-            return size;
+    InterruptState state = acquire_spinlock_irqsave(&uart->lock);
+    size_t count = write_ring_buffer(&uart->tx, data, size);
+    if (count < size) {
+        ++uart->statistics.tx_stalls;
+        do {
+            _fill_tx_fifo(uart);
+            count += write_ring_buffer(&uart->tx, data + count, size - count);
+        } while (count < size);
+    }
+    if (uart->is_interrupt_driven) {
+        // Start an idle transmitter now rather than waiting for an interrupt.
+        _fill_tx_fifo(uart);
+        _update_tx_interrupt(uart);
+    }
+    else {
+        _drain_tx_ring(uart);
+    }
+    release_spinlock_irqrestore(&uart->lock, state);
+    return count;
+}
+
+// Wait until all queued data has left the transmitter.
+void ns16550a_flush(Ns16550aUart* uart)
+{
+    InterruptState state = acquire_spinlock_irqsave(&uart->lock);
+    _drain_tx_ring(uart);
+    _update_tx_interrupt(uart);
+    while (!NS16550A_READ_FIELD(uart, LSR, TXE)) {
+    }
+    release_spinlock_irqrestore(&uart->lock, state);
+}
+
+// Set the receive FIFO trigger level to one of the NS16550A_FCR_RTL values.
+// Lower levels reduce latency; higher levels reduce the interrupt rate.
+void ns16550a_set_rx_trigger_level(Ns16550aUart* uart, uint8_t level)
+{
+    InterruptState state = acquire_spinlock_irqsave(&uart->lock);
+    uart->rx_trigger_level = level;
+    _write_fifo_control(uart, 0);
+    release_spinlock_irqrestore(&uart->lock, state);
+}
+
+// Switch from polling to interrupts.  The caller routes the UART's interrupt
+// line to ns16550a_handle_interrupt.
+void ns16550a_enable_interrupts(Ns16550aUart* uart)
+{
+    InterruptState state = acquire_spinlock_irqsave(&uart->lock);
+    uart->is_interrupt_driven = true;
+    NS16550A_WRITE_FIELD(uart, MCR, OU2, 1);
+    _set_interrupt_enable(uart,
+        NS16550A_IER_RBR_MASK | NS16550A_IER_LSR_MASK);
+    _update_tx_interrupt(uart);
+    release_spinlock_irqrestore(&uart->lock, state);
+}
+
+// Switch back to polling, draining anything still queued.
+void ns16550a_disable_interrupts(Ns16550aUart* uart)
+{
+    InterruptState state = acquire_spinlock_irqsave(&uart->lock);
+    _set_interrupt_enable(uart, 0);
+    uart->is_interrupt_driven = false;
+    _drain_tx_ring(uart);
+    release_spinlock_irqrestore(&uart->lock, state);
+}
+
+void ns16550a_handle_interrupt(Ns16550aUart* uart)
+{
+    acquire_spinlock(&uart->lock);
+    ++uart->statistics.interrupts;
+    for (size_t i = 0; i < MAX_INTERRUPT_ITERATIONS; ++i) {
+        uint8_t isr = ns16550a_read_register(uart, NS16550A_ISR_INDEX);
+        if (isr & NS16550A_ISR_NIP_MASK) {
+            break;
+        }
+
+        switch ((isr & NS16550A_ISR_IIC_MASK) >> NS16550A_ISR_IIC_OFFSET) {
+            case NS16550A_ISR_IIC_LSR:
+                _account_line_status(uart,
+                    ns16550a_read_register(uart, NS16550A_LSR_INDEX));
+                break;
+            case NS16550A_ISR_IIC_RHR:
+            case NS16550A_ISR_IIC_RTO:
+                _drain_rx_fifo(uart);
+                break;
+            case NS16550A_ISR_IIC_THR:
+                _fill_tx_fifo(uart);
+                _update_tx_interrupt(uart);
+                break;
+            case NS16550A_ISR_IIC_MSR:
+                ns16550a_read_register(uart, NS16550A_MSR_INDEX);
+                break;
+            default:
+                break;
         }
     }
-    return size;
+    release_spinlock(&uart->lock);
+}
+
+void ns16550a_get_statistics(Ns16550aUart* uart,
+    Ns16550aStatistics* statistics)
+{
+    InterruptState state = acquire_spinlock_irqsave(&uart->lock);
+    *statistics = uart->statistics;
+    release_spinlock_irqrestore(&uart->lock, state);
 }
 
 static void _activate_console(const Console* console)
@@ -112,18 +320,20 @@ static void _deactivate_console(const Console* console)
 static size_t _read_from_console(const Console* console, char* data,
     size_t size)
 {
-    return ns16550a_receive_buffer(console->tag, (uint8_t*)data, size);
+    return ns16550a_receive_buffer((Ns16550aUart*)console->tag,
+        (uint8_t*)data, size);
 }
 
-static size_t _write_to_console(const Console* console, const char* data)
+static size_t _write_to_console(const Console* console, const char* data,
+    size_t size)
 {
-    return ns16550a_transmit_buffer(console->tag, (const uint8_t*)data,
-        strlen(data));
+    return ns16550a_transmit_buffer((Ns16550aUart*)console->tag,
+        (const uint8_t*)data, size);
 }
 
 static bool _put_to_console(const Console* console, char chr)
 {
-    return ns16550a_transmit(console->tag, chr);
+    return ns16550a_transmit((Ns16550aUart*)console->tag, chr);
 }
 
 static const Console _uart0_console = {
@@ -136,13 +346,56 @@ static const Console _uart0_console = {
     .put = _put_to_console,
 };
 
+static void _handle_uart_interrupt(uint32_t irq, void* data)
+{
+    (void)irq;
+    ns16550a_handle_interrupt(data);
+}
+
 void ns16550a_initialize(void)
 {
+    const FdtDevice* device = find_fdt_device("ns16550a", NULL);
+    if (device != NULL) {
+        ns16550a_uart0.base = physical_to_virtual(device->base);
+        ns16550a_uart0.size = device->size;
+        uint32_t width;
+        if (read_fdt_u32(device->node, "reg-io-width", &width)) {
+            ns16550a_uart0.register_width = width;
+        }
+    }
+    else {
+        dprintf("No ns16550a in FDT; using UART0 at %p\n",
+            ns16550a_uart0.base);
+    }
+
+    // Let the transmitter finish any debug output before resetting the FIFOs.
+    while (!NS16550A_READ_FIELD(&ns16550a_uart0, LSR, TXE)) {
+    }
+    _write_fifo_control(&ns16550a_uart0,
+        NS16550A_FCR_RXR_MASK | NS16550A_FCR_TXR_MASK);
+    ns16550a_write_register(&ns16550a_uart0, NS16550A_IER_INDEX, 0);
+    ns16550a_uart0.ier = 0;
+    __atomic_store_n(&ns16550a_uart0.is_initialized, true, __ATOMIC_RELEASE);
+
     register_console(&_uart0_console);
+
+    // Stay polled without an interrupt line.  The handler may be registered
+    // before the interrupt controller, which applies it when it registers.
+    if (device != NULL && device->has_irq &&
+            register_irq_handler(device->irq, _handle_uart_interrupt,
+                &ns16550a_uart0, IRQ_HART_ANY)) {
+        ns16550a_enable_interrupts(&ns16550a_uart0);
+    }
 }
 
 void ns16550a_finalize(void)
 {
+    ns16550a_disable_interrupts(&ns16550a_uart0);
+    const FdtDevice* device = find_fdt_device("ns16550a", NULL);
+    if (device != NULL && device->has_irq) {
+        deregister_irq_handler(device->irq);
+    }
+    ns16550a_flush(&ns16550a_uart0);
     deregister_console(&_uart0_console);
 }
 
@@ -21,10 +21,31 @@
 #ifndef KERNEL_DEVICE_NS16550A_NS16550A_H
 #define KERNEL_DEVICE_NS16550A_NS16550A_H
 
+#include <kernel/ring_buffer.h>
+#include <kernel/spinlock.h>
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+// Depth of the transmit and receive FIFOs
+#define NS16550A_FIFO_SIZE 16
+
+// Sizes of the software rings in front of the FIFOs, which must be powers of
+// two.
+#ifndef NS16550A_TX_BUFFER_SIZE
+    #define NS16550A_TX_BUFFER_SIZE 4096
+#endif
+#ifndef NS16550A_RX_BUFFER_SIZE
+    #define NS16550A_RX_BUFFER_SIZE 1024
+#endif
+
+// Receive FIFO fill level, as an FCR RTL value, at which the UART interrupts.
+// The UART also interrupts when characters sit in the FIFO for a while.
+#ifndef NS16550A_RX_TRIGGER_LEVEL
+    #define NS16550A_RX_TRIGGER_LEVEL NS16550A_FCR_RTL_8CHR
+#endif
+
 // Receiver buffer register
 #define NS16550A_RBR_INDEX      0x00
 #define NS16550A_RBR_CHR_OFFSET 0  // Character
@@ -196,26 +217,55 @@
         (((value) << (NS16550A_ ## reg ## _ ## field ## _OFFSET)) & \
             (NS16550A_ ## reg ## _ ## field ## _MASK))))
 
+typedef struct Ns16550aStatistics
+{
+    size_t interrupts;
+    size_t transmitted;  // Bytes moved from the TX ring to the FIFO
+    size_t received;  // Bytes moved from the FIFO to the RX ring
+    size_t tx_stalls;  // Writes that waited for the UART to drain the ring
+    size_t rx_throttles;  // Times the RX ring filled and reception paused
+    size_t line_errors;  // Overrun, parity, framing, or break conditions
+} Ns16550aStatistics;
+
+// Transmission and reception go through the rings.  Until interrupts are
+// enabled, the UART is polled and writes wait for the ring to drain.
 typedef struct Ns16550aUart
 {
     volatile uint8_t* base;
     size_t size;
     size_t register_width;
+    bool is_initialized;  // Debug output takes the lock once set
+
+    Spinlock lock;  // Guards the fields below and the registers
+    RingBuffer tx;
+    RingBuffer rx;
+    uint8_t ier;  // Shadow of IER
+    uint8_t rx_trigger_level;
+    bool is_interrupt_driven;
+    Ns16550aStatistics statistics;
 } Ns16550aUart;
 
-extern const Ns16550aUart ns16550a_uart0;
+extern Ns16550aUart ns16550a_uart0;
 
 uint8_t ns16550a_read_register(const Ns16550aUart* uart, uint8_t index);
 void ns16550a_write_register(const Ns16550aUart* uart, uint8_t index,
     uint8_t value);
 
-bool ns16550a_try_receive(const Ns16550aUart* uart, uint8_t* chr);
-size_t ns16550a_receive_buffer(const Ns16550aUart* uart, uint8_t* data,
+bool ns16550a_try_receive(Ns16550aUart* uart, uint8_t* chr);
+size_t ns16550a_receive_buffer(Ns16550aUart* uart, uint8_t* data,
     size_t size);
 
-bool ns16550a_transmit(const Ns16550aUart* uart, uint8_t chr);
-size_t ns16550a_transmit_buffer(const Ns16550aUart* uart, const uint8_t* data,
+bool ns16550a_transmit(Ns16550aUart* uart, uint8_t chr);
+size_t ns16550a_transmit_buffer(Ns16550aUart* uart, const uint8_t* data,
     size_t size);
+void ns16550a_flush(Ns16550aUart* uart);
+
+void ns16550a_set_rx_trigger_level(Ns16550aUart* uart, uint8_t level);
+void ns16550a_enable_interrupts(Ns16550aUart* uart);
+void ns16550a_disable_interrupts(Ns16550aUart* uart);
+void ns16550a_handle_interrupt(Ns16550aUart* uart);
+void ns16550a_get_statistics(Ns16550aUart* uart,
+    Ns16550aStatistics* statistics);
 
 void ns16550a_initialize(void);
 void ns16550a_finalize(void);
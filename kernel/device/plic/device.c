@@ -0,0 +1,252 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/device/plic/plic.h>
+
+#include <kernel/arch/memory.h>
+#include <kernel/arch/trap.h>
+#include <kernel/device.h>
+#include <kernel/fdt.h>
+#include <kernel/hart.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+
+static Plic _plic = {
+    .lock = SPINLOCK_INITIALIZER,
+};
+
+static volatile uint32_t* _get_register(const Plic* plic, size_t offset)
+{
+    return (volatile uint32_t*)(plic->base + offset);
+}
+
+static volatile uint32_t* _get_context_register(const Plic* plic,
+    uint32_t context, size_t offset)
+{
+    return _get_register(plic,
+        PLIC_CONTEXT_BASE + context * PLIC_CONTEXT_STRIDE + offset);
+}
+
+static volatile uint32_t* _get_enable_register(const Plic* plic,
+    uint32_t context, uint32_t irq)
+{
+    return _get_register(plic, PLIC_ENABLE_BASE +
+        context * PLIC_ENABLE_STRIDE + (irq / 32) * sizeof(uint32_t));
+}
+
+// Expects the PLIC lock to be held.
+static void _set_enabled(const Plic* plic, uint32_t context, uint32_t irq,
+    bool is_enabled)
+{
+    volatile uint32_t* enable = _get_enable_register(plic, context, irq);
+    const uint32_t bit = UINT32_C(1) << (irq % 32);
+    if (is_enabled) {
+        *enable |= bit;
+    }
+    else {
+        *enable &= ~bit;
+    }
+}
+
+static void _enable_irq(const IrqController* controller, uint32_t irq,
+    size_t hart_index)
+{
+    Plic* plic = (Plic*)controller->tag;
+    if (hart_index >= MAX_HARTS ||
+            plic->contexts[hart_index] == PLIC_CONTEXT_NONE) {
+        dprintf("PLIC has no context for hart %zu; IRQ %u stays masked\n",
+            hart_index, irq);
+        return;
+    }
+
+    // Enable the source in exactly one context so that a single hart takes
+    // the interrupt instead of all of them racing to claim it.
+    InterruptState state = acquire_spinlock_irqsave(&plic->lock);
+    for (size_t i = 0; i < MAX_HARTS; ++i) {
+        if (plic->contexts[i] != PLIC_CONTEXT_NONE) {
+            _set_enabled(plic, plic->contexts[i], irq, i == hart_index);
+        }
+    }
+    release_spinlock_irqrestore(&plic->lock, state);
+}
+
+static void _disable_irq(const IrqController* controller, uint32_t irq)
+{
+    Plic* plic = (Plic*)controller->tag;
+    InterruptState state = acquire_spinlock_irqsave(&plic->lock);
+    for (size_t i = 0; i < MAX_HARTS; ++i) {
+        if (plic->contexts[i] != PLIC_CONTEXT_NONE) {
+            _set_enabled(plic, plic->contexts[i], irq, false);
+        }
+    }
+    release_spinlock_irqrestore(&plic->lock, state);
+}
+
+static void _set_priority(const IrqController* controller, uint32_t irq,
+    uint32_t priority)
+{
+    const Plic* plic = controller->tag;
+    *_get_register(plic, PLIC_PRIORITY_BASE + irq * sizeof(uint32_t)) =
+        priority;
+}
+
+static void _set_threshold(const IrqController* controller,
+    size_t hart_index, uint32_t threshold)
+{
+    const Plic* plic = controller->tag;
+    if (hart_index < MAX_HARTS &&
+            plic->contexts[hart_index] != PLIC_CONTEXT_NONE) {
+        *_get_context_register(plic, plic->contexts[hart_index],
+            PLIC_THRESHOLD_OFFSET) = threshold;
+    }
+}
+
+// Claiming is atomic in the PLIC, so the claim loop needs no lock.
+static void _handle(const IrqController* controller)
+{
+    const Plic* plic = controller->tag;
+    const uint32_t context = plic->contexts[get_hart_index()];
+    if (context == PLIC_CONTEXT_NONE) {
+        return;
+    }
+
+    volatile uint32_t* claim =
+        _get_context_register(plic, context, PLIC_CLAIM_OFFSET);
+    for (;;) {
+        const uint32_t irq = *claim;
+        if (irq == 0) {
+            break;
+        }
+        dispatch_irq(irq);
+        *claim = irq;
+    }
+}
+
+// Each interrupts-extended entry is a <phandle cause> pair naming the hart's
+// local interrupt controller, and its index is the PLIC context.  Only the
+// supervisor external interrupt contexts are used.
+static void _discover_contexts(Plic* plic, const FdtNode* node)
+{
+    for (size_t i = 0; i < MAX_HARTS; ++i) {
+        plic->contexts[i] = PLIC_CONTEXT_NONE;
+    }
+
+    uint64_t phandle;
+    uint64_t cause;
+    for (uint32_t context = 0; context < PLIC_MAX_CONTEXTS &&
+            read_fdt_cells(node, "interrupts-extended", 2 * context, 1,
+                &phandle) &&
+            read_fdt_cells(node, "interrupts-extended", 2 * context + 1, 1,
+                &cause); ++context) {
+        if (cause != INTERRUPT_SUPERVISOR_EXTERNAL) {
+            continue;
+        }
+        const FdtNode* intc = find_fdt_node_by_phandle((uint32_t)phandle);
+        const FdtNode* cpu_node = intc != NULL ? get_fdt_parent(intc) : NULL;
+        for (size_t j = 0; cpu_node != NULL && j < get_fdt_cpu_count(); ++j) {
+            const FdtCpu* cpu = get_fdt_cpu(j);
+            if (cpu->node != cpu_node) {
+                continue;
+            }
+            const Hart* hart = find_hart(cpu->hart_id);
+            if (hart != NULL) {
+                plic->contexts[hart->index] = context;
+            }
+            break;
+        }
+    }
+}
+
+// Priorities are WARL, so the largest one implemented reads back after
+// writing all ones.
+static uint32_t _probe_max_priority(const Plic* plic)
+{
+    volatile uint32_t* priority =
+        _get_register(plic, PLIC_PRIORITY_BASE + sizeof(uint32_t));
+    *priority = UINT32_MAX;
+    const uint32_t max_priority = *priority;
+    *priority = 0;
+    return max_priority;
+}
+
+void plic_initialize(void)
+{
+    const FdtDevice* device = find_fdt_device("riscv,plic0", NULL);
+    if (device == NULL) {
+        device = find_fdt_device("sifive,plic-1.0.0", NULL);
+    }
+    if (device == NULL) {
+        dprintf("No PLIC in FDT; external interrupts are unavailable\n");
+        return;
+    }
+
+    uint32_t source_count;
+    if (!read_fdt_u32(device->node, "riscv,ndev", &source_count) ||
+            source_count >= PLIC_MAX_SOURCES) {
+        dprintf("PLIC has no valid riscv,ndev\n");
+        return;
+    }
+
+    Plic* plic = &_plic;
+    plic->base = physical_to_virtual(device->base);
+    plic->size = device->size;
+    plic->source_count = source_count;
+    _discover_contexts(plic, device->node);
+
+    // Start from a clean state: everything masked with priority 0.
+    for (size_t i = 0; i < MAX_HARTS; ++i) {
+        if (plic->contexts[i] == PLIC_CONTEXT_NONE) {
+            continue;
+        }
+        for (uint32_t irq = 0; irq <= source_count; irq += 32) {
+            *_get_enable_register(plic, plic->contexts[i], irq) = 0;
+        }
+    }
+    for (uint32_t irq = 1; irq <= source_count; ++irq) {
+        *_get_register(plic, PLIC_PRIORITY_BASE + irq * sizeof(uint32_t)) = 0;
+    }
+
+    plic->controller = (IrqController){
+        .name = "plic",
+        .tag = plic,
+        .irq_count = source_count,
+        .max_priority = _probe_max_priority(plic),
+        .enable = _enable_irq,
+        .disable = _disable_irq,
+        .set_priority = _set_priority,
+        .set_threshold = _set_threshold,
+        .handle = _handle,
+    };
+    if (!register_irq_controller(&plic->controller)) {
+        dprintf("Unable to register the PLIC\n");
+        return;
+    }
+    dprintf("PLIC at %p with %u sources and %u priorities\n", plic->base,
+        source_count, plic->controller.max_priority);
+}
+
+void plic_finalize(void)
+{
+    deregister_irq_controller(&_plic.controller);
+}
+
+DEVICE_INITIALIZER_PRIORITY(plic, plic_initialize, DEVICE_PRIORITY_HIGH);
+DEVICE_FINALIZER(plic, plic_finalize);
@@ -0,0 +1,58 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_DEVICE_PLIC_PLIC_H
+#define KERNEL_DEVICE_PLIC_PLIC_H
+
+#include <kernel/config.h>
+#include <kernel/irq.h>
+#include <kernel/spinlock.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Register layout of the RISC-V platform-level interrupt controller
+#define PLIC_MAX_SOURCES   1024
+#define PLIC_MAX_CONTEXTS  15872
+#define PLIC_PRIORITY_BASE 0x000000  // One word per source
+#define PLIC_PENDING_BASE  0x001000  // One bit per source
+#define PLIC_ENABLE_BASE   0x002000  // One bit per source per context
+#define PLIC_ENABLE_STRIDE 0x80
+#define PLIC_CONTEXT_BASE  0x200000
+#define PLIC_CONTEXT_STRIDE 0x1000
+#define PLIC_THRESHOLD_OFFSET 0x0
+#define PLIC_CLAIM_OFFSET     0x4  // Read to claim, write to complete
+
+#define PLIC_CONTEXT_NONE UINT32_MAX
+
+typedef struct Plic
+{
+    volatile uint8_t* base;
+    size_t size;
+    uint32_t source_count;
+    uint32_t contexts[MAX_HARTS];  // Supervisor context of each hart index
+    Spinlock lock;  // Guards read-modify-write of the enable bits
+    IrqController controller;
+} Plic;
+
+void plic_initialize(void);
+void plic_finalize(void);
+
+#endif  // KERNEL_DEVICE_PLIC_PLIC_H
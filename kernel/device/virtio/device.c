@@ -0,0 +1,215 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/device/virtio/virtio.h>
+
+#include <kernel/arch/memory.h>
+#include <kernel/arch/processor.h>
+#include <kernel/device.h>
+#include <kernel/spinlock.h>
+
+#include <assert.h>
+#include <stdio.h>
+
+static VirtioDevice _devices[VIRTIO_MAX_DEVICES];
+static size_t _device_count = 0;
+static Spinlock _lock = SPINLOCK_INITIALIZER;  // Guards claiming
+
+uint32_t read_virtio_register(const VirtioDevice* device, size_t offset)
+{
+    return *(volatile uint32_t*)(device->base + offset);
+}
+
+void write_virtio_register(const VirtioDevice* device, size_t offset,
+    uint32_t value)
+{
+    *(volatile uint32_t*)(device->base + offset) = value;
+}
+
+void read_virtio_config(const VirtioDevice* device, size_t offset,
+    void* data, size_t size)
+{
+    uint8_t* bytes = data;
+    uint32_t generation;
+    do {
+        generation = read_virtio_register(device,
+            VIRTIO_MMIO_CONFIG_GENERATION);
+        for (size_t i = 0; i < size; ++i) {
+            bytes[i] = device->base[VIRTIO_MMIO_CONFIG + offset + i];
+        }
+    } while (generation != read_virtio_register(device,
+        VIRTIO_MMIO_CONFIG_GENERATION));
+}
+
+VirtioDevice* find_virtio_device(uint32_t device_id,
+    const VirtioDevice* previous)
+{
+    const size_t start = previous != NULL ? previous - _devices + 1 : 0;
+    const InterruptState state = acquire_spinlock_irqsave(&_lock);
+    VirtioDevice* found = NULL;
+    for (size_t i = start; i < _device_count && found == NULL; ++i) {
+        if (_devices[i].device_id == device_id && !_devices[i].is_claimed) {
+            found = &_devices[i];
+        }
+    }
+    release_spinlock_irqrestore(&_lock, state);
+    return found;
+}
+
+void claim_virtio_device(VirtioDevice* device)
+{
+    const InterruptState state = acquire_spinlock_irqsave(&_lock);
+    assert(!device->is_claimed);
+    device->is_claimed = true;
+    release_spinlock_irqrestore(&_lock, state);
+}
+
+static uint64_t _read_device_features(const VirtioDevice* device)
+{
+    write_virtio_register(device, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1);
+    uint64_t features =
+        read_virtio_register(device, VIRTIO_MMIO_DEVICE_FEATURES);
+    write_virtio_register(device, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0);
+    return (features << 32)
+        | read_virtio_register(device, VIRTIO_MMIO_DEVICE_FEATURES);
+}
+
+static void _write_driver_features(const VirtioDevice* device,
+    uint64_t features)
+{
+    write_virtio_register(device, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1);
+    write_virtio_register(device, VIRTIO_MMIO_DRIVER_FEATURES,
+        (uint32_t)(features >> 32));
+    write_virtio_register(device, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0);
+    write_virtio_register(device, VIRTIO_MMIO_DRIVER_FEATURES,
+        (uint32_t)features);
+}
+
+static void _add_status(const VirtioDevice* device, uint32_t status)
+{
+    write_virtio_register(device, VIRTIO_MMIO_STATUS,
+        read_virtio_register(device, VIRTIO_MMIO_STATUS) | status);
+}
+
+void reset_virtio_device(VirtioDevice* device)
+{
+    write_virtio_register(device, VIRTIO_MMIO_STATUS, 0);
+    while (read_virtio_register(device, VIRTIO_MMIO_STATUS) != 0) {
+        cpu_relax();
+    }
+    device->features = 0;
+}
+
+bool start_virtio_device(VirtioDevice* device, uint64_t features)
+{
+    reset_virtio_device(device);
+    _add_status(device, VIRTIO_STATUS_ACKNOWLEDGE);
+    _add_status(device, VIRTIO_STATUS_DRIVER);
+
+    features = (features | VIRTIO_FEATURE(VIRTIO_F_VERSION_1))
+        & _read_device_features(device);
+    if ((features & VIRTIO_FEATURE(VIRTIO_F_VERSION_1)) == 0) {
+        dprintf("Virtio device %u at %p does not support version 1\n",
+            device->device_id, (void*)device->base);
+        fail_virtio_device(device);
+        return false;
+    }
+    _write_driver_features(device, features);
+    _add_status(device, VIRTIO_STATUS_FEATURES_OK);
+    if ((read_virtio_register(device, VIRTIO_MMIO_STATUS)
+            & VIRTIO_STATUS_FEATURES_OK) == 0) {
+        dprintf("Virtio device %u at %p rejected features %llx\n",
+            device->device_id, (void*)device->base,
+            (unsigned long long)features);
+        fail_virtio_device(device);
+        return false;
+    }
+    device->features = features;
+    return true;
+}
+
+bool has_virtio_feature(const VirtioDevice* device, unsigned int bit)
+{
+    return (device->features & VIRTIO_FEATURE(bit)) != 0;
+}
+
+void finish_virtio_setup(VirtioDevice* device)
+{
+    // The queues must be set up before the device may use them.
+    device_write_barrier();
+    _add_status(device, VIRTIO_STATUS_DRIVER_OK);
+}
+
+void fail_virtio_device(VirtioDevice* device)
+{
+    _add_status(device, VIRTIO_STATUS_FAILED);
+}
+
+uint32_t acknowledge_virtio_interrupt(VirtioDevice* device)
+{
+    const uint32_t status =
+        read_virtio_register(device, VIRTIO_MMIO_INTERRUPT_STATUS);
+    if (status != 0) {
+        write_virtio_register(device, VIRTIO_MMIO_INTERRUPT_ACK, status);
+    }
+    // Rings written before the interrupt must be read after the status.
+    device_read_barrier();
+    return status;
+}
+
+void virtio_initialize(void)
+{
+    for (const FdtDevice* fdt = find_fdt_device("virtio,mmio", NULL);
+            fdt != NULL; fdt = find_fdt_device("virtio,mmio", fdt)) {
+        VirtioDevice probe = {
+            .base = physical_to_virtual(fdt->base),
+            .fdt = fdt,
+        };
+        if (read_virtio_register(&probe, VIRTIO_MMIO_MAGIC_VALUE)
+                != VIRTIO_MMIO_MAGIC) {
+            dprintf("No virtio-mmio device at %p\n", (void*)probe.base);
+            continue;
+        }
+        const uint32_t version =
+            read_virtio_register(&probe, VIRTIO_MMIO_VERSION);
+        probe.device_id = read_virtio_register(&probe, VIRTIO_MMIO_DEVICE_ID);
+        if (probe.device_id == 0) {
+            continue;  // Empty slot
+        }
+        if (version != VIRTIO_MMIO_VERSION_MODERN) {
+            dprintf("Skipping legacy virtio-mmio device %u at %p\n",
+                probe.device_id, (void*)probe.base);
+            continue;
+        }
+        if (_device_count == VIRTIO_MAX_DEVICES) {
+            dprintf("Skipping virtio device %u at %p beyond "
+                "VIRTIO_MAX_DEVICES\n", probe.device_id, (void*)probe.base);
+            continue;
+        }
+
+        reset_virtio_device(&probe);
+        _devices[_device_count] = probe;
+        ++_device_count;
+        dprintf("Virtio device %u at %p\n", probe.device_id,
+            (void*)probe.base);
+    }
+}
+
+DEVICE_INITIALIZER_PRIORITY(virtio, virtio_initialize, DEVICE_PRIORITY_HIGH);
@@ -0,0 +1,127 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_DEVICE_VIRTIO_VIRTIO_H
+#define KERNEL_DEVICE_VIRTIO_VIRTIO_H
+
+#include <kernel/fdt.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Devices found behind virtio-mmio slots.  Empty slots are skipped.
+#ifndef VIRTIO_MAX_DEVICES
+    #define VIRTIO_MAX_DEVICES 16
+#endif
+
+// Register layout of the virtio-mmio transport, version 2.  The legacy
+// version 1 layout is not supported.
+#define VIRTIO_MMIO_MAGIC_VALUE         0x000
+#define VIRTIO_MMIO_VERSION             0x004
+#define VIRTIO_MMIO_DEVICE_ID           0x008
+#define VIRTIO_MMIO_VENDOR_ID           0x00C
+#define VIRTIO_MMIO_DEVICE_FEATURES     0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES     0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_QUEUE_SEL           0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX       0x034
+#define VIRTIO_MMIO_QUEUE_NUM           0x038
+#define VIRTIO_MMIO_QUEUE_READY         0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY        0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS    0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK       0x064
+#define VIRTIO_MMIO_STATUS              0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW      0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH     0x084
+#define VIRTIO_MMIO_QUEUE_DRIVER_LOW    0x090
+#define VIRTIO_MMIO_QUEUE_DRIVER_HIGH   0x094
+#define VIRTIO_MMIO_QUEUE_DEVICE_LOW    0x0A0
+#define VIRTIO_MMIO_QUEUE_DEVICE_HIGH   0x0A4
+#define VIRTIO_MMIO_CONFIG_GENERATION   0x0FC
+#define VIRTIO_MMIO_CONFIG              0x100
+
+#define VIRTIO_MMIO_MAGIC 0x74726976  // "virt"
+#define VIRTIO_MMIO_VERSION_MODERN 2
+
+// Device status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE        0x01
+#define VIRTIO_STATUS_DRIVER             0x02
+#define VIRTIO_STATUS_DRIVER_OK          0x04
+#define VIRTIO_STATUS_FEATURES_OK        0x08
+#define VIRTIO_STATUS_DEVICE_NEEDS_RESET 0x40
+#define VIRTIO_STATUS_FAILED             0x80
+
+// Interrupt status bits
+#define VIRTIO_INTERRUPT_USED_BUFFER   0x1
+#define VIRTIO_INTERRUPT_CONFIG_CHANGE 0x2
+
+// Device-independent feature bits
+#define VIRTIO_F_INDIRECT_DESC 28
+#define VIRTIO_F_EVENT_IDX     29
+#define VIRTIO_F_VERSION_1     32
+
+// Device IDs
+#define VIRTIO_ID_NET     1
+#define VIRTIO_ID_BLOCK   2
+#define VIRTIO_ID_CONSOLE 3
+
+#define VIRTIO_FEATURE(bit) ((uint64_t)1 << (bit))
+
+typedef struct VirtioDevice
+{
+    volatile uint8_t* base;
+    const FdtDevice* fdt;
+    uint32_t device_id;
+    uint64_t features;  // Negotiated by start_virtio_device
+    bool is_claimed;  // By a driver, through claim_virtio_device
+} VirtioDevice;
+
+uint32_t read_virtio_register(const VirtioDevice* device, size_t offset);
+void write_virtio_register(const VirtioDevice* device, size_t offset,
+    uint32_t value);
+
+// Read size bytes of the device-specific configuration at offset, retrying
+// until the device reports that it did not change during the read.
+void read_virtio_config(const VirtioDevice* device, size_t offset,
+    void* data, size_t size);
+
+// Find the next unclaimed device of the given ID after previous, or the first
+// if previous is NULL.  Claiming it keeps other drivers from finding it.
+VirtioDevice* find_virtio_device(uint32_t device_id,
+    const VirtioDevice* previous);
+void claim_virtio_device(VirtioDevice* device);
+
+// Reset the device and negotiate the features that both sides support among
+// the requested ones.  VIRTIO_F_VERSION_1 is always requested.  Queues are
+// set up after this and before finish_virtio_setup.
+bool start_virtio_device(VirtioDevice* device, uint64_t features);
+bool has_virtio_feature(const VirtioDevice* device, unsigned int bit);
+void finish_virtio_setup(VirtioDevice* device);
+void fail_virtio_device(VirtioDevice* device);
+void reset_virtio_device(VirtioDevice* device);
+
+// Read and acknowledge the pending interrupt causes.
+uint32_t acknowledge_virtio_interrupt(VirtioDevice* device);
+
+void virtio_initialize(void);
+
+#endif  // KERNEL_DEVICE_VIRTIO_VIRTIO_H
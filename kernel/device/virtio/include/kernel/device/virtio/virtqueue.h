@@ -0,0 +1,132 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_DEVICE_VIRTIO_VIRTQUEUE_H
+#define KERNEL_DEVICE_VIRTIO_VIRTQUEUE_H
+
+#include <kernel/arch/memory.h>
+#include <kernel/device/virtio/virtio.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Split virtqueues.  Virtio is little-endian, as is RISC-V, so the rings are
+// accessed without byte swapping.  A virtqueue does no locking of its own.
+
+#define VIRTQ_DESC_F_NEXT  0x1  // Continues in the next field
+#define VIRTQ_DESC_F_WRITE 0x2  // Written by the device
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 0x1
+#define VIRTQ_USED_F_NO_NOTIFY     0x1
+
+typedef struct VirtqDescriptor
+{
+    uint64_t address;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+} VirtqDescriptor;
+
+// Followed by used_event when VIRTIO_F_EVENT_IDX is negotiated
+typedef struct VirtqAvailable
+{
+    uint16_t flags;
+    uint16_t index;
+    uint16_t ring[];
+} VirtqAvailable;
+
+typedef struct VirtqUsedElement
+{
+    uint32_t id;  // Head of the descriptor chain
+    uint32_t length;  // Bytes written by the device
+} VirtqUsedElement;
+
+// Followed by avail_event when VIRTIO_F_EVENT_IDX is negotiated
+typedef struct VirtqUsed
+{
+    uint16_t flags;
+    uint16_t index;
+    VirtqUsedElement ring[];
+} VirtqUsed;
+
+// One part of a buffer, which is a chain of descriptors
+typedef struct VirtqBuffer
+{
+    void* data;  // In the direct map
+    uint32_t length;
+    bool is_device_writable;
+} VirtqBuffer;
+
+typedef struct Virtqueue
+{
+    VirtioDevice* device;
+    uint16_t index;
+    uint16_t size;
+    bool has_event_index;
+    VirtqDescriptor* descriptors;
+    VirtqAvailable* available;
+    VirtqUsed* used;
+    void** tokens;  // Per chain head
+    PhysicalAddress pages;
+    size_t page_count;
+
+    uint16_t free_head;  // Free descriptors are chained through next
+    uint16_t free_count;
+    uint16_t available_index;  // Shadow of available->index
+    uint16_t notified_index;  // available_index at the last notification
+    uint16_t last_used_index;  // Next used element to pop
+    bool are_interrupts_disabled;
+} Virtqueue;
+
+// Allocate the rings for queue index of the device, with at most size
+// entries, and enable it.  Called between start_virtio_device and
+// finish_virtio_setup.
+bool initialize_virtqueue(Virtqueue* queue, VirtioDevice* device,
+    uint16_t index, uint16_t size);
+void destroy_virtqueue(Virtqueue* queue);
+
+// Make a chain of the buffers available to the device.  Returns false without
+// adding anything if there are not enough free descriptors.  The device may
+// not look at the chain until notify_virtqueue.
+bool add_virtqueue_buffers(Virtqueue* queue, const VirtqBuffer* buffers,
+    size_t count, void* token);
+
+// Tell the device about newly available chains, unless it has said that it
+// does not need to be told.  Returns whether it was notified.
+bool notify_virtqueue(Virtqueue* queue);
+
+// Take the token of the next chain that the device has used, or NULL if there
+// is none.  length receives the number of bytes the device wrote.
+void* pop_virtqueue_used(Virtqueue* queue, uint32_t* length);
+bool has_virtqueue_used(const Virtqueue* queue);
+
+static inline size_t get_virtqueue_free_count(const Virtqueue* queue)
+{
+    return queue->free_count;
+}
+
+// Ask the device to interrupt, or not, when it uses a chain.  Enabling
+// returns false if chains were used in the meantime, which the caller should
+// pop to avoid waiting for an interrupt that already passed.
+void disable_virtqueue_interrupts(Virtqueue* queue);
+bool enable_virtqueue_interrupts(Virtqueue* queue);
+
+#endif  // KERNEL_DEVICE_VIRTIO_VIRTQUEUE_H
@@ -0,0 +1,264 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/device/virtio/virtqueue.h>
+
+#include <kernel/arch/processor.h>
+#include <kernel/bitops.h>
+#include <kernel/pmm.h>
+
+#include <assert.h>
+#include <string.h>
+
+#define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~((size_t)(a) - 1))
+
+// The rings follow each other in one allocation, each aligned as the
+// specification requires, and the tokens come last.
+static size_t _get_available_offset(uint16_t size)
+{
+    return sizeof(VirtqDescriptor) * size;
+}
+
+static size_t _get_used_offset(uint16_t size)
+{
+    return ALIGN_UP(_get_available_offset(size) + sizeof(VirtqAvailable)
+        + sizeof(uint16_t) * (size + 1), 4);
+}
+
+static size_t _get_tokens_offset(uint16_t size)
+{
+    return ALIGN_UP(_get_used_offset(size) + sizeof(VirtqUsed)
+        + sizeof(VirtqUsedElement) * size + sizeof(uint16_t),
+        sizeof(void*));
+}
+
+// used_event and avail_event sit just past the rings.
+static volatile uint16_t* _get_used_event(Virtqueue* queue)
+{
+    return &queue->available->ring[queue->size];
+}
+
+static volatile uint16_t* _get_available_event(const Virtqueue* queue)
+{
+    return (volatile uint16_t*)&queue->used->ring[queue->size];
+}
+
+static void _write_address(const VirtioDevice* device, size_t low_offset,
+    const void* data)
+{
+    const uint64_t address = virtual_to_physical(data);
+    write_virtio_register(device, low_offset, (uint32_t)address);
+    write_virtio_register(device, low_offset + 4, (uint32_t)(address >> 32));
+}
+
+bool initialize_virtqueue(Virtqueue* queue, VirtioDevice* device,
+    uint16_t index, uint16_t size)
+{
+    write_virtio_register(device, VIRTIO_MMIO_QUEUE_SEL, index);
+    if (read_virtio_register(device, VIRTIO_MMIO_QUEUE_READY) != 0) {
+        return false;
+    }
+    const uint32_t max_size =
+        read_virtio_register(device, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if (max_size == 0) {
+        return false;
+    }
+    if (size > max_size) {
+        size = (uint16_t)max_size;
+    }
+    // Split queue sizes are powers of two.
+    size = (uint16_t)(1u << log2_floor(size));
+
+    const size_t bytes = _get_tokens_offset(size) + sizeof(void*) * size;
+    const size_t page_count = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    const PhysicalAddress pages =
+        allocate_contiguous_physical_pages(page_count);
+    if (pages == 0) {
+        return false;
+    }
+    uint8_t* memory = physical_to_virtual(pages);
+    memset(memory, 0, page_count * PAGE_SIZE);
+
+    *queue = (Virtqueue){
+        .device = device,
+        .index = index,
+        .size = size,
+        .has_event_index = has_virtio_feature(device, VIRTIO_F_EVENT_IDX),
+        .descriptors = (VirtqDescriptor*)memory,
+        .available =
+            (VirtqAvailable*)(memory + _get_available_offset(size)),
+        .used = (VirtqUsed*)(memory + _get_used_offset(size)),
+        .tokens = (void**)(memory + _get_tokens_offset(size)),
+        .pages = pages,
+        .page_count = page_count,
+        .free_head = 0,
+        .free_count = size,
+    };
+    for (uint16_t i = 0; i + 1 < size; ++i) {
+        queue->descriptors[i].next = i + 1;
+    }
+
+    write_virtio_register(device, VIRTIO_MMIO_QUEUE_NUM, size);
+    _write_address(device, VIRTIO_MMIO_QUEUE_DESC_LOW, queue->descriptors);
+    _write_address(device, VIRTIO_MMIO_QUEUE_DRIVER_LOW, queue->available);
+    _write_address(device, VIRTIO_MMIO_QUEUE_DEVICE_LOW, queue->used);
+    write_virtio_register(device, VIRTIO_MMIO_QUEUE_READY, 1);
+    return true;
+}
+
+void destroy_virtqueue(Virtqueue* queue)
+{
+    // The device must have been reset so that it no longer uses the rings.
+    free_contiguous_physical_pages(queue->pages, queue->page_count);
+    queue->pages = 0;
+}
+
+bool add_virtqueue_buffers(Virtqueue* queue, const VirtqBuffer* buffers,
+    size_t count, void* token)
+{
+    assert(count != 0);
+    assert(token != NULL);
+    if (count > queue->free_count) {
+        return false;
+    }
+
+    const uint16_t head = queue->free_head;
+    uint16_t last = head;
+    uint16_t index = head;
+    for (size_t i = 0; i < count; ++i) {
+        VirtqDescriptor* descriptor = &queue->descriptors[index];
+        descriptor->address = virtual_to_physical(buffers[i].data);
+        descriptor->length = buffers[i].length;
+        descriptor->flags = (i + 1 < count ? VIRTQ_DESC_F_NEXT : 0)
+            | (buffers[i].is_device_writable ? VIRTQ_DESC_F_WRITE : 0);
+        last = index;
+        index = descriptor->next;
+    }
+    queue->free_head = queue->descriptors[last].next;
+    queue->free_count -= (uint16_t)count;
+    queue->tokens[head] = token;
+
+    queue->available->ring[queue->available_index & (queue->size - 1)] =
+        head;
+    ++queue->available_index;
+    // The descriptors and ring entry must be visible before the index.
+    __atomic_store_n(&queue->available->index, queue->available_index,
+        __ATOMIC_RELEASE);
+    return true;
+}
+
+// Whether the index crossed event when it moved from old to new, following
+// vring_need_event in the specification.
+static bool _needs_event(uint16_t event, uint16_t new, uint16_t old)
+{
+    return (uint16_t)(new - event - 1) < (uint16_t)(new - old);
+}
+
+bool notify_virtqueue(Virtqueue* queue)
+{
+    const uint16_t old = queue->notified_index;
+    const uint16_t new = queue->available_index;
+    if (old == new) {
+        return false;
+    }
+    queue->notified_index = new;
+
+    // The index must be published before reading whether the device wants
+    // to be notified, or the device may go to sleep unnoticed.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    const bool needs_notification = queue->has_event_index
+        ? _needs_event(*_get_available_event(queue), new, old)
+        : (__atomic_load_n(&queue->used->flags, __ATOMIC_RELAXED)
+            & VIRTQ_USED_F_NO_NOTIFY) == 0;
+    if (needs_notification) {
+        device_write_barrier();
+        write_virtio_register(queue->device, VIRTIO_MMIO_QUEUE_NOTIFY,
+            queue->index);
+    }
+    return needs_notification;
+}
+
+bool has_virtqueue_used(const Virtqueue* queue)
+{
+    return __atomic_load_n(&queue->used->index, __ATOMIC_ACQUIRE)
+        != queue->last_used_index;
+}
+
+void* pop_virtqueue_used(Virtqueue* queue, uint32_t* length)
+{
+    if (!has_virtqueue_used(queue)) {
+        return NULL;
+    }
+
+    const VirtqUsedElement* element =
+        &queue->used->ring[queue->last_used_index & (queue->size - 1)];
+    const uint16_t head = (uint16_t)element->id;
+    assert(head < queue->size);
+    if (length != NULL) {
+        *length = element->length;
+    }
+    ++queue->last_used_index;
+    // Keep used_event just behind, where the device can never reach it.
+    if (queue->has_event_index && queue->are_interrupts_disabled) {
+        *_get_used_event(queue) = (uint16_t)(queue->last_used_index - 1);
+    }
+
+    // Return the chain to the free list.
+    uint16_t last = head;
+    uint16_t count = 1;
+    while ((queue->descriptors[last].flags & VIRTQ_DESC_F_NEXT) != 0) {
+        last = queue->descriptors[last].next;
+        ++count;
+    }
+    queue->descriptors[last].next = queue->free_head;
+    queue->free_head = head;
+    queue->free_count += count;
+
+    void* token = queue->tokens[head];
+    queue->tokens[head] = NULL;
+    return token;
+}
+
+void disable_virtqueue_interrupts(Virtqueue* queue)
+{
+    queue->are_interrupts_disabled = true;
+    if (queue->has_event_index) {
+        // The device interrupts only once the used index passes used_event,
+        // which is as far behind as it can be.
+        *_get_used_event(queue) = (uint16_t)(queue->last_used_index - 1);
+    }
+    else {
+        queue->available->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+}
+
+bool enable_virtqueue_interrupts(Virtqueue* queue)
+{
+    queue->are_interrupts_disabled = false;
+    if (queue->has_event_index) {
+        *_get_used_event(queue) = queue->last_used_index;
+    }
+    else {
+        queue->available->flags &= ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+    // The device must see the request before the used index is checked.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return !has_virtqueue_used(queue);
+}
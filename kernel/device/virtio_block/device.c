@@ -0,0 +1,466 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/device/virtio_block/virtio_block.h>
+
+#include <kernel/arch/processor.h>
+#include <kernel/config.h>
+#include <kernel/device.h>
+#include <kernel/hart.h>
+#include <kernel/irq.h>
+#include <kernel/slab.h>
+
+#include <stdio.h>
+#include <string.h>
+
+static VirtioBlock _disks[VIRTIO_BLOCK_MAX_DEVICES];
+static size_t _disk_count = 0;
+
+DEFINE_LOCK_CLASS(virtio_block_queue);
+
+static VirtioBlockQueue* _get_queue(VirtioBlock* disk)
+{
+    return &disk->queues[get_hart_index() % disk->queue_count];
+}
+
+static BlockStatus _to_block_status(uint8_t status)
+{
+    switch (status) {
+        case VIRTIO_BLOCK_S_OK:
+            return BLOCK_OK;
+        case VIRTIO_BLOCK_S_UNSUPP:
+            return BLOCK_UNSUPPORTED;
+        default:
+            return BLOCK_IO_ERROR;
+    }
+}
+
+// The helpers below expect the queue lock to be held.
+
+static bool _add_request(VirtioBlockQueue* queue, BlockRequest* request)
+{
+    const size_t part_count = request->operation == BLOCK_FLUSH ? 2 : 3;
+    if (queue->free_command == VIRTIO_BLOCK_COMMAND_NONE
+            || get_virtqueue_free_count(&queue->queue) < part_count) {
+        return false;
+    }
+
+    VirtioBlockCommand* command = &queue->commands[queue->free_command];
+    queue->free_command = command->next_free;
+    command->header = (VirtioBlockHeader){
+        .type = request->operation == BLOCK_READ ? VIRTIO_BLOCK_T_IN
+            : request->operation == BLOCK_WRITE ? VIRTIO_BLOCK_T_OUT
+            : VIRTIO_BLOCK_T_FLUSH,
+        .sector = request->sector,
+    };
+    command->request = request;
+    command->status = VIRTIO_BLOCK_S_IOERR;
+
+    VirtqBuffer parts[3];
+    size_t count = 0;
+    parts[count++] = (VirtqBuffer){
+        .data = &command->header,
+        .length = sizeof(command->header),
+        .is_device_writable = false,
+    };
+    if (request->operation != BLOCK_FLUSH) {
+        parts[count++] = (VirtqBuffer){
+            .data = request->data,
+            .length = (uint32_t)request->size,
+            .is_device_writable = request->operation == BLOCK_READ,
+        };
+    }
+    parts[count++] = (VirtqBuffer){
+        .data = &command->status,
+        .length = sizeof(command->status),
+        .is_device_writable = true,
+    };
+    add_virtqueue_buffers(&queue->queue, parts, count, command);
+    return true;
+}
+
+static size_t _pop_completions(VirtioBlock* disk, VirtioBlockQueue* queue,
+    BlockRequest** requests, BlockStatus* statuses)
+{
+    size_t count = 0;
+    for (;;) {
+        VirtioBlockCommand* command;
+        while (count < VIRTIO_BLOCK_REAP_BATCH && (command =
+                pop_virtqueue_used(&queue->queue, NULL)) != NULL) {
+            requests[count] = command->request;
+            statuses[count] = _to_block_status(command->status);
+            command->next_free = queue->free_command;
+            queue->free_command = (uint16_t)(command - queue->commands);
+            ++count;
+        }
+        // With event indices, each interrupt must be asked for again.
+        if (count == VIRTIO_BLOCK_REAP_BATCH || disk->is_polling
+                || enable_virtqueue_interrupts(&queue->queue)) {
+            break;
+        }
+    }
+    queue->statistics.completions += count;
+    return count;
+}
+
+// Make as many of the requests available as fit, with one notification.
+// Stops early at a flush that the device does not need.
+static size_t _add_requests(VirtioBlock* disk, VirtioBlockQueue* queue,
+    BlockRequest* const* requests, size_t count)
+{
+    const InterruptState state = acquire_spinlock_irqsave(&queue->lock);
+    size_t added = 0;
+    while (added < count
+            && (requests[added]->operation != BLOCK_FLUSH || disk->has_flush)
+            && _add_request(queue, requests[added])) {
+        ++added;
+    }
+    if (added != 0) {
+        queue->statistics.submissions += added;
+        ++queue->statistics.batches;
+        if (notify_virtqueue(&queue->queue)) {
+            ++queue->statistics.notifications;
+        }
+    }
+    if (added < count && requests[added]->operation != BLOCK_FLUSH) {
+        ++queue->statistics.stalls;
+    }
+    release_spinlock_irqrestore(&queue->lock, state);
+    return added;
+}
+
+// Complete the requests that the device has used, running their callbacks
+// with the queue lock released.  Without should_wait, a queue whose lock is
+// held is left to its holder.
+static size_t _reap_queue(VirtioBlock* disk, VirtioBlockQueue* queue,
+    bool should_wait)
+{
+    BlockRequest* requests[VIRTIO_BLOCK_REAP_BATCH];
+    BlockStatus statuses[VIRTIO_BLOCK_REAP_BATCH];
+    size_t total = 0;
+    size_t count;
+    do {
+        InterruptState state;
+        if (should_wait) {
+            state = acquire_spinlock_irqsave(&queue->lock);
+        }
+        else {
+            state = disable_interrupts();
+            if (!try_acquire_spinlock(&queue->lock)) {
+                restore_interrupts(state);
+                break;
+            }
+        }
+        count = _pop_completions(disk, queue, requests, statuses);
+        release_spinlock_irqrestore(&queue->lock, state);
+
+        for (size_t i = 0; i < count; ++i) {
+            complete_block_request(requests[i], statuses[i]);
+        }
+        total += count;
+    } while (count == VIRTIO_BLOCK_REAP_BATCH);
+    return total;
+}
+
+// Reap the current hart's queue, and the others if nobody else is, since a
+// thread may have moved to another hart after submitting.
+static size_t _poll(VirtioBlock* disk)
+{
+    VirtioBlockQueue* own = _get_queue(disk);
+    size_t count = _reap_queue(disk, own, true);
+    for (size_t i = 0; i < disk->queue_count; ++i) {
+        if (&disk->queues[i] != own) {
+            count += _reap_queue(disk, &disk->queues[i], false);
+        }
+    }
+    return count;
+}
+
+static size_t _submit(const BlockDevice* block, BlockRequest* const* requests,
+    size_t count)
+{
+    VirtioBlock* disk = (VirtioBlock*)block->tag;
+    VirtioBlockQueue* queue = _get_queue(disk);
+    size_t submitted = 0;
+    bool has_reaped = false;
+    while (submitted < count) {
+        // Without VIRTIO_BLK_F_FLUSH, writes are durable once they complete.
+        if (requests[submitted]->operation == BLOCK_FLUSH
+                && !disk->has_flush) {
+            complete_block_request(requests[submitted], BLOCK_OK);
+            ++submitted;
+            continue;
+        }
+
+        const size_t added = _add_requests(disk, queue, &requests[submitted],
+            count - submitted);
+        submitted += added;
+        if (added == 0) {
+            // Make room from completions that nobody has reaped yet, which
+            // is the only way to make progress while polling.
+            if (has_reaped || _reap_queue(disk, queue, true) == 0) {
+                break;
+            }
+            has_reaped = true;
+            wake_all(&disk->waiters);
+        }
+    }
+    return submitted;
+}
+
+static void _wait(const BlockDevice* block, WaitCondition condition,
+    void* data)
+{
+    VirtioBlock* disk = (VirtioBlock*)block->tag;
+    if (!__atomic_load_n(&disk->is_polling, __ATOMIC_ACQUIRE)) {
+        wait_on_queue(&disk->waiters, condition, data);
+        return;
+    }
+    while (!condition(data)) {
+        if (_poll(disk) == 0) {
+            cpu_relax();
+        }
+    }
+}
+
+static void _set_queue_interrupts(VirtioBlock* disk, bool is_enabled)
+{
+    for (size_t i = 0; i < disk->queue_count; ++i) {
+        VirtioBlockQueue* queue = &disk->queues[i];
+        const InterruptState state = acquire_spinlock_irqsave(&queue->lock);
+        if (is_enabled) {
+            enable_virtqueue_interrupts(&queue->queue);
+        }
+        else {
+            disable_virtqueue_interrupts(&queue->queue);
+        }
+        release_spinlock_irqrestore(&queue->lock, state);
+    }
+}
+
+static bool _set_polling(const BlockDevice* block, bool is_polling)
+{
+    VirtioBlock* disk = (VirtioBlock*)block->tag;
+    if (!is_polling && !disk->has_interrupt) {
+        return false;
+    }
+    __atomic_store_n(&disk->is_polling, is_polling, __ATOMIC_RELEASE);
+    _set_queue_interrupts(disk, !is_polling);
+    return true;
+}
+
+static void _handle_block_interrupt(uint32_t irq, void* data)
+{
+    (void)irq;
+    VirtioBlock* disk = data;
+    __atomic_add_fetch(&disk->interrupts, 1, __ATOMIC_RELAXED);
+    acknowledge_virtio_interrupt(disk->device);
+    size_t count = 0;
+    for (size_t i = 0; i < disk->queue_count; ++i) {
+        count += _reap_queue(disk, &disk->queues[i], true);
+    }
+    if (count != 0) {
+        wake_all(&disk->waiters);
+    }
+}
+
+void virtio_block_get_statistics(const VirtioBlock* disk,
+    size_t queue_index, VirtioBlockQueueStatistics* statistics)
+{
+    VirtioBlockQueue* queue = &disk->queues[queue_index];
+    const InterruptState state = acquire_spinlock_irqsave(&queue->lock);
+    *statistics = queue->statistics;
+    release_spinlock_irqrestore(&queue->lock, state);
+}
+
+static void _destroy_queues(VirtioBlock* disk, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        destroy_virtqueue(&disk->queues[i].queue);
+        kfree(disk->queues[i].commands);
+    }
+    kfree(disk->queues);
+    disk->queues = NULL;
+}
+
+static bool _initialize_queues(VirtioBlock* disk, size_t count)
+{
+    disk->queues = kmalloc(sizeof(VirtioBlockQueue) * count);
+    if (disk->queues == NULL) {
+        return false;
+    }
+    memset(disk->queues, 0, sizeof(VirtioBlockQueue) * count);
+
+    for (size_t i = 0; i < count; ++i) {
+        VirtioBlockQueue* queue = &disk->queues[i];
+        initialize_spinlock_in_class(&queue->lock,
+            &LOCK_CLASS_NAME(virtio_block_queue));
+        if (!initialize_virtqueue(&queue->queue, disk->device, (uint16_t)i,
+                VIRTIO_BLOCK_QUEUE_SIZE)) {
+            reset_virtio_device(disk->device);
+            _destroy_queues(disk, i);
+            return false;
+        }
+
+        // Every request takes at least two descriptors.
+        const size_t command_count = queue->queue.size / 2;
+        queue->commands = kmalloc(sizeof(VirtioBlockCommand) * command_count);
+        if (queue->commands == NULL) {
+            reset_virtio_device(disk->device);
+            _destroy_queues(disk, i + 1);
+            return false;
+        }
+        for (size_t j = 0; j < command_count; ++j) {
+            queue->commands[j].next_free = j + 1 < command_count
+                ? (uint16_t)(j + 1) : VIRTIO_BLOCK_COMMAND_NONE;
+        }
+        queue->free_command = 0;
+    }
+    disk->queue_count = count;
+    return true;
+}
+
+static bool _initialize_disk(VirtioBlock* disk, VirtioDevice* device,
+    size_t index)
+{
+    const uint64_t features = VIRTIO_FEATURE(VIRTIO_F_EVENT_IDX)
+        | VIRTIO_FEATURE(VIRTIO_BLOCK_F_SIZE_MAX)
+        | VIRTIO_FEATURE(VIRTIO_BLOCK_F_RO)
+        | VIRTIO_FEATURE(VIRTIO_BLOCK_F_BLK_SIZE)
+        | VIRTIO_FEATURE(VIRTIO_BLOCK_F_FLUSH)
+        | VIRTIO_FEATURE(VIRTIO_BLOCK_F_MQ);
+    if (!start_virtio_device(device, features)) {
+        return false;
+    }
+
+    uint64_t capacity;
+    read_virtio_config(device, VIRTIO_BLOCK_CONFIG_CAPACITY, &capacity,
+        sizeof(capacity));
+    uint32_t block_size = BLOCK_SECTOR_SIZE;
+    if (has_virtio_feature(device, VIRTIO_BLOCK_F_BLK_SIZE)) {
+        read_virtio_config(device, VIRTIO_BLOCK_CONFIG_BLK_SIZE, &block_size,
+            sizeof(block_size));
+        if (block_size < BLOCK_SECTOR_SIZE
+                || block_size % BLOCK_SECTOR_SIZE != 0) {
+            block_size = BLOCK_SECTOR_SIZE;
+        }
+    }
+    // Data is a single descriptor, which size_max bounds.
+    size_t max_transfer_size = VIRTIO_BLOCK_MAX_TRANSFER_SIZE;
+    if (has_virtio_feature(device, VIRTIO_BLOCK_F_SIZE_MAX)) {
+        uint32_t size_max;
+        read_virtio_config(device, VIRTIO_BLOCK_CONFIG_SIZE_MAX, &size_max,
+            sizeof(size_max));
+        if (size_max != 0 && size_max < max_transfer_size) {
+            max_transfer_size = size_max;
+        }
+    }
+    max_transfer_size -= max_transfer_size % block_size;
+
+    // One queue per hart, as far as the device allows
+    uint16_t queue_count = 1;
+    if (has_virtio_feature(device, VIRTIO_BLOCK_F_MQ)) {
+        read_virtio_config(device, VIRTIO_BLOCK_CONFIG_NUM_QUEUES,
+            &queue_count, sizeof(queue_count));
+        if (queue_count == 0) {
+            queue_count = 1;
+        }
+    }
+    if (queue_count > get_hart_count()) {
+        queue_count = (uint16_t)get_hart_count();
+    }
+
+    *disk = (VirtioBlock){
+        .device = device,
+        .has_flush = has_virtio_feature(device, VIRTIO_BLOCK_F_FLUSH),
+    };
+    initialize_wait_queue(&disk->waiters);
+    if (!_initialize_queues(disk, queue_count)) {
+        dprintf("Unable to set up the virtio block queues\n");
+        fail_virtio_device(device);
+        return false;
+    }
+    finish_virtio_setup(device);
+
+    disk->block = (BlockDevice){
+        .tag = disk,
+        .sector_count = capacity,
+        .block_size = block_size,
+        .max_transfer_size = max_transfer_size,
+        .queue_count = disk->queue_count,
+        .is_read_only = has_virtio_feature(device, VIRTIO_BLOCK_F_RO),
+        .submit = _submit,
+        .wait = _wait,
+        .set_polling = _set_polling,
+    };
+    snprintf(disk->block.name, sizeof(disk->block.name), "vd%c",
+        (char)('a' + index));
+
+    const FdtDevice* fdt = device->fdt;
+    disk->has_interrupt = fdt->has_irq && register_irq_handler(fdt->irq,
+        _handle_block_interrupt, disk, IRQ_HART_ANY);
+#ifdef VIRTIO_BLOCK_POLLING
+    _set_polling(&disk->block, true);
+#else
+    if (!disk->has_interrupt) {
+        _set_polling(&disk->block, true);
+    }
+#endif
+    register_block_device(&disk->block);
+
+    dprintf("Virtio block device %s at %p: %llu sectors, %u-byte blocks, "
+        "%zu queues of %u%s%s\n", disk->block.name, (void*)device->base,
+        (unsigned long long)capacity, block_size, disk->queue_count,
+        disk->queues[0].queue.size, disk->block.is_read_only ? ", read-only"
+            : "", disk->is_polling ? ", polled" : "");
+    return true;
+}
+
+void virtio_block_initialize(void)
+{
+    VirtioDevice* device = NULL;
+    while (_disk_count < VIRTIO_BLOCK_MAX_DEVICES
+            && (device = find_virtio_device(VIRTIO_ID_BLOCK, device))
+                != NULL) {
+        claim_virtio_device(device);
+        if (_initialize_disk(&_disks[_disk_count], device, _disk_count)) {
+            ++_disk_count;
+        }
+    }
+}
+
+void virtio_block_finalize(void)
+{
+    for (size_t i = 0; i < _disk_count; ++i) {
+        VirtioBlock* disk = &_disks[i];
+        deregister_block_device(&disk->block);
+        if (disk->has_interrupt) {
+            deregister_irq_handler(disk->device->fdt->irq);
+        }
+        reset_virtio_device(disk->device);
+        _destroy_queues(disk, disk->queue_count);
+        disk->queue_count = 0;
+    }
+    _disk_count = 0;
+}
+
+DEVICE_INITIALIZER_AFTER(virtio_block, virtio_block_initialize,
+    DEVICE_PRIORITY_DEFAULT, "virtio");
+DEVICE_FINALIZER(virtio_block, virtio_block_finalize);
@@ -0,0 +1,136 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_DEVICE_VIRTIO_BLOCK_VIRTIO_BLOCK_H
+#define KERNEL_DEVICE_VIRTIO_BLOCK_VIRTIO_BLOCK_H
+
+#include <kernel/arch/memory.h>
+#include <kernel/block.h>
+#include <kernel/compiler.h>
+#include <kernel/device/virtio/virtqueue.h>
+#include <kernel/spinlock.h>
+#include <kernel/wait_queue.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Feature bits
+#define VIRTIO_BLOCK_F_SIZE_MAX 1
+#define VIRTIO_BLOCK_F_RO       5
+#define VIRTIO_BLOCK_F_BLK_SIZE 6
+#define VIRTIO_BLOCK_F_FLUSH    9
+#define VIRTIO_BLOCK_F_MQ       12
+
+// Offsets in the device configuration
+#define VIRTIO_BLOCK_CONFIG_CAPACITY   0
+#define VIRTIO_BLOCK_CONFIG_SIZE_MAX   8
+#define VIRTIO_BLOCK_CONFIG_BLK_SIZE   20
+#define VIRTIO_BLOCK_CONFIG_NUM_QUEUES 34
+
+// Request types
+#define VIRTIO_BLOCK_T_IN    0
+#define VIRTIO_BLOCK_T_OUT   1
+#define VIRTIO_BLOCK_T_FLUSH 4
+
+// Request status, written by the device
+#define VIRTIO_BLOCK_S_OK     0
+#define VIRTIO_BLOCK_S_IOERR  1
+#define VIRTIO_BLOCK_S_UNSUPP 2
+
+#ifndef VIRTIO_BLOCK_MAX_DEVICES
+    #define VIRTIO_BLOCK_MAX_DEVICES 4
+#endif
+
+// Upper bound on the size of each queue.  A request takes three descriptors,
+// or two for a flush.
+#ifndef VIRTIO_BLOCK_QUEUE_SIZE
+    #define VIRTIO_BLOCK_QUEUE_SIZE 256
+#endif
+
+// Largest request, unless the device limits it further
+#ifndef VIRTIO_BLOCK_MAX_TRANSFER_SIZE
+    #define VIRTIO_BLOCK_MAX_TRANSFER_SIZE (1024 * 1024)
+#endif
+
+// Completions popped under the queue lock before their callbacks run with it
+// released
+#ifndef VIRTIO_BLOCK_REAP_BATCH
+    #define VIRTIO_BLOCK_REAP_BATCH 32
+#endif
+
+#define VIRTIO_BLOCK_COMMAND_NONE UINT16_MAX
+
+typedef struct VirtioBlockHeader
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} VirtioBlockHeader;
+
+// The parts of a request that the driver provides besides its data
+typedef struct VirtioBlockCommand
+{
+    VirtioBlockHeader header;  // Read by the device
+    BlockRequest* request;
+    uint16_t next_free;
+    uint8_t status;  // Written by the device
+} VirtioBlockCommand;
+
+typedef struct VirtioBlockQueueStatistics
+{
+    size_t submissions;  // Requests made available
+    size_t batches;  // Submissions that made requests available together
+    size_t notifications;  // Batches that the device needed to be told of
+    size_t completions;
+    size_t stalls;  // Submissions cut short by a full queue
+} VirtioBlockQueueStatistics;
+
+// Harts submit to the queue of their index modulo the queue count, so with a
+// queue per hart, submissions contend for no lock but their own.
+typedef struct VirtioBlockQueue
+{
+    Spinlock lock;  // Guards the fields below
+    Virtqueue queue;
+    VirtioBlockCommand* commands;
+    uint16_t free_command;
+    VirtioBlockQueueStatistics statistics;
+} ALIGNED(CACHE_LINE_SIZE) VirtioBlockQueue;
+
+typedef struct VirtioBlock
+{
+    BlockDevice block;
+    VirtioDevice* device;
+    VirtioBlockQueue* queues;
+    size_t queue_count;
+    bool has_flush;
+    bool has_interrupt;
+    bool is_polling;  // Completions are reaped by waiters, not interrupts
+    WaitQueue waiters;  // Woken whenever requests complete
+    size_t interrupts;
+} VirtioBlock;
+
+void virtio_block_get_statistics(const VirtioBlock* disk,
+    size_t queue_index, VirtioBlockQueueStatistics* statistics);
+
+void virtio_block_initialize(void);
+void virtio_block_finalize(void);
+
+#endif  // KERNEL_DEVICE_VIRTIO_BLOCK_VIRTIO_BLOCK_H
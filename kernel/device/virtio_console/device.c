@@ -0,0 +1,348 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/device/virtio_console/virtio_console.h>
+
+#include <kernel/arch/processor.h>
+#include <kernel/config.h>
+#include <kernel/device.h>
+#include <kernel/irq.h>
+
+#include <stdio.h>
+#include <string.h>
+
+static uint8_t _console0_tx_data[VIRTIO_CONSOLE_TX_BUFFER_SIZE];
+static uint8_t _console0_rx_data[VIRTIO_CONSOLE_RX_RING_SIZE];
+static uint8_t _console0_rx_buffers[VIRTIO_CONSOLE_RX_BUFFER_COUNT]
+    [VIRTIO_CONSOLE_RX_BUFFER_SIZE];
+
+VirtioConsole virtio_console0 = {
+    .lock = SPINLOCK_INITIALIZER,
+    .tx = {.data = _console0_tx_data, .size = VIRTIO_CONSOLE_TX_BUFFER_SIZE},
+    .rx = {.data = _console0_rx_data, .size = VIRTIO_CONSOLE_RX_RING_SIZE},
+};
+
+// The helpers below expect the console lock to be held.
+
+static void _post_rx_buffer(VirtioConsole* console, uint8_t* buffer)
+{
+    const VirtqBuffer part = {
+        .data = buffer,
+        .length = VIRTIO_CONSOLE_RX_BUFFER_SIZE,
+        .is_device_writable = true,
+    };
+    add_virtqueue_buffers(&console->rx_queue, &part, 1, buffer);
+}
+
+// Move received data into the RX ring and give the buffers back to the
+// device.  Buffers stay with the driver while the ring lacks room for a whole
+// buffer, which throttles the device until the data is read.
+static void _receive(VirtioConsole* console)
+{
+    bool is_posted = false;
+    for (;;) {
+        while (get_ring_buffer_space(&console->rx) >=
+                VIRTIO_CONSOLE_RX_BUFFER_SIZE) {
+            uint32_t length;
+            uint8_t* buffer = pop_virtqueue_used(&console->rx_queue, &length);
+            if (buffer == NULL) {
+                break;
+            }
+            if (length > VIRTIO_CONSOLE_RX_BUFFER_SIZE) {
+                length = VIRTIO_CONSOLE_RX_BUFFER_SIZE;
+            }
+            write_ring_buffer(&console->rx, buffer, length);
+            console->statistics.received += length;
+            _post_rx_buffer(console, buffer);
+            is_posted = true;
+        }
+        // With event indices, each interrupt must be asked for again.
+        if (!console->is_interrupt_driven
+                || enable_virtqueue_interrupts(&console->rx_queue)
+                || get_ring_buffer_space(&console->rx) <
+                    VIRTIO_CONSOLE_RX_BUFFER_SIZE) {
+            break;
+        }
+    }
+    if (is_posted) {
+        notify_virtqueue(&console->rx_queue);
+    }
+}
+
+// Release the runs of the TX ring that the device has consumed.  The device
+// may use them out of order, but the ring is released in order.
+static void _reclaim_tx(VirtioConsole* console)
+{
+    VirtioConsoleTxSlot* slot;
+    while ((slot = pop_virtqueue_used(&console->tx_queue, NULL)) != NULL) {
+        slot->is_done = true;
+    }
+    while (console->tx_slot_tail != console->tx_slot_head) {
+        VirtioConsoleTxSlot* oldest = &console->tx_slots[
+            console->tx_slot_tail % VIRTIO_CONSOLE_QUEUE_SIZE];
+        if (!oldest->is_done) {
+            break;
+        }
+        console->tx.tail += oldest->length;
+        ++console->tx_slot_tail;
+    }
+}
+
+static void _notify_tx(VirtioConsole* console)
+{
+    if (notify_virtqueue(&console->tx_queue)) {
+        ++console->statistics.notifications;
+    }
+}
+
+size_t virtio_console_receive(VirtioConsole* console, uint8_t* data,
+    size_t size)
+{
+    if (console == NULL || data == NULL) {
+        return 0;
+    }
+
+    const InterruptState state = acquire_spinlock_irqsave(&console->lock);
+    if (console->device == NULL) {
+        release_spinlock_irqrestore(&console->lock, state);
+        return 0;
+    }
+    _receive(console);
+    const size_t count = read_ring_buffer(&console->rx, data, size);
+    _receive(console);
+    release_spinlock_irqrestore(&console->lock, state);
+    return count;
+}
+
+// Copy the data into the TX ring and make each contiguous run available as a
+// single descriptor.  Completions are reaped here rather than through
+// interrupts.  When the ring or the queue is full, the writer waits for the
+// device with the lock dropped.
+size_t virtio_console_transmit(VirtioConsole* console, const uint8_t* data,
+    size_t size)
+{
+    if (console == NULL || data == NULL) {
+        return 0;
+    }
+
+    InterruptState state = acquire_spinlock_irqsave(&console->lock);
+    if (console->device == NULL) {
+        release_spinlock_irqrestore(&console->lock, state);
+        return 0;
+    }
+    size_t count = 0;
+    while (count < size) {
+        _reclaim_tx(console);
+        const size_t offset = console->tx.head & (console->tx.size - 1);
+        size_t length = get_ring_buffer_space(&console->tx);
+        if (length > console->tx.size - offset) {
+            length = console->tx.size - offset;
+        }
+        if (length > size - count) {
+            length = size - count;
+        }
+        if (length == 0 || get_virtqueue_free_count(&console->tx_queue) == 0) {
+            ++console->statistics.tx_stalls;
+            _notify_tx(console);
+            release_spinlock_irqrestore(&console->lock, state);
+            cpu_relax();
+            state = acquire_spinlock_irqsave(&console->lock);
+            continue;
+        }
+
+        uint8_t* run = &console->tx.data[offset];
+        memcpy(run, data + count, length);
+        VirtioConsoleTxSlot* slot = &console->tx_slots[
+            console->tx_slot_head % VIRTIO_CONSOLE_QUEUE_SIZE];
+        slot->length = length;
+        slot->is_done = false;
+        const VirtqBuffer part = {
+            .data = run,
+            .length = (uint32_t)length,
+            .is_device_writable = false,
+        };
+        add_virtqueue_buffers(&console->tx_queue, &part, 1, slot);
+        ++console->tx_slot_head;
+        console->tx.head += length;
+        console->statistics.transmitted += length;
+        ++console->statistics.submissions;
+        count += length;
+    }
+    _notify_tx(console);
+    release_spinlock_irqrestore(&console->lock, state);
+    return count;
+}
+
+void virtio_console_flush(VirtioConsole* console)
+{
+    InterruptState state = acquire_spinlock_irqsave(&console->lock);
+    if (console->device != NULL) {
+        _reclaim_tx(console);
+    }
+    while (!is_ring_buffer_empty(&console->tx)) {
+        release_spinlock_irqrestore(&console->lock, state);
+        cpu_relax();
+        state = acquire_spinlock_irqsave(&console->lock);
+        _reclaim_tx(console);
+    }
+    release_spinlock_irqrestore(&console->lock, state);
+}
+
+void virtio_console_handle_interrupt(VirtioConsole* console)
+{
+    acquire_spinlock(&console->lock);
+    ++console->statistics.interrupts;
+    acknowledge_virtio_interrupt(console->device);
+    _receive(console);
+    _reclaim_tx(console);
+    release_spinlock(&console->lock);
+}
+
+void virtio_console_get_statistics(VirtioConsole* console,
+    VirtioConsoleStatistics* statistics)
+{
+    InterruptState state = acquire_spinlock_irqsave(&console->lock);
+    *statistics = console->statistics;
+    release_spinlock_irqrestore(&console->lock, state);
+}
+
+static void _activate_console(const Console* console)
+{
+    (void)console;
+}
+
+static void _deactivate_console(const Console* console)
+{
+    (void)console;
+}
+
+static size_t _read_from_console(const Console* console, char* data,
+    size_t size)
+{
+    return virtio_console_receive((VirtioConsole*)console->tag,
+        (uint8_t*)data, size);
+}
+
+static size_t _write_to_console(const Console* console, const char* data,
+    size_t size)
+{
+    return virtio_console_transmit((VirtioConsole*)console->tag,
+        (const uint8_t*)data, size);
+}
+
+static bool _put_to_console(const Console* console, char chr)
+{
+    const uint8_t byte = (uint8_t)chr;
+    return virtio_console_transmit((VirtioConsole*)console->tag, &byte, 1)
+        == 1;
+}
+
+static const Console _console0 = {
+    .name = "hvc0",
+    .tag = &virtio_console0,
+    .priority = VIRTIO_CONSOLE_PRIORITY,
+    .activate = _activate_console,
+    .deactivate = _deactivate_console,
+    .read = _read_from_console,
+    .write = _write_to_console,
+    .put = _put_to_console,
+};
+
+static void _handle_console_interrupt(uint32_t irq, void* data)
+{
+    (void)irq;
+    virtio_console_handle_interrupt(data);
+}
+
+void virtio_console_initialize(void)
+{
+    VirtioDevice* device = find_virtio_device(VIRTIO_ID_CONSOLE, NULL);
+    if (device == NULL) {
+        return;
+    }
+    claim_virtio_device(device);
+
+    VirtioConsole* console = &virtio_console0;
+    if (!start_virtio_device(device, VIRTIO_FEATURE(VIRTIO_F_EVENT_IDX))) {
+        return;
+    }
+    if (!initialize_virtqueue(&console->rx_queue, device,
+                VIRTIO_CONSOLE_RECEIVE_QUEUE, VIRTIO_CONSOLE_QUEUE_SIZE)
+            || !initialize_virtqueue(&console->tx_queue, device,
+                VIRTIO_CONSOLE_TRANSMIT_QUEUE, VIRTIO_CONSOLE_QUEUE_SIZE)) {
+        dprintf("Unable to set up the virtio console queues\n");
+        fail_virtio_device(device);
+        return;
+    }
+
+    // Writers reap their own completions, so transmission never interrupts.
+    // Reception interrupts once the handler is registered.
+    disable_virtqueue_interrupts(&console->tx_queue);
+    disable_virtqueue_interrupts(&console->rx_queue);
+    for (size_t i = 0; i < VIRTIO_CONSOLE_RX_BUFFER_COUNT
+            && i < console->rx_queue.size; ++i) {
+        _post_rx_buffer(console, _console0_rx_buffers[i]);
+    }
+    finish_virtio_setup(device);
+    notify_virtqueue(&console->rx_queue);
+    console->device = device;
+    register_console(&_console0);
+
+    const FdtDevice* fdt = device->fdt;
+    if (fdt->has_irq && register_irq_handler(fdt->irq,
+            _handle_console_interrupt, console, IRQ_HART_ANY)) {
+        const InterruptState state = acquire_spinlock_irqsave(&console->lock);
+        console->is_interrupt_driven = true;
+        _receive(console);
+        release_spinlock_irqrestore(&console->lock, state);
+    }
+    dprintf("Virtio console at %p with %u-entry queues%s\n",
+        (void*)device->base, console->tx_queue.size,
+        has_virtio_feature(device, VIRTIO_F_EVENT_IDX) ? " and event indices"
+            : "");
+}
+
+void virtio_console_finalize(void)
+{
+    VirtioConsole* console = &virtio_console0;
+    if (console->device == NULL) {
+        return;
+    }
+
+    virtio_console_flush(console);
+    deregister_console(&_console0);
+    if (console->is_interrupt_driven) {
+        deregister_irq_handler(console->device->fdt->irq);
+    }
+
+    const InterruptState state = acquire_spinlock_irqsave(&console->lock);
+    reset_virtio_device(console->device);
+    destroy_virtqueue(&console->rx_queue);
+    destroy_virtqueue(&console->tx_queue);
+    console->tx.tail = console->tx.head;
+    console->tx_slot_tail = console->tx_slot_head;
+    console->is_interrupt_driven = false;
+    console->device = NULL;
+    release_spinlock_irqrestore(&console->lock, state);
+}
+
+DEVICE_INITIALIZER_AFTER(virtio_console, virtio_console_initialize,
+    DEVICE_PRIORITY_DEFAULT, "virtio");
+DEVICE_FINALIZER(virtio_console, virtio_console_finalize);
@@ -0,0 +1,118 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_DEVICE_VIRTIO_CONSOLE_VIRTIO_CONSOLE_H
+#define KERNEL_DEVICE_VIRTIO_CONSOLE_VIRTIO_CONSOLE_H
+
+#include <kernel/console.h>
+#include <kernel/device/virtio/virtqueue.h>
+#include <kernel/ring_buffer.h>
+#include <kernel/spinlock.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Queues of port 0, which is the only port without VIRTIO_CONSOLE_F_MULTIPORT
+#define VIRTIO_CONSOLE_RECEIVE_QUEUE  0
+#define VIRTIO_CONSOLE_TRANSMIT_QUEUE 1
+
+// Below the UART by default, so that it only becomes the active console if
+// it is the only one.  CONSOLE=virtio raises it above.
+#ifndef VIRTIO_CONSOLE_PRIORITY
+    #ifdef VIRTIO_CONSOLE_ACTIVE
+        #define VIRTIO_CONSOLE_PRIORITY CONSOLE_PRIORITY_HIGH
+    #else
+        #define VIRTIO_CONSOLE_PRIORITY CONSOLE_PRIORITY_LOW
+    #endif
+#endif
+
+// Upper bound on the size of each queue
+#ifndef VIRTIO_CONSOLE_QUEUE_SIZE
+    #define VIRTIO_CONSOLE_QUEUE_SIZE 128
+#endif
+
+// Writes are copied into the TX ring, and each contiguous run of a write
+// goes to the device as one descriptor, so a write of any size costs at most
+// two descriptors and one notification.  Must be a power of two.
+#ifndef VIRTIO_CONSOLE_TX_BUFFER_SIZE
+    #define VIRTIO_CONSOLE_TX_BUFFER_SIZE (256 * 1024)
+#endif
+
+// Receive buffers posted to the device, and the ring that holds received data
+// until it is read.  The ring size must be a power of two.
+#ifndef VIRTIO_CONSOLE_RX_BUFFER_COUNT
+    #define VIRTIO_CONSOLE_RX_BUFFER_COUNT 16
+#endif
+#ifndef VIRTIO_CONSOLE_RX_BUFFER_SIZE
+    #define VIRTIO_CONSOLE_RX_BUFFER_SIZE 256
+#endif
+#ifndef VIRTIO_CONSOLE_RX_RING_SIZE
+    #define VIRTIO_CONSOLE_RX_RING_SIZE 4096
+#endif
+
+typedef struct VirtioConsoleStatistics
+{
+    size_t interrupts;
+    size_t transmitted;  // Bytes made available to the device
+    size_t received;  // Bytes moved from receive buffers to the RX ring
+    size_t submissions;  // Descriptors made available for transmission
+    size_t notifications;  // Transmit notifications the device asked for
+    size_t tx_stalls;  // Writes that waited for the device to drain the ring
+} VirtioConsoleStatistics;
+
+// A run of the TX ring in flight, in submission order
+typedef struct VirtioConsoleTxSlot
+{
+    size_t length;
+    bool is_done;
+} VirtioConsoleTxSlot;
+
+typedef struct VirtioConsole
+{
+    VirtioDevice* device;
+    Spinlock lock;  // Guards the fields below and the queues
+    Virtqueue rx_queue;
+    Virtqueue tx_queue;
+    RingBuffer tx;  // From tail to head: data in flight
+    RingBuffer rx;  // Received data not yet read
+    VirtioConsoleTxSlot tx_slots[VIRTIO_CONSOLE_QUEUE_SIZE];
+    size_t tx_slot_head;  // Next slot to submit
+    size_t tx_slot_tail;  // Oldest slot in flight
+    bool is_interrupt_driven;
+    VirtioConsoleStatistics statistics;
+} VirtioConsole;
+
+extern VirtioConsole virtio_console0;
+
+size_t virtio_console_receive(VirtioConsole* console, uint8_t* data,
+    size_t size);
+size_t virtio_console_transmit(VirtioConsole* console, const uint8_t* data,
+    size_t size);
+// Wait until the device has consumed everything transmitted.
+void virtio_console_flush(VirtioConsole* console);
+void virtio_console_handle_interrupt(VirtioConsole* console);
+void virtio_console_get_statistics(VirtioConsole* console,
+    VirtioConsoleStatistics* statistics);
+
+void virtio_console_initialize(void);
+void virtio_console_finalize(void);
+
+#endif  // KERNEL_DEVICE_VIRTIO_CONSOLE_VIRTIO_CONSOLE_H
@@ -0,0 +1,792 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/fdt.h>
+
+#include <kernel/arch/memory.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FDT_MAGIC 0xD00DFEED
+#define FDT_VERSION 17
+#define FDT_COMPATIBLE_VERSION 16
+
+#define FDT_BEGIN_NODE 0x00000001
+#define FDT_END_NODE   0x00000002
+#define FDT_PROP       0x00000003
+#define FDT_NOP        0x00000004
+#define FDT_END        0x00000009
+
+// Defaults given by the devicetree specification for nodes that do not
+// specify #address-cells and #size-cells.
+#define FDT_DEFAULT_ADDRESS_CELLS 2
+#define FDT_DEFAULT_SIZE_CELLS    1
+
+typedef struct FdtHeader
+{
+    uint32_t magic;
+    uint32_t total_size;
+    uint32_t struct_offset;
+    uint32_t strings_offset;
+    uint32_t memory_reservation_offset;
+    uint32_t version;
+    uint32_t last_compatible_version;
+    uint32_t boot_cpu_id;
+    uint32_t strings_size;
+    uint32_t struct_size;
+} FdtHeader;
+
+static const uint8_t* _blob = NULL;
+static size_t _blob_size = 0;
+static uint32_t _boot_hart_id = 0;
+
+static FdtNode _nodes[FDT_MAX_NODES];
+static size_t _node_count = 0;
+static FdtProperty _properties[FDT_MAX_PROPERTIES];
+static size_t _property_count = 0;
+
+static FdtRange _memory_ranges[FDT_MAX_MEMORY_RANGES];
+static size_t _memory_range_count = 0;
+static FdtRange _reserved_ranges[FDT_MAX_RESERVED_RANGES];
+static size_t _reserved_range_count = 0;
+static FdtRange _initrd = {0};
+static FdtCpu _cpus[FDT_MAX_CPUS];
+static size_t _cpu_count = 0;
+static uint64_t _timebase_frequency = 0;
+static FdtDevice _devices[FDT_MAX_DEVICES];
+static size_t _device_count = 0;
+
+// The blob is big-endian and 64-bit values are only 32-bit aligned, so all
+// reads are assembled from bytes.
+static uint32_t _read_be32(const void* p)
+{
+    const uint8_t* b = p;
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) |
+        ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+}
+
+static uint64_t _read_be64(const void* p)
+{
+    const uint8_t* b = p;
+    return ((uint64_t)_read_be32(b) << 32) | _read_be32(b + 4);
+}
+
+static inline size_t _align_4(size_t x)
+{
+    return (x + 3) & ~(size_t)3;
+}
+
+static inline uint16_t _get_node_index(const FdtNode* node)
+{
+    return (uint16_t)(node - _nodes);
+}
+
+static inline const FdtNode* _get_node(uint16_t index)
+{
+    return index == FDT_INDEX_NONE ? NULL : &_nodes[index];
+}
+
+static bool _parse_header(const uint8_t* blob, FdtHeader* header)
+{
+    header->magic = _read_be32(blob + 0);
+    if (header->magic != FDT_MAGIC) {
+        dprintf("FDT has bad magic %x\n", header->magic);
+        return false;
+    }
+
+    header->total_size = _read_be32(blob + 4);
+    header->struct_offset = _read_be32(blob + 8);
+    header->strings_offset = _read_be32(blob + 12);
+    header->memory_reservation_offset = _read_be32(blob + 16);
+    header->version = _read_be32(blob + 20);
+    header->last_compatible_version = _read_be32(blob + 24);
+    header->boot_cpu_id = _read_be32(blob + 28);
+    header->strings_size = _read_be32(blob + 32);
+    header->struct_size = _read_be32(blob + 36);
+
+    if (header->version < FDT_COMPATIBLE_VERSION ||
+            header->last_compatible_version > FDT_VERSION) {
+        dprintf("FDT has incompatible version %u\n", header->version);
+        return false;
+    }
+    if (header->struct_offset + header->struct_size > header->total_size ||
+            header->strings_offset + header->strings_size >
+                header->total_size) {
+        dprintf("FDT blocks exceed the blob size\n");
+        return false;
+    }
+    return true;
+}
+
+static bool _add_property(uint16_t node_index, uint32_t name_offset,
+    uint32_t value_offset, uint32_t size)
+{
+    if (_property_count >= FDT_MAX_PROPERTIES) {
+        dprintf("FDT has more than %u properties\n", FDT_MAX_PROPERTIES);
+        return false;
+    }
+
+    FdtNode* node = &_nodes[node_index];
+    if (node->property_count == 0) {
+        node->first_property = (uint16_t)_property_count;
+    }
+    // Properties precede subnodes, so a node's properties are contiguous.
+    assert(node->first_property + node->property_count == _property_count);
+    ++node->property_count;
+
+    FdtProperty* property = &_properties[_property_count];
+    property->name_offset = name_offset;
+    property->value_offset = value_offset;
+    property->size = size;
+    ++_property_count;
+
+    const char* name = (const char*)_blob + name_offset;
+    const uint8_t* value = _blob + value_offset;
+    if (size == sizeof(uint32_t)) {
+        if (strcmp(name, "#address-cells") == 0) {
+            node->address_cells = (uint8_t)_read_be32(value);
+        }
+        else if (strcmp(name, "#size-cells") == 0) {
+            node->size_cells = (uint8_t)_read_be32(value);
+        }
+        else if (strcmp(name, "phandle") == 0 ||
+                strcmp(name, "linux,phandle") == 0) {
+            node->phandle = _read_be32(value);
+        }
+    }
+    return true;
+}
+
+static bool _parse_struct(const FdtHeader* header)
+{
+    const size_t base = header->struct_offset;
+    const size_t end = base + header->struct_size;
+    uint16_t stack[FDT_MAX_DEPTH];
+    uint16_t last_child[FDT_MAX_DEPTH];
+    size_t depth = 0;
+
+    size_t offset = base;
+    while (offset + sizeof(uint32_t) <= end) {
+        const uint32_t token = _read_be32(_blob + offset);
+        offset += sizeof(uint32_t);
+
+        switch (token) {
+            case FDT_BEGIN_NODE: {
+                if (_node_count >= FDT_MAX_NODES) {
+                    dprintf("FDT has more than %u nodes\n", FDT_MAX_NODES);
+                    return false;
+                }
+                if (depth >= FDT_MAX_DEPTH) {
+                    dprintf("FDT is deeper than %u nodes\n", FDT_MAX_DEPTH);
+                    return false;
+                }
+
+                const char* name = (const char*)_blob + offset;
+                const size_t length = strnlen(name, end - offset);
+                const uint16_t index = (uint16_t)_node_count;
+                ++_node_count;
+
+                FdtNode* node = &_nodes[index];
+                node->name_offset = (uint32_t)offset;
+                node->phandle = 0;
+                node->parent = depth == 0 ? FDT_INDEX_NONE : stack[depth - 1];
+                node->first_child = FDT_INDEX_NONE;
+                node->next_sibling = FDT_INDEX_NONE;
+                node->first_property = FDT_INDEX_NONE;
+                node->property_count = 0;
+                node->address_cells = FDT_DEFAULT_ADDRESS_CELLS;
+                node->size_cells = FDT_DEFAULT_SIZE_CELLS;
+
+                if (depth != 0) {
+                    if (last_child[depth - 1] == FDT_INDEX_NONE) {
+                        _nodes[stack[depth - 1]].first_child = index;
+                    }
+                    else {
+                        _nodes[last_child[depth - 1]].next_sibling = index;
+                    }
+                    last_child[depth - 1] = index;
+                }
+                stack[depth] = index;
+                last_child[depth] = FDT_INDEX_NONE;
+                ++depth;
+
+                offset += _align_4(length + 1);
+                break;
+            }
+
+            case FDT_END_NODE:
+                if (depth == 0) {
+                    dprintf("FDT has unbalanced END_NODE\n");
+                    return false;
+                }
+                --depth;
+                break;
+
+            case FDT_PROP: {
+                if (depth == 0 || offset + 2 * sizeof(uint32_t) > end) {
+                    dprintf("FDT has malformed property\n");
+                    return false;
+                }
+                const uint32_t size = _read_be32(_blob + offset);
+                const uint32_t name_offset = _read_be32(_blob + offset + 4);
+                offset += 2 * sizeof(uint32_t);
+                if (offset + size > end ||
+                        name_offset >= header->strings_size) {
+                    dprintf("FDT property exceeds its block\n");
+                    return false;
+                }
+                if (!_add_property(stack[depth - 1],
+                        header->strings_offset + name_offset,
+                        (uint32_t)offset, size)) {
+                    return false;
+                }
+                offset += _align_4(size);
+                break;
+            }
+
+            case FDT_NOP:
+                break;
+
+            case FDT_END:
+                return depth == 0 && _node_count != 0;
+
+            default:
+                dprintf("FDT has unknown token %x\n", token);
+                return false;
+        }
+    }
+
+    dprintf("FDT structure block is not terminated\n");
+    return false;
+}
+
+// Read a property holding a single number of one or two cells.
+static bool _read_number(const FdtNode* node, const char* name,
+    uint64_t* value)
+{
+    const FdtProperty* property = get_fdt_property(node, name);
+    if (property == NULL) {
+        return false;
+    }
+    const size_t cell_count = property->size / sizeof(uint32_t);
+    return read_fdt_cells(node, name, 0, cell_count, value);
+}
+
+static void _add_range(FdtRange* ranges, size_t* count, size_t capacity,
+    uint64_t base, uint64_t size)
+{
+    if (size == 0) {
+        return;
+    }
+    if (*count >= capacity) {
+        dprintf("FDT range %p+%p dropped: table is full\n",
+            (void*)(uintptr_t)base, (void*)(uintptr_t)size);
+        return;
+    }
+    ranges[*count].base = base;
+    ranges[*count].size = size;
+    ++*count;
+}
+
+static void _index_memory(const FdtHeader* header)
+{
+    const FdtNode* root = get_fdt_root();
+    for (const FdtNode* node = get_fdt_first_child(root); node != NULL;
+            node = get_fdt_next_sibling(node)) {
+        const char* type = read_fdt_string(node, "device_type");
+        if (type == NULL || strcmp(type, "memory") != 0) {
+            continue;
+        }
+        uint64_t base;
+        uint64_t size;
+        for (size_t i = 0; get_fdt_reg(node, i, &base, &size); ++i) {
+            _add_range(_memory_ranges, &_memory_range_count,
+                FDT_MAX_MEMORY_RANGES, base, size);
+        }
+    }
+
+    // The memory reservation block is a list of (address, size) pairs
+    // terminated by a zero pair.
+    for (size_t offset = header->memory_reservation_offset;
+            offset + 2 * sizeof(uint64_t) <= _blob_size;
+            offset += 2 * sizeof(uint64_t)) {
+        const uint64_t base = _read_be64(_blob + offset);
+        const uint64_t size = _read_be64(_blob + offset + sizeof(uint64_t));
+        if (base == 0 && size == 0) {
+            break;
+        }
+        _add_range(_reserved_ranges, &_reserved_range_count,
+            FDT_MAX_RESERVED_RANGES, base, size);
+    }
+
+    const FdtNode* reserved = find_fdt_node("/reserved-memory");
+    for (const FdtNode* node = get_fdt_first_child(reserved); node != NULL;
+            node = get_fdt_next_sibling(node)) {
+        uint64_t base;
+        uint64_t size;
+        for (size_t i = 0; get_fdt_reg(node, i, &base, &size); ++i) {
+            _add_range(_reserved_ranges, &_reserved_range_count,
+                FDT_MAX_RESERVED_RANGES, base, size);
+        }
+    }
+
+    // The blob itself must outlive the index.
+    _add_range(_reserved_ranges, &_reserved_range_count,
+        FDT_MAX_RESERVED_RANGES, virtual_to_physical(_blob), _blob_size);
+
+    // So must the initrd, which is used in place.
+    const FdtNode* chosen = find_fdt_node("/chosen");
+    uint64_t initrd_start;
+    uint64_t initrd_end;
+    if (_read_number(chosen, "linux,initrd-start", &initrd_start)
+            && _read_number(chosen, "linux,initrd-end", &initrd_end)
+            && initrd_end > initrd_start) {
+        _initrd.base = initrd_start;
+        _initrd.size = initrd_end - initrd_start;
+        _add_range(_reserved_ranges, &_reserved_range_count,
+            FDT_MAX_RESERVED_RANGES, _initrd.base, _initrd.size);
+    }
+}
+
+static void _index_cpus(void)
+{
+    const FdtNode* cpus = find_fdt_node("/cpus");
+    if (cpus == NULL) {
+        return;
+    }
+
+    uint64_t frequency;
+    if (_read_number(cpus, "timebase-frequency", &frequency)) {
+        _timebase_frequency = frequency;
+    }
+
+    for (const FdtNode* node = get_fdt_first_child(cpus); node != NULL;
+            node = get_fdt_next_sibling(node)) {
+        const char* type = read_fdt_string(node, "device_type");
+        if (type == NULL || strcmp(type, "cpu") != 0) {
+            continue;
+        }
+        const char* status = read_fdt_string(node, "status");
+        if (status != NULL && strcmp(status, "okay") != 0) {
+            continue;
+        }
+        uint64_t hart_id;
+        if (!get_fdt_reg(node, 0, &hart_id, NULL)) {
+            continue;
+        }
+        if (_cpu_count >= FDT_MAX_CPUS) {
+            dprintf("FDT hart %llu dropped: table is full\n",
+                (unsigned long long)hart_id);
+            continue;
+        }
+
+        FdtCpu* cpu = &_cpus[_cpu_count];
+        cpu->node = node;
+        cpu->hart_id = hart_id;
+        cpu->isa = read_fdt_string(node, "riscv,isa");
+        ++_cpu_count;
+
+        if (_timebase_frequency == 0 &&
+                _read_number(node, "timebase-frequency", &frequency)) {
+            _timebase_frequency = frequency;
+        }
+    }
+}
+
+static const FdtNode* _get_interrupt_parent(const FdtNode* node)
+{
+    for (; node != NULL; node = get_fdt_parent(node)) {
+        uint32_t phandle;
+        if (read_fdt_u32(node, "interrupt-parent", &phandle)) {
+            return find_fdt_node_by_phandle(phandle);
+        }
+    }
+    return NULL;
+}
+
+static void _index_devices(void)
+{
+    for (size_t i = 0; i < _node_count; ++i) {
+        const FdtNode* node = &_nodes[i];
+        if (get_fdt_property(node, "compatible") == NULL) {
+            continue;
+        }
+        const char* status = read_fdt_string(node, "status");
+        if (status != NULL && strcmp(status, "okay") != 0) {
+            continue;
+        }
+        const char* type = read_fdt_string(node, "device_type");
+        if (type != NULL && strcmp(type, "cpu") == 0) {
+            continue;
+        }
+        uint64_t base;
+        uint64_t size;
+        if (!get_fdt_reg(node, 0, &base, &size)) {
+            continue;
+        }
+        if (_device_count >= FDT_MAX_DEVICES) {
+            dprintf("FDT device %s dropped: table is full\n",
+                get_fdt_node_name(node));
+            continue;
+        }
+
+        FdtDevice* device = &_devices[_device_count];
+        device->node = node;
+        device->base = base;
+        device->size = size;
+        device->interrupt_parent = _get_interrupt_parent(node);
+        uint32_t irq;
+        device->has_irq = read_fdt_u32(node, "interrupts", &irq);
+        device->irq = device->has_irq ? irq : 0;
+        ++_device_count;
+    }
+}
+
+bool initialize_fdt(const void* blob)
+{
+    if (blob == NULL) {
+        dprintf("No FDT was provided\n");
+        return false;
+    }
+
+    FdtHeader header;
+    if (!_parse_header(blob, &header)) {
+        return false;
+    }
+
+    _blob = blob;
+    _blob_size = header.total_size;
+    _boot_hart_id = header.boot_cpu_id;
+    _node_count = 0;
+    _property_count = 0;
+    if (!_parse_struct(&header)) {
+        _blob = NULL;
+        _blob_size = 0;
+        return false;
+    }
+
+    _index_memory(&header);
+    _index_cpus();
+    _index_devices();
+
+    dprintf("FDT has %zu nodes, %zu properties, %zu harts, %zu devices\n",
+        _node_count, _property_count, _cpu_count, _device_count);
+    return true;
+}
+
+bool is_fdt_initialized(void)
+{
+    return _blob != NULL;
+}
+
+const void* get_fdt_blob(void)
+{
+    return _blob;
+}
+
+size_t get_fdt_blob_size(void)
+{
+    return _blob_size;
+}
+
+const FdtNode* get_fdt_root(void)
+{
+    return _node_count != 0 ? &_nodes[0] : NULL;
+}
+
+const FdtNode* get_fdt_parent(const FdtNode* node)
+{
+    return node != NULL ? _get_node(node->parent) : NULL;
+}
+
+const FdtNode* get_fdt_first_child(const FdtNode* node)
+{
+    return node != NULL ? _get_node(node->first_child) : NULL;
+}
+
+const FdtNode* get_fdt_next_sibling(const FdtNode* node)
+{
+    return node != NULL ? _get_node(node->next_sibling) : NULL;
+}
+
+const char* get_fdt_node_name(const FdtNode* node)
+{
+    assert(node != NULL);
+    return (const char*)_blob + node->name_offset;
+}
+
+// Compare a node name against a path component.  A component without a unit
+// address matches any unit address.
+static bool _is_node_name(const FdtNode* node, const char* component,
+    size_t length)
+{
+    const char* name = get_fdt_node_name(node);
+    if (strncmp(name, component, length) != 0) {
+        return false;
+    }
+    return name[length] == '\0' ||
+        (name[length] == '@' && memchr(component, '@', length) == NULL);
+}
+
+const FdtNode* find_fdt_node(const char* path)
+{
+    const FdtNode* node = get_fdt_root();
+    if (node == NULL || path == NULL || *path != '/') {
+        return NULL;
+    }
+
+    while (node != NULL) {
+        while (*path == '/') {
+            ++path;
+        }
+        if (*path == '\0') {
+            return node;
+        }
+
+        size_t length = 0;
+        while (path[length] != '\0' && path[length] != '/') {
+            ++length;
+        }
+
+        const FdtNode* child = get_fdt_first_child(node);
+        while (child != NULL && !_is_node_name(child, path, length)) {
+            child = get_fdt_next_sibling(child);
+        }
+        node = child;
+        path += length;
+    }
+    return NULL;
+}
+
+const FdtNode* find_fdt_node_by_phandle(uint32_t phandle)
+{
+    if (phandle == 0) {
+        return NULL;
+    }
+    for (size_t i = 0; i < _node_count; ++i) {
+        if (_nodes[i].phandle == phandle) {
+            return &_nodes[i];
+        }
+    }
+    return NULL;
+}
+
+bool is_fdt_node_compatible(const FdtNode* node, const char* compatible)
+{
+    const FdtProperty* property = get_fdt_property(node, "compatible");
+    if (property == NULL) {
+        return false;
+    }
+
+    // The value is a list of NUL-terminated strings.
+    const char* s = get_fdt_property_value(property);
+    const char* end = s + property->size;
+    while (s < end) {
+        if (strcmp(s, compatible) == 0) {
+            return true;
+        }
+        s += strnlen(s, end - s) + 1;
+    }
+    return false;
+}
+
+const FdtNode* find_fdt_compatible_node(const char* compatible,
+    const FdtNode* previous)
+{
+    size_t i = previous == NULL ? 0 : _get_node_index(previous) + 1;
+    for (; i < _node_count; ++i) {
+        if (is_fdt_node_compatible(&_nodes[i], compatible)) {
+            return &_nodes[i];
+        }
+    }
+    return NULL;
+}
+
+const FdtProperty* get_fdt_property(const FdtNode* node, const char* name)
+{
+    if (node == NULL || node->property_count == 0) {
+        return NULL;
+    }
+
+    const FdtProperty* property = &_properties[node->first_property];
+    const FdtProperty* end = property + node->property_count;
+    for (; property < end; ++property) {
+        if (strcmp(get_fdt_property_name(property), name) == 0) {
+            return property;
+        }
+    }
+    return NULL;
+}
+
+const char* get_fdt_property_name(const FdtProperty* property)
+{
+    assert(property != NULL);
+    return (const char*)_blob + property->name_offset;
+}
+
+const void* get_fdt_property_value(const FdtProperty* property)
+{
+    assert(property != NULL);
+    return _blob + property->value_offset;
+}
+
+bool read_fdt_u32(const FdtNode* node, const char* name, uint32_t* value)
+{
+    const FdtProperty* property = get_fdt_property(node, name);
+    if (property == NULL || property->size < sizeof(uint32_t)) {
+        return false;
+    }
+    *value = _read_be32(get_fdt_property_value(property));
+    return true;
+}
+
+bool read_fdt_cells(const FdtNode* node, const char* name, size_t index,
+    size_t cell_count, uint64_t* value)
+{
+    const FdtProperty* property = get_fdt_property(node, name);
+    if (property == NULL || cell_count == 0 || cell_count > 2) {
+        return false;
+    }
+
+    const size_t offset = index * cell_count * sizeof(uint32_t);
+    if (offset + cell_count * sizeof(uint32_t) > property->size) {
+        return false;
+    }
+
+    const uint8_t* cells = (const uint8_t*)get_fdt_property_value(property) +
+        offset;
+    *value = cell_count == 1 ? _read_be32(cells) : _read_be64(cells);
+    return true;
+}
+
+const char* read_fdt_string(const FdtNode* node, const char* name)
+{
+    const FdtProperty* property = get_fdt_property(node, name);
+    if (property == NULL || property->size == 0) {
+        return NULL;
+    }
+
+    const char* value = get_fdt_property_value(property);
+    return value[property->size - 1] == '\0' ? value : NULL;
+}
+
+bool get_fdt_reg(const FdtNode* node, size_t index, uint64_t* base,
+    uint64_t* size)
+{
+    const FdtNode* parent = get_fdt_parent(node);
+    if (parent == NULL) {
+        return false;
+    }
+
+    // Addresses wider than 64 bits are not supported.  Bus address
+    // translation through ranges is assumed to be the identity, as it is on
+    // qemu-virt.
+    const size_t address_cells = parent->address_cells;
+    const size_t size_cells = parent->size_cells;
+    if (address_cells == 0 || address_cells > 2 || size_cells > 2) {
+        return false;
+    }
+
+    const FdtProperty* property = get_fdt_property(node, "reg");
+    const size_t entry_size = (address_cells + size_cells) * sizeof(uint32_t);
+    if (property == NULL || (index + 1) * entry_size > property->size) {
+        return false;
+    }
+
+    const uint8_t* entry = (const uint8_t*)get_fdt_property_value(property) +
+        index * entry_size;
+    *base = address_cells == 1 ? _read_be32(entry) : _read_be64(entry);
+    if (size != NULL) {
+        entry += address_cells * sizeof(uint32_t);
+        *size = size_cells == 0
+            ? 0
+            : size_cells == 1 ? _read_be32(entry) : _read_be64(entry);
+    }
+    return true;
+}
+
+size_t get_fdt_memory_range_count(void)
+{
+    return _memory_range_count;
+}
+
+const FdtRange* get_fdt_memory_range(size_t index)
+{
+    return index < _memory_range_count ? &_memory_ranges[index] : NULL;
+}
+
+size_t get_fdt_reserved_range_count(void)
+{
+    return _reserved_range_count;
+}
+
+const FdtRange* get_fdt_reserved_range(size_t index)
+{
+    return index < _reserved_range_count ? &_reserved_ranges[index] : NULL;
+}
+
+const FdtRange* get_fdt_initrd(void)
+{
+    return _initrd.size != 0 ? &_initrd : NULL;
+}
+
+size_t get_fdt_cpu_count(void)
+{
+    return _cpu_count;
+}
+
+const FdtCpu* get_fdt_cpu(size_t index)
+{
+    return index < _cpu_count ? &_cpus[index] : NULL;
+}
+
+uint32_t get_fdt_boot_hart_id(void)
+{
+    return _boot_hart_id;
+}
+
+uint64_t get_fdt_timebase_frequency(void)
+{
+    return _timebase_frequency;
+}
+
+size_t get_fdt_device_count(void)
+{
+    return _device_count;
+}
+
+const FdtDevice* get_fdt_device(size_t index)
+{
+    return index < _device_count ? &_devices[index] : NULL;
+}
+
+const FdtDevice* find_fdt_device(const char* compatible,
+    const FdtDevice* previous)
+{
+    size_t i = previous == NULL ? 0 : (size_t)(previous - _devices) + 1;
+    for (; i < _device_count; ++i) {
+        if (is_fdt_node_compatible(_devices[i].node, compatible)) {
+            return &_devices[i];
+        }
+    }
+    return NULL;
+}
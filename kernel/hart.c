@@ -0,0 +1,114 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/hart.h>
+
+#include <kernel/arch/processor.h>
+#include <kernel/config.h>
+#include <kernel/fdt.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// The template of the Hart at the start of each per-hart area.  The linker
+// script places .percpu.hart first in the .percpu section.
+Hart hart_template LINKER_SECTION(.percpu.hart);
+
+_Static_assert(offsetof(Hart, index) == HART_INDEX_OFFSET,
+    "The entry code expects Hart.index at HART_INDEX_OFFSET");
+
+static size_t _hart_count = 1;
+
+static void _initialize_hart_area(size_t index)
+{
+    memcpy(get_hart_area(index), __percpu_start, get_per_hart_area_size());
+}
+
+size_t get_hart_count(void)
+{
+    return _hart_count;
+}
+
+// Return the started hart with the given hardware ID, or NULL if there is none.
+Hart* find_hart(size_t hart_id)
+{
+    for (size_t i = 0; i < _hart_count; ++i) {
+        Hart* hart = get_hart(i);
+        if (hart->id == hart_id) {
+            return hart;
+        }
+    }
+    return NULL;
+}
+
+void initialize_boot_hart(size_t hart_id)
+{
+    // The entry code has already copied the template into the boot hart's
+    // area and pointed the current hart at it.
+    Hart* hart = get_current_hart();
+    assert(hart == get_hart(0));
+    hart->index = 0;
+    hart->id = hart_id;
+    hart->online = true;
+}
+
+void start_secondary_harts(void)
+{
+    const size_t boot_hart_id = get_current_hart()->id;
+    for (size_t i = 0; i < get_fdt_cpu_count(); ++i) {
+        const FdtCpu* cpu = get_fdt_cpu(i);
+        if (cpu->hart_id == boot_hart_id) {
+            continue;
+        }
+        if (_hart_count >= MAX_HARTS) {
+            dprintf("Not starting hart %llu: MAX_HARTS is %u\n",
+                (unsigned long long)cpu->hart_id, MAX_HARTS);
+            continue;
+        }
+
+        const size_t index = _hart_count;
+        _initialize_hart_area(index);
+        Hart* hart = get_hart(index);
+        hart->index = index;
+        hart->id = cpu->hart_id;
+        hart->online = false;
+        if (!start_hart(hart)) {
+            dprintf("Unable to start hart %llu\n",
+                (unsigned long long)cpu->hart_id);
+            continue;
+        }
+        ++_hart_count;
+    }
+
+    for (size_t index = 1; index < _hart_count; ++index) {
+        const Hart* hart = get_hart(index);
+        while (!__atomic_load_n(&hart->online, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+    dprintf("%zu harts online\n", _hart_count);
+}
+
+void set_hart_online(void)
+{
+    __atomic_store_n(&get_current_hart()->online, true, __ATOMIC_RELEASE);
+}
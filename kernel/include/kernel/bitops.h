@@ -0,0 +1,100 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_BITOPS_H
+#define KERNEL_BITOPS_H
+
+#include <limits.h>
+#include <stdbool.h>
+
+#define BITS_PER_LONG (sizeof(unsigned long) * CHAR_BIT)
+
+// The compiler builtins for these operations lower to libgcc calls on targets
+// without native instructions, and the kernel does not link libgcc.  Targets
+// with Zbb get the builtins, which become single clz, ctz, and cpop
+// instructions; the rest get branch-light software versions.
+
+// Returns the index of the least significant set bit of x.  x must not be 0.
+static inline unsigned int find_first_set_bit(unsigned long x)
+{
+#ifdef __riscv_zbb
+    return (unsigned int)__builtin_ctzl(x);
+#else
+    unsigned int index = 0;
+    for (unsigned int shift = BITS_PER_LONG / 2; shift != 0; shift /= 2) {
+        const unsigned long mask = (1ul << shift) - 1;
+        if ((x & mask) == 0) {
+            x >>= shift;
+            index += shift;
+        }
+    }
+    return index;
+#endif
+}
+
+// Returns the index of the most significant set bit of x.  x must not be 0.
+static inline unsigned int find_last_set_bit(unsigned long x)
+{
+#ifdef __riscv_zbb
+    return (unsigned int)(BITS_PER_LONG - 1 - __builtin_clzl(x));
+#else
+    unsigned int index = 0;
+    for (unsigned int shift = BITS_PER_LONG / 2; shift != 0; shift /= 2) {
+        if ((x >> shift) != 0) {
+            x >>= shift;
+            index += shift;
+        }
+    }
+    return index;
+#endif
+}
+
+static inline unsigned int count_set_bits(unsigned long x)
+{
+#ifdef __riscv_zbb
+    return (unsigned int)__builtin_popcountl(x);
+#else
+    unsigned int count = 0;
+    while (x != 0) {
+        x &= x - 1;
+        ++count;
+    }
+    return count;
+#endif
+}
+
+static inline bool is_power_of_two(unsigned long x)
+{
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+// Returns floor(log2(x)).  x must not be 0.
+static inline unsigned int log2_floor(unsigned long x)
+{
+    return find_last_set_bit(x);
+}
+
+// Returns ceil(log2(x)).  x must not be 0.
+static inline unsigned int log2_ceil(unsigned long x)
+{
+    return x == 1 ? 0 : find_last_set_bit(x - 1) + 1;
+}
+
+#endif  // KERNEL_BITOPS_H
@@ -0,0 +1,139 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_BLOCK_H
+#define KERNEL_BLOCK_H
+
+#include <kernel/wait_queue.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLOCK_NAME_SIZE 32
+
+// Positions and capacities are in sectors of BLOCK_SECTOR_SIZE bytes,
+// whatever the block size of the device.
+#define BLOCK_SECTOR_SIZE 512
+
+// Parameters of run_block_benchmark
+#ifndef BLOCK_BENCHMARK_DURATION_NS
+    #define BLOCK_BENCHMARK_DURATION_NS 1000000000
+#endif
+#ifndef BLOCK_BENCHMARK_QUEUE_DEPTH
+    #define BLOCK_BENCHMARK_QUEUE_DEPTH 16
+#endif
+#ifndef BLOCK_BENCHMARK_REQUEST_SIZE
+    #define BLOCK_BENCHMARK_REQUEST_SIZE 4096
+#endif
+
+typedef enum BlockOperation
+{
+    BLOCK_READ,
+    BLOCK_WRITE,
+    BLOCK_FLUSH,  // Make completed writes durable
+} BlockOperation;
+
+typedef enum BlockStatus
+{
+    BLOCK_PENDING,
+    BLOCK_OK,
+    BLOCK_IO_ERROR,
+    BLOCK_INVALID,  // Out of range, misaligned, or writing a read-only device
+    BLOCK_UNSUPPORTED,
+} BlockStatus;
+
+struct BlockRequest;
+typedef void (*BlockCompletion)(struct BlockRequest* request);
+
+typedef struct BlockRequest
+{
+    BlockOperation operation;
+    uint64_t sector;
+    void* data;  // Physically contiguous, in the direct map
+    size_t size;  // A multiple of the block size
+    // Called once the status is set, possibly in interrupt context, so it
+    // must not block.  It may submit new requests.  Without a callback, the
+    // request belongs to the submitter again as soon as its status is not
+    // BLOCK_PENDING; with one, only once the callback returns.
+    BlockCompletion complete;
+    void* context;  // For the callback
+    BlockStatus status;
+} BlockRequest;
+
+typedef struct BlockDevice
+{
+    char name[BLOCK_NAME_SIZE];
+    const void* tag;
+    uint64_t sector_count;
+    uint32_t block_size;  // A multiple of BLOCK_SECTOR_SIZE
+    size_t max_transfer_size;  // Largest size of a single request
+    size_t queue_count;  // Hardware queues that submissions spread across
+    bool is_read_only;
+    // Make valid requests available to the device, in order, with as few
+    // notifications as possible.  Returns how many were taken, which is fewer
+    // than count when the current queue is full.
+    size_t (*submit)(const struct BlockDevice*, BlockRequest* const*, size_t);
+    // Block until condition(data) holds.  Completions make it true.
+    void (*wait)(const struct BlockDevice*, WaitCondition, void*);
+    // Reap completions by polling rather than interrupts, or go back.  Only
+    // switched while no requests are in flight.  Optional.
+    bool (*set_polling)(const struct BlockDevice*, bool);
+} BlockDevice;
+
+bool register_block_device(const BlockDevice* device);
+bool deregister_block_device(const BlockDevice* device);
+size_t get_block_device_count(void);
+const BlockDevice* get_block_device(size_t index);
+const BlockDevice* find_block_device(const char* name);
+
+// Submit a batch of requests.  Invalid requests are taken and completed at
+// once.  Returns how many requests were taken; the caller resubmits the rest
+// once some of its requests complete.
+size_t submit_block_requests(const BlockDevice* device,
+    BlockRequest* const* requests, size_t count);
+// Submit every request, waiting for room as needed.
+void submit_all_block_requests(const BlockDevice* device,
+    BlockRequest* const* requests, size_t count);
+// Called by drivers when a request finishes.
+void complete_block_request(BlockRequest* request, BlockStatus status);
+
+// Wait until none of the requests is pending.  Only for requests without
+// callbacks.
+void wait_for_block_requests(const BlockDevice* device,
+    BlockRequest* const* requests, size_t count);
+
+// Synchronous transfers
+BlockStatus read_block_device(const BlockDevice* device, uint64_t sector,
+    void* data, size_t size);
+BlockStatus write_block_device(const BlockDevice* device, uint64_t sector,
+    const void* data, size_t size);
+BlockStatus flush_block_device(const BlockDevice* device);
+
+bool set_block_device_polling(const BlockDevice* device, bool is_polling);
+
+// Measure random reads of BLOCK_BENCHMARK_REQUEST_SIZE bytes from one thread
+// per hart for 1, 2, 4, ... harts, keeping BLOCK_BENCHMARK_QUEUE_DEPTH
+// requests in flight per thread, with interrupts and, if the device supports
+// it, with polling.  Then measure the same reads through the block cache and
+// print its statistics.
+void run_block_benchmark(const BlockDevice* device);
+
+#endif  // KERNEL_BLOCK_H
@@ -0,0 +1,159 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_BLOCK_CACHE_H
+#define KERNEL_BLOCK_CACHE_H
+
+#include <kernel/arch/memory.h>
+#include <kernel/block.h>
+#include <kernel/list.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Blocks of devices are cached in pages, keyed by device and block number.
+// Replacement follows 2Q: a block enters a FIFO on its first access, and
+// only a block that is accessed again after falling out of the FIFO, while
+// its key is still remembered in a ghost queue, enters the main queue.  Scans
+// therefore pass through the FIFO without flushing the main queue.  The main
+// queue is swept by CLOCK, so a hit sets a bit instead of moving the block.
+#define BLOCK_CACHE_BLOCK_SIZE PAGE_SIZE
+#define BLOCK_CACHE_BLOCK_SECTORS (BLOCK_CACHE_BLOCK_SIZE / BLOCK_SECTOR_SIZE)
+
+// The cache holds up to 1/2^BLOCK_CACHE_DRAM_SHIFT of DRAM.  Pages are only
+// taken from the PMM as blocks are first cached.
+#ifndef BLOCK_CACHE_DRAM_SHIFT
+    #define BLOCK_CACHE_DRAM_SHIFT 4
+#endif
+#ifndef BLOCK_CACHE_MIN_BLOCKS
+    #define BLOCK_CACHE_MIN_BLOCKS 64
+#endif
+
+// Shares of the capacity for the FIFO and for the keys in the ghost queue,
+// in percent, as the 2Q paper recommends
+#ifndef BLOCK_CACHE_FIFO_PERCENT
+    #define BLOCK_CACHE_FIFO_PERCENT 25
+#endif
+#ifndef BLOCK_CACHE_GHOST_PERCENT
+    #define BLOCK_CACHE_GHOST_PERCENT 50
+#endif
+
+// Sequential reads of a device start a readahead window of
+// BLOCK_CACHE_READAHEAD_MIN blocks, which doubles each time half of it has
+// been consumed, up to BLOCK_CACHE_READAHEAD_MAX.
+#ifndef BLOCK_CACHE_READAHEAD_MIN
+    #define BLOCK_CACHE_READAHEAD_MIN 4
+#endif
+#ifndef BLOCK_CACHE_READAHEAD_MAX
+    #define BLOCK_CACHE_READAHEAD_MAX 32
+#endif
+
+// Dirty blocks are written back in batches of up to
+// BLOCK_CACHE_WRITEBACK_BATCH, sorted by block, followed by one flush of the
+// device.  A background thread does so every
+// BLOCK_CACHE_WRITEBACK_INTERVAL_NS.
+#ifndef BLOCK_CACHE_WRITEBACK_BATCH
+    #define BLOCK_CACHE_WRITEBACK_BATCH 64
+#endif
+#ifndef BLOCK_CACHE_WRITEBACK_INTERVAL_NS
+    #define BLOCK_CACHE_WRITEBACK_INTERVAL_NS 1000000000
+#endif
+
+// Entry flags
+#define BLOCK_CACHE_VALID      0x01  // Data matches or supersedes the device
+#define BLOCK_CACHE_DIRTY      0x02  // Data must be written back
+#define BLOCK_CACHE_LOADING    0x04  // Being read from the device
+#define BLOCK_CACHE_WRITING    0x08  // Being written to the device
+#define BLOCK_CACHE_REFERENCED 0x10  // Hit since CLOCK last passed
+#define BLOCK_CACHE_READAHEAD  0x20  // Read ahead and not yet accessed
+#define BLOCK_CACHE_ERROR      0x40  // The read failed
+
+typedef enum BlockCacheQueue
+{
+    BLOCK_CACHE_FREE,
+    BLOCK_CACHE_FIFO,
+    BLOCK_CACHE_MAIN,
+    BLOCK_CACHE_GHOST,  // Key only, without data
+} BlockCacheQueue;
+
+typedef struct BlockCacheEntry
+{
+    const BlockDevice* device;
+    uint64_t block;
+    uint8_t* data;  // A page, which free entries may keep
+    struct BlockCacheEntry* next_in_bucket;
+    ListNode node;  // In the queue of the entry, or the free list
+    ListNode dirty_node;  // In the dirty list while dirty
+    BlockRequest request;  // For reading and writing back the block
+    size_t pins;
+    unsigned int flags;
+    BlockCacheQueue queue;
+} BlockCacheEntry;
+
+typedef struct BlockCacheStatistics
+{
+    size_t capacity;  // In blocks
+    size_t cached;  // Blocks with data
+    size_t dirty;
+    size_t hits;
+    size_t misses;
+    size_t ghost_hits;  // Misses promoted straight to the main queue
+    size_t readaheads;  // Blocks read ahead
+    size_t readahead_hits;  // First accesses of blocks read ahead
+    size_t evictions;
+    size_t exhausted;  // Misses refused with no block to evict
+    size_t writebacks;  // Blocks written back
+    size_t write_batches;
+    size_t write_errors;
+    size_t flushes;  // Device flushes after write-back
+} BlockCacheStatistics;
+
+// Return the block pinned in the cache with its data read, or NULL if it
+// cannot be read.  The data stays in place until the block is released.
+// Callers serialize their own accesses to the data.  A miss also returns
+// NULL when no block can be evicted for it, because every cached block is
+// pinned or write-back fails, so callers should not hold many blocks at once.
+BlockCacheEntry* read_cached_block(const BlockDevice* device, uint64_t block);
+// Mark a pinned block for write-back after changing its data.
+void mark_cached_block_dirty(BlockCacheEntry* entry);
+void release_cached_block(BlockCacheEntry* entry);
+
+// Byte-granular access through the cache
+bool read_block_cache(const BlockDevice* device, uint64_t offset, void* data,
+    size_t size);
+bool write_block_cache(const BlockDevice* device, uint64_t offset,
+    const void* data, size_t size);
+
+// Write back the dirty blocks of the device, or of every device for NULL,
+// and flush the devices written to.  Returns false if a write failed.
+bool write_back_block_cache(const BlockDevice* device);
+// Write back and drop every block of the device once its I/O has finished.
+// Called when it is deregistered.  Returns false, dropping nothing, if a
+// block of the device is still pinned.
+bool invalidate_block_cache(const BlockDevice* device);
+
+void get_block_cache_statistics(BlockCacheStatistics* statistics);
+void print_block_cache_statistics(void);
+
+// Called on the boot hart once the scheduler is initialized.
+void initialize_block_cache(void);
+
+#endif  // KERNEL_BLOCK_CACHE_H
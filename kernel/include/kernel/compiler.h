@@ -25,5 +25,6 @@
 #define LINKER_SECTION(name) \
     __attribute__((section(LINKER_SECTION_NAME(name))))
 #define USED __attribute__((unused))
+#define ALIGNED(x) __attribute__((aligned(x)))
 
 #endif  // KERNEL_COMPILER_H
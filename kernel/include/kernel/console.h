@@ -27,14 +27,21 @@
 
 #define CONSOLE_NAME_SIZE 32
 
+// Registering a console activates it if no active console has a priority as
+// high, so the choice does not depend on the order in which devices start.
+#define CONSOLE_PRIORITY_LOW -100
+#define CONSOLE_PRIORITY_DEFAULT 0
+#define CONSOLE_PRIORITY_HIGH 100
+
 typedef struct Console
 {
     char name[CONSOLE_NAME_SIZE];
     const void* tag;
+    int priority;
     void (*activate)(const struct Console*);
     void (*deactivate)(const struct Console*);
     size_t (*read)(const struct Console*, char*, size_t);
-    size_t (*write)(const struct Console*, const char*);
+    size_t (*write)(const struct Console*, const char*, size_t);
     bool (*put)(const struct Console*, char);
 } Console;
 
@@ -49,7 +56,7 @@ bool deactivate_console(void);
 const Console* get_active_console(void);
 
 size_t read_from_console(char* data, size_t size);
-size_t write_to_console(const char* data);
+size_t write_to_console(const char* data, size_t size);
 bool put_to_console(char chr);
 
 #endif  // KERNEL_CONSOLE_H
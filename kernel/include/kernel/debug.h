@@ -21,8 +21,11 @@
 #ifndef KERNEL_DEBUG_H
 #define KERNEL_DEBUG_H
 
+#include <stddef.h>
+
 void dputc(char c);
 void dputs(const char* s);
+void dwrite(const char* data, size_t size);
 void initialize_debug(void);
 
 #endif  // KERNEL_DEBUG_H
@@ -23,12 +23,33 @@
 
 #include <kernel/compiler.h>
 
+// Device initializers run in parallel on worker threads spread across the
+// harts.  An initializer starts only after every initializer it depends on,
+// named by tag, has finished.  Among those ready to start, higher priorities
+// start first.
+#define DEVICE_PRIORITY_LOW -100
+#define DEVICE_PRIORITY_DEFAULT 0
+#define DEVICE_PRIORITY_HIGH 100
+
 #define DEVICE_INITIALIZER_NAME(tag, func) \
     device_initializer_ ## tag ## _ ## func
+#define _DEVICE_INITIALIZER(tag_, func_, priority_, dependencies_) \
+    const DeviceInitializer \
+        DEVICE_INITIALIZER_NAME(tag_, func_) USED \
+        LINKER_SECTION(.device.initializer) = { \
+            .tag = #tag_, \
+            .initialize = func_, \
+            .dependencies = dependencies_, \
+            .priority = priority_, \
+        }
 #define DEVICE_INITIALIZER(tag, func) \
-    DeviceInitializer \
-        DEVICE_INITIALIZER_NAME(tag, func) USED \
-        LINKER_SECTION(.device.initializer) = func
+    _DEVICE_INITIALIZER(tag, func, DEVICE_PRIORITY_DEFAULT, NULL)
+#define DEVICE_INITIALIZER_PRIORITY(tag, func, priority) \
+    _DEVICE_INITIALIZER(tag, func, priority, NULL)
+// The trailing arguments are the tags of the dependencies as strings.
+#define DEVICE_INITIALIZER_AFTER(tag, func, priority, ...) \
+    _DEVICE_INITIALIZER(tag, func, priority, \
+        ((const char* const[]){__VA_ARGS__, NULL}))
 
 #define DEVICE_FINALIZER_NAME(tag, func) \
     device_finalizer_ ## tag ## _ ## func
@@ -37,7 +58,14 @@
         DEVICE_FINALIZER_NAME(tag, func) USED \
         LINKER_SECTION(.device.finalizer) = func
 
-typedef void (*DeviceInitializer)(void);
+typedef struct DeviceInitializer
+{
+    const char* tag;
+    void (*initialize)(void);
+    const char* const* dependencies;  // NULL or terminated by NULL
+    int priority;
+} DeviceInitializer;
+
 typedef void (*DeviceFinalizer)(void);
 
 extern const DeviceInitializer __device_initializer_start;
@@ -46,4 +74,12 @@ extern const DeviceInitializer __device_initializer_end;
 extern const DeviceFinalizer __device_finalizer_start;
 extern const DeviceFinalizer __device_finalizer_end;
 
+// Run every device initializer and wait for all of them to finish.  Called
+// from a thread once the scheduler runs on every hart.
+void initialize_devices(void);
+void finalize_devices(void);
+
+// Print when and where each initializer ran and how long it took.
+void print_boot_timeline(void);
+
 #endif  // KERNEL_DEVICE_H
@@ -0,0 +1,143 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_FDT_H
+#define KERNEL_FDT_H
+
+#include <kernel/config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The flattened device tree is parsed once at boot into fixed-size tables.
+// Nodes and properties refer into the blob by offset, so the blob must stay
+// mapped and reserved for the lifetime of the kernel.
+#ifndef FDT_MAX_NODES
+    #define FDT_MAX_NODES 512
+#endif
+#ifndef FDT_MAX_PROPERTIES
+    #define FDT_MAX_PROPERTIES 4096
+#endif
+#ifndef FDT_MAX_DEPTH
+    #define FDT_MAX_DEPTH 16
+#endif
+#ifndef FDT_MAX_MEMORY_RANGES
+    #define FDT_MAX_MEMORY_RANGES 16
+#endif
+#ifndef FDT_MAX_RESERVED_RANGES
+    #define FDT_MAX_RESERVED_RANGES 32
+#endif
+#ifndef FDT_MAX_CPUS
+    #define FDT_MAX_CPUS 64
+#endif
+#ifndef FDT_MAX_DEVICES
+    #define FDT_MAX_DEVICES 128
+#endif
+
+#define FDT_INDEX_NONE UINT16_MAX
+
+typedef struct FdtProperty
+{
+    uint32_t name_offset;   // Offset of the name in the blob
+    uint32_t value_offset;  // Offset of the value in the blob
+    uint32_t size;
+} FdtProperty;
+
+typedef struct FdtNode
+{
+    uint32_t name_offset;  // Offset of the name in the blob
+    uint32_t phandle;      // 0 if the node has no phandle
+    uint16_t parent;
+    uint16_t first_child;
+    uint16_t next_sibling;
+    uint16_t first_property;
+    uint16_t property_count;
+    uint8_t address_cells;  // #address-cells for the children of this node
+    uint8_t size_cells;     // #size-cells for the children of this node
+} FdtNode;
+
+typedef struct FdtRange
+{
+    uint64_t base;
+    uint64_t size;
+} FdtRange;
+
+typedef struct FdtCpu
+{
+    const FdtNode* node;
+    uint64_t hart_id;
+    const char* isa;  // NULL if the node has no riscv,isa property
+} FdtCpu;
+
+typedef struct FdtDevice
+{
+    const FdtNode* node;
+    uint64_t base;  // First reg entry
+    uint64_t size;
+    uint32_t irq;   // First interrupts entry, if has_irq
+    bool has_irq;
+    const FdtNode* interrupt_parent;
+} FdtDevice;
+
+bool initialize_fdt(const void* blob);
+bool is_fdt_initialized(void);
+const void* get_fdt_blob(void);
+size_t get_fdt_blob_size(void);
+
+const FdtNode* get_fdt_root(void);
+const FdtNode* get_fdt_parent(const FdtNode* node);
+const FdtNode* get_fdt_first_child(const FdtNode* node);
+const FdtNode* get_fdt_next_sibling(const FdtNode* node);
+const char* get_fdt_node_name(const FdtNode* node);
+const FdtNode* find_fdt_node(const char* path);
+const FdtNode* find_fdt_node_by_phandle(uint32_t phandle);
+const FdtNode* find_fdt_compatible_node(const char* compatible,
+    const FdtNode* previous);
+bool is_fdt_node_compatible(const FdtNode* node, const char* compatible);
+
+const FdtProperty* get_fdt_property(const FdtNode* node, const char* name);
+const char* get_fdt_property_name(const FdtProperty* property);
+const void* get_fdt_property_value(const FdtProperty* property);
+bool read_fdt_u32(const FdtNode* node, const char* name, uint32_t* value);
+bool read_fdt_cells(const FdtNode* node, const char* name, size_t index,
+    size_t cell_count, uint64_t* value);
+const char* read_fdt_string(const FdtNode* node, const char* name);
+bool get_fdt_reg(const FdtNode* node, size_t index, uint64_t* base,
+    uint64_t* size);
+
+size_t get_fdt_memory_range_count(void);
+const FdtRange* get_fdt_memory_range(size_t index);
+size_t get_fdt_reserved_range_count(void);
+const FdtRange* get_fdt_reserved_range(size_t index);
+// The initrd from /chosen, which is also reserved, or NULL if there is none
+const FdtRange* get_fdt_initrd(void);
+
+size_t get_fdt_cpu_count(void);
+const FdtCpu* get_fdt_cpu(size_t index);
+uint32_t get_fdt_boot_hart_id(void);
+uint64_t get_fdt_timebase_frequency(void);
+
+size_t get_fdt_device_count(void);
+const FdtDevice* get_fdt_device(size_t index);
+const FdtDevice* find_fdt_device(const char* compatible,
+    const FdtDevice* previous);
+
+#endif  // KERNEL_FDT_H
@@ -0,0 +1,65 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_HART_H
+#define KERNEL_HART_H
+
+// Hart.index is at the start of every per-hart area for the entry code.
+#define HART_INDEX_OFFSET 0
+
+#ifdef __C__
+    #include <kernel/arch/hart.h>
+    #include <kernel/percpu.h>
+
+    #include <stdbool.h>
+    #include <stddef.h>
+
+    typedef struct Hart
+    {
+        size_t index;  // Dense index in [0, get_hart_count())
+        size_t id;     // Hardware hart ID
+        bool online;
+    } Hart;
+
+    // The Hart is the first object in every per-hart area.
+    static inline Hart* get_current_hart(void)
+    {
+        return get_per_hart_area();
+    }
+
+    static inline size_t get_hart_index(void)
+    {
+        return get_current_hart()->index;
+    }
+
+    static inline Hart* get_hart(size_t index)
+    {
+        return get_hart_area(index);
+    }
+
+    size_t get_hart_count(void);
+    Hart* find_hart(size_t hart_id);
+
+    void initialize_boot_hart(size_t hart_id);
+    void start_secondary_harts(void);
+    void set_hart_online(void);
+#endif
+
+#endif  // KERNEL_HART_H
@@ -0,0 +1,66 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_INITRAMFS_H
+#define KERNEL_INITRAMFS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// File types in InitramfsFile::mode
+#define INITRAMFS_MODE_TYPE_MASK 0170000
+#define INITRAMFS_MODE_DIRECTORY 0040000
+#define INITRAMFS_MODE_REGULAR 0100000
+#define INITRAMFS_MODE_SYMLINK 0120000
+
+// A file in the initramfs.  The name and data point into the archive, which
+// stays where the bootloader put it, so reading a file copies nothing.  Names
+// are relative to the root and have no leading "/" or "./"; the root itself
+// is "".
+typedef struct InitramfsFile
+{
+    const char* name;
+    size_t name_length;
+    uint64_t hash;
+    uint32_t mode;
+    const void* data;
+    size_t size;
+} InitramfsFile;
+
+// Find a file by path in O(1).  Leading "/" and "./" are ignored.
+const InitramfsFile* find_initramfs_file(const char* path);
+size_t get_initramfs_file_count(void);
+const InitramfsFile* get_initramfs_file(size_t index);
+
+static inline bool is_initramfs_directory(const InitramfsFile* file)
+{
+    return (file->mode & INITRAMFS_MODE_TYPE_MASK) == INITRAMFS_MODE_DIRECTORY;
+}
+
+static inline bool is_initramfs_regular_file(const InitramfsFile* file)
+{
+    return (file->mode & INITRAMFS_MODE_TYPE_MASK) == INITRAMFS_MODE_REGULAR;
+}
+
+// Index the cpio (newc) archive passed as the initrd, if there is one.
+void initialize_initramfs(void);
+
+#endif  // KERNEL_INITRAMFS_H
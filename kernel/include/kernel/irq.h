@@ -0,0 +1,82 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_IRQ_H
+#define KERNEL_IRQ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of IRQ numbers that can have handlers.  IRQ 0 means "no interrupt",
+// as it does for the PLIC, and cannot be registered.
+#ifndef MAX_IRQS
+    #define MAX_IRQS 128
+#endif
+
+#define IRQ_PRIORITY_DEFAULT 1
+#define IRQ_HART_ANY SIZE_MAX
+
+typedef void (*IrqHandler)(uint32_t irq, void* data);
+
+// An interrupt controller that routes device IRQs to harts.  The generic code
+// serializes calls to enable, disable, set_priority, and set_threshold.
+typedef struct IrqController
+{
+    const char* name;
+    const void* tag;
+    uint32_t irq_count;     // IRQs are in [1, irq_count]
+    uint32_t max_priority;  // Priorities are in [0, max_priority]
+    // Route the IRQ to exactly one hart and unmask it.
+    void (*enable)(const struct IrqController*, uint32_t irq,
+        size_t hart_index);
+    void (*disable)(const struct IrqController*, uint32_t irq);
+    void (*set_priority)(const struct IrqController*, uint32_t irq,
+        uint32_t priority);
+    // Mask IRQs with priority not above the threshold on the hart.
+    void (*set_threshold)(const struct IrqController*, size_t hart_index,
+        uint32_t threshold);
+    // Claim, dispatch, and complete the IRQs pending on the current hart.
+    void (*handle)(const struct IrqController*);
+} IrqController;
+
+bool register_irq_controller(const IrqController* controller);
+bool deregister_irq_controller(const IrqController* controller);
+const IrqController* get_irq_controller(void);
+
+// Handlers and their settings can be registered before the controller.  They
+// are applied once the controller registers, so device initializers may run in
+// any order.  A handler is routed to hart_index, or spread across the harts
+// in turn for IRQ_HART_ANY.
+bool register_irq_handler(uint32_t irq, IrqHandler handler, void* data,
+    size_t hart_index);
+bool deregister_irq_handler(uint32_t irq);
+bool set_irq_affinity(uint32_t irq, size_t hart_index);
+size_t get_irq_affinity(uint32_t irq);
+bool set_irq_priority(uint32_t irq, uint32_t priority);
+bool set_irq_threshold(size_t hart_index, uint32_t threshold);
+
+void dispatch_irq(uint32_t irq);
+void handle_external_interrupt(void);
+
+size_t get_irq_dispatch_count(size_t hart_index, uint32_t irq);
+void print_irq_statistics(void);
+
+#endif  // KERNEL_IRQ_H
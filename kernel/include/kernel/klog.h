@@ -0,0 +1,115 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_KLOG_H
+#define KERNEL_KLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// The kernel log defers formatting.  klog records a timestamp, the hart, the
+// format string pointer, and the raw arguments in a ring owned by the current
+// hart, and a drainer thread formats the records later.  Arguments must be
+// integers or pointers, and %s strings must outlive the record, so they are
+// best kept to string literals and other static data.
+#define KLOG_MAX_ARGUMENTS 8
+
+// Records per hart.  Must be a power of two.  A full ring drops new records.
+#ifndef KLOG_RING_SIZE
+    #define KLOG_RING_SIZE 256
+#endif
+
+// How long the drainer sleeps when the rings are empty
+#define KLOG_DRAIN_INTERVAL_NS 10000000
+
+typedef struct KlogRecord
+{
+    uint64_t time;
+    const char* format;
+    uint32_t hart_index;
+    uint32_t argument_count;
+    uint64_t arguments[KLOG_MAX_ARGUMENTS];
+} KlogRecord;
+
+// Widen an integer or pointer argument to a record word.
+#if UINTPTR_MAX == UINT64_MAX
+    #define KLOG_ARGUMENT(x) ((uint64_t)(uintptr_t)(x))
+#else
+    #define KLOG_ARGUMENT(x) \
+        _Generic((x) + 0, \
+            long long: (uint64_t)(x), \
+            unsigned long long: (uint64_t)(x), \
+            default: (uint64_t)(uintptr_t)(x))
+#endif
+
+#define _KLOG_SELECT(_1, _2, _3, _4, _5, _6, _7, _8, _9, name, ...) name
+#define _KLOG_FORMAT(format, ...) format
+#define _KLOG_ARGUMENTS_0(format)
+#define _KLOG_ARGUMENTS_1(format, a) , KLOG_ARGUMENT(a)
+#define _KLOG_ARGUMENTS_2(format, a, ...) \
+    , KLOG_ARGUMENT(a) _KLOG_ARGUMENTS_1(format, __VA_ARGS__)
+#define _KLOG_ARGUMENTS_3(format, a, ...) \
+    , KLOG_ARGUMENT(a) _KLOG_ARGUMENTS_2(format, __VA_ARGS__)
+#define _KLOG_ARGUMENTS_4(format, a, ...) \
+    , KLOG_ARGUMENT(a) _KLOG_ARGUMENTS_3(format, __VA_ARGS__)
+#define _KLOG_ARGUMENTS_5(format, a, ...) \
+    , KLOG_ARGUMENT(a) _KLOG_ARGUMENTS_4(format, __VA_ARGS__)
+#define _KLOG_ARGUMENTS_6(format, a, ...) \
+    , KLOG_ARGUMENT(a) _KLOG_ARGUMENTS_5(format, __VA_ARGS__)
+#define _KLOG_ARGUMENTS_7(format, a, ...) \
+    , KLOG_ARGUMENT(a) _KLOG_ARGUMENTS_6(format, __VA_ARGS__)
+#define _KLOG_ARGUMENTS_8(format, a, ...) \
+    , KLOG_ARGUMENT(a) _KLOG_ARGUMENTS_7(format, __VA_ARGS__)
+#define _KLOG_ARGUMENTS(...) \
+    _KLOG_SELECT(__VA_ARGS__, _KLOG_ARGUMENTS_8, _KLOG_ARGUMENTS_7, \
+        _KLOG_ARGUMENTS_6, _KLOG_ARGUMENTS_5, _KLOG_ARGUMENTS_4, \
+        _KLOG_ARGUMENTS_3, _KLOG_ARGUMENTS_2, _KLOG_ARGUMENTS_1, \
+        _KLOG_ARGUMENTS_0)(__VA_ARGS__)
+
+// klog(format, ...) takes up to KLOG_MAX_ARGUMENTS arguments.  The dead
+// dprintf lets the compiler check them against the format.  The leading 0
+// keeps the array nonempty when there are no arguments.
+#define klog(...) \
+    do { \
+        if (0) { \
+            dprintf(__VA_ARGS__); \
+        } \
+        const uint64_t _klog_arguments[] = {0 _KLOG_ARGUMENTS(__VA_ARGS__)}; \
+        record_klog(_KLOG_FORMAT(__VA_ARGS__, _), &_klog_arguments[1], \
+            sizeof(_klog_arguments) / sizeof(_klog_arguments[0]) - 1); \
+    } while (0)
+
+// Record a log entry on the current hart's ring.  Safe in any context,
+// including interrupt handlers.
+void record_klog(const char* format, const uint64_t* arguments, size_t count);
+
+// Format all pending records in timestamp order.  Returns without draining if
+// another hart is already draining.
+void drain_klog(void);
+
+// Records dropped because a ring was full or not yet allocated
+size_t get_klog_dropped_count(void);
+
+// Called on the boot hart once threads can be created.  Allocates the rings
+// and starts the drainer.
+void initialize_klog(void);
+
+#endif  // KERNEL_KLOG_H
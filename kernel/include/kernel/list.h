@@ -0,0 +1,113 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_LIST_H
+#define KERNEL_LIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Get a pointer to the structure of the given type that contains the member
+// pointed to by ptr.
+#define CONTAINER_OF(ptr, type, member) \
+    ((type*)((char*)(ptr) - offsetof(type, member)))
+
+// Intrusive circular doubly-linked list.  A List is a sentinel node; a
+// ListNode is embedded in each element.  Every operation is O(1).
+typedef struct ListNode
+{
+    struct ListNode* prev;
+    struct ListNode* next;
+} ListNode;
+
+typedef ListNode List;
+
+#define LIST_ENTRY(node, type, member) CONTAINER_OF(node, type, member)
+
+#define LIST_FOR_EACH(node, list) \
+    for (ListNode* node = (list)->next; node != (list); node = node->next)
+
+// Safe against removal of node during iteration.
+#define LIST_FOR_EACH_SAFE(node, list) \
+    for (ListNode* node = (list)->next, *_next_ ## node = node->next; \
+            node != (list); \
+            node = _next_ ## node, _next_ ## node = node->next)
+
+static inline void initialize_list(List* list)
+{
+    list->prev = list;
+    list->next = list;
+}
+
+static inline bool is_list_empty(const List* list)
+{
+    return list->next == list;
+}
+
+static inline void _insert_list_node(ListNode* node, ListNode* prev,
+    ListNode* next)
+{
+    node->prev = prev;
+    node->next = next;
+    prev->next = node;
+    next->prev = node;
+}
+
+static inline void push_list_front(List* list, ListNode* node)
+{
+    _insert_list_node(node, list, list->next);
+}
+
+static inline void push_list_back(List* list, ListNode* node)
+{
+    _insert_list_node(node, list->prev, list);
+}
+
+static inline void remove_list_node(ListNode* node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node;
+    node->next = node;
+}
+
+static inline ListNode* pop_list_front(List* list)
+{
+    if (is_list_empty(list)) {
+        return NULL;
+    }
+
+    ListNode* node = list->next;
+    remove_list_node(node);
+    return node;
+}
+
+static inline ListNode* pop_list_back(List* list)
+{
+    if (is_list_empty(list)) {
+        return NULL;
+    }
+
+    ListNode* node = list->prev;
+    remove_list_node(node);
+    return node;
+}
+
+#endif  // KERNEL_LIST_H
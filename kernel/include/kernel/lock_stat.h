@@ -0,0 +1,98 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_LOCK_STAT_H
+#define KERNEL_LOCK_STAT_H
+
+#include <kernel/arch/timer.h>
+#include <kernel/compiler.h>
+#include <kernel/config.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Locks that share a class share statistics, which are recorded only with
+// LOCK_STATISTICS.  A lock that does not name a class counts toward the
+// default class of its kind.  Times are in ticks of get_time, which is
+// synchronized across harts, so a hold may end on another hart.
+typedef struct LockClass
+{
+    const char* name;
+    uint64_t acquisitions;
+    uint64_t contentions;  // Acquisitions that had to wait
+    uint64_t wait_time;
+    uint64_t hold_time;  // Of exclusive holds only
+    uint64_t max_hold_time;
+} LockClass;
+
+#define LOCK_CLASS_NAME(name) _LOCK_CLASS_NAME(name)
+#define _LOCK_CLASS_NAME(name) lock_class_ ## name
+#define DEFINE_LOCK_CLASS(name) \
+    LockClass LOCK_CLASS_NAME(name) USED LINKER_SECTION(.lock_class) = { \
+        #name, \
+        0, \
+        0, \
+        0, \
+        0, \
+        0, \
+    }
+#define DECLARE_LOCK_CLASS(name) extern LockClass LOCK_CLASS_NAME(name)
+
+DECLARE_LOCK_CLASS(spinlock);
+DECLARE_LOCK_CLASS(mcs_lock);
+DECLARE_LOCK_CLASS(rwlock);
+
+extern LockClass __lock_class_start[];
+extern LockClass __lock_class_end[];
+
+#ifdef LOCK_STATISTICS
+
+// Returns the time of the acquisition, from which the hold is measured.
+static inline uint64_t record_lock_acquired(LockClass* class,
+    uint64_t wait_start, bool was_contended)
+{
+    const uint64_t now = get_time();
+    __atomic_fetch_add(&class->acquisitions, 1, __ATOMIC_RELAXED);
+    if (was_contended) {
+        __atomic_fetch_add(&class->contentions, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&class->wait_time, now - wait_start,
+            __ATOMIC_RELAXED);
+    }
+    return now;
+}
+
+static inline void record_lock_released(LockClass* class,
+    uint64_t acquired_at)
+{
+    const uint64_t hold_time = get_time() - acquired_at;
+    __atomic_fetch_add(&class->hold_time, hold_time, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&class->max_hold_time, __ATOMIC_RELAXED);
+    while (hold_time > max && !__atomic_compare_exchange_n(
+            &class->max_hold_time, &max, hold_time, true, __ATOMIC_RELAXED,
+            __ATOMIC_RELAXED)) {
+    }
+}
+
+#endif
+
+// Print the statistics of every class that has been acquired.
+void print_lock_statistics(void);
+
+#endif  // KERNEL_LOCK_STAT_H
@@ -0,0 +1,152 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_MCS_LOCK_H
+#define KERNEL_MCS_LOCK_H
+
+#include <kernel/arch/interrupt.h>
+#include <kernel/arch/processor.h>
+#include <kernel/lock_stat.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A queued (MCS) lock.  Each waiter spins on a flag in its own node, and the
+// holder hands the lock to the next node directly, so a release touches only
+// the next waiter's cache line however many harts are waiting.  This keeps
+// the lock fair and its throughput flat under contention, where every waiter
+// of a Spinlock would reload the line on each release.
+//
+// The node belongs to the acquirer, usually on its stack, and must stay
+// valid until the matching release.
+typedef struct McsNode
+{
+    struct McsNode* next;
+    bool is_waiting;
+} McsNode;
+
+typedef struct McsLock
+{
+    McsNode* tail;  // Last node in line, or NULL if the lock is free
+#ifdef LOCK_STATISTICS
+    LockClass* class;
+    uint64_t acquired_at;
+#endif
+} McsLock;
+
+#ifdef LOCK_STATISTICS
+    #define MCS_LOCK_CLASS_INITIALIZER(name) \
+        {.tail = NULL, .class = &LOCK_CLASS_NAME(name)}
+#else
+    #define MCS_LOCK_CLASS_INITIALIZER(name) {.tail = NULL}
+#endif
+#define MCS_LOCK_INITIALIZER MCS_LOCK_CLASS_INITIALIZER(mcs_lock)
+
+static inline void initialize_mcs_lock_in_class(McsLock* lock,
+    LockClass* class)
+{
+#ifdef LOCK_STATISTICS
+    lock->class = class;
+#else
+    (void)class;
+#endif
+    __atomic_store_n(&lock->tail, NULL, __ATOMIC_RELAXED);
+}
+
+static inline void initialize_mcs_lock(McsLock* lock)
+{
+    initialize_mcs_lock_in_class(lock, &LOCK_CLASS_NAME(mcs_lock));
+}
+
+static inline bool try_acquire_mcs_lock(McsLock* lock, McsNode* node)
+{
+    node->next = NULL;
+    McsNode* tail = NULL;
+    if (!__atomic_compare_exchange_n(&lock->tail, &tail, node, false,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+#ifdef LOCK_STATISTICS
+    lock->acquired_at = record_lock_acquired(lock->class, 0, false);
+#endif
+    return true;
+}
+
+static inline void acquire_mcs_lock(McsLock* lock, McsNode* node)
+{
+#ifdef LOCK_STATISTICS
+    const uint64_t wait_start = get_time();
+#endif
+    node->next = NULL;
+    node->is_waiting = true;
+    McsNode* previous =
+        __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (previous != NULL) {
+        // Join the line and wait for the previous holder to hand over.
+        __atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node->is_waiting, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+#ifdef LOCK_STATISTICS
+    lock->acquired_at =
+        record_lock_acquired(lock->class, wait_start, previous != NULL);
+#endif
+}
+
+static inline void release_mcs_lock(McsLock* lock, McsNode* node)
+{
+#ifdef LOCK_STATISTICS
+    record_lock_released(lock->class, lock->acquired_at);
+#endif
+    McsNode* next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (next == NULL) {
+        // Free the lock unless another hart has just swapped itself in.
+        McsNode* tail = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &tail, NULL, false,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        // It has, so wait for it to link itself behind this node.
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))
+                == NULL) {
+            cpu_relax();
+        }
+    }
+    __atomic_store_n(&next->is_waiting, false, __ATOMIC_RELEASE);
+}
+
+// Like acquire_spinlock_irqsave, for locks also taken by interrupt handlers.
+static inline InterruptState acquire_mcs_lock_irqsave(McsLock* lock,
+    McsNode* node)
+{
+    const InterruptState state = disable_interrupts();
+    acquire_mcs_lock(lock, node);
+    return state;
+}
+
+static inline void release_mcs_lock_irqrestore(McsLock* lock, McsNode* node,
+    InterruptState state)
+{
+    release_mcs_lock(lock, node);
+    restore_interrupts(state);
+}
+
+#endif  // KERNEL_MCS_LOCK_H
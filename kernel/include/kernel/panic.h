@@ -22,9 +22,15 @@
 #define KERNEL_PANIC_H
 
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdnoreturn.h>
 
-noreturn void vpanic(const char* restrict format, va_list arg);
-noreturn void panic(const char* restrict format, ...);
+noreturn void vpanic(const char* restrict format, va_list arg)
+    PRINTF_FORMAT(1, 0);
+noreturn void panic(const char* restrict format, ...) PRINTF_FORMAT(1, 2);
+
+// Report whether any hart has begun to panic.
+bool is_panicking(void);
 
 #endif  // KERNEL_PANIC_H
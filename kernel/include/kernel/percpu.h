@@ -0,0 +1,63 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_PERCPU_H
+#define KERNEL_PERCPU_H
+
+#include <kernel/arch/hart.h>
+#include <kernel/compiler.h>
+
+#include <stddef.h>
+
+// Per-hart variables are defined into the .percpu section, which is only a
+// template.  Each hart owns a copy of the section, its per-hart area, and the
+// architecture keeps the address of the current hart's area in a register.
+// Per-hart variables must be accessed through THIS_HART_PTR or HART_PTR, never
+// by name.
+#define DEFINE_PER_HART(type, name) type name LINKER_SECTION(.percpu)
+#define DECLARE_PER_HART(type, name) extern type name
+
+#define THIS_HART_PTR(variable) \
+    ((__typeof__(&(variable)))_get_per_hart_address( \
+        get_per_hart_area(), &(variable)))
+#define HART_PTR(variable, index) \
+    ((__typeof__(&(variable)))_get_per_hart_address( \
+        get_hart_area(index), &(variable)))
+
+extern char __percpu_start[];
+extern char __percpu_end[];
+extern char __percpu_areas_start[];
+
+static inline size_t get_per_hart_area_size(void)
+{
+    return (size_t)(__percpu_end - __percpu_start);
+}
+
+static inline void* get_hart_area(size_t index)
+{
+    return __percpu_areas_start + index * get_per_hart_area_size();
+}
+
+static inline void* _get_per_hart_address(void* area, const void* variable)
+{
+    return (char*)area + ((const char*)variable - __percpu_start);
+}
+
+#endif  // KERNEL_PERCPU_H
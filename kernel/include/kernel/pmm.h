@@ -25,12 +25,44 @@
 
 #include <stddef.h>
 
+// Physical memory is managed in naturally aligned blocks of 2^order pages for
+// orders in [0, PMM_ORDER_COUNT).  The largest block is 1 GiB.  Contiguous
+// allocations of a power-of-two count of pages are aligned at their size.
+#define PMM_ORDER_COUNT 19
+
+// Single-page allocations are served from a per-hart magazine of up to
+// PMM_MAGAZINE_SIZE pages.  An empty magazine is refilled, and a full one is
+// spilled, by PMM_MAGAZINE_BATCH pages through the batch interface.
+#ifndef PMM_MAGAZINE_SIZE
+    #define PMM_MAGAZINE_SIZE 64
+#endif
+#ifndef PMM_MAGAZINE_BATCH
+    #define PMM_MAGAZINE_BATCH (PMM_MAGAZINE_SIZE / 2)
+#endif
+
+typedef struct PmmMagazineStatistics
+{
+    size_t allocate_hits;    // Allocations served by the magazine
+    size_t allocate_misses;  // Allocations that found the magazine empty
+    size_t free_hits;        // Frees absorbed by the magazine
+    size_t free_misses;      // Frees that found the magazine full
+    size_t refills;          // Batches taken from the global allocator
+    size_t spills;           // Batches returned to the global allocator
+} PmmMagazineStatistics;
+
 size_t allocate_physical_pages(PhysicalAddress* addrs, size_t count);
 PhysicalAddress allocate_physical_page(void);
+PhysicalAddress allocate_contiguous_physical_pages(size_t count);
 
 void free_physical_pages(PhysicalAddress* addrs, size_t count);
 void free_physical_page(PhysicalAddress addr);
+void free_contiguous_physical_pages(PhysicalAddress addr, size_t count);
+
+void drain_pmm_magazine(void);
+void get_pmm_magazine_statistics(size_t hart_index,
+    PmmMagazineStatistics* statistics);
 
+size_t get_free_physical_page_count(void);
 size_t get_dram_size(void);
 
 void initialize_pmm(void);
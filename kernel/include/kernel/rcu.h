@@ -0,0 +1,83 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_RCU_H
+#define KERNEL_RCU_H
+
+#include <kernel/list.h>
+#include <kernel/thread.h>
+
+// Read-copy-update.  Readers of RCU-protected data take no locks and write
+// nothing shared: a read-side critical section only keeps its thread on its
+// hart.  Writers publish a new version of the data and reclaim the old one
+// after a grace period, once every hart has passed through a quiescent state
+// (a context switch, or an interrupt taken outside of any critical section)
+// and so can no longer be reading it.
+
+// How often synchronize_rcu checks for the end of the grace period
+#ifndef RCU_POLL_INTERVAL_NS
+    #define RCU_POLL_INTERVAL_NS 1000000
+#endif
+
+typedef struct RcuHead RcuHead;
+typedef void (*RcuCallback)(RcuHead* head);
+
+// Embedded in an object to be reclaimed by call_rcu
+struct RcuHead
+{
+    ListNode node;
+    RcuCallback callback;
+};
+
+// Critical sections nest and may be entered in any context, but must not
+// block or yield.
+static inline void begin_rcu_read(void)
+{
+    disable_preemption();
+}
+
+static inline void end_rcu_read(void)
+{
+    enable_preemption();
+}
+
+// Read a pointer published with publish_rcu_pointer, inside a critical
+// section.  What it points to stays valid until the section ends.
+#define read_rcu_pointer(pointer) __atomic_load_n(pointer, __ATOMIC_ACQUIRE)
+// Publish a pointer to fully initialized data.  Writers must serialize
+// among themselves.
+#define publish_rcu_pointer(pointer, value) \
+    __atomic_store_n(pointer, value, __ATOMIC_RELEASE)
+
+// Wait until every critical section that began before the call has ended.
+// Called from a thread outside of any critical section.
+void synchronize_rcu(void);
+// Call callback(head) from a thread after a grace period.  Safe in any
+// context.
+void call_rcu(RcuHead* head, RcuCallback callback);
+
+// Called by the scheduler at quiescent states with interrupts disabled.
+void report_rcu_quiescent_state(void);
+
+// Called on the boot hart after the scheduler is initialized.  Starts the
+// thread that runs callbacks.
+void initialize_rcu(void);
+
+#endif  // KERNEL_RCU_H
@@ -0,0 +1,114 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_RING_BUFFER_H
+#define KERNEL_RING_BUFFER_H
+
+#include <kernel/bitops.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte ring buffer over caller-provided storage of a power-of-two size.  The
+// head and tail run freely and are masked on access, so the buffer can be
+// completely full.  Callers provide their own synchronization.
+typedef struct RingBuffer
+{
+    uint8_t* data;
+    size_t size;
+    size_t head;  // Position of the next write
+    size_t tail;  // Position of the next read
+} RingBuffer;
+
+static inline void initialize_ring_buffer(RingBuffer* ring, uint8_t* data,
+    size_t size)
+{
+    assert(is_power_of_two(size));
+    ring->data = data;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+static inline size_t get_ring_buffer_count(const RingBuffer* ring)
+{
+    return ring->head - ring->tail;
+}
+
+static inline size_t get_ring_buffer_space(const RingBuffer* ring)
+{
+    return ring->size - get_ring_buffer_count(ring);
+}
+
+static inline bool is_ring_buffer_empty(const RingBuffer* ring)
+{
+    return ring->head == ring->tail;
+}
+
+static inline bool is_ring_buffer_full(const RingBuffer* ring)
+{
+    return get_ring_buffer_count(ring) == ring->size;
+}
+
+static inline bool push_ring_buffer(RingBuffer* ring, uint8_t value)
+{
+    if (is_ring_buffer_full(ring)) {
+        return false;
+    }
+    ring->data[ring->head & (ring->size - 1)] = value;
+    ++ring->head;
+    return true;
+}
+
+static inline bool pop_ring_buffer(RingBuffer* ring, uint8_t* value)
+{
+    if (is_ring_buffer_empty(ring)) {
+        return false;
+    }
+    *value = ring->data[ring->tail & (ring->size - 1)];
+    ++ring->tail;
+    return true;
+}
+
+// Write as much of data as fits and return the number of bytes written.
+static inline size_t write_ring_buffer(RingBuffer* ring, const uint8_t* data,
+    size_t size)
+{
+    size_t count = 0;
+    while (count < size && push_ring_buffer(ring, data[count])) {
+        ++count;
+    }
+    return count;
+}
+
+// Read up to size bytes and return the number of bytes read.
+static inline size_t read_ring_buffer(RingBuffer* ring, uint8_t* data,
+    size_t size)
+{
+    size_t count = 0;
+    while (count < size && pop_ring_buffer(ring, &data[count])) {
+        ++count;
+    }
+    return count;
+}
+
+#endif  // KERNEL_RING_BUFFER_H
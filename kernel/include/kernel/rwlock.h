@@ -0,0 +1,187 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_RWLOCK_H
+#define KERNEL_RWLOCK_H
+
+#include <kernel/arch/interrupt.h>
+#include <kernel/arch/processor.h>
+#include <kernel/lock_stat.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A reader-writer lock that admits any number of readers or one writer.  A
+// waiting writer holds off new readers, so a steady stream of readers cannot
+// starve it.
+#define RWLOCK_WRITER 1u
+#define RWLOCK_WRITER_WAITING 2u
+#define RWLOCK_READER 4u  // Readers are counted in the bits above
+
+typedef struct RwLock
+{
+    uint32_t state;
+#ifdef LOCK_STATISTICS
+    LockClass* class;
+    uint64_t acquired_at;  // By the writer
+#endif
+} RwLock;
+
+#ifdef LOCK_STATISTICS
+    #define RWLOCK_CLASS_INITIALIZER(name) \
+        {.state = 0, .class = &LOCK_CLASS_NAME(name)}
+#else
+    #define RWLOCK_CLASS_INITIALIZER(name) {.state = 0}
+#endif
+#define RWLOCK_INITIALIZER RWLOCK_CLASS_INITIALIZER(rwlock)
+
+static inline void initialize_rwlock_in_class(RwLock* lock, LockClass* class)
+{
+#ifdef LOCK_STATISTICS
+    lock->class = class;
+#else
+    (void)class;
+#endif
+    __atomic_store_n(&lock->state, 0, __ATOMIC_RELAXED);
+}
+
+static inline void initialize_rwlock(RwLock* lock)
+{
+    initialize_rwlock_in_class(lock, &LOCK_CLASS_NAME(rwlock));
+}
+
+static inline bool try_acquire_rwlock_read(RwLock* lock)
+{
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    while ((state & (RWLOCK_WRITER | RWLOCK_WRITER_WAITING)) == 0) {
+        if (__atomic_compare_exchange_n(&lock->state, &state,
+                state + RWLOCK_READER, true, __ATOMIC_ACQUIRE,
+                __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline void acquire_rwlock_read(RwLock* lock)
+{
+#ifdef LOCK_STATISTICS
+    const uint64_t wait_start = get_time();
+#endif
+    bool was_contended = false;
+    while (!try_acquire_rwlock_read(lock)) {
+        was_contended = true;
+        cpu_relax();
+    }
+#ifdef LOCK_STATISTICS
+    record_lock_acquired(lock->class, wait_start, was_contended);
+#else
+    (void)was_contended;
+#endif
+}
+
+static inline void release_rwlock_read(RwLock* lock)
+{
+    __atomic_fetch_sub(&lock->state, RWLOCK_READER, __ATOMIC_RELEASE);
+}
+
+static inline bool try_acquire_rwlock_write(RwLock* lock)
+{
+    // A waiting bit may be left by another writer, which sets it again.
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    if ((state & ~RWLOCK_WRITER_WAITING) != 0
+            || !__atomic_compare_exchange_n(&lock->state, &state,
+                RWLOCK_WRITER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+#ifdef LOCK_STATISTICS
+    lock->acquired_at = record_lock_acquired(lock->class, 0, false);
+#endif
+    return true;
+}
+
+static inline void acquire_rwlock_write(RwLock* lock)
+{
+#ifdef LOCK_STATISTICS
+    const uint64_t wait_start = get_time();
+#endif
+    bool was_contended = false;
+    for (;;) {
+        uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if ((state & ~RWLOCK_WRITER_WAITING) == 0) {
+            if (__atomic_compare_exchange_n(&lock->state, &state,
+                    RWLOCK_WRITER, false, __ATOMIC_ACQUIRE,
+                    __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if ((state & RWLOCK_WRITER_WAITING) == 0) {
+            __atomic_fetch_or(&lock->state, RWLOCK_WRITER_WAITING,
+                __ATOMIC_RELAXED);
+        }
+        was_contended = true;
+        cpu_relax();
+    }
+#ifdef LOCK_STATISTICS
+    lock->acquired_at =
+        record_lock_acquired(lock->class, wait_start, was_contended);
+#else
+    (void)was_contended;
+#endif
+}
+
+static inline void release_rwlock_write(RwLock* lock)
+{
+#ifdef LOCK_STATISTICS
+    record_lock_released(lock->class, lock->acquired_at);
+#endif
+    // Keep the waiting bit of any other writer.
+    __atomic_fetch_and(&lock->state, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+}
+
+static inline InterruptState acquire_rwlock_read_irqsave(RwLock* lock)
+{
+    const InterruptState state = disable_interrupts();
+    acquire_rwlock_read(lock);
+    return state;
+}
+
+static inline void release_rwlock_read_irqrestore(RwLock* lock,
+    InterruptState state)
+{
+    release_rwlock_read(lock);
+    restore_interrupts(state);
+}
+
+static inline InterruptState acquire_rwlock_write_irqsave(RwLock* lock)
+{
+    const InterruptState state = disable_interrupts();
+    acquire_rwlock_write(lock);
+    return state;
+}
+
+static inline void release_rwlock_write_irqrestore(RwLock* lock,
+    InterruptState state)
+{
+    release_rwlock_write(lock);
+    restore_interrupts(state);
+}
+
+#endif  // KERNEL_RWLOCK_H
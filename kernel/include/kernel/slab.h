@@ -0,0 +1,84 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_SLAB_H
+#define KERNEL_SLAB_H
+
+#include <kernel/arch/memory.h>
+
+#include <stddef.h>
+
+// Objects are carved out of slabs of SLAB_PAGES contiguous pages.  Slabs are
+// aligned at their size so that the slab of an object is found by masking its
+// address.  Objects larger than SLAB_MAX_OBJECT_SIZE belong in the PMM.
+#define SLAB_PAGES 4
+#define SLAB_SIZE (SLAB_PAGES * PAGE_SIZE)
+#define SLAB_MAX_OBJECT_SIZE (SLAB_SIZE / 4)
+
+// Each hart keeps up to SLAB_HART_CACHE_SIZE free objects of every cache.  An
+// empty hart cache is refilled, and a full one is flushed, by
+// SLAB_HART_CACHE_BATCH objects under the cache lock.
+#ifndef SLAB_HART_CACHE_SIZE
+    #define SLAB_HART_CACHE_SIZE 16
+#endif
+#ifndef SLAB_HART_CACHE_BATCH
+    #define SLAB_HART_CACHE_BATCH (SLAB_HART_CACHE_SIZE / 2)
+#endif
+
+// kmalloc serves sizes up to KMALLOC_MAX_SIZE from caches of powers of two
+// starting at KMALLOC_MIN_SIZE and larger sizes directly from the PMM.  The
+// slab header would leave a quarter of every slab of SLAB_MAX_OBJECT_SIZE
+// objects unused, so the largest cache holds objects of half that size.
+#define KMALLOC_MIN_SIZE 16
+#define KMALLOC_MAX_SIZE (SLAB_MAX_OBJECT_SIZE / 2)
+
+typedef struct SlabCache SlabCache;
+
+// Called once for each object when its slab is created.  Objects must be
+// returned to their constructed state before they are freed.
+typedef void (*SlabConstructor)(void* object);
+
+typedef struct SlabStatistics
+{
+    const char* name;
+    size_t object_size;      // Size requested at creation
+    size_t stride;           // Distance between objects in a slab
+    size_t slab_count;       // Slabs owned by the cache
+    size_t object_count;     // Objects in all slabs
+    size_t allocated_count;  // Objects handed out to callers
+    size_t cached_count;     // Free objects held by hart caches
+} SlabStatistics;
+
+SlabCache* create_slab_cache(const char* name, size_t size, size_t align,
+    SlabConstructor constructor);
+void destroy_slab_cache(SlabCache* cache);
+
+void* allocate_slab_object(SlabCache* cache);
+void free_slab_object(SlabCache* cache, void* object);
+
+void* kmalloc(size_t size);
+void kfree(void* ptr);
+
+void get_slab_statistics(const SlabCache* cache, SlabStatistics* statistics);
+void print_slab_statistics(void);
+
+void initialize_slab(void);
+
+#endif  // KERNEL_SLAB_H
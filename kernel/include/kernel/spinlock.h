@@ -0,0 +1,131 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_SPINLOCK_H
+#define KERNEL_SPINLOCK_H
+
+#include <kernel/arch/interrupt.h>
+#include <kernel/arch/processor.h>
+#include <kernel/lock_stat.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A ticket lock, which grants the lock in the order that harts asked for it
+// so that none can starve.  Every waiter spins on the same cache line, so
+// heavily contended locks should be McsLocks instead.
+typedef struct Spinlock
+{
+    uint32_t next;  // Ticket of the next hart to ask
+    uint32_t owner;  // Ticket of the holder
+#ifdef LOCK_STATISTICS
+    LockClass* class;
+    uint64_t acquired_at;
+#endif
+} Spinlock;
+
+#ifdef LOCK_STATISTICS
+    #define SPINLOCK_CLASS_INITIALIZER(name) \
+        {.next = 0, .owner = 0, .class = &LOCK_CLASS_NAME(name)}
+#else
+    #define SPINLOCK_CLASS_INITIALIZER(name) {.next = 0, .owner = 0}
+#endif
+#define SPINLOCK_INITIALIZER SPINLOCK_CLASS_INITIALIZER(spinlock)
+
+static inline void initialize_spinlock_in_class(Spinlock* lock,
+    LockClass* class)
+{
+#ifdef LOCK_STATISTICS
+    lock->class = class;
+#else
+    (void)class;
+#endif
+    __atomic_store_n(&lock->next, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock->owner, 0, __ATOMIC_RELAXED);
+}
+
+static inline void initialize_spinlock(Spinlock* lock)
+{
+    initialize_spinlock_in_class(lock, &LOCK_CLASS_NAME(spinlock));
+}
+
+static inline bool try_acquire_spinlock(Spinlock* lock)
+{
+    // The lock is free when no ticket is outstanding.  The owner cannot pass
+    // next, so if next still equals the owner read here, so does the owner.
+    uint32_t ticket = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&lock->next, &ticket, ticket + 1, false,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+#ifdef LOCK_STATISTICS
+    lock->acquired_at = record_lock_acquired(lock->class, 0, false);
+#endif
+    return true;
+}
+
+static inline void acquire_spinlock(Spinlock* lock)
+{
+#ifdef LOCK_STATISTICS
+    const uint64_t wait_start = get_time();
+#endif
+    const uint32_t ticket =
+        __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    const bool was_contended =
+        __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket;
+    if (was_contended) {
+        // Waiters only read the line until the holder releases it.
+        while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+            cpu_relax();
+        }
+    }
+#ifdef LOCK_STATISTICS
+    lock->acquired_at =
+        record_lock_acquired(lock->class, wait_start, was_contended);
+#endif
+}
+
+static inline void release_spinlock(Spinlock* lock)
+{
+#ifdef LOCK_STATISTICS
+    record_lock_released(lock->class, lock->acquired_at);
+#endif
+    // Only the holder writes the owner.
+    const uint32_t owner = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock->owner, owner + 1, __ATOMIC_RELEASE);
+}
+
+// Acquire the lock with interrupts disabled on the current hart, so that an
+// interrupt handler cannot deadlock against its own hart.
+static inline InterruptState acquire_spinlock_irqsave(Spinlock* lock)
+{
+    const InterruptState state = disable_interrupts();
+    acquire_spinlock(lock);
+    return state;
+}
+
+static inline void release_spinlock_irqrestore(Spinlock* lock,
+    InterruptState state)
+{
+    release_spinlock(lock);
+    restore_interrupts(state);
+}
+
+#endif  // KERNEL_SPINLOCK_H
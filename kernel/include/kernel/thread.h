@@ -0,0 +1,107 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_THREAD_H
+#define KERNEL_THREAD_H
+
+#include <kernel/arch/thread.h>
+#include <kernel/list.h>
+#include <kernel/wait_queue.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdnoreturn.h>
+
+#define THREAD_NAME_SIZE 32
+
+// Length of the time slice after which a thread is preempted if another is
+// ready on its hart
+#ifndef SCHEDULER_TIME_SLICE_NS
+    #define SCHEDULER_TIME_SLICE_NS 10000000
+#endif
+
+typedef enum ThreadState
+{
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_EXITED,
+} ThreadState;
+
+typedef void (*ThreadEntry)(void* argument);
+
+typedef struct Thread
+{
+    ThreadContext context;
+    char name[THREAD_NAME_SIZE];
+    ThreadState state;
+    bool is_on_hart;  // Until a hart has switched away from the thread
+    bool is_idle;
+    ThreadEntry entry;
+    void* argument;
+    void* stack;
+    ListNode wait_node;  // In a WaitQueue while blocked
+    WaitQueue joiners;
+} Thread;
+
+typedef struct SchedulerStatistics
+{
+    size_t switches;
+    size_t preemptions;
+    size_t steals;
+    size_t idle_wakeups;
+} SchedulerStatistics;
+
+// Create a thread and make it ready on the current hart, from which idle
+// harts may steal it.  Returns NULL if memory runs out.
+Thread* create_thread(const char* name, ThreadEntry entry, void* argument);
+// Wait for the thread to exit and free it.  Every thread must be joined
+// exactly once unless it never exits.
+void join_thread(Thread* thread);
+noreturn void exit_thread(void);
+void yield_thread(void);
+Thread* get_current_thread(void);
+
+// Run the ready thread that has waited longest, or the idle thread.  Called
+// with interrupts in any state.
+void schedule(void);
+// Called on the way out of an interrupt with interrupts disabled.
+void preempt_if_needed(void);
+// Keep the current thread on its hart until preemption is enabled again.
+// Calls nest, and the thread must not block or yield in between.
+void disable_preemption(void);
+void enable_preemption(void);
+// Called for the interrupt raised by send_ipi.
+void handle_ipi(void);
+
+// Called by _thread_trampoline to run a new thread.
+noreturn void enter_thread(ThreadEntry entry, void* argument);
+
+void get_scheduler_statistics(size_t hart_index,
+    SchedulerStatistics* statistics);
+void print_scheduler_statistics(void);
+
+// Called on each hart with interrupts disabled.  The code running on the
+// hart becomes its idle thread once it calls run_idle_thread.
+void initialize_scheduler(void);
+noreturn void run_idle_thread(void);
+
+#endif  // KERNEL_THREAD_H
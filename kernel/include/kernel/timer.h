@@ -0,0 +1,92 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_TIMER_H
+#define KERNEL_TIMER_H
+
+#include <kernel/arch/timer.h>
+#include <kernel/list.h>
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Each hart keeps its timers in a hierarchical wheel.  Level n has
+// TIMER_WHEEL_SLOTS slots of 2^(n * TIMER_WHEEL_SLOT_BITS) ticks.  A timer goes
+// in the level of the most significant digit in which its deadline differs
+// from the wheel's time, so inserting and cancelling are O(1), and timers
+// cascade to lower levels as their deadlines approach.  There is no periodic
+// tick: the hardware timer is programmed for the earliest deadline, and not at
+// all while the wheel is empty.
+#if ULONG_MAX > 0xFFFFFFFF
+    #define TIMER_WHEEL_SLOT_BITS 6
+#else
+    #define TIMER_WHEEL_SLOT_BITS 5
+#endif
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS \
+    ((64 + TIMER_WHEEL_SLOT_BITS - 1) / TIMER_WHEEL_SLOT_BITS)
+
+// Used when the FDT has no timebase-frequency
+#ifndef TIMER_DEFAULT_FREQUENCY
+    #define TIMER_DEFAULT_FREQUENCY 10000000
+#endif
+
+#define TIMER_HART_NONE SIZE_MAX
+#define TIMER_DEADLINE_NONE UINT64_MAX
+
+#define NANOSECONDS_PER_SECOND UINT64_C(1000000000)
+
+struct Timer;
+typedef void (*TimerCallback)(struct Timer* timer, void* data);
+
+// Callbacks run on the hart that started the timer, in interrupt context with
+// interrupts disabled, and may restart their own timer.
+typedef struct Timer
+{
+    ListNode node;
+    uint64_t deadline;  // In ticks of get_time
+    TimerCallback callback;
+    void* data;
+    size_t hart_index;  // Wheel holding the timer, or TIMER_HART_NONE
+    unsigned int slot;  // Position in the wheel, for cancellation
+} Timer;
+
+void initialize_timer(Timer* timer, TimerCallback callback, void* data);
+// Start or restart the timer on the current hart to fire at the deadline.
+void start_timer(Timer* timer, uint64_t deadline);
+// Returns whether the timer was pending.  The callback may still be running
+// on another hart when this returns false.
+bool cancel_timer(Timer* timer);
+bool is_timer_pending(const Timer* timer);
+
+uint64_t get_timer_frequency(void);
+uint64_t nanoseconds_to_ticks(uint64_t nanoseconds);
+uint64_t ticks_to_nanoseconds(uint64_t ticks);
+
+// Wait on the current hart until get_time reaches the deadline.
+void sleep_until(uint64_t deadline);
+void sleep_for(uint64_t nanoseconds);
+
+void handle_timer_interrupt(void);
+void initialize_timers(void);
+
+#endif  // KERNEL_TIMER_H
@@ -0,0 +1,112 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_TRACEPOINT_H
+#define KERNEL_TRACEPOINT_H
+
+#include <kernel/arch/tracepoint.h>
+#include <kernel/compiler.h>
+#include <kernel/klog.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Tracepoints are static probes that cost a single nop while disabled.
+// Enabling one patches its sites into jumps to code that records a
+// fixed-size event, timestamped from the time CSR, into the current hart's
+// trace buffer.  Like klog, arguments are integers or pointers and are only
+// formatted when the buffers are printed, so %s strings must be static.
+#define TRACE_MAX_ARGUMENTS 6
+
+// Events per hart.  Must be a power of two.  A full buffer overwrites its
+// oldest events, so it always holds the most recent history.
+#ifndef TRACE_BUFFER_SIZE
+    #define TRACE_BUFFER_SIZE 1024
+#endif
+
+typedef struct Tracepoint
+{
+    const char* name;
+    const char* format;  // Printf format of the arguments
+    bool is_enabled;
+} Tracepoint;
+
+// One cache line per event
+typedef struct TraceEvent
+{
+    uint64_t time;
+    const Tracepoint* tracepoint;
+    uint64_t arguments[TRACE_MAX_ARGUMENTS];
+} TraceEvent;
+
+#define TRACEPOINT_NAME(name) _TRACEPOINT_NAME(name)
+#define _TRACEPOINT_NAME(name) tracepoint_ ## name
+#define DEFINE_TRACEPOINT(name, format) \
+    Tracepoint TRACEPOINT_NAME(name) USED LINKER_SECTION(.tracepoint) = { \
+        #name, \
+        format, \
+        false, \
+    }
+#define DECLARE_TRACEPOINT(name) extern Tracepoint TRACEPOINT_NAME(name)
+
+#define _TRACE_NAME(name, ...) name
+
+// trace(name, ...) takes up to TRACE_MAX_ARGUMENTS arguments, which are only
+// evaluated while the tracepoint is enabled.
+#define trace(...) \
+    do { \
+        if (is_tracepoint_site_enabled( \
+                &TRACEPOINT_NAME(_TRACE_NAME(__VA_ARGS__, _)))) { \
+            const uint64_t _trace_arguments[] = \
+                {0 _KLOG_ARGUMENTS(__VA_ARGS__)}; \
+            _Static_assert(sizeof(_trace_arguments) <= \
+                    (TRACE_MAX_ARGUMENTS + 1) * sizeof(uint64_t), \
+                "Too many tracepoint arguments"); \
+            record_trace(&TRACEPOINT_NAME(_TRACE_NAME(__VA_ARGS__, _)), \
+                &_trace_arguments[1], \
+                sizeof(_trace_arguments) / sizeof(_trace_arguments[0]) - 1); \
+        } \
+    } while (0)
+
+extern Tracepoint __tracepoint_start[];
+extern Tracepoint __tracepoint_end[];
+
+// Record an event on the current hart's buffer.  Safe in any context,
+// including interrupt handlers.
+void record_trace(const Tracepoint* tracepoint, const uint64_t* arguments,
+    size_t count);
+
+Tracepoint* find_tracepoint(const char* name);
+
+// Enabling and disabling patch every site of the tracepoint and may be called
+// from any thread.
+void enable_tracepoint(Tracepoint* tracepoint);
+void disable_tracepoint(Tracepoint* tracepoint);
+
+// Print every hart's buffered events, oldest first.  Events recorded while
+// printing may be torn, so this is best called once tracing is quiet.
+void print_trace(void);
+
+// Called on the boot hart after the PMM is initialized.  Allocates the
+// buffers.  With TRACE_AT_BOOT, also enables every tracepoint.
+void initialize_tracepoints(void);
+
+#endif  // KERNEL_TRACEPOINT_H
@@ -0,0 +1,59 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KERNEL_WAIT_QUEUE_H
+#define KERNEL_WAIT_QUEUE_H
+
+#include <kernel/list.h>
+#include <kernel/spinlock.h>
+
+#include <stdbool.h>
+
+// Threads blocked until a condition holds.  Wakers change the state that the
+// condition reads and then wake the queue.
+DECLARE_LOCK_CLASS(wait_queue);
+
+typedef struct WaitQueue
+{
+    Spinlock lock;
+    List threads;
+} WaitQueue;
+
+#define WAIT_QUEUE_INITIALIZER(name) \
+    { \
+        .lock = SPINLOCK_CLASS_INITIALIZER(wait_queue), \
+        .threads = {.prev = &(name).threads, .next = &(name).threads}, \
+    }
+
+typedef bool (*WaitCondition)(void* data);
+
+void initialize_wait_queue(WaitQueue* queue);
+
+// Block the current thread until condition(data) holds.  The condition is
+// evaluated with the queue lock held, so a waker that updates its state
+// under the same lock cannot be missed.
+void wait_on_queue(WaitQueue* queue, WaitCondition condition, void* data);
+
+// Wake the longest-waiting thread, or every thread.  Safe in interrupt
+// handlers.
+bool wake_one(WaitQueue* queue);
+void wake_all(WaitQueue* queue);
+
+#endif  // KERNEL_WAIT_QUEUE_H
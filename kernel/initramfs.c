@@ -0,0 +1,274 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/initramfs.h>
+
+#include <kernel/arch/memory.h>
+#include <kernel/bitops.h>
+#include <kernel/fdt.h>
+#include <kernel/slab.h>
+
+#include <stdio.h>
+#include <string.h>
+
+// An entry of a cpio archive in the "new ASCII" (newc) format is a header of
+// 13 fields of 8 hexadecimal digits after a 6-character magic number, then
+// the name and the data, each padded to a multiple of 4 bytes.  The archive
+// ends with an entry named "TRAILER!!!", and several archives may be
+// concatenated with zeros between them.
+#define CPIO_MAGIC_SIZE 6
+#define CPIO_FIELD_SIZE 8
+#define CPIO_HEADER_SIZE (CPIO_MAGIC_SIZE + 13 * CPIO_FIELD_SIZE)
+#define CPIO_ALIGNMENT 4
+#define CPIO_FIELD_MODE 1
+#define CPIO_FIELD_FILE_SIZE 6
+#define CPIO_FIELD_NAME_SIZE 11
+#define CPIO_TRAILER "TRAILER!!!"
+
+#define FNV_OFFSET_BASIS UINT64_C(0xCBF29CE484222325)
+#define FNV_PRIME UINT64_C(0x100000001B3)
+
+static InitramfsFile* _files = NULL;
+static size_t _file_count = 0;
+// Open-addressed index of _files by name.  Each slot holds a file index plus
+// one, or 0 if it is empty, and at least half of the slots are empty.
+static uint32_t* _slots = NULL;
+static unsigned int _slot_bits = 0;
+
+static size_t _align(size_t offset)
+{
+    return (offset + CPIO_ALIGNMENT - 1) & ~(size_t)(CPIO_ALIGNMENT - 1);
+}
+
+static bool _read_field(const char* header, size_t index, uint32_t* value)
+{
+    const char* field = header + CPIO_MAGIC_SIZE + index * CPIO_FIELD_SIZE;
+    uint32_t result = 0;
+    for (size_t i = 0; i < CPIO_FIELD_SIZE; ++i) {
+        const char digit = field[i];
+        uint32_t nibble;
+        if (digit >= '0' && digit <= '9') {
+            nibble = (uint32_t)(digit - '0');
+        }
+        else if (digit >= 'a' && digit <= 'f') {
+            nibble = (uint32_t)(digit - 'a' + 10);
+        }
+        else if (digit >= 'A' && digit <= 'F') {
+            nibble = (uint32_t)(digit - 'A' + 10);
+        }
+        else {
+            return false;
+        }
+        result = (result << 4) | nibble;
+    }
+    *value = result;
+    return true;
+}
+
+// Strip the leading "/" and "./" components and any trailing "/" from a path,
+// so "/", "." and "" all name the root.
+static const char* _normalize_path(const char* path, size_t length,
+    size_t* normalized_length)
+{
+    const char* end = path + length;
+    while (path < end) {
+        if (path[0] == '/') {
+            ++path;
+        }
+        else if (path[0] == '.' && (path + 1 == end || path[1] == '/')) {
+            ++path;
+        }
+        else {
+            break;
+        }
+    }
+    while (end > path && end[-1] == '/') {
+        --end;
+    }
+    *normalized_length = (size_t)(end - path);
+    return path;
+}
+
+static uint64_t _hash(const char* name, size_t length)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (uint8_t)name[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// Find the slot of a name, or the empty slot where it would go.
+static uint32_t* _find_slot(const char* name, size_t length, uint64_t hash)
+{
+    const size_t mask = ((size_t)1 << _slot_bits) - 1;
+    for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+        if (_slots[i] == 0) {
+            return &_slots[i];
+        }
+        const InitramfsFile* file = &_files[_slots[i] - 1];
+        if (file->hash == hash && file->name_length == length
+                && memcmp(file->name, name, length) == 0) {
+            return &_slots[i];
+        }
+    }
+}
+
+// A later entry with the same name replaces an earlier one, as when an
+// archive is appended to override files in another.
+static void _add_file(const InitramfsFile* file)
+{
+    uint32_t* slot = _find_slot(file->name, file->name_length, file->hash);
+    if (*slot != 0) {
+        _files[*slot - 1] = *file;
+        return;
+    }
+    _files[_file_count] = *file;
+    *slot = (uint32_t)++_file_count;
+}
+
+// Walk the entries of an archive, adding them to the index if it exists, and
+// count them.  Returns false if the archive is malformed.
+static bool _walk_archive(const char* archive, size_t size, size_t* count)
+{
+    *count = 0;
+    size_t offset = 0;
+    while (true) {
+        // Skip the padding after a trailer.
+        while (offset < size && archive[offset] == '\0') {
+            ++offset;
+        }
+        if (offset >= size) {
+            return true;
+        }
+
+        const char* header = archive + offset;
+        uint32_t mode;
+        uint32_t file_size;
+        uint32_t name_size;
+        if (size - offset < CPIO_HEADER_SIZE
+                || (memcmp(header, "070701", CPIO_MAGIC_SIZE) != 0
+                    && memcmp(header, "070702", CPIO_MAGIC_SIZE) != 0)
+                || !_read_field(header, CPIO_FIELD_MODE, &mode)
+                || !_read_field(header, CPIO_FIELD_FILE_SIZE, &file_size)
+                || !_read_field(header, CPIO_FIELD_NAME_SIZE, &name_size)) {
+            dprintf("Invalid initramfs entry header at offset %zu\n", offset);
+            return false;
+        }
+        offset += CPIO_HEADER_SIZE;
+
+        const char* name = archive + offset;
+        if (name_size == 0 || name_size > size - offset
+                || name[name_size - 1] != '\0') {
+            dprintf("Invalid initramfs entry name at offset %zu\n", offset);
+            return false;
+        }
+        offset = _align(offset + name_size);
+
+        if (offset > size || file_size > size - offset) {
+            dprintf("Truncated initramfs entry %s\n", name);
+            return false;
+        }
+        const char* data = archive + offset;
+        offset = _align(offset + file_size);
+
+        if (strcmp(name, CPIO_TRAILER) == 0) {
+            continue;
+        }
+        ++*count;
+        if (_slots != NULL) {
+            InitramfsFile file = {
+                .mode = mode,
+                .data = data,
+                .size = file_size,
+            };
+            file.name =
+                _normalize_path(name, name_size - 1, &file.name_length);
+            file.hash = _hash(file.name, file.name_length);
+            _add_file(&file);
+        }
+    }
+}
+
+const InitramfsFile* find_initramfs_file(const char* path)
+{
+    if (_slots == NULL) {
+        return NULL;
+    }
+    size_t length;
+    const char* name = _normalize_path(path, strlen(path), &length);
+    const uint32_t slot = *_find_slot(name, length, _hash(name, length));
+    return slot != 0 ? &_files[slot - 1] : NULL;
+}
+
+size_t get_initramfs_file_count(void)
+{
+    return _file_count;
+}
+
+const InitramfsFile* get_initramfs_file(size_t index)
+{
+    return index < _file_count ? &_files[index] : NULL;
+}
+
+void initialize_initramfs(void)
+{
+    const FdtRange* initrd = get_fdt_initrd();
+    if (initrd == NULL) {
+        return;
+    }
+    // The initrd is reserved from the PMM and covered by the direct map, so
+    // the archive can be used where it is.
+    const char* archive = physical_to_virtual(initrd->base);
+    const size_t size = initrd->size;
+    if (size >= 2 && (uint8_t)archive[0] == 0x1F
+            && (uint8_t)archive[1] == 0x8B) {
+        dprintf("Compressed initramfs is not supported\n");
+        return;
+    }
+
+    size_t count;
+    if (!_walk_archive(archive, size, &count)) {
+        return;
+    }
+    if (count == 0) {
+        dprintf("Initramfs is empty\n");
+        return;
+    }
+
+    const unsigned int slot_bits = log2_ceil(count * 2);
+    InitramfsFile* files = kmalloc(sizeof(InitramfsFile) * count);
+    uint32_t* slots = kmalloc(sizeof(uint32_t) << slot_bits);
+    if (files == NULL || slots == NULL) {
+        kfree(files);
+        kfree(slots);
+        dprintf("Unable to allocate the initramfs index\n");
+        return;
+    }
+    memset(slots, 0, sizeof(uint32_t) << slot_bits);
+    _files = files;
+    _slots = slots;
+    _slot_bits = slot_bits;
+    _walk_archive(archive, size, &count);
+
+    dprintf("Initramfs of %zu files in %zu bytes at %p\n", _file_count, size,
+        (const void*)archive);
+}
@@ -0,0 +1,291 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/irq.h>
+
+#include <kernel/hart.h>
+#include <kernel/klog.h>
+#include <kernel/percpu.h>
+#include <kernel/spinlock.h>
+#include <kernel/tracepoint.h>
+
+#include <assert.h>
+#include <stdio.h>
+
+typedef struct Irq
+{
+    IrqHandler handler;
+    void* data;
+    size_t hart_index;
+    uint32_t priority;
+} Irq;
+
+typedef struct HartIrqStatistics
+{
+    size_t dispatch_counts[MAX_IRQS];
+} HartIrqStatistics;
+
+static Spinlock _lock = SPINLOCK_INITIALIZER;
+static Irq _irqs[MAX_IRQS];
+static uint32_t _thresholds[MAX_HARTS];
+static const IrqController* _controller = NULL;
+static size_t _next_hart_index = 0;
+
+static DEFINE_PER_HART(HartIrqStatistics, _statistics);
+
+DEFINE_TRACEPOINT(irq_dispatch, "irq %u handler %p");
+
+static bool _is_valid_irq(uint32_t irq)
+{
+    if (irq == 0 || irq >= MAX_IRQS) {
+        return false;
+    }
+    return _controller == NULL || irq <= _controller->irq_count;
+}
+
+// Pick the next online hart in turn so that IRQs without an affinity are
+// spread across the harts rather than all landing on the boot hart.
+static size_t _choose_hart(void)
+{
+    const size_t count = get_hart_count();
+    for (size_t i = 0; i < count; ++i) {
+        const size_t index = _next_hart_index % count;
+        ++_next_hart_index;
+        if (__atomic_load_n(&get_hart(index)->online, __ATOMIC_ACQUIRE)) {
+            return index;
+        }
+    }
+    return get_hart_index();
+}
+
+// Expects the lock to be held.
+static void _apply_irq(uint32_t irq)
+{
+    const Irq* entry = &_irqs[irq];
+    if (_controller == NULL || irq > _controller->irq_count) {
+        return;
+    }
+    if (entry->handler == NULL) {
+        _controller->disable(_controller, irq);
+        return;
+    }
+    uint32_t priority = entry->priority;
+    if (priority > _controller->max_priority) {
+        priority = _controller->max_priority;
+    }
+    _controller->set_priority(_controller, irq, priority);
+    _controller->enable(_controller, irq, entry->hart_index);
+}
+
+bool register_irq_controller(const IrqController* controller)
+{
+    if (controller == NULL) {
+        return false;
+    }
+
+    InterruptState state = acquire_spinlock_irqsave(&_lock);
+    if (_controller != NULL) {
+        release_spinlock_irqrestore(&_lock, state);
+        return false;
+    }
+    _controller = controller;
+    for (size_t i = 0; i < get_hart_count(); ++i) {
+        _controller->set_threshold(_controller, i, _thresholds[i]);
+    }
+    for (uint32_t irq = 1; irq < MAX_IRQS; ++irq) {
+        if (_irqs[irq].handler != NULL) {
+            _apply_irq(irq);
+        }
+    }
+    release_spinlock_irqrestore(&_lock, state);
+    return true;
+}
+
+bool deregister_irq_controller(const IrqController* controller)
+{
+    InterruptState state = acquire_spinlock_irqsave(&_lock);
+    if (controller == NULL || _controller != controller) {
+        release_spinlock_irqrestore(&_lock, state);
+        return false;
+    }
+    for (uint32_t irq = 1; irq < MAX_IRQS && irq <= controller->irq_count;
+            ++irq) {
+        controller->disable(controller, irq);
+    }
+    __atomic_store_n(&_controller, NULL, __ATOMIC_RELEASE);
+    release_spinlock_irqrestore(&_lock, state);
+    return true;
+}
+
+const IrqController* get_irq_controller(void)
+{
+    return __atomic_load_n(&_controller, __ATOMIC_ACQUIRE);
+}
+
+bool register_irq_handler(uint32_t irq, IrqHandler handler, void* data,
+    size_t hart_index)
+{
+    if (handler == NULL ||
+            (hart_index != IRQ_HART_ANY && hart_index >= get_hart_count())) {
+        return false;
+    }
+
+    InterruptState state = acquire_spinlock_irqsave(&_lock);
+    if (!_is_valid_irq(irq) || _irqs[irq].handler != NULL) {
+        release_spinlock_irqrestore(&_lock, state);
+        return false;
+    }
+    Irq* entry = &_irqs[irq];
+    entry->data = data;
+    entry->hart_index =
+        hart_index == IRQ_HART_ANY ? _choose_hart() : hart_index;
+    if (entry->priority == 0) {
+        entry->priority = IRQ_PRIORITY_DEFAULT;
+    }
+    // Publish the handler after its data for dispatch_irq.
+    __atomic_store_n(&entry->handler, handler, __ATOMIC_RELEASE);
+    _apply_irq(irq);
+    release_spinlock_irqrestore(&_lock, state);
+    return true;
+}
+
+bool deregister_irq_handler(uint32_t irq)
+{
+    InterruptState state = acquire_spinlock_irqsave(&_lock);
+    if (!_is_valid_irq(irq) || _irqs[irq].handler == NULL) {
+        release_spinlock_irqrestore(&_lock, state);
+        return false;
+    }
+    __atomic_store_n(&_irqs[irq].handler, NULL, __ATOMIC_RELEASE);
+    _apply_irq(irq);
+    release_spinlock_irqrestore(&_lock, state);
+    return true;
+}
+
+bool set_irq_affinity(uint32_t irq, size_t hart_index)
+{
+    if (hart_index != IRQ_HART_ANY && hart_index >= get_hart_count()) {
+        return false;
+    }
+
+    InterruptState state = acquire_spinlock_irqsave(&_lock);
+    if (!_is_valid_irq(irq)) {
+        release_spinlock_irqrestore(&_lock, state);
+        return false;
+    }
+    _irqs[irq].hart_index =
+        hart_index == IRQ_HART_ANY ? _choose_hart() : hart_index;
+    if (_irqs[irq].handler != NULL) {
+        _apply_irq(irq);
+    }
+    release_spinlock_irqrestore(&_lock, state);
+    return true;
+}
+
+size_t get_irq_affinity(uint32_t irq)
+{
+    if (irq == 0 || irq >= MAX_IRQS) {
+        return IRQ_HART_ANY;
+    }
+    return __atomic_load_n(&_irqs[irq].hart_index, __ATOMIC_RELAXED);
+}
+
+// Priority 0 never interrupts, so it effectively masks the IRQ.
+bool set_irq_priority(uint32_t irq, uint32_t priority)
+{
+    InterruptState state = acquire_spinlock_irqsave(&_lock);
+    if (!_is_valid_irq(irq)) {
+        release_spinlock_irqrestore(&_lock, state);
+        return false;
+    }
+    _irqs[irq].priority = priority;
+    if (_irqs[irq].handler != NULL) {
+        _apply_irq(irq);
+    }
+    release_spinlock_irqrestore(&_lock, state);
+    return true;
+}
+
+bool set_irq_threshold(size_t hart_index, uint32_t threshold)
+{
+    if (hart_index >= MAX_HARTS) {
+        return false;
+    }
+
+    InterruptState state = acquire_spinlock_irqsave(&_lock);
+    _thresholds[hart_index] = threshold;
+    if (_controller != NULL && hart_index < get_hart_count()) {
+        _controller->set_threshold(_controller, hart_index, threshold);
+    }
+    release_spinlock_irqrestore(&_lock, state);
+    return true;
+}
+
+// Called by the controller with interrupts disabled.
+void dispatch_irq(uint32_t irq)
+{
+    if (irq == 0 || irq >= MAX_IRQS) {
+        klog("Ignoring IRQ %u beyond MAX_IRQS\n", irq);
+        return;
+    }
+
+    ++THIS_HART_PTR(_statistics)->dispatch_counts[irq];
+    const IrqHandler handler =
+        __atomic_load_n(&_irqs[irq].handler, __ATOMIC_ACQUIRE);
+    trace(irq_dispatch, irq, handler);
+    if (handler != NULL) {
+        handler(irq, _irqs[irq].data);
+    }
+    else {
+        klog("Ignoring IRQ %u without a handler\n", irq);
+    }
+}
+
+// Called by the trap handler for external interrupts.
+void handle_external_interrupt(void)
+{
+    const IrqController* controller = get_irq_controller();
+    if (controller != NULL) {
+        controller->handle(controller);
+    }
+}
+
+size_t get_irq_dispatch_count(size_t hart_index, uint32_t irq)
+{
+    assert(hart_index < get_hart_count());
+    if (irq >= MAX_IRQS) {
+        return 0;
+    }
+    return HART_PTR(_statistics, hart_index)->dispatch_counts[irq];
+}
+
+void print_irq_statistics(void)
+{
+    for (uint32_t irq = 1; irq < MAX_IRQS; ++irq) {
+        if (_irqs[irq].handler == NULL) {
+            continue;
+        }
+        dprintf("IRQ %u on hart %zu:", irq, get_irq_affinity(irq));
+        for (size_t i = 0; i < get_hart_count(); ++i) {
+            dprintf(" %zu", get_irq_dispatch_count(i, irq));
+        }
+        dprintf("\n");
+    }
+}
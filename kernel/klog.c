@@ -0,0 +1,194 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/klog.h>
+
+#include <kernel/arch/interrupt.h>
+#include <kernel/arch/memory.h>
+#include <kernel/arch/timer.h>
+#include <kernel/compiler.h>
+#include <kernel/config.h>
+#include <kernel/fdt.h>
+#include <kernel/hart.h>
+#include <kernel/panic.h>
+#include <kernel/pmm.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+
+#include <stdbool.h>
+
+#define KLOG_RING_MASK (KLOG_RING_SIZE - 1)
+
+// A single-producer, single-consumer ring.  Only the owning hart writes tail,
+// with interrupts disabled so that handlers cannot interleave with it, and
+// only the drainer writes head.  Each index lives on its own cache line so
+// that the two sides do not contend for it.
+typedef struct KlogRing
+{
+    KlogRecord* records;
+    size_t tail ALIGNED(CACHE_LINE_SIZE);
+    size_t dropped;
+    size_t head ALIGNED(CACHE_LINE_SIZE);
+} KlogRing;
+
+static KlogRing _rings[MAX_HARTS];
+static size_t _ring_count = 0;
+static Spinlock _drain_lock = SPINLOCK_INITIALIZER;
+
+void record_klog(const char* format, const uint64_t* arguments, size_t count)
+{
+    if (count > KLOG_MAX_ARGUMENTS) {
+        count = KLOG_MAX_ARGUMENTS;
+    }
+
+    const InterruptState state = disable_interrupts();
+    const size_t hart_index = get_hart_index();
+    KlogRing* ring = &_rings[hart_index];
+    const size_t tail = ring->tail;
+    if (ring->records == NULL ||
+            tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+                KLOG_RING_SIZE) {
+        ++ring->dropped;
+        restore_interrupts(state);
+        return;
+    }
+
+    KlogRecord* record = &ring->records[tail & KLOG_RING_MASK];
+    record->time = get_time();
+    record->format = format;
+    record->hart_index = (uint32_t)hart_index;
+    record->argument_count = (uint32_t)count;
+    for (size_t i = 0; i < count; ++i) {
+        record->arguments[i] = arguments[i];
+    }
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    restore_interrupts(state);
+}
+
+// Copy out the oldest pending record across all rings.  Returns false if
+// every ring is empty.
+static bool _pop_oldest_record(KlogRecord* record)
+{
+    KlogRing* oldest = NULL;
+    for (size_t i = 0; i < _ring_count; ++i) {
+        KlogRing* ring = &_rings[i];
+        const size_t head = ring->head;
+        if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        if (oldest == NULL || ring->records[head & KLOG_RING_MASK].time <
+                oldest->records[oldest->head & KLOG_RING_MASK].time) {
+            oldest = ring;
+        }
+    }
+    if (oldest == NULL) {
+        return false;
+    }
+
+    *record = oldest->records[oldest->head & KLOG_RING_MASK];
+    __atomic_store_n(&oldest->head, oldest->head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void _print_record(const KlogRecord* record)
+{
+#ifdef KLOG_RAW
+    // One line per record for tools/klog.py, which looks up the format
+    // string in the kernel ELF.
+    dprintf("@klog %llx %x %p", (unsigned long long)record->time,
+        (unsigned int)record->hart_index, (const void*)record->format);
+    for (size_t i = 0; i < record->argument_count; ++i) {
+        dprintf(" %llx", (unsigned long long)record->arguments[i]);
+    }
+    dprintf("\n");
+#else
+    const uint64_t microseconds = ticks_to_nanoseconds(record->time) / 1000;
+    dprintf("[%5llu.%06llu] %u: ",
+        (unsigned long long)(microseconds / 1000000),
+        (unsigned long long)(microseconds % 1000000),
+        (unsigned int)record->hart_index);
+    dprintf_arguments(record->format, record->arguments,
+        record->argument_count);
+#endif
+}
+
+void drain_klog(void)
+{
+    if (!try_acquire_spinlock(&_drain_lock)) {
+        return;
+    }
+    KlogRecord record;
+    while (_pop_oldest_record(&record)) {
+        _print_record(&record);
+    }
+    release_spinlock(&_drain_lock);
+}
+
+size_t get_klog_dropped_count(void)
+{
+    size_t dropped = 0;
+    for (size_t i = 0; i < MAX_HARTS; ++i) {
+        dropped += __atomic_load_n(&_rings[i].dropped, __ATOMIC_RELAXED);
+    }
+    return dropped;
+}
+
+static void _run_drainer(void* argument)
+{
+    (void)argument;
+    for (;;) {
+        drain_klog();
+        sleep_for(KLOG_DRAIN_INTERVAL_NS);
+    }
+}
+
+void initialize_klog(void)
+{
+    // Harts are indexed in FDT order, so there is never a hart index beyond
+    // the FDT hart count.
+    size_t count = get_fdt_cpu_count();
+    if (count == 0) {
+        count = 1;
+    }
+    if (count > MAX_HARTS) {
+        count = MAX_HARTS;
+    }
+
+    const size_t page_count =
+        (KLOG_RING_SIZE * sizeof(KlogRecord) + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (size_t i = 0; i < count; ++i) {
+        const PhysicalAddress pages =
+            allocate_contiguous_physical_pages(page_count);
+        if (pages == 0) {
+            panic("Unable to allocate the kernel log ring for hart %zu\n", i);
+        }
+        _rings[i].records = physical_to_virtual(pages);
+    }
+    _ring_count = count;
+
+#ifdef KLOG_RAW
+    dprintf("@klog-frequency %llu\n",
+        (unsigned long long)get_timer_frequency());
+#endif
+    if (create_thread("klog", _run_drainer, NULL) == NULL) {
+        panic("Unable to create the kernel log drainer\n");
+    }
+}
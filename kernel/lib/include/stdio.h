@@ -23,17 +23,31 @@
 
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #define EOF (-1)
 
-int snprintf(char* restrict s, size_t n, const char* restrict format, ...);
+// Lets the compiler check arguments against the format string.  The engine
+// supports the C99 flags, field width, precision, and length modifiers but
+// not floating-point conversions.
+#define PRINTF_FORMAT(format_index, first_arg_index) \
+    __attribute__((format(printf, format_index, first_arg_index)))
+
+int snprintf(char* restrict s, size_t n, const char* restrict format, ...)
+    PRINTF_FORMAT(3, 4);
 int vsnprintf(char* restrict s, size_t n, const char* restrict format,
-    va_list arg);
+    va_list arg) PRINTF_FORMAT(3, 0);
+
+int printf(const char* restrict format, ...) PRINTF_FORMAT(1, 2);
+int vprintf(const char* restrict format, va_list arg) PRINTF_FORMAT(1, 0);
 
-int printf(const char* restrict format, ...);
-int vprintf(const char* restrict format, va_list arg);
+int dprintf(const char* restrict format, ...) PRINTF_FORMAT(1, 2);
+int vdprintf(const char* restrict format, va_list arg) PRINTF_FORMAT(1, 0);
 
-int dprintf(const char* restrict format, ...);
-int vdprintf(const char* restrict format, va_list arg);
+// Like dprintf, but with the arguments already widened to 64-bit words, as
+// the kernel log records them.  Each is converted back to the type its
+// conversion expects.  %n consumes its argument without storing anything.
+int dprintf_arguments(const char* restrict format, const uint64_t* arguments,
+    size_t count);
 
 #endif  // KERNEL_STDIO_H
@@ -24,8 +24,15 @@
 #include <stddef.h>
 
 size_t strlen(const char* s);
+size_t strnlen(const char* s, size_t n);
+int strcmp(const char* s1, const char* s2);
+int strncmp(const char* s1, const char* s2, size_t n);
+char* strchr(const char* s, int c);
 
+void* memchr(const void* s, int c, size_t n);
 void* memcpy(void* restrict s1, const void* restrict s2, size_t n);
+void* memmove(void* s1, const void* s2, size_t n);
 void* memset(void* s, int c, size_t n);
+int memcmp(const void* s1, const void* s2, size_t n);
 
 #endif  // KERNEL_STRING_H
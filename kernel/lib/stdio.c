@@ -25,7 +25,16 @@
 
 #include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+// Console and debug output is staged in the print state and written out a
+// chunk at a time rather than a character at a time.
+#define PRINT_BUFFER_SIZE 128
+
+// Large enough for the digits of a uintmax_t in octal.
+#define PRINT_DIGITS_SIZE 24
 
 typedef enum PrintType
 {
@@ -35,6 +44,18 @@ typedef enum PrintType
     print_type_string,
 } PrintType;
 
+typedef enum PrintLength
+{
+    print_length_default,
+    print_length_char,       // hh
+    print_length_short,      // h
+    print_length_long,       // l
+    print_length_long_long,  // ll
+    print_length_intmax,     // j
+    print_length_size,       // z
+    print_length_ptrdiff,    // t
+} PrintLength;
+
 typedef struct PrintState
 {
     const char* format;
@@ -42,131 +63,468 @@ typedef struct PrintState
     size_t capacity;
     size_t length;
     PrintType type;
-    union {
-        char* string;
-    } output;
+
+    // If not NULL, the arguments are taken from this array instead of arg.
+    const uint64_t* arguments;
+    size_t argument_count;
+    size_t argument_index;
+
+    // Characters are stored here until they are flushed.  Strings are their
+    // own buffer and are never flushed.
+    char* buffer;
+    size_t buffer_size;
+    size_t buffered;
+    char staging[PRINT_BUFFER_SIZE];
 
     // Formatting flags.
     size_t base;
     bool lowercase;
+    bool left_justify;
+    bool zero_pad;
+    bool force_sign;
+    bool space_sign;
+    bool alternate;
+    size_t width;
+    int precision;  // Negative if unspecified
+    PrintLength length_modifier;
 } PrintState;
 
 static void _reset_print_flags(PrintState* state)
 {
     state->base = 10;
     state->lowercase = false;
+    state->left_justify = false;
+    state->zero_pad = false;
+    state->force_sign = false;
+    state->space_sign = false;
+    state->alternate = false;
+    state->width = 0;
+    state->precision = -1;
+    state->length_modifier = print_length_default;
 }
 
-static void _finalize_print(PrintState* state)
+static void _initialize_print(PrintState* state, const char* format,
+    PrintType type, char* string, size_t capacity)
 {
-    va_end(state->arg);
-
-    switch (state->type) {
+    state->format = format;
+    state->capacity = capacity;
+    state->length = 0;
+    state->type = type;
+    state->arguments = NULL;
+    state->argument_count = 0;
+    state->argument_index = 0;
+    state->buffered = 0;
+    switch (type) {
         case print_type_measure:
+            state->buffer = NULL;
+            state->buffer_size = 0;
+            state->capacity = 0;
             break;
 
-        case print_type_debug:
+        case print_type_debug:  // Fallthrough
+        case print_type_console:
+            state->buffer = state->staging;
+            state->buffer_size = PRINT_BUFFER_SIZE;
             break;
 
-        case print_type_console:
+        case print_type_string:
+            state->buffer = string;
+            state->buffer_size = capacity;
             break;
+    }
+}
 
+static void _flush_print(PrintState* state)
+{
+    switch (state->type) {
+        case print_type_measure:  // Fallthrough
         case print_type_string:
-            state->output.string[state->length] = '\0';
+            return;
+
+        case print_type_debug:
+            dwrite(state->buffer, state->buffered);
+            break;
+
+        case print_type_console:
+            write_to_console(state->buffer, state->buffered);
             break;
     }
+    state->buffered = 0;
 }
 
-static void _do_print_chr(PrintState* state, char c)
+static void _finalize_print(PrintState* state)
 {
-    if (state->length + 1 < state->capacity) {
-        switch (state->type) {
-            case print_type_measure:
-                break;
+    if (state->arguments == NULL) {
+        va_end(state->arg);
+    }
 
-            case print_type_debug:
-                dputc(c);
-                break;
+    if (state->type == print_type_string) {
+        if (state->capacity != 0) {
+            state->buffer[state->buffered] = '\0';
+        }
+    }
+    else {
+        _flush_print(state);
+    }
+}
 
-            case print_type_console:
-                put_to_console(c);
-                break;
+// Print size characters from data, or as many of them as fit.
+static void _do_print_data(PrintState* state, const char* data, size_t size)
+{
+    size_t count = state->length + 1 < state->capacity
+        ? state->capacity - state->length - 1
+        : 0;
+    if (count > size) {
+        count = size;
+    }
 
-            case print_type_string:
-                state->output.string[state->length] = c;
-                break;
+    while (count > 0) {
+        if (state->buffered == state->buffer_size) {
+            _flush_print(state);
+        }
+        size_t chunk = state->buffer_size - state->buffered;
+        if (chunk > count) {
+            chunk = count;
         }
+        memcpy(state->buffer + state->buffered, data, chunk);
+        state->buffered += chunk;
+        data += chunk;
+        count -= chunk;
     }
-    ++state->length;
+    state->length += size;
 }
 
-static void _do_print_str(PrintState* state, const char* s)
+static void _do_print_chr(PrintState* state, char c)
+{
+    _do_print_data(state, &c, 1);
+}
+
+static void _do_print_padding(PrintState* state, char c, size_t count)
 {
-    for (; *s != '\0'; ++s) {
-        _do_print_chr(state, *s);
+    char padding[16];
+    memset(padding, c, sizeof(padding));
+    while (count > 0) {
+        const size_t chunk = count < sizeof(padding) ? count : sizeof(padding);
+        _do_print_data(state, padding, chunk);
+        count -= chunk;
     }
 }
 
-static void _do_print_int(PrintState* state, intmax_t i)
+// Print a prefix and body padded to the field width.  Zero padding goes
+// between the prefix and the body, and at least zeros zeros precede the body.
+static void _do_print_field(PrintState* state, const char* prefix,
+    const char* body, size_t size, size_t zeros)
 {
-    static const char* digits = "0123456789";
-    static const size_t buffer_size = 48;
+    const size_t prefix_size = strlen(prefix);
+    size_t used = prefix_size + zeros + size;
+    size_t padding = state->width > used ? state->width - used : 0;
+    if (state->zero_pad && !state->left_justify && state->precision < 0) {
+        zeros += padding;
+        padding = 0;
+    }
+
+    if (!state->left_justify) {
+        _do_print_padding(state, ' ', padding);
+    }
+    _do_print_data(state, prefix, prefix_size);
+    _do_print_padding(state, '0', zeros);
+    _do_print_data(state, body, size);
+    if (state->left_justify) {
+        _do_print_padding(state, ' ', padding);
+    }
+}
 
-    const bool negative = i < 0;
-    if (negative) {
-        i *= -1;
+static void _do_print_str(PrintState* state, const char* s)
+{
+    if (s == NULL) {
+        s = "(null)";
     }
+    const size_t size = state->precision < 0
+        ? strlen(s)
+        : strnlen(s, (size_t)state->precision);
+    _do_print_field(state, "", s, size, 0);
+}
 
-    char s[buffer_size];
-    char* p = &s[buffer_size - 1];
-    *p = '\0';
+// Format the digits of i into the end of digits and return the first one.
+static char* _format_digits(PrintState* state, uintmax_t i,
+    char digits[PRINT_DIGITS_SIZE])
+{
+    const char* symbols = state->lowercase
+        ? "0123456789abcdef"
+        : "0123456789ABCDEF";
+
+    char* p = &digits[PRINT_DIGITS_SIZE];
+    // A precision of 0 prints nothing for 0.
+    if (i == 0 && state->precision == 0) {
+        return p;
+    }
     do {
         --p;
-        *p = digits[i % state->base];
+        *p = symbols[i % state->base];
         i /= state->base;
     } while (i != 0);
+    return p;
+}
 
-    if (negative) {
-        --p;
-        *p = '-';
+static void _do_print_number(PrintState* state, const char* prefix,
+    uintmax_t magnitude)
+{
+    char digits[PRINT_DIGITS_SIZE];
+    const char* p = _format_digits(state, magnitude, digits);
+    const size_t size = (size_t)(&digits[PRINT_DIGITS_SIZE] - p);
+    size_t zeros = state->precision > 0 && (size_t)state->precision > size
+        ? (size_t)state->precision - size
+        : 0;
+
+    // The octal alternate form makes the first digit a 0.
+    if (state->alternate && state->base == 8 && zeros == 0 &&
+            (size == 0 || *p != '0')) {
+        zeros = 1;
     }
-
-    _do_print_str(state, p);
+    _do_print_field(state, prefix, p, size, zeros);
 }
 
-static void _do_print_uint(PrintState* state, uintmax_t i)
+static void _do_print_int(PrintState* state, intmax_t i)
 {
-    static const char* lowercase_digits = "0123456789abcdef";
-    static const char* uppercase_digits = "0123456789ABCDEF";
-    static const size_t buffer_size = 48;
-
-    const char* digits = state->lowercase
-        ? lowercase_digits
-        : uppercase_digits;
+    const char* prefix = "";
+    if (i < 0) {
+        prefix = "-";
+    }
+    else if (state->force_sign) {
+        prefix = "+";
+    }
+    else if (state->space_sign) {
+        prefix = " ";
+    }
 
-    char s[buffer_size];
-    char* p = &s[buffer_size - 1];
-    *p = '\0';
-    do {
-        --p;
-        *p = digits[i % state->base];
-        i /= state->base;
-    } while (i != 0);
+    // Negate as unsigned so that the minimum value does not overflow.
+    const uintmax_t magnitude = i < 0 ? -(uintmax_t)i : (uintmax_t)i;
+    _do_print_number(state, prefix, magnitude);
+}
 
-    _do_print_str(state, p);
+static void _do_print_uint(PrintState* state, uintmax_t i)
+{
+    const char* prefix = "";
+    if (state->alternate && state->base == 16 && i != 0) {
+        prefix = state->lowercase ? "0x" : "0X";
+    }
+    _do_print_number(state, prefix, i);
 }
 
 static void _do_print_ptr(PrintState* state, void* p)
 {
-    _reset_print_flags(state);  // Do not apply any user-specified flags.
+    // Do not apply any user-specified flags other than the width.
+    const size_t width = state->width;
+    const bool left_justify = state->left_justify;
+    _reset_print_flags(state);
+    state->width = width;
+    state->left_justify = left_justify;
 
     if (p == NULL) {
-        _do_print_str(state, "(nil)");
+        _do_print_field(state, "", "(nil)", 5, 0);
     }
     else {
-        _do_print_str(state, "0x");
         state->base = 16;
-        _do_print_uint(state, (uintptr_t)p);
+        _do_print_number(state, "0x", (uintptr_t)p);
+    }
+}
+
+// Missing array arguments read as 0.
+static uint64_t _next_array_argument(PrintState* state)
+{
+    return state->argument_index < state->argument_count
+        ? state->arguments[state->argument_index++]
+        : 0;
+}
+
+// Read the next argument as an integer or pointer type.  Array arguments are
+// converted to the type, which truncates them to its width.
+#define NEXT_ARGUMENT(state, type) \
+    ((state)->arguments != NULL \
+        ? (type)_next_array_argument(state) \
+        : va_arg((state)->arg, type))
+#define NEXT_POINTER_ARGUMENT(state, type) \
+    ((state)->arguments != NULL \
+        ? (type)(uintptr_t)_next_array_argument(state) \
+        : va_arg((state)->arg, type))
+
+static intmax_t _read_int_argument(PrintState* state)
+{
+    switch (state->length_modifier) {
+        case print_length_char:
+            return (signed char)NEXT_ARGUMENT(state, int);
+        case print_length_short:
+            return (short)NEXT_ARGUMENT(state, int);
+        case print_length_long:
+            return NEXT_ARGUMENT(state, long);
+        case print_length_long_long:
+            return NEXT_ARGUMENT(state, long long);
+        case print_length_intmax:
+            return NEXT_ARGUMENT(state, intmax_t);
+        case print_length_size:  // Fallthrough
+        case print_length_ptrdiff:
+            // There is no signed size_t; ptrdiff_t has the same width.
+            return NEXT_ARGUMENT(state, ptrdiff_t);
+        default:
+            return NEXT_ARGUMENT(state, int);
+    }
+}
+
+static uintmax_t _read_uint_argument(PrintState* state)
+{
+    switch (state->length_modifier) {
+        case print_length_char:
+            return (unsigned char)NEXT_ARGUMENT(state, unsigned int);
+        case print_length_short:
+            return (unsigned short)NEXT_ARGUMENT(state, unsigned int);
+        case print_length_long:
+            return NEXT_ARGUMENT(state, unsigned long);
+        case print_length_long_long:
+            return NEXT_ARGUMENT(state, unsigned long long);
+        case print_length_intmax:
+            return NEXT_ARGUMENT(state, uintmax_t);
+        case print_length_size:
+            return NEXT_ARGUMENT(state, size_t);
+        case print_length_ptrdiff:
+            return (uintmax_t)NEXT_ARGUMENT(state, ptrdiff_t);
+        default:
+            return NEXT_ARGUMENT(state, unsigned int);
+    }
+}
+
+static void _store_length(PrintState* state)
+{
+    // Array arguments are copies, so there is nowhere to store the length.
+    if (state->arguments != NULL) {
+        _next_array_argument(state);
+        return;
+    }
+
+    const size_t length = state->length;
+    switch (state->length_modifier) {
+        case print_length_char:
+            *va_arg(state->arg, signed char*) = (signed char)length;
+            break;
+        case print_length_short:
+            *va_arg(state->arg, short*) = (short)length;
+            break;
+        case print_length_long:
+            *va_arg(state->arg, long*) = (long)length;
+            break;
+        case print_length_long_long:
+            *va_arg(state->arg, long long*) = (long long)length;
+            break;
+        case print_length_intmax:
+            *va_arg(state->arg, intmax_t*) = (intmax_t)length;
+            break;
+        case print_length_size:
+            *va_arg(state->arg, size_t*) = length;
+            break;
+        case print_length_ptrdiff:
+            *va_arg(state->arg, ptrdiff_t*) = (ptrdiff_t)length;
+            break;
+        default:
+            *va_arg(state->arg, int*) = (int)length;
+            break;
+    }
+}
+
+static bool _is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Parse a decimal field width or precision, or * to take it from the
+// arguments.
+static int _parse_print_number(PrintState* state)
+{
+    if (*state->format == '*') {
+        ++state->format;
+        return NEXT_ARGUMENT(state, int);
+    }
+
+    int value = 0;
+    for (; _is_digit(*state->format); ++state->format) {
+        if (value <= (INT_MAX - 9) / 10) {
+            value = value * 10 + (*state->format - '0');
+        }
+    }
+    return value;
+}
+
+// Parse the flags, field width, precision, and length modifier of a
+// conversion specification, leaving the format at the conversion specifier.
+static void _parse_print_specification(PrintState* state)
+{
+    for (;; ++state->format) {
+        switch (*state->format) {
+            case '-':
+                state->left_justify = true;
+                continue;
+            case '0':
+                state->zero_pad = true;
+                continue;
+            case '+':
+                state->force_sign = true;
+                continue;
+            case ' ':
+                state->space_sign = true;
+                continue;
+            case '#':
+                state->alternate = true;
+                continue;
+        }
+        break;
+    }
+
+    const int width = _parse_print_number(state);
+    if (width < 0) {
+        // A negative width argument is a - flag and a positive width.
+        state->left_justify = true;
+        state->width = -(size_t)width;
+    }
+    else {
+        state->width = (size_t)width;
+    }
+
+    if (*state->format == '.') {
+        ++state->format;
+        // A negative precision argument is taken as if it were omitted.
+        state->precision = _parse_print_number(state);
+        if (state->precision < 0) {
+            state->precision = -1;
+        }
+    }
+
+    switch (*state->format) {
+        case 'h':
+            ++state->format;
+            state->length_modifier = print_length_short;
+            if (*state->format == 'h') {
+                ++state->format;
+                state->length_modifier = print_length_char;
+            }
+            break;
+        case 'l':
+            ++state->format;
+            state->length_modifier = print_length_long;
+            if (*state->format == 'l') {
+                ++state->format;
+                state->length_modifier = print_length_long_long;
+            }
+            break;
+        case 'j':
+            ++state->format;
+            state->length_modifier = print_length_intmax;
+            break;
+        case 'z':
+            ++state->format;
+            state->length_modifier = print_length_size;
+            break;
+        case 't':
+            ++state->format;
+            state->length_modifier = print_length_ptrdiff;
+            break;
     }
 }
 
@@ -174,67 +532,75 @@ static int _do_print(PrintState* state)
 {
     while (*state->format != '\0') {
         if (*state->format != '%') {
-            _do_print_chr(state, *state->format);
-            ++state->format;
+            // Print the literal text up to the next conversion in one piece.
+            const char* text = state->format;
+            while (*state->format != '\0' && *state->format != '%') {
+                ++state->format;
+            }
+            _do_print_data(state, text, (size_t)(state->format - text));
             continue;
         }
 
         _reset_print_flags(state);
 
         ++state->format;
+        _parse_print_specification(state);
         switch (*state->format) {
             case '%':
                 _do_print_chr(state, *state->format);
                 ++state->format;
                 break;
 
-            case 'c':
-                _do_print_chr(state, (unsigned char)va_arg(state->arg, int));
+            case 'c': {
+                const char c = (char)(unsigned char)NEXT_ARGUMENT(state, int);
+                _do_print_field(state, "", &c, 1, 0);
                 ++state->format;
                 break;
+            }
 
             case 's':
-                _do_print_str(state, va_arg(state->arg, const char*));
+                _do_print_str(state,
+                    NEXT_POINTER_ARGUMENT(state, const char*));
                 ++state->format;
                 break;
 
             case 'd':  // Fallthrough
             case 'i':
-                _do_print_int(state, va_arg(state->arg, int));
+                _do_print_int(state, _read_int_argument(state));
                 ++state->format;
                 break;
 
             case 'o':
                 state->base = 8;
-                _do_print_uint(state, va_arg(state->arg, unsigned int));
+                _do_print_uint(state, _read_uint_argument(state));
                 ++state->format;
                 break;
 
             case 'x':
                 state->base = 16;
                 state->lowercase = true;
-                _do_print_uint(state, va_arg(state->arg, unsigned int));
+                _do_print_uint(state, _read_uint_argument(state));
                 ++state->format;
                 break;
 
             case 'X':
                 state->base = 16;
-                _do_print_uint(state, va_arg(state->arg, unsigned int));
+                _do_print_uint(state, _read_uint_argument(state));
                 ++state->format;
                 break;
 
             case 'u':
-                _do_print_uint(state, va_arg(state->arg, unsigned int));
+                _do_print_uint(state, _read_uint_argument(state));
                 ++state->format;
                 break;
 
             case 'n':
-                *va_arg(state->arg, int*) = state->length;
+                _store_length(state);
                 ++state->format;
                 break;
 
             case 'p':
-                _do_print_ptr(state, va_arg(state->arg, void*));
+                _do_print_ptr(state, NEXT_POINTER_ARGUMENT(state, void*));
                 ++state->format;
                 break;
 
@@ -269,13 +635,9 @@ int vsnprintf(char* restrict s, size_t n, const char* restrict format,
         return EOF;
     }
 
-    PrintState state = {
-        .format = format,
-        .capacity = n,
-        .length = 0,
-        .type = s == NULL ? print_type_measure : print_type_string,
-        .output.string = s,
-    };
+    PrintState state;
+    _initialize_print(&state, format,
+        s == NULL ? print_type_measure : print_type_string, s, n);
     va_copy(state.arg, arg);
     return _do_print(&state);
 }
@@ -295,12 +657,8 @@ int vprintf(const char* restrict format, va_list arg)
         return 0;
     }
 
-    PrintState state = {
-        .format = format,
-        .capacity = INT_MAX,
-        .length = 0,
-        .type = print_type_console,
-    };
+    PrintState state;
+    _initialize_print(&state, format, print_type_console, NULL, INT_MAX);
     va_copy(state.arg, arg);
     return _do_print(&state);
 }
@@ -320,12 +678,22 @@ int vdprintf(const char* restrict format, va_list arg)
         return 0;
     }
 
-    PrintState state = {
-        .format = format,
-        .capacity = INT_MAX,
-        .length = 0,
-        .type = print_type_debug,
-    };
+    PrintState state;
+    _initialize_print(&state, format, print_type_debug, NULL, INT_MAX);
     va_copy(state.arg, arg);
     return _do_print(&state);
 }
+
+int dprintf_arguments(const char* restrict format, const uint64_t* arguments,
+    size_t count)
+{
+    if (format == NULL) {
+        return 0;
+    }
+
+    PrintState state;
+    _initialize_print(&state, format, print_type_debug, NULL, INT_MAX);
+    state.arguments = arguments;
+    state.argument_count = count;
+    return _do_print(&state);
+}
@@ -20,31 +20,287 @@
 
 #include <string.h>
 
+#include <kernel/arch/vector.h>
+#include <kernel/bitops.h>
+
 #include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stdint.h>
 
+// Bulk operations work a machine word at a time.  Unaligned heads and tails
+// are done byte by byte, and a source misaligned relative to the destination
+// is read in aligned words and shifted into place, so no access is
+// misaligned.  Aligned word reads never cross a page boundary that a byte
+// access would not.  may_alias lets the words overlay any type.
+typedef uintptr_t __attribute__((may_alias)) Word;
+
+#define WORD_SIZE sizeof(Word)
+#define WORD_BITS (WORD_SIZE * CHAR_BIT)
+#define WORD_MASK (WORD_SIZE - 1)
+
+// Operations shorter than this are not worth aligning.
+#define SMALL_SIZE (4 * WORD_SIZE)
+
+static bool _is_aligned(const void* p)
+{
+    return ((uintptr_t)p & WORD_MASK) == 0;
+}
+
+// Return a word whose least significant set bit lies in the first zero byte of
+// x, or 0 if x has no zero byte.
+static Word _find_zero_bytes(Word x)
+{
+#ifdef __riscv_zbb
+    // orc.b sets each nonzero byte to all ones and leaves each zero byte zero.
+    Word combined;
+    __asm__("orc.b %0, %1" : "=r"(combined) : "r"(x));
+    return ~combined;
+#else
+    // Borrowing from a zero byte sets its high bit.  Borrows may also mark the
+    // bytes above it, but never the ones below.
+    const Word ones = ~(Word)0 / 0xFF;
+    return (x - ones) & ~x & (ones << (CHAR_BIT - 1));
+#endif
+}
+
 size_t strlen(const char* s)
 {
     assert(s != NULL);
-    size_t n = 0;
-    while (*s != '\0') {
-        ++s;
-        ++n;
+    const char* p = s;
+    for (; !_is_aligned(p); ++p) {
+        if (*p == '\0') {
+            return (size_t)(p - s);
+        }
+    }
+
+    // An aligned word never straddles a page, so reading past the terminator
+    // within its word is safe.
+    const Word* w = (const Word*)p;
+    for (size_t count = 0;; ++count, ++w) {
+        const Word zeros = _find_zero_bytes(*w);
+        if (zeros != 0) {
+            return (size_t)((const char*)w - s) +
+                find_first_set_bit(zeros) / CHAR_BIT;
+        }
+        // Only strings that turn out to be long are worth the vector unit.
+        if (count == VECTOR_MIN_SIZE / WORD_SIZE && is_vector_enabled()) {
+            const char* rest = (const char*)(w + 1);
+            return (size_t)(rest - s) + get_string_length_with_vector(rest);
+        }
+    }
+}
+
+size_t strnlen(const char* s, size_t n)
+{
+    assert(s != NULL);
+    size_t i = 0;
+    while (i < n && s[i] != '\0') {
+        ++i;
+    }
+    return i;
+}
+
+int strcmp(const char* s1, const char* s2)
+{
+    assert(s1 != NULL);
+    assert(s2 != NULL);
+    while (*s1 != '\0' && *s1 == *s2) {
+        ++s1;
+        ++s2;
+    }
+    return (int)(unsigned char)*s1 - (int)(unsigned char)*s2;
+}
+
+int strncmp(const char* s1, const char* s2, size_t n)
+{
+    assert(s1 != NULL);
+    assert(s2 != NULL);
+    for (; n > 0; --n) {
+        if (*s1 != *s2 || *s1 == '\0') {
+            return (int)(unsigned char)*s1 - (int)(unsigned char)*s2;
+        }
+        ++s1;
+        ++s2;
+    }
+    return 0;
+}
+
+char* strchr(const char* s, int c)
+{
+    assert(s != NULL);
+    for (;; ++s) {
+        if (*s == (char)c) {
+            return (char*)s;
+        }
+        if (*s == '\0') {
+            return NULL;
+        }
+    }
+}
+
+void* memchr(const void* s, int c, size_t n)
+{
+    assert(s != NULL);
+    const uint8_t* p = s;
+    for (; n > 0; --n) {
+        if (*p == (uint8_t)c) {
+            return (void*)p;
+        }
+        ++p;
+    }
+    return NULL;
+}
+
+// Copy words from an aligned source to an aligned destination.
+static void _copy_words_forward(Word* d, const Word* s, size_t count)
+{
+    for (; count >= 8; count -= 8) {
+        const Word w0 = s[0];
+        const Word w1 = s[1];
+        const Word w2 = s[2];
+        const Word w3 = s[3];
+        const Word w4 = s[4];
+        const Word w5 = s[5];
+        const Word w6 = s[6];
+        const Word w7 = s[7];
+        d[0] = w0;
+        d[1] = w1;
+        d[2] = w2;
+        d[3] = w3;
+        d[4] = w4;
+        d[5] = w5;
+        d[6] = w6;
+        d[7] = w7;
+        d += 8;
+        s += 8;
+    }
+    for (; count > 0; --count) {
+        *d++ = *s++;
+    }
+}
+
+// Copy count words to an aligned destination from a source offset bytes past
+// the aligned s.  offset must not be 0.
+static void _copy_shifted_forward(Word* d, const Word* s, size_t offset,
+    size_t count)
+{
+    const unsigned int right = offset * CHAR_BIT;
+    const unsigned int left = WORD_BITS - right;
+    Word previous = *s++;
+    for (; count >= 4; count -= 4) {
+        const Word w0 = s[0];
+        const Word w1 = s[1];
+        const Word w2 = s[2];
+        const Word w3 = s[3];
+        d[0] = (previous >> right) | (w0 << left);
+        d[1] = (w0 >> right) | (w1 << left);
+        d[2] = (w1 >> right) | (w2 << left);
+        d[3] = (w2 >> right) | (w3 << left);
+        previous = w3;
+        d += 4;
+        s += 4;
+    }
+    for (; count > 0; --count) {
+        const Word next = *s++;
+        *d++ = (previous >> right) | (next << left);
+        previous = next;
+    }
+}
+
+// Copy forward, which is safe for overlapping buffers when d is below s.
+static void _copy_forward(uint8_t* d, const uint8_t* s, size_t n)
+{
+    if (n >= SMALL_SIZE) {
+        for (; !_is_aligned(d); --n) {
+            *d++ = *s++;
+        }
+        const size_t count = n / WORD_SIZE;
+        const size_t offset = (uintptr_t)s & WORD_MASK;
+        if (offset == 0) {
+            _copy_words_forward((Word*)d, (const Word*)s, count);
+        }
+        else {
+            _copy_shifted_forward((Word*)d, (const Word*)(s - offset),
+                offset, count);
+        }
+        d += count * WORD_SIZE;
+        s += count * WORD_SIZE;
+        n -= count * WORD_SIZE;
+    }
+    for (; n > 0; --n) {
+        *d++ = *s++;
+    }
+}
+
+// Copy backward from the ends of the buffers, which is safe for overlapping
+// buffers when d is above s.
+static void _copy_backward(uint8_t* d, const uint8_t* s, size_t n)
+{
+    d += n;
+    s += n;
+    if (n >= SMALL_SIZE) {
+        for (; !_is_aligned(d); --n) {
+            *--d = *--s;
+        }
+        size_t count = n / WORD_SIZE;
+        n -= count * WORD_SIZE;
+        Word* dw = (Word*)d;
+        const size_t offset = (uintptr_t)s & WORD_MASK;
+        if (offset == 0) {
+            const Word* sw = (const Word*)s;
+            for (; count > 0; --count) {
+                *--dw = *--sw;
+            }
+        }
+        else {
+            const unsigned int right = offset * CHAR_BIT;
+            const unsigned int left = WORD_BITS - right;
+            const Word* sw = (const Word*)(s - offset);
+            Word next = *sw;
+            for (; count > 0; --count) {
+                const Word previous = *--sw;
+                *--dw = (previous >> right) | (next << left);
+                next = previous;
+            }
+        }
+        s -= (uint8_t*)d - (uint8_t*)dw;
+        d = (uint8_t*)dw;
+    }
+    for (; n > 0; --n) {
+        *--d = *--s;
     }
-    return n;
 }
 
 void* memcpy(void* restrict s1, const void* restrict s2, size_t n)
 {
     assert(s1 != NULL);
     assert(s2 != NULL);
-    // TODO: Optimize.
-    uint8_t* p1 = s1;
-    const uint8_t* p2 = s2;
-    while (n > 0) {
-        *p1 = *p2;
-        ++p1;
-        ++p2;
+    if (n >= VECTOR_MIN_SIZE && is_vector_enabled()) {
+        copy_memory_with_vector(s1, s2, n);
+    }
+    else {
+        _copy_forward(s1, s2, n);
+    }
+    return s1;
+}
+
+void* memmove(void* s1, const void* s2, size_t n)
+{
+    assert(s1 != NULL);
+    assert(s2 != NULL);
+    uint8_t* d = s1;
+    const uint8_t* s = s2;
+    if (d <= s || d >= s + n) {
+        if (n >= VECTOR_MIN_SIZE && is_vector_enabled()) {
+            copy_memory_with_vector(d, s, n);
+        }
+        else {
+            _copy_forward(d, s, n);
+        }
+    }
+    else {
+        _copy_backward(d, s, n);
     }
     return s1;
 }
@@ -52,11 +308,96 @@ void* memcpy(void* restrict s1, const void* restrict s2, size_t n)
 void* memset(void* s, int c, size_t n)
 {
     assert(s != NULL);
+    if (n >= VECTOR_MIN_SIZE && is_vector_enabled()) {
+        set_memory_with_vector(s, c, n);
+        return s;
+    }
+
     uint8_t* p = s;
-    while (n > 0) {
-        *p = (uint8_t)c;
-        ++p;
-        --n;
+    const uint8_t value = (uint8_t)c;
+    if (n >= SMALL_SIZE) {
+        for (; !_is_aligned(p); --n) {
+            *p++ = value;
+        }
+        // Replicate the byte into every byte of the word.
+        const Word pattern = value * (~(Word)0 / 0xFF);
+        Word* w = (Word*)p;
+        size_t count = n / WORD_SIZE;
+        n -= count * WORD_SIZE;
+        for (; count >= 8; count -= 8) {
+            w[0] = pattern;
+            w[1] = pattern;
+            w[2] = pattern;
+            w[3] = pattern;
+            w[4] = pattern;
+            w[5] = pattern;
+            w[6] = pattern;
+            w[7] = pattern;
+            w += 8;
+        }
+        for (; count > 0; --count) {
+            *w++ = pattern;
+        }
+        p = (uint8_t*)w;
+    }
+    for (; n > 0; --n) {
+        *p++ = value;
     }
     return s;
 }
+
+int memcmp(const void* s1, const void* s2, size_t n)
+{
+    assert(s1 != NULL);
+    assert(s2 != NULL);
+    if (n >= VECTOR_MIN_SIZE && is_vector_enabled()) {
+        return compare_memory_with_vector(s1, s2, n);
+    }
+
+    const uint8_t* p1 = s1;
+    const uint8_t* p2 = s2;
+    if (n >= SMALL_SIZE) {
+        for (; !_is_aligned(p1); --n) {
+            if (*p1 != *p2) {
+                return (int)*p1 - (int)*p2;
+            }
+            ++p1;
+            ++p2;
+        }
+
+        // Skip the equal words.  The first differing word, if any, is left
+        // for the byte loop to order.
+        const Word* w1 = (const Word*)p1;
+        const size_t offset = (uintptr_t)p2 & WORD_MASK;
+        const Word* w2 = (const Word*)(p2 - offset);
+        size_t count = 0;
+        if (offset == 0) {
+            for (; count < n / WORD_SIZE && w1[count] == w2[count];
+                    ++count) {
+            }
+        }
+        else {
+            const unsigned int right = offset * CHAR_BIT;
+            const unsigned int left = WORD_BITS - right;
+            Word previous = w2[0];
+            for (; count < n / WORD_SIZE; ++count) {
+                const Word next = w2[count + 1];
+                if (w1[count] != ((previous >> right) | (next << left))) {
+                    break;
+                }
+                previous = next;
+            }
+        }
+        p1 += count * WORD_SIZE;
+        p2 += count * WORD_SIZE;
+        n -= count * WORD_SIZE;
+    }
+    for (; n > 0; --n) {
+        if (*p1 != *p2) {
+            return (int)*p1 - (int)*p2;
+        }
+        ++p1;
+        ++p2;
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/lock_stat.h>
+
+#include <kernel/timer.h>
+
+#include <stdio.h>
+
+DEFINE_LOCK_CLASS(spinlock);
+DEFINE_LOCK_CLASS(mcs_lock);
+DEFINE_LOCK_CLASS(rwlock);
+
+void print_lock_statistics(void)
+{
+#ifdef LOCK_STATISTICS
+    for (const LockClass* class = __lock_class_start;
+            class < __lock_class_end; ++class) {
+        const uint64_t acquisitions =
+            __atomic_load_n(&class->acquisitions, __ATOMIC_RELAXED);
+        if (acquisitions == 0) {
+            continue;
+        }
+        const uint64_t contentions =
+            __atomic_load_n(&class->contentions, __ATOMIC_RELAXED);
+        const uint64_t wait_time =
+            __atomic_load_n(&class->wait_time, __ATOMIC_RELAXED);
+        const uint64_t hold_time =
+            __atomic_load_n(&class->hold_time, __ATOMIC_RELAXED);
+        const uint64_t max_hold_time =
+            __atomic_load_n(&class->max_hold_time, __ATOMIC_RELAXED);
+        dprintf("%s: %llu acquisitions, %llu%% contended, "
+            "%llu ns waited, %llu ns held, %llu ns longest hold\n",
+            class->name, (unsigned long long)acquisitions,
+            (unsigned long long)(contentions * 100 / acquisitions),
+            (unsigned long long)ticks_to_nanoseconds(wait_time),
+            (unsigned long long)ticks_to_nanoseconds(hold_time),
+            (unsigned long long)ticks_to_nanoseconds(max_hold_time));
+    }
+#else
+    dprintf("Lock statistics are disabled\n");
+#endif
+}
@@ -18,32 +18,21 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 // DEALINGS IN THE SOFTWARE.
 
+#include <kernel/block.h>
 #include <kernel/device.h>
 
 #include <stdio.h>
 
-static void _initialize_devices(void)
-{
-    for (const DeviceInitializer* func = &__device_initializer_start;
-            func < &__device_initializer_end; ++func) {
-        (*func)();
-    }
-}
-
-static void _finalize_devices(void)
-{
-    for (const DeviceFinalizer* func = &__device_finalizer_start;
-            func < &__device_finalizer_end; ++func) {
-        (*func)();
-    }
-}
-
 int main(void)
 {
     dprintf("Entered main\n");
 
-    _initialize_devices();
+    initialize_devices();
+    print_boot_timeline();
+#ifdef BLOCK_BENCHMARK
+    run_block_benchmark(get_block_device(0));
+#endif
 
-    _finalize_devices();
+    finalize_devices();
     return 0;
 }
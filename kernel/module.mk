@@ -26,10 +26,24 @@ $(eval $(call generate-module,product))
 $(MODULE).TYPES := config elf
 
 $(MODULE).SRCS := \
+    block.c \
+    block_cache.c \
     console.c \
+    device.c \
+    fdt.c \
+    hart.c \
+    initramfs.c \
+    irq.c \
+    klog.c \
+    lock_stat.c \
     main.c \
     panic.c \
-    pmm.c
+    pmm.c \
+    rcu.c \
+    slab.c \
+    thread.c \
+    timer.c \
+    tracepoint.c
 $(MODULE).INC_DIRS := include
 
 $(MODULE).CONFIG.SRC := include/kernel/config.h.in
@@ -41,6 +55,41 @@ $(MODULE).CONFIG := $(strip \
     $(arch/$(ARCH).KERNEL_CONFIG) \
     )
 
+# KLOG=raw makes the kernel log drainer print raw records for tools/klog.py
+# instead of formatting them on the target.
+ifeq ($(KLOG),raw)
+    $(MODULE).CONFIG += KLOG_RAW
+endif
+
+# CONSOLE=virtio makes the virtio console the active console even when a
+# UART is present.
+ifeq ($(CONSOLE),virtio)
+    $(MODULE).CONFIG += VIRTIO_CONSOLE_ACTIVE
+endif
+
+# BLOCK=poll makes virtio block devices reap completions by polling instead
+# of waiting for interrupts.
+ifeq ($(BLOCK),poll)
+    $(MODULE).CONFIG += VIRTIO_BLOCK_POLLING
+endif
+
+# BENCHMARK=block measures random reads from the first block device after
+# the devices are initialized.
+ifeq ($(BENCHMARK),block)
+    $(MODULE).CONFIG += BLOCK_BENCHMARK
+endif
+
+# LOCK=stat records acquisitions, contention and hold times per lock class
+# for print_lock_statistics.
+ifeq ($(LOCK),stat)
+    $(MODULE).CONFIG += LOCK_STATISTICS
+endif
+
+# TRACE=all enables every tracepoint as soon as the trace buffers exist.
+ifeq ($(TRACE),all)
+    $(MODULE).CONFIG += TRACE_AT_BOOT
+endif
+
 SUBMODULES :=
 
 $(MODULE).DEBUG := $(addprefix device/,$(platform/$(PLATFORM).KERNEL_DEBUG))
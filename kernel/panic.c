@@ -22,11 +22,26 @@
 
 #include <kernel/arch/halt.h>
 #include <kernel/debug.h>
+#include <kernel/klog.h>
+#include <kernel/tracepoint.h>
 
 #include <stdio.h>
 
+static bool _is_panicking = false;
+
+bool is_panicking(void)
+{
+    return __atomic_load_n(&_is_panicking, __ATOMIC_RELAXED);
+}
+
 void vpanic(const char* restrict format, va_list arg)
 {
+    // Debug output stops taking locks that a broken kernel may hold.
+    __atomic_store_n(&_is_panicking, true, __ATOMIC_RELAXED);
+
+    // Show what led up to the panic.
+    drain_klog();
+    print_trace();
     dprintf("PANIC\n");
     dprintf("Reason:\n");
     vdprintf(format, arg);
@@ -20,63 +20,515 @@
 
 #include <kernel/pmm.h>
 
+#include <kernel/arch/interrupt.h>
 #include <kernel/arch/memory.h>
+#include <kernel/bitops.h>
+#include <kernel/compiler.h>
+#include <kernel/fdt.h>
+#include <kernel/hart.h>
+#include <kernel/list.h>
+#include <kernel/panic.h>
+#include <kernel/spinlock.h>
+#include <kernel/tracepoint.h>
 
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
-// This implementation meets the bare-minimum definition of a memory manager.
-// It allocates physical pages without regard considering the amount of DRAM
-// available in the system.  It does not free unused pages or even track which
-// pages have been freed.  It is a starting point for a more advanced manager.
+// Physical pages are managed by a binary buddy allocator.  Free memory is kept
+// as naturally aligned blocks of 2^order pages on per-order free lists.
+// Allocation splits the smallest sufficient block and freeing merges a block
+// with its buddy for as long as the buddy is also free, so both take at most
+// PMM_ORDER_COUNT steps.  The free list node is stored in the free block
+// itself.  The only other metadata is one state byte per page frame.
+//
+// The buddy allocator is shared by all harts under a single lock.  In front
+// of it, each hart keeps a magazine: a stack of single pages that only that
+// hart touches, with interrupts disabled, so the common single-page path
+// takes no lock and performs no atomic operations.  Magazines exchange pages
+// with the buddy allocator in batches to amortize the lock.
+
+#define PAGE_STATE_FREE 0x80  // Head of a free block; the low bits are the order
+#define PAGE_STATE_USED 0x00  // Allocated, reserved, or inside a free block
+#define PAGE_STATE_AVAILABLE 0x01  // Not yet released; only during initialization
+
+// Size of DRAM assumed at DRAM_BASE when the FDT does not describe memory.
+#define FALLBACK_DRAM_SIZE (128 * 1024 * 1024)
+
+#define ORDER_PAGES(order) ((size_t)1 << (order))
+
+typedef struct FreeArea
+{
+    List blocks;
+    size_t count;
+} FreeArea;
+
+typedef struct PageMagazine
+{
+    size_t count;
+    PhysicalAddress pages[PMM_MAGAZINE_SIZE];
+    PmmMagazineStatistics statistics;
+} ALIGNED(CACHE_LINE_SIZE) PageMagazine;
 
 extern void* const __end;
-static PhysicalAddress _start = 0;
-static PhysicalAddress _next = 0;
+
+static DEFINE_PER_HART(PageMagazine, _magazine);
+
+// Guards the buddy allocator
+DEFINE_LOCK_CLASS(pmm);
+static Spinlock _lock = SPINLOCK_CLASS_INITIALIZER(pmm);
+static FreeArea _free_areas[PMM_ORDER_COUNT];
+static unsigned long _free_area_mask = 0;  // Bit n is set if order n is nonempty
+static uint8_t* _page_states = NULL;
+static size_t _first_frame = 0;
+static size_t _frame_count = 0;
+static size_t _free_page_count = 0;
+static size_t _dram_size = 0;
+
+DEFINE_TRACEPOINT(pmm_allocate, "page %p");
+DEFINE_TRACEPOINT(pmm_free, "page %p");
+DEFINE_TRACEPOINT(pmm_allocate_contiguous, "pages %p count %zu");
+DEFINE_TRACEPOINT(pmm_free_contiguous, "pages %p count %zu");
+DEFINE_TRACEPOINT(pmm_magazine_refill, "count %zu");
+DEFINE_TRACEPOINT(pmm_magazine_spill, "count %zu");
+
+static inline size_t _address_to_frame(PhysicalAddress addr)
+{
+    return addr >> PAGE_BITS;
+}
+
+static inline PhysicalAddress _frame_to_address(size_t frame)
+{
+    return (PhysicalAddress)frame << PAGE_BITS;
+}
+
+static inline bool _is_managed_frame(size_t frame)
+{
+    return frame >= _first_frame && frame - _first_frame < _frame_count;
+}
+
+static inline uint8_t* _get_page_state(size_t frame)
+{
+    return &_page_states[frame - _first_frame];
+}
+
+static bool _is_free_block(size_t frame, unsigned int order)
+{
+    return _is_managed_frame(frame) &&
+        *_get_page_state(frame) == (PAGE_STATE_FREE | order);
+}
+
+static void _push_free_block(size_t frame, unsigned int order)
+{
+    FreeArea* area = &_free_areas[order];
+    ListNode* node = physical_to_virtual(_frame_to_address(frame));
+    push_list_front(&area->blocks, node);
+    ++area->count;
+    _free_area_mask |= 1ul << order;
+    *_get_page_state(frame) = PAGE_STATE_FREE | order;
+}
+
+static void _remove_free_block(size_t frame, unsigned int order)
+{
+    FreeArea* area = &_free_areas[order];
+    remove_list_node(physical_to_virtual(_frame_to_address(frame)));
+    --area->count;
+    if (area->count == 0) {
+        _free_area_mask &= ~(1ul << order);
+    }
+    *_get_page_state(frame) = PAGE_STATE_USED;
+}
+
+static bool _allocate_block(unsigned int order, size_t* frame)
+{
+    const unsigned long candidates = _free_area_mask & ~((1ul << order) - 1);
+    if (candidates == 0) {
+        return false;
+    }
+
+    unsigned int found = find_first_set_bit(candidates);
+    const ListNode* node = _free_areas[found].blocks.next;
+    const size_t block = _address_to_frame(virtual_to_physical(node));
+    _remove_free_block(block, found);
+
+    // Split the block, returning the upper halves to the free lists.
+    while (found > order) {
+        --found;
+        _push_free_block(block + ORDER_PAGES(found), found);
+    }
+
+    _free_page_count -= ORDER_PAGES(order);
+    *frame = block;
+    return true;
+}
+
+static void _free_block(size_t frame, unsigned int order)
+{
+    assert(_is_managed_frame(frame));
+    assert((*_get_page_state(frame) & PAGE_STATE_FREE) == 0);  // Double free
+
+    _free_page_count += ORDER_PAGES(order);
+
+    // Merge with the buddy for as long as the buddy is a free block of the
+    // same order.
+    while (order + 1 < PMM_ORDER_COUNT) {
+        const size_t buddy = frame ^ ORDER_PAGES(order);
+        if (!_is_free_block(buddy, order)) {
+            break;
+        }
+        _remove_free_block(buddy, order);
+        frame &= ~ORDER_PAGES(order);
+        ++order;
+    }
+    _push_free_block(frame, order);
+}
+
+// Free the frames in [start, end) as the largest naturally aligned blocks
+// that fit.
+static void _free_frame_range(size_t start, size_t end)
+{
+    while (start < end) {
+        unsigned int order = start == 0
+            ? PMM_ORDER_COUNT - 1
+            : find_first_set_bit(start);
+        if (order >= PMM_ORDER_COUNT) {
+            order = PMM_ORDER_COUNT - 1;
+        }
+        while (start + ORDER_PAGES(order) > end) {
+            --order;
+        }
+        _free_block(start, order);
+        start += ORDER_PAGES(order);
+    }
+}
 
 size_t allocate_physical_pages(PhysicalAddress* addrs, size_t count)
 {
     assert(addrs != NULL);
-    dprintf("Allocating %u physical pages into %p\n", count, addrs);
+    const InterruptState state = acquire_spinlock_irqsave(&_lock);
     size_t i = 0;
     for (; i < count; ++i) {
-        addrs[i] = _next;
-        _next += PAGE_SIZE;
+        size_t frame;
+        if (!_allocate_block(0, &frame)) {
+            break;
+        }
+        addrs[i] = _frame_to_address(frame);
     }
+    release_spinlock_irqrestore(&_lock, state);
     return i;
 }
 
 PhysicalAddress allocate_physical_page(void)
 {
-    PhysicalAddress addr = 0;  // Unmodified if allocate_physical_pages fails.
-    allocate_physical_pages(&addr, 1);
+    PhysicalAddress addr = 0;  // Unmodified if the magazine cannot refill.
+
+    const InterruptState state = disable_interrupts();
+    PageMagazine* magazine = THIS_HART_PTR(_magazine);
+    if (magazine->count != 0) {
+        ++magazine->statistics.allocate_hits;
+    }
+    else {
+        ++magazine->statistics.allocate_misses;
+        magazine->count = allocate_physical_pages(magazine->pages,
+            PMM_MAGAZINE_BATCH);
+        if (magazine->count != 0) {
+            ++magazine->statistics.refills;
+        }
+        trace(pmm_magazine_refill, magazine->count);
+    }
+    if (magazine->count != 0) {
+        --magazine->count;
+        addr = magazine->pages[magazine->count];
+    }
+    restore_interrupts(state);
+    trace(pmm_allocate, addr);
+
     return addr;
 }
 
+PhysicalAddress allocate_contiguous_physical_pages(size_t count)
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    const unsigned int order = log2_ceil(count);
+    if (order >= PMM_ORDER_COUNT) {
+        return 0;
+    }
+
+    InterruptState state = acquire_spinlock_irqsave(&_lock);
+    size_t frame;
+    bool allocated = _allocate_block(order, &frame);
+    release_spinlock_irqrestore(&_lock, state);
+    if (!allocated) {
+        // Pages held in this hart's magazine may complete a block.
+        drain_pmm_magazine();
+        state = acquire_spinlock_irqsave(&_lock);
+        allocated = _allocate_block(order, &frame);
+        release_spinlock_irqrestore(&_lock, state);
+        if (!allocated) {
+            return 0;
+        }
+    }
+
+    // Return the pages beyond count so that only the requested pages are
+    // consumed.
+    state = acquire_spinlock_irqsave(&_lock);
+    _free_frame_range(frame + count, frame + ORDER_PAGES(order));
+    release_spinlock_irqrestore(&_lock, state);
+    trace(pmm_allocate_contiguous, _frame_to_address(frame), count);
+    return _frame_to_address(frame);
+}
+
 void free_physical_pages(PhysicalAddress* addrs, size_t count)
 {
     assert(addrs != NULL);
-    dprintf("Freeing %u physical pages at %p\n", count, addrs);
+    const InterruptState state = acquire_spinlock_irqsave(&_lock);
+    for (size_t i = 0; i < count; ++i) {
+        assert((addrs[i] & ~PAGE_MASK) == 0);
+        _free_block(_address_to_frame(addrs[i]), 0);
+    }
+    release_spinlock_irqrestore(&_lock, state);
 }
 
 void free_physical_page(PhysicalAddress addr)
 {
-    free_physical_pages(&addr, 1);
+    assert((addr & ~PAGE_MASK) == 0);
+
+    const InterruptState state = disable_interrupts();
+    PageMagazine* magazine = THIS_HART_PTR(_magazine);
+    if (magazine->count < PMM_MAGAZINE_SIZE) {
+        ++magazine->statistics.free_hits;
+    }
+    else {
+        // Spill the oldest pages and keep the most recently freed, which are
+        // the most likely to still be cached.
+        ++magazine->statistics.free_misses;
+        ++magazine->statistics.spills;
+        free_physical_pages(magazine->pages, PMM_MAGAZINE_BATCH);
+        trace(pmm_magazine_spill, PMM_MAGAZINE_BATCH);
+        magazine->count -= PMM_MAGAZINE_BATCH;
+        for (size_t i = 0; i < magazine->count; ++i) {
+            magazine->pages[i] = magazine->pages[i + PMM_MAGAZINE_BATCH];
+        }
+    }
+    magazine->pages[magazine->count] = addr;
+    ++magazine->count;
+    restore_interrupts(state);
+    trace(pmm_free, addr);
+}
+
+void free_contiguous_physical_pages(PhysicalAddress addr, size_t count)
+{
+    assert((addr & ~PAGE_MASK) == 0);
+    const size_t frame = _address_to_frame(addr);
+    const InterruptState state = acquire_spinlock_irqsave(&_lock);
+    _free_frame_range(frame, frame + count);
+    release_spinlock_irqrestore(&_lock, state);
+    trace(pmm_free_contiguous, addr, count);
+}
+
+void drain_pmm_magazine(void)
+{
+    const InterruptState state = disable_interrupts();
+    PageMagazine* magazine = THIS_HART_PTR(_magazine);
+    if (magazine->count != 0) {
+        ++magazine->statistics.spills;
+        free_physical_pages(magazine->pages, magazine->count);
+        magazine->count = 0;
+    }
+    restore_interrupts(state);
+}
+
+void get_pmm_magazine_statistics(size_t hart_index,
+    PmmMagazineStatistics* statistics)
+{
+    assert(hart_index < get_hart_count());
+    assert(statistics != NULL);
+    *statistics = HART_PTR(_magazine, hart_index)->statistics;
+}
+
+size_t get_free_physical_page_count(void)
+{
+    return _free_page_count;
 }
 
 size_t get_dram_size(void)
 {
-    // TODO: Get actual size of DRAM from FDT.
-    return 128 * 1024 * 1024;
+    return _dram_size;
+}
+
+static size_t _get_memory_range_count(void)
+{
+    const size_t count = get_fdt_memory_range_count();
+    return count != 0 ? count : 1;
+}
+
+static FdtRange _get_memory_range(size_t index)
+{
+    if (get_fdt_memory_range_count() == 0) {
+        const FdtRange fallback = {
+            .base = DRAM_BASE,
+            .size = FALLBACK_DRAM_SIZE,
+        };
+        return fallback;
+    }
+    return *get_fdt_memory_range(index);
+}
+
+// Set the state of the managed frames that overlap [start, end).
+static void _set_frame_states(PhysicalAddress start, PhysicalAddress end,
+    uint8_t state)
+{
+    size_t first = _address_to_frame(start);
+    size_t last = _address_to_frame(ROUND_PAGE_UP(end));
+    if (first < _first_frame) {
+        first = _first_frame;
+    }
+    if (last > _first_frame + _frame_count) {
+        last = _first_frame + _frame_count;
+    }
+    for (size_t frame = first; frame < last; ++frame) {
+        *_get_page_state(frame) = state;
+    }
+}
+
+static bool _overlaps(PhysicalAddress start, PhysicalAddress end,
+    uint64_t base, uint64_t size)
+{
+    return start < base + size && base < end;
+}
+
+// Report whether [start, end) lies in one memory range and clear of the
+// kernel image and every reserved range, which include the FDT blob and the
+// initrd.
+static bool _is_unclaimed(PhysicalAddress start, PhysicalAddress end,
+    PhysicalAddress kernel_end)
+{
+    bool is_in_memory = false;
+    for (size_t i = 0; i < _get_memory_range_count(); ++i) {
+        const FdtRange range = _get_memory_range(i);
+        if (start >= range.base && end <= range.base + range.size) {
+            is_in_memory = true;
+        }
+    }
+    if (!is_in_memory
+            || _overlaps(start, end, DRAM_BASE, kernel_end - DRAM_BASE)) {
+        return false;
+    }
+    for (size_t i = 0; i < get_fdt_reserved_range_count(); ++i) {
+        const FdtRange* range = get_fdt_reserved_range(i);
+        if (_overlaps(start, end, range->base, range->size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Find room for size bytes of page states, preferably right after the kernel
+// image, and otherwise right after a reserved range or at the start of a
+// memory range.
+static PhysicalAddress _place_page_states(size_t size,
+    PhysicalAddress kernel_end)
+{
+    if (_is_unclaimed(kernel_end, kernel_end + size, kernel_end)) {
+        return kernel_end;
+    }
+    for (size_t i = 0; i < get_fdt_reserved_range_count(); ++i) {
+        const FdtRange* range = get_fdt_reserved_range(i);
+        const PhysicalAddress start = ROUND_PAGE_UP(range->base + range->size);
+        if (_is_unclaimed(start, start + size, kernel_end)) {
+            return start;
+        }
+    }
+    for (size_t i = 0; i < _get_memory_range_count(); ++i) {
+        const PhysicalAddress start =
+            ROUND_PAGE_UP(_get_memory_range(i).base);
+        if (_is_unclaimed(start, start + size, kernel_end)) {
+            return start;
+        }
+    }
+    panic("No room for %zu bytes of page states\n", size);
 }
 
 void initialize_pmm(void)
 {
-    PhysicalAddress start = ROUND_PAGE_UP((PhysicalAddress)&__end);
-    dprintf("Initializing PMM with starting address %p\n", start);
+    for (unsigned int order = 0; order < PMM_ORDER_COUNT; ++order) {
+        initialize_list(&_free_areas[order].blocks);
+        _free_areas[order].count = 0;
+    }
+
+    // Find the extent of physical memory.
+    PhysicalAddress lowest = UINTPTR_MAX;
+    PhysicalAddress highest = 0;
+    for (size_t i = 0; i < _get_memory_range_count(); ++i) {
+        const FdtRange range = _get_memory_range(i);
+        const PhysicalAddress start = ROUND_PAGE_DOWN(range.base);
+        const PhysicalAddress end = ROUND_PAGE_DOWN(range.base + range.size);
+        dprintf("Memory range %p-%p\n", (void*)start, (void*)end);
+        if (start < lowest) {
+            lowest = start;
+        }
+        if (end > highest) {
+            highest = end;
+        }
+        _dram_size += range.size;
+    }
+    assert(lowest < highest);
+
+    // The page state array goes where it overwrites neither the kernel nor
+    // anything reserved, which the firmware may have placed right after the
+    // image.
+    const PhysicalAddress kernel_end =
+        ROUND_PAGE_UP(virtual_to_physical(&__end));
+    _first_frame = _address_to_frame(lowest);
+    _frame_count = _address_to_frame(highest) - _first_frame;
+    const PhysicalAddress states = _place_page_states(_frame_count,
+        kernel_end);
+    dprintf("Initializing PMM with page states at %p\n", (void*)states);
+    _page_states = physical_to_virtual(states);
+    memset(_page_states, PAGE_STATE_USED, _frame_count);
+
+    for (size_t i = 0; i < _get_memory_range_count(); ++i) {
+        const FdtRange range = _get_memory_range(i);
+        _set_frame_states(range.base, range.base + range.size,
+            PAGE_STATE_AVAILABLE);
+    }
+    for (size_t i = 0; i < get_fdt_reserved_range_count(); ++i) {
+        const FdtRange* range = get_fdt_reserved_range(i);
+        dprintf("Reserved range %p-%p\n", (void*)(uintptr_t)range->base,
+            (void*)(uintptr_t)(range->base + range->size));
+        _set_frame_states(range->base, range->base + range->size,
+            PAGE_STATE_USED);
+    }
+    // Everything from the start of DRAM to the end of the kernel holds the
+    // firmware and the kernel.
+    _set_frame_states(DRAM_BASE, kernel_end, PAGE_STATE_USED);
+    _set_frame_states(states, states + _frame_count, PAGE_STATE_USED);
+
+    // Release each run of available frames.
+    size_t run_start = 0;
+    bool in_run = false;
+    for (size_t frame = _first_frame; frame <= _first_frame + _frame_count;
+            ++frame) {
+        const bool available = frame < _first_frame + _frame_count &&
+            *_get_page_state(frame) == PAGE_STATE_AVAILABLE;
+        if (available) {
+            *_get_page_state(frame) = PAGE_STATE_USED;
+            if (!in_run) {
+                run_start = frame;
+                in_run = true;
+            }
+        }
+        else if (in_run) {
+            _free_frame_range(run_start, frame);
+            in_run = false;
+        }
+    }
 
-    _start = start;
-    _next = _start;
+    dprintf("PMM has %zu MiB of DRAM and %zu free pages\n",
+        _dram_size >> 20, _free_page_count);
 }
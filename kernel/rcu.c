@@ -0,0 +1,161 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/rcu.h>
+
+#include <kernel/arch/hart.h>
+#include <kernel/arch/interrupt.h>
+#include <kernel/arch/timer.h>
+#include <kernel/bitops.h>
+#include <kernel/config.h>
+#include <kernel/hart.h>
+#include <kernel/percpu.h>
+#include <kernel/spinlock.h>
+#include <kernel/timer.h>
+#include <kernel/tracepoint.h>
+#include <kernel/wait_queue.h>
+
+#include <stdio.h>
+
+_Static_assert(MAX_HARTS <= BITS_PER_LONG,
+    "The kicked hart mask needs one bit per hart");
+
+// Grace periods are numbered.  Starting one increments _sequence, and it
+// ends once every online hart has reported a quiescent state at that number
+// or later.
+static unsigned long _sequence = 0;
+static DEFINE_PER_HART(unsigned long, _quiescent_sequence);
+
+// Guards _callbacks
+DEFINE_LOCK_CLASS(rcu);
+static Spinlock _lock = SPINLOCK_CLASS_INITIALIZER(rcu);
+static List _callbacks = {.prev = &_callbacks, .next = &_callbacks};
+static WaitQueue _callback_waiters =
+    WAIT_QUEUE_INITIALIZER(_callback_waiters);
+
+DEFINE_TRACEPOINT(rcu_grace_period, "sequence %lu took %llu ticks");
+
+static bool _has_reported(size_t hart_index, unsigned long sequence)
+{
+    const unsigned long reported = __atomic_load_n(
+        HART_PTR(_quiescent_sequence, hart_index), __ATOMIC_ACQUIRE);
+    return (long)(reported - sequence) >= 0;
+}
+
+void report_rcu_quiescent_state(void)
+{
+    unsigned long* reported = THIS_HART_PTR(_quiescent_sequence);
+    const unsigned long sequence =
+        __atomic_load_n(&_sequence, __ATOMIC_ACQUIRE);
+    if (*reported != sequence) {
+        // Release orders the reads of every earlier critical section on this
+        // hart before the report.
+        __atomic_store_n(reported, sequence, __ATOMIC_RELEASE);
+    }
+}
+
+void synchronize_rcu(void)
+{
+    const uint64_t start = get_time();
+    // The writer published before starting the grace period, so a hart that
+    // reports it can only see the new data from then on.
+    const unsigned long sequence =
+        __atomic_add_fetch(&_sequence, 1, __ATOMIC_SEQ_CST);
+    // Nothing on this hart is reading: not the caller, and not a thread that
+    // it preempted, since critical sections cannot be preempted.
+    const InterruptState state = disable_interrupts();
+    report_rcu_quiescent_state();
+    restore_interrupts(state);
+
+    unsigned long kicked = 0;
+    for (;;) {
+        bool is_done = true;
+        for (size_t i = 0; i < get_hart_count(); ++i) {
+            const Hart* hart = get_hart(i);
+            if (!__atomic_load_n(&hart->online, __ATOMIC_ACQUIRE)
+                    || _has_reported(i, sequence)) {
+                continue;
+            }
+            is_done = false;
+            // The interrupt makes the hart report on its way out, or, if it
+            // is reading, makes it switch threads as soon as it stops.
+            if ((kicked & (1ul << i)) == 0) {
+                kicked |= 1ul << i;
+                send_ipi(hart);
+            }
+        }
+        if (is_done) {
+            break;
+        }
+        sleep_for(RCU_POLL_INTERVAL_NS);
+    }
+    trace(rcu_grace_period, sequence,
+        (unsigned long long)(get_time() - start));
+}
+
+void call_rcu(RcuHead* head, RcuCallback callback)
+{
+    head->callback = callback;
+    const InterruptState state = acquire_spinlock_irqsave(&_lock);
+    push_list_back(&_callbacks, &head->node);
+    release_spinlock_irqrestore(&_lock, state);
+    wake_one(&_callback_waiters);
+}
+
+static bool _has_callbacks(void* data)
+{
+    (void)data;
+    acquire_spinlock(&_lock);
+    const bool has_callbacks = !is_list_empty(&_callbacks);
+    release_spinlock(&_lock);
+    return has_callbacks;
+}
+
+static void _run_callbacks(void* argument)
+{
+    (void)argument;
+    for (;;) {
+        wait_on_queue(&_callback_waiters, _has_callbacks, NULL);
+
+        // Every callback queued so far shares one grace period.
+        List batch;
+        initialize_list(&batch);
+        const InterruptState state = acquire_spinlock_irqsave(&_lock);
+        for (ListNode* node = pop_list_front(&_callbacks); node != NULL;
+                node = pop_list_front(&_callbacks)) {
+            push_list_back(&batch, node);
+        }
+        release_spinlock_irqrestore(&_lock, state);
+
+        synchronize_rcu();
+        for (ListNode* node = pop_list_front(&batch); node != NULL;
+                node = pop_list_front(&batch)) {
+            RcuHead* head = LIST_ENTRY(node, RcuHead, node);
+            head->callback(head);
+        }
+    }
+}
+
+void initialize_rcu(void)
+{
+    if (create_thread("rcu", _run_callbacks, NULL) == NULL) {
+        dprintf("Unable to create the RCU callback thread\n");
+    }
+}
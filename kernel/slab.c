@@ -0,0 +1,549 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/slab.h>
+
+#include <kernel/arch/interrupt.h>
+#include <kernel/arch/memory.h>
+#include <kernel/bitops.h>
+#include <kernel/compiler.h>
+#include <kernel/config.h>
+#include <kernel/hart.h>
+#include <kernel/list.h>
+#include <kernel/pmm.h>
+#include <kernel/spinlock.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Each cache owns a set of slabs, filed on a partial, full, or empty list by
+// how many of their objects are in use, and serves objects through a small
+// cache per hart.  Like the PMM magazines, a hart cache is only touched by its
+// hart with interrupts disabled, so the common path takes no lock.  The slab
+// header sits at the start of the slab and the free objects of a slab are
+// linked through a word inside each object, or after it if the cache has a
+// constructor.
+
+#define KMALLOC_CACHE_COUNT 8
+
+// Empty slabs kept by each cache to absorb allocation churn.  Any more are
+// returned to the PMM.
+#define MAX_EMPTY_SLABS 1
+
+// Large kmalloc blocks are preceded by a header of this size so that the
+// returned memory keeps the alignment of the kmalloc caches.
+#define LARGE_BLOCK_HEADER_SIZE CACHE_LINE_SIZE
+
+_Static_assert(KMALLOC_MIN_SIZE << (KMALLOC_CACHE_COUNT - 1)
+        == KMALLOC_MAX_SIZE,
+    "KMALLOC_CACHE_COUNT must cover KMALLOC_MIN_SIZE to KMALLOC_MAX_SIZE");
+
+typedef struct HartObjectCache
+{
+    size_t count;
+    void* objects[SLAB_HART_CACHE_SIZE];
+} ALIGNED(CACHE_LINE_SIZE) HartObjectCache;
+
+struct SlabCache
+{
+    const char* name;
+    size_t object_size;
+    size_t stride;
+    size_t link_offset;  // Offset of the free list link in each object
+    size_t first_offset;  // Offset of the first object in each slab
+    size_t objects_per_slab;
+    SlabConstructor constructor;
+    ListNode node;  // In _caches
+
+    Spinlock lock;  // Guards the slabs and counts below
+    List partial_slabs;
+    List full_slabs;
+    List empty_slabs;
+    size_t slab_count;
+    size_t empty_slab_count;
+    size_t in_use_count;  // Objects outside of slab free lists
+
+    HartObjectCache hart_caches[MAX_HARTS];
+};
+
+typedef struct Slab
+{
+    SlabCache* cache;  // Must be first; NULL for a large kmalloc block
+    ListNode node;
+    void* free_objects;
+    size_t in_use_count;
+} Slab;
+
+typedef struct LargeBlock
+{
+    SlabCache* cache;  // Must be first; always NULL
+    size_t page_count;
+} LargeBlock;
+
+_Static_assert(offsetof(Slab, cache) == offsetof(LargeBlock, cache),
+    "kfree must find the cache of slabs and large blocks alike");
+_Static_assert(sizeof(LargeBlock) <= LARGE_BLOCK_HEADER_SIZE,
+    "The large block header does not fit");
+
+static SlabCache _cache_cache;  // Allocates the other SlabCaches
+static SlabCache _kmalloc_caches[KMALLOC_CACHE_COUNT];
+static const char* const _kmalloc_cache_names[KMALLOC_CACHE_COUNT] = {
+    "kmalloc-16",
+    "kmalloc-32",
+    "kmalloc-64",
+    "kmalloc-128",
+    "kmalloc-256",
+    "kmalloc-512",
+    "kmalloc-1024",
+    "kmalloc-2048",
+};
+
+static Spinlock _caches_lock = SPINLOCK_INITIALIZER;  // Guards _caches
+DEFINE_LOCK_CLASS(slab_cache);
+static List _caches;
+
+static size_t _round_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+static void** _get_link(const SlabCache* cache, void* object)
+{
+    return (void**)((char*)object + cache->link_offset);
+}
+
+static Slab* _get_slab(const void* object)
+{
+    return (Slab*)((uintptr_t)object & ~((uintptr_t)SLAB_SIZE - 1));
+}
+
+static bool _initialize_cache(SlabCache* cache, const char* name, size_t size,
+    size_t align, SlabConstructor constructor)
+{
+    if (size == 0 || size > SLAB_MAX_OBJECT_SIZE) {
+        return false;
+    }
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+    if (!is_power_of_two(align) || align > PAGE_SIZE) {
+        return false;
+    }
+
+    cache->name = name;
+    cache->object_size = size;
+    if (constructor != NULL) {
+        // The link must not overwrite the constructed state.
+        cache->link_offset = _round_up(size, sizeof(void*));
+        size = cache->link_offset + sizeof(void*);
+    }
+    else {
+        cache->link_offset = 0;
+        if (size < sizeof(void*)) {
+            size = sizeof(void*);
+        }
+    }
+    cache->stride = _round_up(size, align);
+    cache->first_offset = _round_up(sizeof(Slab), align);
+    if (cache->first_offset + cache->stride > SLAB_SIZE) {
+        return false;
+    }
+    cache->objects_per_slab =
+        (SLAB_SIZE - cache->first_offset) / cache->stride;
+    cache->constructor = constructor;
+
+    initialize_spinlock_in_class(&cache->lock, &LOCK_CLASS_NAME(slab_cache));
+    initialize_list(&cache->partial_slabs);
+    initialize_list(&cache->full_slabs);
+    initialize_list(&cache->empty_slabs);
+    cache->slab_count = 0;
+    cache->empty_slab_count = 0;
+    cache->in_use_count = 0;
+    for (size_t i = 0; i < MAX_HARTS; ++i) {
+        cache->hart_caches[i].count = 0;
+    }
+
+    const InterruptState state = acquire_spinlock_irqsave(&_caches_lock);
+    push_list_back(&_caches, &cache->node);
+    release_spinlock_irqrestore(&_caches_lock, state);
+    return true;
+}
+
+static Slab* _create_slab(SlabCache* cache)
+{
+    const PhysicalAddress addr = allocate_contiguous_physical_pages(SLAB_PAGES);
+    if (addr == 0) {
+        return NULL;
+    }
+
+    Slab* slab = physical_to_virtual(addr);
+    assert(((uintptr_t)slab & (SLAB_SIZE - 1)) == 0);
+    slab->cache = cache;
+    slab->free_objects = NULL;
+    slab->in_use_count = 0;
+
+    // Link the objects from the last so that they are handed out in address
+    // order.
+    char* object = (char*)slab + cache->first_offset
+        + (cache->objects_per_slab - 1) * cache->stride;
+    for (size_t i = 0; i < cache->objects_per_slab; ++i) {
+        if (cache->constructor != NULL) {
+            cache->constructor(object);
+        }
+        *_get_link(cache, object) = slab->free_objects;
+        slab->free_objects = object;
+        object -= cache->stride;
+    }
+    return slab;
+}
+
+static void _destroy_slab(Slab* slab)
+{
+    free_contiguous_physical_pages(virtual_to_physical(slab), SLAB_PAGES);
+}
+
+// Move slab to the list matching its use.  The cache lock must be held.
+static void _file_slab(SlabCache* cache, Slab* slab)
+{
+    if (slab->in_use_count == 0) {
+        push_list_back(&cache->empty_slabs, &slab->node);
+        ++cache->empty_slab_count;
+    }
+    else if (slab->in_use_count == cache->objects_per_slab) {
+        push_list_back(&cache->full_slabs, &slab->node);
+    }
+    else {
+        push_list_back(&cache->partial_slabs, &slab->node);
+    }
+}
+
+static void _unfile_slab(SlabCache* cache, Slab* slab)
+{
+    if (slab->in_use_count == 0) {
+        --cache->empty_slab_count;
+    }
+    remove_list_node(&slab->node);
+}
+
+// Take up to count objects from the slabs of cache.  The cache lock must be
+// held.  Partial slabs are used first to let the others empty out.
+static size_t _take_objects(SlabCache* cache, void** objects, size_t count)
+{
+    size_t taken = 0;
+    while (taken < count) {
+        List* list = &cache->partial_slabs;
+        if (is_list_empty(list)) {
+            list = &cache->empty_slabs;
+            if (is_list_empty(list)) {
+                break;
+            }
+        }
+
+        Slab* slab = LIST_ENTRY(list->next, Slab, node);
+        _unfile_slab(cache, slab);
+        while (taken < count && slab->free_objects != NULL) {
+            void* object = slab->free_objects;
+            slab->free_objects = *_get_link(cache, object);
+            objects[taken] = object;
+            ++taken;
+            ++slab->in_use_count;
+        }
+        _file_slab(cache, slab);
+    }
+    cache->in_use_count += taken;
+    return taken;
+}
+
+// Return count objects to their slabs.  The cache lock must be held.  Slabs
+// that become empty beyond MAX_EMPTY_SLABS are unlinked into *released for
+// the caller to destroy after dropping the lock.
+static void _return_objects(SlabCache* cache, void* const* objects,
+    size_t count, List* released)
+{
+    for (size_t i = 0; i < count; ++i) {
+        void* object = objects[i];
+        Slab* slab = _get_slab(object);
+        assert(slab->cache == cache);
+        assert(slab->in_use_count != 0);
+
+        _unfile_slab(cache, slab);
+        *_get_link(cache, object) = slab->free_objects;
+        slab->free_objects = object;
+        --slab->in_use_count;
+        if (slab->in_use_count == 0
+            && cache->empty_slab_count >= MAX_EMPTY_SLABS) {
+            --cache->slab_count;
+            push_list_back(released, &slab->node);
+        }
+        else {
+            _file_slab(cache, slab);
+        }
+    }
+    cache->in_use_count -= count;
+}
+
+static void _destroy_released_slabs(List* released)
+{
+    while (!is_list_empty(released)) {
+        _destroy_slab(LIST_ENTRY(pop_list_front(released), Slab, node));
+    }
+}
+
+// Refill the hart cache with a batch of objects, creating a slab if the
+// existing ones are exhausted.  Interrupts must be disabled.
+static bool _refill_hart_cache(SlabCache* cache, HartObjectCache* hart_cache)
+{
+    while (true) {
+        acquire_spinlock(&cache->lock);
+        hart_cache->count = _take_objects(cache, hart_cache->objects,
+            SLAB_HART_CACHE_BATCH);
+        release_spinlock(&cache->lock);
+        if (hart_cache->count != 0) {
+            return true;
+        }
+
+        // Constructors run outside of the lock.
+        Slab* slab = _create_slab(cache);
+        if (slab == NULL) {
+            return false;
+        }
+        acquire_spinlock(&cache->lock);
+        ++cache->slab_count;
+        _file_slab(cache, slab);
+        release_spinlock(&cache->lock);
+    }
+}
+
+// Return count objects from the bottom of the hart cache to the slabs.
+// Interrupts must be disabled.
+static void _flush_hart_cache(SlabCache* cache, HartObjectCache* hart_cache,
+    size_t count)
+{
+    List released;
+    initialize_list(&released);
+    acquire_spinlock(&cache->lock);
+    _return_objects(cache, hart_cache->objects, count, &released);
+    release_spinlock(&cache->lock);
+    _destroy_released_slabs(&released);
+
+    hart_cache->count -= count;
+    for (size_t i = 0; i < hart_cache->count; ++i) {
+        hart_cache->objects[i] = hart_cache->objects[i + count];
+    }
+}
+
+SlabCache* create_slab_cache(const char* name, size_t size, size_t align,
+    SlabConstructor constructor)
+{
+    SlabCache* cache = allocate_slab_object(&_cache_cache);
+    if (cache == NULL) {
+        return NULL;
+    }
+    if (!_initialize_cache(cache, name, size, align, constructor)) {
+        free_slab_object(&_cache_cache, cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void destroy_slab_cache(SlabCache* cache)
+{
+    assert(cache != NULL);
+
+    const InterruptState state = acquire_spinlock_irqsave(&_caches_lock);
+    remove_list_node(&cache->node);
+    release_spinlock_irqrestore(&_caches_lock, state);
+
+    // The cache must no longer be in use on any hart, so every hart cache can
+    // be flushed from here.
+    const InterruptState hart_state = disable_interrupts();
+    for (size_t i = 0; i < MAX_HARTS; ++i) {
+        HartObjectCache* hart_cache = &cache->hart_caches[i];
+        if (hart_cache->count != 0) {
+            _flush_hart_cache(cache, hart_cache, hart_cache->count);
+        }
+    }
+    restore_interrupts(hart_state);
+
+    if (cache->in_use_count != 0) {
+        dprintf("Destroying slab cache %s with %zu objects in use\n",
+            cache->name, cache->in_use_count);
+    }
+    while (!is_list_empty(&cache->empty_slabs)) {
+        _destroy_slab(LIST_ENTRY(pop_list_front(&cache->empty_slabs), Slab,
+            node));
+    }
+    free_slab_object(&_cache_cache, cache);
+}
+
+void* allocate_slab_object(SlabCache* cache)
+{
+    assert(cache != NULL);
+
+    void* object = NULL;
+    const InterruptState state = disable_interrupts();
+    HartObjectCache* hart_cache = &cache->hart_caches[get_hart_index()];
+    if (hart_cache->count != 0 || _refill_hart_cache(cache, hart_cache)) {
+        --hart_cache->count;
+        object = hart_cache->objects[hart_cache->count];
+    }
+    restore_interrupts(state);
+    return object;
+}
+
+void free_slab_object(SlabCache* cache, void* object)
+{
+    assert(cache != NULL);
+    if (object == NULL) {
+        return;
+    }
+    assert(_get_slab(object)->cache == cache);
+
+    const InterruptState state = disable_interrupts();
+    HartObjectCache* hart_cache = &cache->hart_caches[get_hart_index()];
+    if (hart_cache->count == SLAB_HART_CACHE_SIZE) {
+        _flush_hart_cache(cache, hart_cache, SLAB_HART_CACHE_BATCH);
+    }
+    hart_cache->objects[hart_cache->count] = object;
+    ++hart_cache->count;
+    restore_interrupts(state);
+}
+
+void* kmalloc(size_t size)
+{
+    if (size == 0) {
+        return NULL;
+    }
+    if (size <= KMALLOC_MAX_SIZE) {
+        const unsigned int order = size <= KMALLOC_MIN_SIZE
+            ? 0
+            : log2_ceil(size) - log2_floor(KMALLOC_MIN_SIZE);
+        return allocate_slab_object(&_kmalloc_caches[order]);
+    }
+
+    // Large blocks are rounded up to a power of two of at least SLAB_PAGES
+    // pages so that they are aligned at SLAB_SIZE like slabs are.
+    if (size > SIZE_MAX - LARGE_BLOCK_HEADER_SIZE - PAGE_SIZE) {
+        return NULL;
+    }
+    size_t page_count = (size + LARGE_BLOCK_HEADER_SIZE + PAGE_SIZE - 1)
+        >> PAGE_BITS;
+    if (page_count < SLAB_PAGES) {
+        page_count = SLAB_PAGES;
+    }
+    const PhysicalAddress addr = allocate_contiguous_physical_pages(
+        (size_t)1 << log2_ceil(page_count));
+    if (addr == 0) {
+        return NULL;
+    }
+
+    LargeBlock* block = physical_to_virtual(addr);
+    block->cache = NULL;
+    block->page_count = (size_t)1 << log2_ceil(page_count);
+    return (char*)block + LARGE_BLOCK_HEADER_SIZE;
+}
+
+void kfree(void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    Slab* slab = _get_slab(ptr);
+    if (slab->cache != NULL) {
+        free_slab_object(slab->cache, ptr);
+        return;
+    }
+
+    LargeBlock* block = (LargeBlock*)slab;
+    assert((char*)ptr == (char*)block + LARGE_BLOCK_HEADER_SIZE);
+    free_contiguous_physical_pages(virtual_to_physical(block),
+        block->page_count);
+}
+
+void get_slab_statistics(const SlabCache* cache, SlabStatistics* statistics)
+{
+    assert(cache != NULL);
+    assert(statistics != NULL);
+
+    // The hart caches are read without synchronization, so the counts are
+    // only a snapshot.
+    size_t cached_count = 0;
+    for (size_t i = 0; i < get_hart_count(); ++i) {
+        cached_count +=
+            __atomic_load_n(&cache->hart_caches[i].count, __ATOMIC_RELAXED);
+    }
+
+    SlabCache* mutable_cache = (SlabCache*)cache;
+    const InterruptState state =
+        acquire_spinlock_irqsave(&mutable_cache->lock);
+    statistics->name = cache->name;
+    statistics->object_size = cache->object_size;
+    statistics->stride = cache->stride;
+    statistics->slab_count = cache->slab_count;
+    statistics->object_count = cache->slab_count * cache->objects_per_slab;
+    statistics->allocated_count = cache->in_use_count > cached_count
+        ? cache->in_use_count - cached_count
+        : 0;
+    statistics->cached_count = cached_count;
+    release_spinlock_irqrestore(&mutable_cache->lock, state);
+}
+
+void print_slab_statistics(void)
+{
+    const InterruptState state = acquire_spinlock_irqsave(&_caches_lock);
+    LIST_FOR_EACH(node, &_caches) {
+        const SlabCache* cache = LIST_ENTRY(node, SlabCache, node);
+        SlabStatistics statistics;
+        get_slab_statistics(cache, &statistics);
+
+        // Utilization is the share of slab memory holding allocated objects.
+        const size_t slab_bytes = statistics.slab_count * SLAB_SIZE;
+        const size_t used_bytes =
+            statistics.allocated_count * statistics.object_size;
+        dprintf("%s: %zu/%zu objects of %zu bytes in %zu slabs, "
+            "%zu cached, %zu%% utilized\n",
+            statistics.name, statistics.allocated_count,
+            statistics.object_count, statistics.object_size,
+            statistics.slab_count, statistics.cached_count,
+            slab_bytes == 0 ? 0 : used_bytes * 100 / slab_bytes);
+    }
+    release_spinlock_irqrestore(&_caches_lock, state);
+}
+
+void initialize_slab(void)
+{
+    initialize_list(&_caches);
+
+    bool initialized = _initialize_cache(&_cache_cache, "slab-cache",
+        sizeof(SlabCache), CACHE_LINE_SIZE, NULL);
+    assert(initialized);
+    for (size_t i = 0; i < KMALLOC_CACHE_COUNT; ++i) {
+        // Power-of-two objects are naturally aligned up to a cache line.
+        const size_t size = (size_t)KMALLOC_MIN_SIZE << i;
+        initialized = _initialize_cache(&_kmalloc_caches[i],
+            _kmalloc_cache_names[i], size,
+            size < CACHE_LINE_SIZE ? size : CACHE_LINE_SIZE, NULL);
+        assert(initialized);
+    }
+    (void)initialized;
+}
@@ -0,0 +1,568 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/thread.h>
+
+#include <kernel/arch/hart.h>
+#include <kernel/arch/interrupt.h>
+#include <kernel/arch/memory.h>
+#include <kernel/arch/processor.h>
+#include <kernel/bitops.h>
+#include <kernel/config.h>
+#include <kernel/hart.h>
+#include <kernel/panic.h>
+#include <kernel/percpu.h>
+#include <kernel/pmm.h>
+#include <kernel/rcu.h>
+#include <kernel/slab.h>
+#include <kernel/timer.h>
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdio.h>
+
+#define DEQUE_INITIAL_SIZE 64
+
+_Static_assert(MAX_HARTS <= BITS_PER_LONG,
+    "The idle hart mask needs one bit per hart");
+
+typedef struct DequeArray
+{
+    size_t size;  // Power of two
+    Thread* threads[];
+} DequeArray;
+
+// Chase-Lev work-stealing deque of ready threads.  Only the owning hart
+// pushes, at the bottom.  The owner and thieves alike take from the top, so
+// each hart runs its threads in FIFO order.  Arrays outgrown by the owner are
+// never freed because a thief may still be reading them; they total less
+// than the largest array.
+typedef struct ThreadDeque
+{
+    alignas(CACHE_LINE_SIZE) size_t top;
+    alignas(CACHE_LINE_SIZE) size_t bottom;
+    DequeArray* array;
+} ThreadDeque;
+
+typedef struct HartScheduler
+{
+    ThreadDeque queue;
+    Thread* current;
+    Thread* previous;  // Switched away from; see _finish_switch
+    Thread idle_thread;
+    bool need_resched;
+    unsigned int preempt_count;  // Preemption is deferred while nonzero
+    Timer slice_timer;
+    SchedulerStatistics statistics;
+} HartScheduler;
+
+static DEFINE_PER_HART(HartScheduler, _scheduler);
+
+static SlabCache* _thread_cache = NULL;
+static uint64_t _slice_ticks = 0;
+static unsigned long _idle_harts = 0;  // Harts waiting for an interrupt
+
+DEFINE_LOCK_CLASS(wait_queue);
+
+static DequeArray* _allocate_deque_array(size_t size)
+{
+    DequeArray* array = kmalloc(sizeof(DequeArray) + size * sizeof(Thread*));
+    if (array != NULL) {
+        array->size = size;
+    }
+    return array;
+}
+
+// Called by the owner with interrupts disabled.
+static void _push_thread(ThreadDeque* deque, Thread* thread)
+{
+    const size_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    const size_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    DequeArray* array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+    if (bottom - top >= array->size) {
+        DequeArray* grown = _allocate_deque_array(array->size * 2);
+        if (grown == NULL) {
+            panic("Out of memory growing the run queue\n");
+        }
+        for (size_t i = top; i < bottom; ++i) {
+            grown->threads[i & (grown->size - 1)] =
+                array->threads[i & (array->size - 1)];
+        }
+        __atomic_store_n(&deque->array, grown, __ATOMIC_RELEASE);
+        array = grown;
+    }
+    __atomic_store_n(&array->threads[bottom & (array->size - 1)], thread,
+        __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+// Take the oldest thread.  Safe from any hart.
+static Thread* _take_thread(ThreadDeque* deque)
+{
+    for (;;) {
+        size_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        const size_t bottom = __atomic_load_n(&deque->bottom,
+            __ATOMIC_ACQUIRE);
+        if (top >= bottom) {
+            return NULL;
+        }
+
+        const DequeArray* array =
+            __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+        Thread* thread = __atomic_load_n(
+            &array->threads[top & (array->size - 1)], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return thread;
+        }
+        cpu_relax();
+    }
+}
+
+static bool _is_deque_empty(const ThreadDeque* deque)
+{
+    return __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE) >=
+        __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+}
+
+static bool _is_work_available(void)
+{
+    for (size_t i = 0; i < get_hart_count(); ++i) {
+        const HartScheduler* scheduler = HART_PTR(_scheduler, i);
+        if (__atomic_load_n(&scheduler->queue.array, __ATOMIC_ACQUIRE) !=
+                NULL && !_is_deque_empty(&scheduler->queue)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Take from this hart's queue, or steal from the others starting with the
+// next hart so that thieves spread out.
+static Thread* _find_thread(HartScheduler* scheduler)
+{
+    Thread* thread = _take_thread(&scheduler->queue);
+    if (thread != NULL) {
+        return thread;
+    }
+
+    const size_t count = get_hart_count();
+    const size_t self = get_hart_index();
+    for (size_t i = 1; i < count; ++i) {
+        HartScheduler* victim = HART_PTR(_scheduler, (self + i) % count);
+        if (__atomic_load_n(&victim->queue.array, __ATOMIC_ACQUIRE) == NULL) {
+            continue;
+        }
+        thread = _take_thread(&victim->queue);
+        if (thread != NULL) {
+            ++scheduler->statistics.steals;
+            return thread;
+        }
+    }
+    return NULL;
+}
+
+// Wake one idle hart to steal newly ready work.  The fence orders the push
+// before the read of the idle mask; an idle hart sets its bit before checking
+// the queues, so one side always sees the other.
+static void _kick_idle_hart(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    const unsigned long self = 1ul << get_hart_index();
+    const unsigned long idle =
+        __atomic_load_n(&_idle_harts, __ATOMIC_RELAXED) & ~self;
+    if (idle == 0) {
+        return;
+    }
+    const unsigned long bit = 1ul << find_first_set_bit(idle);
+    if (__atomic_fetch_and(&_idle_harts, ~bit, __ATOMIC_RELAXED) & bit) {
+        send_ipi(get_hart(find_first_set_bit(bit)));
+    }
+}
+
+static void _expire_slice(Timer* timer, void* data)
+{
+    (void)timer;
+    (void)data;
+    THIS_HART_PTR(_scheduler)->need_resched = true;
+}
+
+// A running thread only gets a time slice while others wait on its hart, so
+// a hart with one thread takes no timer interrupts.
+static void _start_slice(HartScheduler* scheduler)
+{
+    if (!scheduler->current->is_idle && !_is_deque_empty(&scheduler->queue) &&
+            !is_timer_pending(&scheduler->slice_timer)) {
+        start_timer(&scheduler->slice_timer, get_time() + _slice_ticks);
+    }
+}
+
+// Called with interrupts disabled.
+static void _make_ready(Thread* thread)
+{
+    HartScheduler* scheduler = THIS_HART_PTR(_scheduler);
+    __atomic_store_n(&thread->state, THREAD_READY, __ATOMIC_RELEASE);
+    _push_thread(&scheduler->queue, thread);
+    if (scheduler->current->is_idle) {
+        scheduler->need_resched = true;
+    }
+    else {
+        _start_slice(scheduler);
+    }
+    _kick_idle_hart();
+}
+
+// Complete a switch on the new thread's side.  The previous thread is now off
+// its stack, so other harts may run or free it.
+static void _finish_switch(void)
+{
+    HartScheduler* scheduler = THIS_HART_PTR(_scheduler);
+    Thread* previous = scheduler->previous;
+    scheduler->previous = NULL;
+    if (previous != NULL) {
+        __atomic_store_n(&previous->is_on_hart, false, __ATOMIC_RELEASE);
+    }
+}
+
+static void _switch_to(HartScheduler* scheduler, Thread* previous,
+    Thread* next)
+{
+    // A thread that was made ready while still switching out on another hart
+    // must finish leaving that hart first.
+    while (__atomic_load_n(&next->is_on_hart, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+
+    __atomic_store_n(&next->state, THREAD_RUNNING, __ATOMIC_RELAXED);
+    next->is_on_hart = true;
+    scheduler->current = next;
+    scheduler->previous = previous;
+    ++scheduler->statistics.switches;
+    cancel_timer(&scheduler->slice_timer);
+    _start_slice(scheduler);
+
+    switch_context(&previous->context, &next->context);
+    // This may now be a different hart.
+    _finish_switch();
+}
+
+void schedule(void)
+{
+    const InterruptState state = disable_interrupts();
+    HartScheduler* scheduler = THIS_HART_PTR(_scheduler);
+    assert(scheduler->preempt_count == 0);
+    // Whatever ran here last has left any RCU read-side critical section.
+    report_rcu_quiescent_state();
+    Thread* previous = scheduler->current;
+    if (previous == NULL) {
+        restore_interrupts(state);
+        return;
+    }
+    scheduler->need_resched = false;
+
+    const ThreadState previous_state =
+        __atomic_load_n(&previous->state, __ATOMIC_ACQUIRE);
+    const bool is_runnable =
+        previous_state == THREAD_RUNNING && !previous->is_idle;
+    Thread* next = _find_thread(scheduler);
+    if (next == NULL) {
+        if (is_runnable || previous->is_idle) {
+            restore_interrupts(state);
+            return;
+        }
+        next = &scheduler->idle_thread;
+    }
+    else if (is_runnable) {
+        __atomic_store_n(&previous->state, THREAD_READY, __ATOMIC_RELAXED);
+        _push_thread(&scheduler->queue, previous);
+    }
+
+    if (next == previous) {
+        // Woken before it could block, and then taken back from the queue.
+        __atomic_store_n(&next->state, THREAD_RUNNING, __ATOMIC_RELAXED);
+    }
+    else {
+        _switch_to(scheduler, previous, next);
+    }
+    restore_interrupts(state);
+}
+
+void preempt_if_needed(void)
+{
+    HartScheduler* scheduler = THIS_HART_PTR(_scheduler);
+    if (scheduler->preempt_count != 0) {
+        // enable_preemption switches once the count drops to zero.
+        return;
+    }
+    // The interrupted code was not in a read-side critical section, and the
+    // handler has left any of its own.
+    report_rcu_quiescent_state();
+    if (scheduler->current != NULL && scheduler->need_resched) {
+        if (!scheduler->current->is_idle) {
+            ++scheduler->statistics.preemptions;
+        }
+        schedule();
+    }
+}
+
+void disable_preemption(void)
+{
+    const InterruptState state = disable_interrupts();
+    ++THIS_HART_PTR(_scheduler)->preempt_count;
+    restore_interrupts(state);
+}
+
+void enable_preemption(void)
+{
+    const InterruptState state = disable_interrupts();
+    HartScheduler* scheduler = THIS_HART_PTR(_scheduler);
+    assert(scheduler->preempt_count != 0);
+    --scheduler->preempt_count;
+    // Switch now if an interrupt wanted to, unless the caller keeps
+    // interrupts disabled, as it may while holding a spinlock.
+    const bool should_schedule = scheduler->preempt_count == 0
+        && scheduler->need_resched && scheduler->current != NULL
+        && state != 0;
+    restore_interrupts(state);
+    if (should_schedule) {
+        schedule();
+    }
+}
+
+void handle_ipi(void)
+{
+    HartScheduler* scheduler = THIS_HART_PTR(_scheduler);
+    ++scheduler->statistics.idle_wakeups;
+    scheduler->need_resched = true;
+}
+
+static void _initialize_thread(Thread* thread, const char* name)
+{
+    size_t i = 0;
+    for (; i + 1 < THREAD_NAME_SIZE && name[i] != '\0'; ++i) {
+        thread->name[i] = name[i];
+    }
+    thread->name[i] = '\0';
+    thread->state = THREAD_READY;
+    thread->is_on_hart = false;
+    thread->is_idle = false;
+    thread->entry = NULL;
+    thread->argument = NULL;
+    thread->stack = NULL;
+    initialize_list(&thread->wait_node);
+    initialize_wait_queue(&thread->joiners);
+}
+
+Thread* create_thread(const char* name, ThreadEntry entry, void* argument)
+{
+    assert(name != NULL);
+    assert(entry != NULL);
+
+    Thread* thread = allocate_slab_object(_thread_cache);
+    if (thread == NULL) {
+        return NULL;
+    }
+    const PhysicalAddress stack =
+        allocate_contiguous_physical_pages(STACK_SIZE / PAGE_SIZE);
+    if (stack == 0) {
+        free_slab_object(_thread_cache, thread);
+        return NULL;
+    }
+
+    _initialize_thread(thread, name);
+    thread->entry = entry;
+    thread->argument = argument;
+    thread->stack = physical_to_virtual(stack);
+    initialize_thread_context(&thread->context,
+        (char*)thread->stack + STACK_SIZE, entry, argument);
+
+    const InterruptState state = disable_interrupts();
+    _make_ready(thread);
+    restore_interrupts(state);
+    return thread;
+}
+
+static bool _has_exited(void* data)
+{
+    const Thread* thread = data;
+    return __atomic_load_n(&thread->state, __ATOMIC_ACQUIRE) == THREAD_EXITED;
+}
+
+void join_thread(Thread* thread)
+{
+    assert(thread != NULL);
+    assert(thread != get_current_thread());
+
+    wait_on_queue(&thread->joiners, _has_exited, thread);
+    while (__atomic_load_n(&thread->is_on_hart, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+    free_contiguous_physical_pages(virtual_to_physical(thread->stack),
+        STACK_SIZE / PAGE_SIZE);
+    free_slab_object(_thread_cache, thread);
+}
+
+noreturn void exit_thread(void)
+{
+    disable_interrupts();
+    Thread* thread = get_current_thread();
+    assert(thread != NULL && !thread->is_idle);
+
+    acquire_spinlock(&thread->joiners.lock);
+    __atomic_store_n(&thread->state, THREAD_EXITED, __ATOMIC_RELEASE);
+    release_spinlock(&thread->joiners.lock);
+    wake_all(&thread->joiners);
+
+    schedule();
+    panic("Exited thread %s was scheduled\n", thread->name);
+}
+
+void yield_thread(void)
+{
+    schedule();
+}
+
+Thread* get_current_thread(void)
+{
+    const InterruptState state = disable_interrupts();
+    Thread* thread = THIS_HART_PTR(_scheduler)->current;
+    restore_interrupts(state);
+    return thread;
+}
+
+noreturn void enter_thread(ThreadEntry entry, void* argument)
+{
+    _finish_switch();
+    enable_interrupts();
+    entry(argument);
+    exit_thread();
+}
+
+void initialize_wait_queue(WaitQueue* queue)
+{
+    initialize_spinlock_in_class(&queue->lock, &LOCK_CLASS_NAME(wait_queue));
+    initialize_list(&queue->threads);
+}
+
+void wait_on_queue(WaitQueue* queue, WaitCondition condition, void* data)
+{
+    const InterruptState state = disable_interrupts();
+    Thread* thread = THIS_HART_PTR(_scheduler)->current;
+    acquire_spinlock(&queue->lock);
+    while (!condition(data)) {
+        assert(thread != NULL && !thread->is_idle);
+        __atomic_store_n(&thread->state, THREAD_BLOCKED, __ATOMIC_RELEASE);
+        push_list_back(&queue->threads, &thread->wait_node);
+        release_spinlock(&queue->lock);
+        schedule();
+        acquire_spinlock(&queue->lock);
+    }
+    release_spinlock(&queue->lock);
+    restore_interrupts(state);
+}
+
+bool wake_one(WaitQueue* queue)
+{
+    const InterruptState state = acquire_spinlock_irqsave(&queue->lock);
+    ListNode* node = pop_list_front(&queue->threads);
+    if (node != NULL) {
+        _make_ready(LIST_ENTRY(node, Thread, wait_node));
+    }
+    release_spinlock_irqrestore(&queue->lock, state);
+    return node != NULL;
+}
+
+void wake_all(WaitQueue* queue)
+{
+    const InterruptState state = acquire_spinlock_irqsave(&queue->lock);
+    for (ListNode* node = pop_list_front(&queue->threads); node != NULL;
+            node = pop_list_front(&queue->threads)) {
+        _make_ready(LIST_ENTRY(node, Thread, wait_node));
+    }
+    release_spinlock_irqrestore(&queue->lock, state);
+}
+
+void get_scheduler_statistics(size_t hart_index,
+    SchedulerStatistics* statistics)
+{
+    assert(hart_index < get_hart_count());
+    assert(statistics != NULL);
+    *statistics = HART_PTR(_scheduler, hart_index)->statistics;
+}
+
+void print_scheduler_statistics(void)
+{
+    for (size_t i = 0; i < get_hart_count(); ++i) {
+        SchedulerStatistics statistics;
+        get_scheduler_statistics(i, &statistics);
+        dprintf("Hart %zu: %zu switches, %zu preemptions, %zu steals, "
+            "%zu wakeups\n", i, statistics.switches, statistics.preemptions,
+            statistics.steals, statistics.idle_wakeups);
+    }
+}
+
+void initialize_scheduler(void)
+{
+    if (_thread_cache == NULL) {
+        _thread_cache = create_slab_cache("thread", sizeof(Thread),
+            alignof(Thread), NULL);
+        _slice_ticks = nanoseconds_to_ticks(SCHEDULER_TIME_SLICE_NS);
+    }
+    if (_thread_cache == NULL) {
+        panic("Unable to create the thread cache\n");
+    }
+
+    HartScheduler* scheduler = THIS_HART_PTR(_scheduler);
+    scheduler->queue.top = 0;
+    scheduler->queue.bottom = 0;
+    DequeArray* array = _allocate_deque_array(DEQUE_INITIAL_SIZE);
+    if (array == NULL) {
+        panic("Unable to allocate the run queue\n");
+    }
+
+    Thread* idle = &scheduler->idle_thread;
+    _initialize_thread(idle, "idle");
+    idle->state = THREAD_RUNNING;
+    idle->is_on_hart = true;
+    idle->is_idle = true;
+    scheduler->current = idle;
+    scheduler->previous = NULL;
+    scheduler->need_resched = false;
+    initialize_timer(&scheduler->slice_timer, _expire_slice, NULL);
+    __atomic_store_n(&scheduler->queue.array, array, __ATOMIC_RELEASE);
+}
+
+noreturn void run_idle_thread(void)
+{
+    const unsigned long bit = 1ul << get_hart_index();
+    for (;;) {
+        schedule();
+
+        disable_interrupts();
+        __atomic_fetch_or(&_idle_harts, bit, __ATOMIC_SEQ_CST);
+        if (!_is_work_available()) {
+            wait_for_interrupt();
+        }
+        __atomic_fetch_and(&_idle_harts, ~bit, __ATOMIC_RELAXED);
+        enable_interrupts();
+    }
+}
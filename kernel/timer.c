@@ -0,0 +1,379 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/timer.h>
+
+#include <kernel/arch/processor.h>
+#include <kernel/bitops.h>
+#include <kernel/fdt.h>
+#include <kernel/hart.h>
+#include <kernel/percpu.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+
+#include <assert.h>
+#include <stdio.h>
+
+// Timer.slot of a timer that has expired and waits for its callback
+#define SLOT_EXPIRED UINT_MAX
+
+_Static_assert(TIMER_WHEEL_SLOTS == BITS_PER_LONG,
+    "Each level needs one occupancy bit per slot");
+
+typedef struct TimerWheel
+{
+    Spinlock lock;
+    uint64_t time;        // Timers are placed relative to this time
+    uint64_t programmed;  // Deadline of the hardware timer
+    size_t count;
+    unsigned long occupied[TIMER_WHEEL_LEVELS];  // Non-empty slots
+    List slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    List expired;  // Timers whose callbacks have yet to run
+} TimerWheel;
+
+static DEFINE_PER_HART(TimerWheel, _wheel);
+DEFINE_LOCK_CLASS(timer_wheel);
+
+static uint64_t _frequency = 0;
+
+static unsigned int _find_last_set_bit64(uint64_t x)
+{
+    if ((x >> 32) != 0) {
+        return 32 + find_last_set_bit((unsigned long)(x >> 32));
+    }
+    return find_last_set_bit((unsigned long)x);
+}
+
+static unsigned int _get_digit(uint64_t time, unsigned int level)
+{
+    return (time >> (level * TIMER_WHEEL_SLOT_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+}
+
+// Bits of the time above the digit of the level
+static uint64_t _get_upper(uint64_t time, unsigned int level)
+{
+    const unsigned int shift = (level + 1) * TIMER_WHEEL_SLOT_BITS;
+    return shift >= 64 ? 0 : time >> shift;
+}
+
+// The helpers below expect the wheel lock to be held.
+
+static void _insert_timer(TimerWheel* wheel, Timer* timer)
+{
+    // Timers already due go in the current level-0 slot.
+    unsigned int level = 0;
+    uint64_t when = wheel->time;
+    if (timer->deadline > wheel->time) {
+        when = timer->deadline;
+        level = _find_last_set_bit64(when ^ wheel->time) /
+            TIMER_WHEEL_SLOT_BITS;
+    }
+    const unsigned int digit = _get_digit(when, level);
+    push_list_back(&wheel->slots[level][digit], &timer->node);
+    wheel->occupied[level] |= 1ul << digit;
+    timer->slot = level * TIMER_WHEEL_SLOTS + digit;
+}
+
+static void _remove_timer(TimerWheel* wheel, Timer* timer)
+{
+    remove_list_node(&timer->node);
+    if (timer->slot != SLOT_EXPIRED) {
+        const unsigned int level = timer->slot / TIMER_WHEEL_SLOTS;
+        const unsigned int digit = timer->slot % TIMER_WHEEL_SLOTS;
+        if (is_list_empty(&wheel->slots[level][digit])) {
+            wheel->occupied[level] &= ~(1ul << digit);
+        }
+    }
+    __atomic_store_n(&timer->hart_index, TIMER_HART_NONE, __ATOMIC_RELEASE);
+    --wheel->count;
+}
+
+// Move the wheel to now.  Every slot that starts at or before now is emptied;
+// its expired timers move to the expired list, and the rest cascade to lower
+// levels.
+static void _advance_wheel(TimerWheel* wheel, uint64_t now)
+{
+    if (now <= wheel->time) {
+        return;
+    }
+
+    List pending;
+    initialize_list(&pending);
+    for (unsigned int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        if (wheel->occupied[level] == 0) {
+            continue;
+        }
+
+        unsigned long due = ~0ul;
+        if (_get_upper(now, level) == _get_upper(wheel->time, level)) {
+            const unsigned int digit = _get_digit(now, level);
+            if (digit + 1 < TIMER_WHEEL_SLOTS) {
+                due = (1ul << (digit + 1)) - 1;
+            }
+        }
+        due &= wheel->occupied[level];
+        wheel->occupied[level] &= ~due;
+        while (due != 0) {
+            const unsigned int digit = find_first_set_bit(due);
+            due &= due - 1;
+            List* slot = &wheel->slots[level][digit];
+            for (ListNode* node = pop_list_front(slot); node != NULL;
+                    node = pop_list_front(slot)) {
+                push_list_back(&pending, node);
+            }
+        }
+    }
+
+    wheel->time = now;
+    for (ListNode* node = pop_list_front(&pending); node != NULL;
+            node = pop_list_front(&pending)) {
+        Timer* timer = LIST_ENTRY(node, Timer, node);
+        if (timer->deadline <= now) {
+            push_list_back(&wheel->expired, node);
+            timer->slot = SLOT_EXPIRED;
+        }
+        else {
+            _insert_timer(wheel, timer);
+        }
+    }
+}
+
+// Timers in lower levels always expire before those in higher levels, and
+// within a level the first occupied slot comes first, so only one slot needs
+// to be searched.
+static uint64_t _get_next_deadline(const TimerWheel* wheel)
+{
+    if (!is_list_empty(&wheel->expired)) {
+        return wheel->time;
+    }
+
+    for (unsigned int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        if (wheel->occupied[level] == 0) {
+            continue;
+        }
+
+        const unsigned int digit = find_first_set_bit(wheel->occupied[level]);
+        if (level == 0) {
+            return (wheel->time & ~(uint64_t)(TIMER_WHEEL_SLOTS - 1)) | digit;
+        }
+        uint64_t deadline = TIMER_DEADLINE_NONE;
+        LIST_FOR_EACH(node, &wheel->slots[level][digit]) {
+            const Timer* timer = LIST_ENTRY(node, Timer, node);
+            if (timer->deadline < deadline) {
+                deadline = timer->deadline;
+            }
+        }
+        return deadline;
+    }
+    return TIMER_DEADLINE_NONE;
+}
+
+// A fired timer interrupt stays pending until the deadline is rewritten, so
+// the interrupt handler forces the write.
+static void _program_timer(TimerWheel* wheel, bool is_forced)
+{
+    const uint64_t deadline = _get_next_deadline(wheel);
+    if (is_forced || deadline != wheel->programmed) {
+        wheel->programmed = deadline;
+        set_timer_deadline(deadline);
+    }
+}
+
+void initialize_timer(Timer* timer, TimerCallback callback, void* data)
+{
+    assert(timer != NULL);
+    initialize_list(&timer->node);
+    timer->deadline = TIMER_DEADLINE_NONE;
+    timer->callback = callback;
+    timer->data = data;
+    timer->hart_index = TIMER_HART_NONE;
+    timer->slot = SLOT_EXPIRED;
+}
+
+// A timer must not be started from two harts at once.
+void start_timer(Timer* timer, uint64_t deadline)
+{
+    assert(timer != NULL);
+    cancel_timer(timer);
+
+    InterruptState state = disable_interrupts();
+    TimerWheel* wheel = THIS_HART_PTR(_wheel);
+    acquire_spinlock(&wheel->lock);
+    if (wheel->count == 0) {
+        // Place relative to the present so that the timer does not need to
+        // cascade down from a stale time.
+        _advance_wheel(wheel, get_time());
+    }
+    timer->deadline = deadline;
+    _insert_timer(wheel, timer);
+    ++wheel->count;
+    __atomic_store_n(&timer->hart_index, get_hart_index(), __ATOMIC_RELEASE);
+    if (deadline < wheel->programmed) {
+        _program_timer(wheel, false);
+    }
+    release_spinlock(&wheel->lock);
+    restore_interrupts(state);
+}
+
+// The hardware timer is left as is, so cancelling the earliest timer costs at
+// most one spurious interrupt.
+bool cancel_timer(Timer* timer)
+{
+    assert(timer != NULL);
+    for (;;) {
+        const size_t index =
+            __atomic_load_n(&timer->hart_index, __ATOMIC_ACQUIRE);
+        if (index == TIMER_HART_NONE) {
+            return false;
+        }
+
+        TimerWheel* wheel = HART_PTR(_wheel, index);
+        InterruptState state = acquire_spinlock_irqsave(&wheel->lock);
+        const bool is_held = timer->hart_index == index;
+        if (is_held) {
+            _remove_timer(wheel, timer);
+        }
+        release_spinlock_irqrestore(&wheel->lock, state);
+        if (is_held) {
+            return true;
+        }
+    }
+}
+
+bool is_timer_pending(const Timer* timer)
+{
+    return __atomic_load_n(&timer->hart_index, __ATOMIC_ACQUIRE) !=
+        TIMER_HART_NONE;
+}
+
+uint64_t get_timer_frequency(void)
+{
+    return _frequency;
+}
+
+// Split the conversions at whole seconds so that the products cannot
+// overflow.  Ticks round up so that sleeps are never short.
+uint64_t nanoseconds_to_ticks(uint64_t nanoseconds)
+{
+    const uint64_t seconds = nanoseconds / NANOSECONDS_PER_SECOND;
+    const uint64_t remainder = nanoseconds % NANOSECONDS_PER_SECOND;
+    return seconds * _frequency + (remainder * _frequency +
+        NANOSECONDS_PER_SECOND - 1) / NANOSECONDS_PER_SECOND;
+}
+
+uint64_t ticks_to_nanoseconds(uint64_t ticks)
+{
+    const uint64_t seconds = ticks / _frequency;
+    const uint64_t remainder = ticks % _frequency;
+    return seconds * NANOSECONDS_PER_SECOND +
+        remainder * NANOSECONDS_PER_SECOND / _frequency;
+}
+
+static void _wake(Timer* timer, void* data)
+{
+    (void)timer;
+    if (data != NULL) {
+        wake_all(data);
+    }
+}
+
+static bool _is_deadline_reached(void* data)
+{
+    return get_time() >= *(const uint64_t*)data;
+}
+
+// Threads block until the timer wakes them.  Before the scheduler runs, or
+// with interrupts disabled, the hart waits instead; the timer only wakes it,
+// and the deadline is checked against the time itself.  Either way, the sleep
+// is accurate to the timebase.
+void sleep_until(uint64_t deadline)
+{
+    Timer timer;
+    if (are_interrupts_enabled() && get_current_thread() != NULL) {
+        WaitQueue queue;
+        initialize_wait_queue(&queue);
+        initialize_timer(&timer, _wake, &queue);
+        start_timer(&timer, deadline);
+        wait_on_queue(&queue, _is_deadline_reached, &deadline);
+    }
+    else {
+        initialize_timer(&timer, _wake, NULL);
+        start_timer(&timer, deadline);
+        while (get_time() < deadline) {
+            wait_for_interrupt();
+        }
+    }
+    cancel_timer(&timer);
+}
+
+void sleep_for(uint64_t nanoseconds)
+{
+    sleep_until(get_time() + nanoseconds_to_ticks(nanoseconds));
+}
+
+// Called by the trap handler with interrupts disabled.
+void handle_timer_interrupt(void)
+{
+    TimerWheel* wheel = THIS_HART_PTR(_wheel);
+    acquire_spinlock(&wheel->lock);
+    _advance_wheel(wheel, get_time());
+    for (;;) {
+        ListNode* node = pop_list_front(&wheel->expired);
+        if (node == NULL) {
+            break;
+        }
+        Timer* timer = LIST_ENTRY(node, Timer, node);
+        --wheel->count;
+        __atomic_store_n(&timer->hart_index, TIMER_HART_NONE,
+            __ATOMIC_RELEASE);
+        release_spinlock(&wheel->lock);
+        timer->callback(timer, timer->data);
+        acquire_spinlock(&wheel->lock);
+    }
+    _program_timer(wheel, true);
+    release_spinlock(&wheel->lock);
+}
+
+// Called on each hart after the FDT is parsed.
+void initialize_timers(void)
+{
+    if (_frequency == 0) {
+        _frequency = get_fdt_timebase_frequency();
+        if (_frequency == 0) {
+            _frequency = TIMER_DEFAULT_FREQUENCY;
+            dprintf("No timebase-frequency in FDT; assuming %llu Hz\n",
+                (unsigned long long)_frequency);
+        }
+    }
+
+    TimerWheel* wheel = THIS_HART_PTR(_wheel);
+    initialize_spinlock_in_class(&wheel->lock, &LOCK_CLASS_NAME(timer_wheel));
+    wheel->time = get_time();
+    wheel->programmed = TIMER_DEADLINE_NONE;
+    wheel->count = 0;
+    for (unsigned int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        wheel->occupied[level] = 0;
+        for (unsigned int digit = 0; digit < TIMER_WHEEL_SLOTS; ++digit) {
+            initialize_list(&wheel->slots[level][digit]);
+        }
+    }
+    initialize_list(&wheel->expired);
+    initialize_arch_timer();
+}
@@ -0,0 +1,184 @@
+// Copyright (c) 2023 Jeremiah Z. Griffin
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <kernel/tracepoint.h>
+
+#include <kernel/arch/interrupt.h>
+#include <kernel/arch/memory.h>
+#include <kernel/arch/timer.h>
+#include <kernel/config.h>
+#include <kernel/fdt.h>
+#include <kernel/hart.h>
+#include <kernel/panic.h>
+#include <kernel/pmm.h>
+#include <kernel/spinlock.h>
+#include <kernel/timer.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_BUFFER_MASK (TRACE_BUFFER_SIZE - 1)
+
+_Static_assert(sizeof(TraceEvent) == CACHE_LINE_SIZE,
+    "TraceEvent must fill one cache line");
+
+extern const TracepointSite __tracepoint_site_start[];
+extern const TracepointSite __tracepoint_site_end[];
+
+// Only the owning hart writes a buffer, with interrupts disabled so that
+// handlers cannot interleave with it.  Buffers are aligned so that harts do
+// not contend for each other's tail.
+typedef struct TraceBuffer
+{
+    TraceEvent* events;
+    size_t tail;  // Count of events ever recorded
+} ALIGNED(CACHE_LINE_SIZE) TraceBuffer;
+
+static TraceBuffer _buffers[MAX_HARTS];
+static size_t _buffer_count = 0;
+static Spinlock _patch_lock = SPINLOCK_INITIALIZER;
+
+void record_trace(const Tracepoint* tracepoint, const uint64_t* arguments,
+    size_t count)
+{
+    const InterruptState state = disable_interrupts();
+    TraceBuffer* buffer = &_buffers[get_hart_index()];
+    if (buffer->events != NULL) {
+        TraceEvent* event = &buffer->events[buffer->tail & TRACE_BUFFER_MASK];
+        event->time = get_time();
+        event->tracepoint = tracepoint;
+        size_t i = 0;
+        for (; i < count; ++i) {
+            event->arguments[i] = arguments[i];
+        }
+        for (; i < TRACE_MAX_ARGUMENTS; ++i) {
+            event->arguments[i] = 0;
+        }
+        __atomic_store_n(&buffer->tail, buffer->tail + 1, __ATOMIC_RELEASE);
+    }
+    restore_interrupts(state);
+}
+
+Tracepoint* find_tracepoint(const char* name)
+{
+    for (Tracepoint* tracepoint = __tracepoint_start;
+            tracepoint < __tracepoint_end; ++tracepoint) {
+        if (strcmp(tracepoint->name, name) == 0) {
+            return tracepoint;
+        }
+    }
+    return NULL;
+}
+
+// Patch the sites of tracepoint, or of every tracepoint if it is NULL.
+static void _set_tracepoint_enabled(Tracepoint* tracepoint, bool is_enabled)
+{
+    const InterruptState state = acquire_spinlock_irqsave(&_patch_lock);
+    bool is_patched = false;
+    for (const TracepointSite* site = __tracepoint_site_start;
+            site < __tracepoint_site_end; ++site) {
+        if ((tracepoint == NULL || site->tracepoint == tracepoint)
+                && site->tracepoint->is_enabled != is_enabled) {
+            patch_tracepoint_site(site, is_enabled);
+            is_patched = true;
+        }
+    }
+    for (Tracepoint* other = __tracepoint_start; other < __tracepoint_end;
+            ++other) {
+        if (tracepoint == NULL || other == tracepoint) {
+            other->is_enabled = is_enabled;
+        }
+    }
+    if (is_patched) {
+        synchronize_tracepoint_sites();
+    }
+    release_spinlock_irqrestore(&_patch_lock, state);
+}
+
+void enable_tracepoint(Tracepoint* tracepoint)
+{
+    assert(tracepoint != NULL);
+    _set_tracepoint_enabled(tracepoint, true);
+}
+
+void disable_tracepoint(Tracepoint* tracepoint)
+{
+    assert(tracepoint != NULL);
+    _set_tracepoint_enabled(tracepoint, false);
+}
+
+static void _print_event(size_t hart_index, const TraceEvent* event)
+{
+    const uint64_t microseconds = ticks_to_nanoseconds(event->time) / 1000;
+    dprintf("[%5llu.%06llu] %zu: %s: ",
+        (unsigned long long)(microseconds / 1000000),
+        (unsigned long long)(microseconds % 1000000),
+        hart_index, event->tracepoint->name);
+    dprintf_arguments(event->tracepoint->format, event->arguments,
+        TRACE_MAX_ARGUMENTS);
+    dprintf("\n");
+}
+
+void print_trace(void)
+{
+    for (size_t i = 0; i < _buffer_count; ++i) {
+        const TraceBuffer* buffer = &_buffers[i];
+        const size_t tail = __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE);
+        const size_t head =
+            tail > TRACE_BUFFER_SIZE ? tail - TRACE_BUFFER_SIZE : 0;
+        for (size_t j = head; j < tail; ++j) {
+            const TraceEvent event = buffer->events[j & TRACE_BUFFER_MASK];
+            _print_event(i, &event);
+        }
+    }
+}
+
+void initialize_tracepoints(void)
+{
+    // Harts are indexed in FDT order, so there is never a hart index beyond
+    // the FDT hart count.
+    size_t count = get_fdt_cpu_count();
+    if (count == 0) {
+        count = 1;
+    }
+    if (count > MAX_HARTS) {
+        count = MAX_HARTS;
+    }
+
+    const size_t page_count =
+        (TRACE_BUFFER_SIZE * sizeof(TraceEvent) + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (size_t i = 0; i < count; ++i) {
+        const PhysicalAddress pages =
+            allocate_contiguous_physical_pages(page_count);
+        if (pages == 0) {
+            panic("Unable to allocate the trace buffer for hart %zu\n", i);
+        }
+        _buffers[i].events = physical_to_virtual(pages);
+    }
+    _buffer_count = count;
+
+    dprintf("%zu tracepoints at %zu sites\n",
+        (size_t)(__tracepoint_end - __tracepoint_start),
+        (size_t)(__tracepoint_site_end - __tracepoint_site_start));
+#ifdef TRACE_AT_BOOT
+    _set_tracepoint_enabled(NULL, true);
+#endif
+}
@@ -22,6 +22,9 @@
 TOUCH = touch
 MKDIR = mkdir -p
 RM = rm -f
+TRUNCATE = truncate
+CPIO = cpio
+FIND = find
 
 # Toolchain
 PYTHON ?= python3
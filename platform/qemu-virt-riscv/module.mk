@@ -21,13 +21,14 @@
 ARCH = riscv
 SUBARCH = RV64GC
 ABI ?= lp64d
-MMU ?= bare
+MMU ?= sv39
 
 $(MODULE).MEMORY_MAP.DRAM_BASE = 0x80000000
 $(MODULE).MEMORY_MAP.ENTRIES = DRAM
 
 $(MODULE).KERNEL_CONFIG += \
-    KERNEL_LOAD_OFFSET=0x00200000
+    KERNEL_LOAD_OFFSET=0x00200000 \
+    MAX_HARTS=8
 
 # UART0
 $(MODULE).MEMORY_MAP.UART0_BASE = 0x10000000
@@ -36,9 +37,36 @@ $(MODULE).MEMORY_MAP.ENTRIES += UART0
 $(MODULE).KERNEL_CONFIG += UART0_REGISTER_WIDTH=1
 $(MODULE).KERNEL_DEVICES += ns16550a
 
+# Interrupt controller
+$(MODULE).KERNEL_DEVICES += plic
+
+# Virtio devices behind the virtio-mmio slots.  The console's output goes to
+# a file in the output directory, and the disk is a raw image there with a
+# queue per hart.
+$(MODULE).KERNEL_DEVICES += virtio virtio_block virtio_console
+
 # Debug
 $(MODULE).KERNEL_DEBUG = ns16550a
 
 QEMU ?= qemu-system-riscv64
-QEMUFLAGS += -serial mon:stdio -machine virt -nographic
+QEMU_CPU ?= rv64,v=true
+QEMU_HARTS ?= 4
+QEMU_DISK ?= $(OUT_DIR)disk.img
+QEMU_DISK_SIZE ?= 256M
+# INITRAMFS_DIR packs a directory into the initrd; QEMU_INITRD names an
+# existing cpio (newc) archive instead.
+ifneq ($(INITRAMFS_DIR),)
+QEMU_INITRD ?= $(OUT_DIR)initramfs.cpio
+endif
+QEMUFLAGS += -serial mon:stdio -machine virt -cpu $(QEMU_CPU) -nographic
+QEMUFLAGS += -smp $(QEMU_HARTS)
+QEMUFLAGS += -global virtio-mmio.force-legacy=false
+QEMUFLAGS += -device virtio-serial-device \
+    -chardev file,id=virtcon0,path=$(OUT_DIR)virtio-console.log \
+    -device virtconsole,chardev=virtcon0
+QEMUFLAGS += -drive file=$(QEMU_DISK),if=none,format=raw,id=disk0 \
+    -device virtio-blk-device,drive=disk0,num-queues=$(QEMU_HARTS)
+ifneq ($(QEMU_INITRD),)
+QEMUFLAGS += -initrd $(QEMU_INITRD)
+endif
 MODULES += emulator
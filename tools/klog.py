@@ -0,0 +1,241 @@
+# Copyright (c) 2023 Jeremiah Z. Griffin
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to
+# deal in the Software without restriction, including without limitation the
+# rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+"""Decode the raw kernel log.
+
+Build the kernel with KLOG=raw to make the log drainer print each record as
+
+    @klog <time> <hart> <format address> <argument>...
+
+with every number in hexadecimal.  This tool reads those lines from a console
+capture, looks up each format string (and each %s argument) in the kernel ELF,
+and prints the formatted messages.  Other lines pass through unchanged.
+"""
+
+from dataclasses import dataclass
+from typing import Iterator, Optional, TextIO
+import argparse
+import re
+import struct
+import sys
+
+
+@dataclass
+class Segment:
+    address: int
+    data: bytes
+
+
+class Image:
+    def __init__(self, path: str):
+        with open(path, "rb") as file:
+            elf = file.read()
+        if elf[:4] != b"\x7fELF":
+            raise ValueError(f"{path} is not an ELF file")
+        self.is_64 = elf[4] == 2
+        endian = "<" if elf[5] == 1 else ">"
+
+        if self.is_64:
+            phoff, = struct.unpack_from(endian + "Q", elf, 0x20)
+            phentsize, phnum = struct.unpack_from(endian + "HH", elf, 0x36)
+            layout = endian + "IIQQQQQQ"
+        else:
+            phoff, = struct.unpack_from(endian + "I", elf, 0x1C)
+            phentsize, phnum = struct.unpack_from(endian + "HH", elf, 0x2A)
+            layout = endian + "IIIIIIII"
+
+        self.segments: list[Segment] = []
+        for i in range(phnum):
+            fields = struct.unpack_from(layout, elf, phoff + i * phentsize)
+            if self.is_64:
+                kind, _, offset, vaddr, _, filesz, _, _ = fields
+            else:
+                kind, offset, vaddr, _, filesz, _, _, _ = fields
+            if kind == 1:  # PT_LOAD
+                self.segments.append(Segment(vaddr, elf[offset : offset + filesz]))
+
+    def read_string(self, address: int) -> Optional[str]:
+        for segment in self.segments:
+            offset = address - segment.address
+            if 0 <= offset < len(segment.data):
+                end = segment.data.find(b"\0", offset)
+                if end < 0:
+                    return None
+                return segment.data[offset:end].decode("utf-8", "replace")
+        return None
+
+
+CONVERSION_REGEX = re.compile(
+    r"%(?P<flags>[-+ #0]*)(?P<width>\*|\d+)?(?:\.(?P<precision>\*|\d*))?"
+    r"(?P<length>hh|h|ll|l|j|z|t)?(?P<conversion>[diouxXcspn%])"
+)
+
+
+def get_length_bits(length: Optional[str], is_64: bool) -> int:
+    if length == "hh":
+        return 8
+    if length == "h":
+        return 16
+    if length in ("ll", "j"):
+        return 64
+    if length in ("l", "z", "t"):
+        return 64 if is_64 else 32
+    return 32
+
+
+def to_signed(value: int, bits: int) -> int:
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def pad(text: str, flags: str, width: int) -> str:
+    return text.ljust(width) if "-" in flags else text.rjust(width)
+
+
+def format_record(image: Image, format: str, arguments: list[int]) -> str:
+    """Format like the kernel's printf engine, with arguments as record words."""
+    words: Iterator[int] = iter(arguments)
+
+    def next_word() -> int:
+        return next(words, 0)
+
+    def replace(match: re.Match) -> str:
+        flags = match["flags"]
+        conversion = match["conversion"]
+        if conversion == "%":
+            return "%"
+
+        width = 0
+        if match["width"] == "*":
+            width = to_signed(next_word(), 32)
+            if width < 0:
+                flags += "-"
+                width = -width
+        elif match["width"]:
+            width = int(match["width"])
+
+        precision: Optional[int] = None
+        if match["precision"] == "*":
+            precision = to_signed(next_word(), 32)
+            if precision < 0:
+                precision = None
+        elif match["precision"] is not None:
+            precision = int(match["precision"] or "0")
+
+        word = next_word()
+        bits = get_length_bits(match["length"], image.is_64)
+        if conversion == "n":
+            return ""
+        if conversion == "c":
+            return pad(chr(word & 0xFF), flags, width)
+        if conversion == "s":
+            text = image.read_string(word)
+            if text is None:
+                text = f"<{word:#x}>"
+            if precision is not None:
+                text = text[:precision]
+            return pad(text, flags, width)
+        if conversion == "p":
+            text = f"0x{word:X}" if word != 0 else "(nil)"
+            return pad(text, flags, width)
+
+        prefix = ""
+        if conversion in "di":
+            value = to_signed(word, bits)
+            if value < 0:
+                prefix = "-"
+            elif "+" in flags:
+                prefix = "+"
+            elif " " in flags:
+                prefix = " "
+            digits = str(abs(value))
+        else:
+            value = word & ((1 << bits) - 1)
+            if conversion == "o":
+                digits = f"{value:o}"
+            elif conversion == "x":
+                digits = f"{value:x}"
+            elif conversion == "X":
+                digits = f"{value:X}"
+            else:
+                digits = str(value)
+            if "#" in flags and conversion in "xX" and value != 0:
+                prefix = "0" + conversion
+
+        if precision == 0 and value == 0:
+            digits = ""
+        if precision is not None:
+            digits = digits.rjust(precision, "0")
+        if "#" in flags and conversion == "o" and not digits.startswith("0"):
+            digits = "0" + digits
+        if "0" in flags and "-" not in flags and precision is None:
+            digits = digits.rjust(width - len(prefix), "0")
+        return pad(prefix + digits, flags, width)
+
+    return CONVERSION_REGEX.sub(replace, format)
+
+
+def decode(image: Image, input: TextIO, output: TextIO) -> None:
+    frequency = 10_000_000
+    for line in input:
+        fields = line.split()
+        if len(fields) >= 2 and fields[0] == "@klog-frequency":
+            frequency = int(fields[1])
+            continue
+        if len(fields) < 4 or fields[0] != "@klog":
+            output.write(line)
+            continue
+
+        time, hart, address = (int(x, 16) for x in fields[1:4])
+        arguments = [int(x, 16) for x in fields[4:]]
+        format = image.read_string(address)
+        if format is None:
+            message = f"<unknown format {address:#x}> {arguments}\n"
+        else:
+            message = format_record(image, format, arguments)
+        microseconds = time * 1_000_000 // frequency
+        output.write(
+            f"[{microseconds // 1_000_000:5}.{microseconds % 1_000_000:06}] "
+            f"{hart}: {message}"
+        )
+
+
+def main(argv: list[str]) -> int:
+    parser = argparse.ArgumentParser(prog=argv[0], description=__doc__.split("\n")[0])
+    parser.add_argument("kernel", help="kernel ELF that produced the log")
+    parser.add_argument("log", nargs="?", help="console capture (default: stdin)")
+    args = parser.parse_args(argv[1:])
+
+    try:
+        image = Image(args.kernel)
+    except (OSError, ValueError, struct.error) as e:
+        print(f"{e}", file=sys.stderr)
+        return 1
+
+    if args.log is None:
+        decode(image, sys.stdin, sys.stdout)
+    else:
+        with open(args.log) as file:
+            decode(image, file, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))